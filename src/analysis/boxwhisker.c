@@ -57,10 +57,10 @@ int main(int argc, char *argv[]) {
 	int i;
 
 	int colcount = 0;
-	struct obdservicecmd *columns[20]; // Only support this many columns at most.
+	struct obdservicecmd *columns[OBDCMDS_MODE1_COLUMNS]; // Each column appears once
 	while(SQLITE_ROW == sqlite3_step(columnlist_stmt)) {
 		struct obdservicecmd *cmd = obdGetCmdForColumn(sqlite3_column_text(columnlist_stmt, 1));
-		if(NULL != cmd) {
+		if(NULL != cmd && colcount < OBDCMDS_MODE1_COLUMNS) {
 			columns[colcount] = cmd;
 			colcount++;
 		}
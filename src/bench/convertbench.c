@@ -0,0 +1,207 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/** \file
+ \brief Microbenchmark batch conversions
+
+ Checks obdConvertBatch and obdRevConvertBatch give exactly what the
+ single-sample functions give, for every raw sample and for a sweep of
+ values across each PID's range, then times both ways.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "obdservicecommands.h"
+#include "obdconvertbatch.h"
+
+/// Default number of samples per PID
+#define CONVERTBENCH_DEFAULTSAMPLES 65536
+
+/// Samples in the reverse sweep
+#define CONVERTBENCH_SWEEP 100000
+
+/// Bytes per packed sample
+#define CONVERTBENCH_STRIDE 4
+
+/// Seconds since some point
+static double now_seconds() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/// Check one PID both ways. Returns number of mismatches
+static int check_pid(struct obdservicecmd *cmd, unsigned char *raw, float *vals) {
+	int mismatches = 0;
+	size_t i;
+
+	// Every possible A and B
+	for(i=0;i<65536;i++) {
+		raw[i*CONVERTBENCH_STRIDE] = i / 256;
+		raw[i*CONVERTBENCH_STRIDE+1] = i % 256;
+		raw[i*CONVERTBENCH_STRIDE+2] = 0;
+		raw[i*CONVERTBENCH_STRIDE+3] = 0;
+	}
+	obdConvertBatch(cmd->cmdid, raw, CONVERTBENCH_STRIDE, vals, 65536);
+	for(i=0;i<65536;i++) {
+		float v = cmd->conv(i / 256, i % 256, 0, 0);
+		if(0 != memcmp(&v, &vals[i], sizeof(v))) {
+			if(mismatches++ < 4) {
+				fprintf(stderr, "PID %02X raw %04X: %.9g != %.9g\n",
+					cmd->cmdid, (unsigned int)i, vals[i], v);
+			}
+		}
+	}
+
+	// A sweep across the range, and every value the forward direction made
+	float min = cmd->min_value;
+	float max = cmd->max_value;
+	for(i=0;i<CONVERTBENCH_SWEEP;i++) {
+		vals[65536+i] = min + (float)i/(float)CONVERTBENCH_SWEEP * (max-min);
+	}
+	size_t count = 65536 + CONVERTBENCH_SWEEP;
+	memset(raw, 0, count * CONVERTBENCH_STRIDE);
+	int bytes = obdRevConvertBatch(cmd->cmdid, vals, count, raw, CONVERTBENCH_STRIDE);
+	for(i=0;i<count;i++) {
+		unsigned int abcd[4] = { 0, 0, 0, 0 };
+		int n = cmd->convrev(vals[i], abcd+0, abcd+1, abcd+2, abcd+3);
+		int j;
+		int bad = (n != bytes);
+		for(j=0;j<4;j++) {
+			if((unsigned char)abcd[j] != raw[i*CONVERTBENCH_STRIDE+j]) bad = 1;
+		}
+		if(bad && mismatches++ < 4) {
+			fprintf(stderr, "PID %02X value %.9g: %02X %02X != %02X %02X\n",
+				cmd->cmdid, vals[i],
+				raw[i*CONVERTBENCH_STRIDE], raw[i*CONVERTBENCH_STRIDE+1],
+				abcd[0] & 0xFF, abcd[1] & 0xFF);
+		}
+	}
+	return mismatches;
+}
+
+int main(int argc, char **argv) {
+	long samples = CONVERTBENCH_DEFAULTSAMPLES;
+	if(argc > 1) {
+		samples = atol(argv[1]);
+		if(samples <= 0) {
+			fprintf(stderr, "Usage: %s [samples]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	size_t size = 65536 + CONVERTBENCH_SWEEP;
+	if((size_t)samples > size) size = samples;
+	unsigned char *raw = (unsigned char *)malloc(size * CONVERTBENCH_STRIDE);
+	float *vals = (float *)malloc(size * sizeof(float));
+	if(NULL == raw || NULL == vals) {
+		fprintf(stderr, "Couldn't allocate %lu samples\n", (unsigned long)size);
+		return 1;
+	}
+
+	int mismatches = 0;
+	int pids = 0;
+	int i;
+	for(i=0;i<OBDCMDS_MODE1_COUNT-1;i++) {
+		struct obdservicecmd *cmd = &obdcmds_mode1[i];
+		if(NULL == cmd->conv) continue;
+		if(!obdHasConvertBatch(cmd->cmdid)) {
+			fprintf(stderr, "PID %02X has no batch conversion\n", cmd->cmdid);
+			mismatches++;
+			continue;
+		}
+		mismatches += check_pid(cmd, raw, vals);
+		pids++;
+	}
+	if(mismatches > 0) {
+		return 1;
+	}
+
+	// Random samples, so nothing is suspiciously predictable
+	srand(1);
+	long l;
+	for(l=0;l<samples*CONVERTBENCH_STRIDE;l++) {
+		raw[l] = rand() & 0xFF;
+	}
+
+	float sink = 0;
+	double start, single, batch;
+
+	start = now_seconds();
+	for(i=0;i<OBDCMDS_MODE1_COUNT-1;i++) {
+		struct obdservicecmd *cmd = &obdcmds_mode1[i];
+		if(NULL == cmd->conv) continue;
+		for(l=0;l<samples;l++) {
+			const unsigned char *s = raw + l*CONVERTBENCH_STRIDE;
+			vals[l] = cmd->conv(s[0], s[1], s[2], s[3]);
+		}
+		sink += vals[samples-1];
+	}
+	single = now_seconds() - start;
+
+	start = now_seconds();
+	for(i=0;i<OBDCMDS_MODE1_COUNT-1;i++) {
+		struct obdservicecmd *cmd = &obdcmds_mode1[i];
+		if(NULL == cmd->conv) continue;
+		obdConvertBatch(cmd->cmdid, raw, CONVERTBENCH_STRIDE, vals, samples);
+		sink += vals[samples-1];
+	}
+	batch = now_seconds() - start;
+
+	printf("Convert:         single %6.2f ns, batch %6.2f ns\n",
+		1e9 * single / (samples * pids), 1e9 * batch / (samples * pids));
+
+	for(l=0;l<samples;l++) {
+		vals[l] = (float)(rand() % 10000) / 100.0f;
+	}
+
+	start = now_seconds();
+	for(i=0;i<OBDCMDS_MODE1_COUNT-1;i++) {
+		struct obdservicecmd *cmd = &obdcmds_mode1[i];
+		if(NULL == cmd->convrev) continue;
+		for(l=0;l<samples;l++) {
+			unsigned int abcd[4] = { 0, 0, 0, 0 };
+			cmd->convrev(vals[l], abcd+0, abcd+1, abcd+2, abcd+3);
+			unsigned char *s = raw + l*CONVERTBENCH_STRIDE;
+			s[0] = abcd[0];
+			s[1] = abcd[1];
+		}
+		sink += raw[0];
+	}
+	single = now_seconds() - start;
+
+	start = now_seconds();
+	for(i=0;i<OBDCMDS_MODE1_COUNT-1;i++) {
+		struct obdservicecmd *cmd = &obdcmds_mode1[i];
+		if(NULL == cmd->convrev) continue;
+		obdRevConvertBatch(cmd->cmdid, vals, samples, raw, CONVERTBENCH_STRIDE);
+		sink += raw[0];
+	}
+	batch = now_seconds() - start;
+
+	printf("Reverse convert: single %6.2f ns, batch %6.2f ns\n",
+		1e9 * single / (samples * pids), 1e9 * batch / (samples * pids));
+
+	free(raw);
+	free(vals);
+	return 0 == sink; // Never true for these PIDs; just keeps sink alive
+}
+
@@ -0,0 +1,377 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/** \file
+ \brief Benchmark obd2csv on a large generated log
+
+ Checks csvwriter_formatdouble gives strings that read back as the
+ values they came from, times it against printf, then generates a
+ database the way obdgpslogger lays one out and times obd2csv
+ exporting it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "obdservicecommands.h"
+#include "supportedcommands.h"
+#include "obddb.h"
+#include "gpsdb.h"
+#include "tripdb.h"
+#include "csvwriter.h"
+
+#include "sqlite3.h"
+
+/// Default number of obd rows to generate
+#define CSVBENCH_DEFAULTROWS 1000000
+
+/// Values in the formatting check and timing
+#define CSVBENCH_VALUES 1000000
+
+/// Time of the first generated row
+#define CSVBENCH_STARTTIME 1300000000.0
+
+/// Seconds since some point
+static double now_seconds() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/// Find an executable next to this one
+static char *find_sibling(const char *argv0, const char *name) {
+	char path[4096];
+	const char *slash = strrchr(argv0, '/');
+	if(NULL == slash) {
+		return strdup(name);
+	}
+	snprintf(path, sizeof(path), "%.*s/%s", (int)(slash - argv0), argv0, name);
+	return strdup(path);
+}
+
+/// Some value a column could plausibly have, made the way the logger makes it
+static float random_value(struct obdservicecmd *cmd) {
+	return cmd->conv(rand() & 0xFF, rand() & 0xFF, rand() & 0xFF, rand() & 0xFF);
+}
+
+/// The sort of values obd2csv writes: OBD values, times, positions
+static void make_values(double *vals, long count) {
+	long l;
+	for(l=0;l<count;l++) {
+		struct obdservicecmd *cmd = &obdcmds_mode1[rand() % (OBDCMDS_MODE1_COUNT-1)];
+		switch(l % 4) {
+			case 0:
+			case 1:
+				vals[l] = (NULL == cmd->conv)?0:random_value(cmd);
+				break;
+			case 2:
+				// How the logger makes a time out of gettimeofday
+				vals[l] = CSVBENCH_STARTTIME + l + (rand() % 1000000) / 1000000.0;
+				break;
+			default:
+				// gpsd's positions come from strings with a few decimal places
+				vals[l] = (rand() % 360000000 - 180000000) / 1000000.0;
+				break;
+		}
+	}
+}
+
+/// Check every value reads back as itself. Returns number of mismatches
+static int check_format(const double *vals, long count) {
+	int mismatches = 0;
+	static const double edges[] = {
+		0.0, -0.0, 1.0, -1.0, 0.1, 1e-300, 1e300, 123456789012345678.0,
+		0.1f, 1e-12f, 3.4e38f, 16777217.0, 9007199254740993.0, 1.0/3.0
+	};
+	char out[CSVWRITER_MAXNUMBER];
+	long l;
+	for(l=0;l<count + (long)(sizeof(edges)/sizeof(edges[0]));l++) {
+		double v = (l<count)?vals[l]:edges[l-count];
+		int len = csvwriter_formatdouble(out, v);
+		int isfloat = ((double)(float)v == v);
+		int ok = (len == (int)strlen(out)) && (len < CSVWRITER_MAXNUMBER);
+		if(isfloat) {
+			ok = ok && (strtof(out, NULL) == (float)v);
+		} else {
+			ok = ok && (strtod(out, NULL) == v);
+		}
+		if(!ok && mismatches++ < 4) {
+			fprintf(stderr, "%.17g formatted as \"%s\"\n", v, out);
+		}
+	}
+	return mismatches;
+}
+
+/// Fill a database with rows rows, the way obdgpslogger would
+static int generate_db(const char *dbname, long rows) {
+	sqlite3 *db;
+	if(SQLITE_OK != sqlite3_open(dbname, &db)) {
+		fprintf(stderr, "Can't open database %s: %s\n", dbname, sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return 1;
+	}
+
+	// Every PID with a conversion. Some without one share a column name
+	//  with an older PID, and can't both be in the table
+	struct obdcapabilities caps;
+	memset(&caps, 0, sizeof(caps));
+	int i;
+	for(i=0;i<OBDCMDS_MODE1_COUNT-1;i++) {
+		if(NULL != obdcmds_mode1[i].conv) {
+			obdcapset_add(&caps.all, 1, obdcmds_mode1[i].cmdid);
+		}
+	}
+
+	sqlite3_stmt *obdinsert;
+	sqlite3_stmt *gpsinsert;
+	if(0 != createobdtable(db, &caps) || 0 != creategpstable(db) || 0 != createtriptable(db)) {
+		sqlite3_close(db);
+		return 1;
+	}
+	int obdcols = createobdinsertstmt(db, &obdinsert, &caps) - 1;
+	if(obdcols < 0 || 0 == creategpsinsertstmt(db, &gpsinsert)) {
+		sqlite3_close(db);
+		return 1;
+	}
+
+	// The same columns in the same order createobdinsertstmt used
+	struct obdservicecmd *cmds[OBDCMDS_MODE1_COLUMNS];
+	int pid;
+	i = 0;
+	for(pid=obdcapset_next(&caps.all,1,-1); pid>=0 && i<obdcols; pid=obdcapset_next(&caps.all,1,pid)) {
+		struct obdservicecmd *cmd = obdGetCmdForPID(pid);
+		if(NULL != cmd && NULL != cmd->db_column) {
+			cmds[i++] = cmd;
+		}
+	}
+
+	obdbegintransaction(db);
+	sqlite3_int64 tripid = starttrip(db, CSVBENCH_STARTTIME - 1);
+
+	srand(1);
+	long l;
+	for(l=0;l<rows;l++) {
+		double t = CSVBENCH_STARTTIME + l * 0.25;
+		for(i=0;i<obdcols;i++) {
+			// Not every ECU sends every PID
+			if(0 == rand() % 10) {
+				sqlite3_bind_null(obdinsert, i+1);
+			} else {
+				sqlite3_bind_double(obdinsert, i+1, random_value(cmds[i]));
+			}
+		}
+		sqlite3_bind_double(obdinsert, obdcols+1, t);
+		sqlite3_bind_int64(obdinsert, obdcols+2, tripid);
+		sqlite3_bind_int(obdinsert, obdcols+3, l % 2);
+		sqlite3_step(obdinsert);
+		sqlite3_reset(obdinsert);
+
+		// A GPS fix for every other pair of rows
+		if(0 == l % 4) {
+			sqlite3_bind_double(gpsinsert, 1, (37000000 + l) / 1000000.0);
+			sqlite3_bind_double(gpsinsert, 2, (-122000000 - l) / 1000000.0);
+			sqlite3_bind_double(gpsinsert, 3, 30.0 + rand() % 100);
+			sqlite3_bind_double(gpsinsert, 4, rand() % 30);
+			sqlite3_bind_double(gpsinsert, 5, rand() % 360);
+			sqlite3_bind_double(gpsinsert, 6, t);
+			sqlite3_bind_double(gpsinsert, 7, t);
+			sqlite3_bind_int64(gpsinsert, 8, tripid);
+			sqlite3_step(gpsinsert);
+			sqlite3_reset(gpsinsert);
+		}
+	}
+
+	updatetrip(db, tripid, CSVBENCH_STARTTIME + rows * 0.25);
+	obdcommittransaction(db);
+
+	sqlite3_finalize(obdinsert);
+	sqlite3_finalize(gpsinsert);
+	sqlite3_close(db);
+	return 0;
+}
+
+/// Run obd2csv. Returns its exit status, or -1
+static int run_export(const char *obd2csv, const char *dbname, const char *outname,
+		const char *format, int compress, int jobs) {
+	char jobsarg[16];
+	snprintf(jobsarg, sizeof(jobsarg), "%i", jobs);
+
+	pid_t pid = fork();
+	if(-1 == pid) {
+		perror("Couldn't fork");
+		return -1;
+	}
+	if(0 == pid) {
+		execlp(obd2csv, obd2csv, "-d", dbname, "-o", outname, "-j", jobsarg,
+			"-f", format, compress?"-z":NULL, (char *)NULL);
+		perror(obd2csv);
+		_exit(1);
+	}
+	int status;
+	if(pid != waitpid(pid, &status, 0) || !WIFEXITED(status)) return -1;
+	return WEXITSTATUS(status);
+}
+
+/// Print the help
+static void printhelp(const char *argv0) {
+	printf("Usage: %s [params]\n"
+		"   [-n <rows=%i>]\n"
+		"   [-d <database, kept and reused if it exists>]\n"
+		"   [-x <obd2csv executable>]\n"
+		"   [-j <obd2csv jobs=1>]\n"
+		"   [-f <csv|columns>]\n"
+		"   [-z]\n"
+		"   [-h]\n", argv0, CSVBENCH_DEFAULTROWS);
+}
+
+int main(int argc, char **argv) {
+	long rows = CSVBENCH_DEFAULTROWS;
+	char *dbname = NULL;
+	char *obd2csv = NULL;
+	int compress = 0;
+	int jobs = 1;
+	const char *format = "csv";
+	int keepdb = 0;
+
+	int optc;
+	while(-1 != (optc = getopt(argc, argv, "n:d:x:j:f:zh"))) {
+		switch(optc) {
+			case 'n':
+				rows = atol(optarg);
+				break;
+			case 'd':
+				dbname = strdup(optarg);
+				keepdb = 1;
+				break;
+			case 'x':
+				obd2csv = strdup(optarg);
+				break;
+			case 'j':
+				jobs = atoi(optarg);
+				break;
+			case 'f':
+				format = optarg;
+				break;
+			case 'z':
+				compress = 1;
+				break;
+			default:
+				printhelp(argv[0]);
+				return 1;
+		}
+	}
+	if(rows <= 0) {
+		printhelp(argv[0]);
+		return 1;
+	}
+	if(NULL == obd2csv) obd2csv = find_sibling(argv[0], "obd2csv");
+
+	double *vals = (double *)malloc(CSVBENCH_VALUES * sizeof(double));
+	if(NULL == vals) {
+		fprintf(stderr, "Couldn't allocate %i values\n", CSVBENCH_VALUES);
+		return 1;
+	}
+	srand(1);
+	make_values(vals, CSVBENCH_VALUES);
+	if(0 != check_format(vals, CSVBENCH_VALUES)) {
+		return 1;
+	}
+
+	char out[CSVWRITER_MAXNUMBER];
+	long sink = 0;
+	long l;
+	double start = now_seconds();
+	for(l=0;l<CSVBENCH_VALUES;l++) {
+		sink += snprintf(out, sizeof(out), "%f", vals[l]);
+	}
+	double printfsecs = now_seconds() - start;
+
+	start = now_seconds();
+	for(l=0;l<CSVBENCH_VALUES;l++) {
+		sink += csvwriter_formatdouble(out, vals[l]);
+	}
+	double formatsecs = now_seconds() - start;
+	free(vals);
+
+	printf("Format:  printf(\"%%f\") %6.2f ns, csvwriter %6.2f ns\n",
+		1e9 * printfsecs / CSVBENCH_VALUES, 1e9 * formatsecs / CSVBENCH_VALUES);
+
+	char tmpdir[] = "/tmp/csvbench.XXXXXX";
+	if(NULL == mkdtemp(tmpdir)) {
+		perror("Couldn't create temporary directory");
+		return 1;
+	}
+	if(NULL == dbname) {
+		char tmpdb[4096];
+		snprintf(tmpdb, sizeof(tmpdb), "%s/bench.db", tmpdir);
+		dbname = strdup(tmpdb);
+	}
+	char outname[4096];
+	snprintf(outname, sizeof(outname), "%s/bench.%s%s", tmpdir, format, compress?".gz":"");
+
+	struct stat st;
+	if(0 != stat(dbname, &st)) {
+		printf("Generating %li rows in %s\n", rows, dbname);
+		start = now_seconds();
+		if(0 != generate_db(dbname, rows)) {
+			return 1;
+		}
+		printf("Generated in %.2fs\n", now_seconds() - start);
+	}
+
+	// Count what's actually there, in case the database was reused
+	sqlite3 *db;
+	sqlite3_stmt *count_stmt;
+	if(SQLITE_OK != sqlite3_open_v2(dbname, &db, SQLITE_OPEN_READONLY, NULL) ||
+		SQLITE_OK != sqlite3_prepare_v2(db, "SELECT count(*) FROM obd", -1, &count_stmt, NULL)) {
+		fprintf(stderr, "Can't read database %s: %s\n", dbname, sqlite3_errmsg(db));
+		return 1;
+	}
+	if(SQLITE_ROW == sqlite3_step(count_stmt)) {
+		rows = (long)sqlite3_column_int64(count_stmt, 0);
+	}
+	sqlite3_finalize(count_stmt);
+	sqlite3_close(db);
+
+	start = now_seconds();
+	int ret = run_export(obd2csv, dbname, outname, format, compress, jobs);
+	double exportsecs = now_seconds() - start;
+	if(0 != ret) {
+		fprintf(stderr, "%s failed\n", obd2csv);
+		return 1;
+	}
+
+	stat(outname, &st);
+	printf("Export:  %s, %li rows, %i jobs, in %.2fs, %.0f rows/s, %.1f MB/s written\n",
+		format, rows, jobs, exportsecs, rows / exportsecs, st.st_size / exportsecs / (1024*1024));
+
+	unlink(outname);
+	if(!keepdb) unlink(dbname);
+	rmdir(tmpdir);
+
+	free(dbname);
+	free(obd2csv);
+	return 0 == sink; // Never true; just keeps sink alive
+}
+
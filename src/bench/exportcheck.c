@@ -0,0 +1,317 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/** \file
+ \brief Compare obd2gpx and obd2kml against another build
+
+ Generates a database the way obdgpslogger's main loop writes one,
+ with each trip starting and ending at the times of its first and
+ last rows, then runs obd2gpx and obd2kml from this build and from a
+ reference build on it and checks the outputs are the same.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "obdservicecommands.h"
+#include "supportedcommands.h"
+#include "obddb.h"
+#include "gpsdb.h"
+#include "tripdb.h"
+
+#include "sqlite3.h"
+
+/// Default number of trips to generate
+#define EXPORTCHECK_DEFAULTTRIPS 5
+
+/// Samples in each generated trip
+#define EXPORTCHECK_TRIPSAMPLES 200
+
+/// Time of the first generated sample
+#define EXPORTCHECK_STARTTIME 1300000000.0
+
+/// Find an executable next to this one
+static char *find_sibling(const char *argv0, const char *name) {
+	char path[4096];
+	const char *slash = strrchr(argv0, '/');
+	if(NULL == slash) {
+		return strdup(name);
+	}
+	snprintf(path, sizeof(path), "%.*s/%s", (int)(slash - argv0), argv0, name);
+	return strdup(path);
+}
+
+/// Fill a database with trips, the way obdgpslogger's main loop would
+static int generate_db(const char *dbname, int trips) {
+	sqlite3 *db;
+	if(SQLITE_OK != sqlite3_open(dbname, &db)) {
+		fprintf(stderr, "Can't open database %s: %s\n", dbname, sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return 1;
+	}
+
+	// Every PID with a conversion. Some without one share a column name
+	//  with an older PID, and can't both be in the table
+	struct obdcapabilities caps;
+	memset(&caps, 0, sizeof(caps));
+	int i;
+	for(i=0;i<OBDCMDS_MODE1_COUNT-1;i++) {
+		if(NULL != obdcmds_mode1[i].conv) {
+			obdcapset_add(&caps.all, 1, obdcmds_mode1[i].cmdid);
+		}
+	}
+
+	sqlite3_stmt *obdinsert;
+	sqlite3_stmt *gpsinsert;
+	if(0 != createobdtable(db, &caps) || 0 != creategpstable(db) || 0 != createtriptable(db)) {
+		sqlite3_close(db);
+		return 1;
+	}
+	int obdcols = createobdinsertstmt(db, &obdinsert, &caps) - 1;
+	if(obdcols < 0 || 0 == creategpsinsertstmt(db, &gpsinsert)) {
+		sqlite3_close(db);
+		return 1;
+	}
+
+	// The same columns in the same order createobdinsertstmt used
+	struct obdservicecmd *cmds[OBDCMDS_MODE1_COLUMNS];
+	int pid;
+	i = 0;
+	for(pid=obdcapset_next(&caps.all,1,-1); pid>=0 && i<obdcols; pid=obdcapset_next(&caps.all,1,pid)) {
+		struct obdservicecmd *cmd = obdGetCmdForPID(pid);
+		if(NULL != cmd && NULL != cmd->db_column) {
+			cmds[i++] = cmd;
+		}
+	}
+
+	obdbegintransaction(db);
+	srand(1);
+	double t = EXPORTCHECK_STARTTIME;
+	int trip;
+	for(trip=0;trip<trips;trip++) {
+		// The logger starts a trip at the time of its first row...
+		sqlite3_int64 tripid = starttrip(db, t);
+		int l;
+		for(l=0;l<EXPORTCHECK_TRIPSAMPLES;l++) {
+			for(i=0;i<obdcols;i++) {
+				sqlite3_bind_double(obdinsert, i+1,
+					cmds[i]->conv(rand() & 0xFF, rand() & 0xFF, rand() & 0xFF, rand() & 0xFF));
+			}
+			sqlite3_bind_double(obdinsert, obdcols+1, t);
+			sqlite3_bind_int64(obdinsert, obdcols+2, tripid);
+			sqlite3_bind_int(obdinsert, obdcols+3, 0);
+			sqlite3_step(obdinsert);
+			sqlite3_reset(obdinsert);
+
+			// ...and writes the fix with the same time as the obd row.
+			//  Now and then there's no fix; never at either end of a trip
+			if(0 == l || EXPORTCHECK_TRIPSAMPLES-1 == l || 0 != l % 7) {
+				sqlite3_bind_double(gpsinsert, 1, 37.0 + (trip * EXPORTCHECK_TRIPSAMPLES + l) / 10000.0);
+				sqlite3_bind_double(gpsinsert, 2, -122.0 - (rand() % 100) / 10000.0);
+				sqlite3_bind_double(gpsinsert, 3, (0 == l % 5)?-1000:30.0 + rand() % 100);
+				sqlite3_bind_double(gpsinsert, 4, rand() % 30);
+				sqlite3_bind_double(gpsinsert, 5, rand() % 360);
+				sqlite3_bind_double(gpsinsert, 6, t);
+				sqlite3_bind_double(gpsinsert, 7, t);
+				sqlite3_bind_int64(gpsinsert, 8, tripid);
+				sqlite3_step(gpsinsert);
+				sqlite3_reset(gpsinsert);
+			}
+
+			// ...and ends it at the time of its last
+			updatetrip(db, tripid, t);
+			t += 1.0;
+		}
+		t += 600.0;
+	}
+	obdcommittransaction(db);
+
+	sqlite3_finalize(obdinsert);
+	sqlite3_finalize(gpsinsert);
+	sqlite3_close(db);
+	return 0;
+}
+
+/// Run an exporter quietly. Returns its exit status, or -1
+static int run_export(const char *exe, const char *dbname, const char *outname) {
+	pid_t pid = fork();
+	if(-1 == pid) {
+		perror("Couldn't fork");
+		return -1;
+	}
+	if(0 == pid) {
+		int devnull = open("/dev/null", O_WRONLY);
+		if(-1 != devnull) {
+			dup2(devnull, STDOUT_FILENO);
+			dup2(devnull, STDERR_FILENO);
+		}
+		execlp(exe, exe, "-d", dbname, "-o", outname, (char *)NULL);
+		_exit(127);
+	}
+	int status;
+	if(pid != waitpid(pid, &status, 0) || !WIFEXITED(status)) return -1;
+	return WEXITSTATUS(status);
+}
+
+/// Compare two files line by line. Returns 0 if they're the same
+static int compare_files(const char *a, const char *b) {
+	FILE *fa = fopen(a, "r");
+	FILE *fb = fopen(b, "r");
+	int ret = 1;
+	if(NULL == fa || NULL == fb) {
+		perror(NULL == fa?a:b);
+	} else {
+		char la[4096];
+		char lb[4096];
+		long line = 0;
+		for(;;) {
+			char *ra = fgets(la, sizeof(la), fa);
+			char *rb = fgets(lb, sizeof(lb), fb);
+			line++;
+			if(NULL == ra && NULL == rb) {
+				ret = 0;
+				break;
+			}
+			if(NULL == ra || NULL == rb || 0 != strcmp(la, lb)) {
+				fprintf(stderr, "%s and %s differ at line %li:\n< %s> %s", a, b, line,
+					NULL == ra?"(end of file)\n":la, NULL == rb?"(end of file)\n":lb);
+				break;
+			}
+		}
+	}
+	if(NULL != fa) fclose(fa);
+	if(NULL != fb) fclose(fb);
+	return ret;
+}
+
+/// Export with an exporter from each build, and compare. Returns 0 if they match
+static int check_exporter(const char *name, const char *suffix, const char *builddir,
+		const char *refdir, const char *dbname, const char *tmpdir) {
+	char exe[4096], refexe[4096];
+	char out[4096], refout[4096];
+	snprintf(exe, sizeof(exe), "%s/%s", builddir, name);
+	snprintf(refexe, sizeof(refexe), "%s/%s", refdir, name);
+	// Same file name in different directories; gpx writes it in its header
+	snprintf(out, sizeof(out), "%s/build/out.%s", tmpdir, suffix);
+	snprintf(refout, sizeof(refout), "%s/ref/out.%s", tmpdir, suffix);
+
+	if(0 != run_export(exe, dbname, out)) {
+		fprintf(stderr, "%s failed\n", exe);
+		return 1;
+	}
+	if(0 != run_export(refexe, dbname, refout)) {
+		fprintf(stderr, "%s failed\n", refexe);
+		return 1;
+	}
+	int ret = compare_files(out, refout);
+	printf("%-8s %s\n", name, 0 == ret?"same":"DIFFERENT");
+	unlink(out);
+	unlink(refout);
+	return ret;
+}
+
+/// Print the help
+static void printhelp(const char *argv0) {
+	printf("Usage: %s -r <reference bin directory> [params]\n"
+		"   [-b <bin directory to check, default this one's>]\n"
+		"   [-n <trips=%i>]\n"
+		"   [-d <database, kept and reused if it exists>]\n"
+		"   [-h]\n", argv0, EXPORTCHECK_DEFAULTTRIPS);
+}
+
+int main(int argc, char **argv) {
+	int trips = EXPORTCHECK_DEFAULTTRIPS;
+	char *dbname = NULL;
+	char *builddir = NULL;
+	char *refdir = NULL;
+	int keepdb = 0;
+
+	int optc;
+	while(-1 != (optc = getopt(argc, argv, "r:b:n:d:h"))) {
+		switch(optc) {
+			case 'r':
+				refdir = strdup(optarg);
+				break;
+			case 'b':
+				builddir = strdup(optarg);
+				break;
+			case 'n':
+				trips = atoi(optarg);
+				break;
+			case 'd':
+				dbname = strdup(optarg);
+				keepdb = 1;
+				break;
+			default:
+				printhelp(argv[0]);
+				return 1;
+		}
+	}
+	if(NULL == refdir || trips <= 0) {
+		printhelp(argv[0]);
+		return 1;
+	}
+	if(NULL == builddir) builddir = find_sibling(argv[0], ".");
+
+	char tmpdir[] = "/tmp/exportcheck.XXXXXX";
+	if(NULL == mkdtemp(tmpdir)) {
+		perror("Couldn't create temporary directory");
+		return 1;
+	}
+	char subdir[4096];
+	snprintf(subdir, sizeof(subdir), "%s/build", tmpdir);
+	mkdir(subdir, 0700);
+	snprintf(subdir, sizeof(subdir), "%s/ref", tmpdir);
+	mkdir(subdir, 0700);
+
+	if(NULL == dbname) {
+		char tmpdb[4096];
+		snprintf(tmpdb, sizeof(tmpdb), "%s/check.db", tmpdir);
+		dbname = strdup(tmpdb);
+	}
+
+	struct stat st;
+	if(0 != stat(dbname, &st)) {
+		printf("Generating %i trips in %s\n", trips, dbname);
+		if(0 != generate_db(dbname, trips)) {
+			return 1;
+		}
+	}
+
+	int ret = 0;
+	ret |= check_exporter("obd2gpx", "gpx", builddir, refdir, dbname, tmpdir);
+	ret |= check_exporter("obd2kml", "kml", builddir, refdir, dbname, tmpdir);
+
+	if(!keepdb) unlink(dbname);
+	snprintf(subdir, sizeof(subdir), "%s/build", tmpdir);
+	rmdir(subdir);
+	snprintf(subdir, sizeof(subdir), "%s/ref", tmpdir);
+	rmdir(subdir);
+	rmdir(tmpdir);
+
+	free(dbname);
+	free(builddir);
+	free(refdir);
+	return ret;
+}
@@ -0,0 +1,625 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** \file
+ \brief Benchmark obdgpslogger against obdsim
+
+ Launches obdsim with whatever arguments follow "--", or once per line of
+ a scenarios file, points obdgpslogger at it for a fixed number of samples
+ or a fixed duration, then reports throughput, per-request latency, CPU
+ usage of both ends and database size. Results can be written as JSON to
+ track performance between versions. Use with obdsim --replay for runs
+ that are repeatable from one build to the next.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "obdconfig.h"
+#include "obdbench.h"
+
+#include "sqlite3.h"
+
+/// Turn a timeval into seconds
+static double tv_seconds(struct timeval *tv) {
+	return tv->tv_sec + tv->tv_usec / 1000000.0;
+}
+
+/// Find an executable next to this one, unless the user said where it is
+static char *find_sibling(const char *argv0, const char *name) {
+	char path[4096];
+	const char *slash = strrchr(argv0, '/');
+	if(NULL == slash) {
+		return strdup(name);
+	}
+	snprintf(path, sizeof(path), "%.*s/%s", (int)(slash - argv0), argv0, name);
+	return strdup(path);
+}
+
+/// Fork and exec, with stdout and stderr going to outname
+static pid_t spawn(char *const argv[], const char *outname) {
+	pid_t pid = fork();
+	if(-1 == pid) {
+		perror("Couldn't fork");
+		return -1;
+	}
+	if(0 == pid) {
+		int fd = open(outname, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		if(-1 != fd) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+			close(fd);
+		}
+		execvp(argv[0], argv);
+		perror(argv[0]);
+		_exit(1);
+	}
+	return pid;
+}
+
+/// Wait for obdsim to print the name of its port
+/** \return 0 on success, nonzero if the sim died or took too long */
+static int wait_simport(pid_t simpid, const char *simout, char *port, size_t portlen) {
+	int tries;
+	for(tries = 0; tries < OBDBENCH_SIMSTARTTIMEOUT * 20; tries++) {
+		FILE *f = fopen(simout, "r");
+		if(NULL != f) {
+			char line[4096];
+			while(NULL != fgets(line, sizeof(line), f)) {
+				if(0 == strncmp(line, "SimPort name: ", 14)) {
+					snprintf(port, portlen, "%s", line + 14);
+					port[strcspn(port, "\r\n")] = '\0';
+					fclose(f);
+					return 0;
+				}
+			}
+			fclose(f);
+		}
+
+		int status;
+		if(simpid == waitpid(simpid, &status, WNOHANG)) {
+			fprintf(stderr, "obdsim exited before opening a port. See %s\n", simout);
+			return 1;
+		}
+		usleep(50000);
+	}
+	fprintf(stderr, "Timed out waiting for obdsim to open a port\n");
+	return 1;
+}
+
+/// Parse the time of day out of a serial log record header
+/** \return direction: 1 for out, 2 for in, 0 if this isn't a header line */
+static int parse_logheader(const char *line, double *t) {
+	int h, m, s;
+	int consumed = 0;
+	if(3 != sscanf(line, "%2d:%2d:%2d%n", &h, &m, &s, &consumed) || 8 != consumed) {
+		return 0;
+	}
+	line += consumed;
+	double frac = 0;
+	if('.' == *line) {
+		char *end;
+		frac = strtod(line, &end);
+		line = end;
+	}
+	*t = h*3600 + m*60 + s + frac;
+	if(0 == strncmp(line, "(out): ", 7)) return 1;
+	if(0 == strncmp(line, "(in): ", 6)) return 2;
+	return 0;
+}
+
+/// Local time of day for a unix time, to compare against serial log timestamps
+static double time_of_day(double t) {
+	time_t secs = (time_t)t;
+	struct tm *tmp = localtime(&secs);
+	if(NULL == tmp) return 0;
+	return tmp->tm_hour*3600 + tmp->tm_min*60 + tmp->tm_sec + (t - secs);
+}
+
+static int cmp_double(const void *a, const void *b) {
+	double da = *(const double *)a;
+	double db = *(const double *)b;
+	return (da > db) - (da < db);
+}
+
+/// Nearest-rank percentile of a sorted array
+static double percentile(const double *sorted, long n, double p) {
+	if(0 >= n) return 0;
+	long idx = (long)(p * n + 0.999999) - 1;
+	if(idx < 0) idx = 0;
+	if(idx >= n) idx = n-1;
+	return sorted[idx];
+}
+
+/// Latency of every request sent after windowstart, from an obdgpslogger serial log
+/** Requests during ELM initialisation are excluded; obdgpslogger sleeps
+    between those so they only measure its own sleep.
+    \param logname the serial log
+    \param windowstart time of day of the first sample
+    \param res filled with query and latency stats
+*/
+static void serial_latency(const char *logname, double windowstart, struct obdbench_result *res) {
+	FILE *f = fopen(logname, "r");
+	if(NULL == f) {
+		return;
+	}
+
+	long allocated = 1024;
+	long n = 0;
+	double *lats = (double *)malloc(allocated * sizeof(double));
+	double total = 0;
+	double lastresponse = windowstart;
+
+	char line[OBDBENCH_MAXLINE];
+	double sent = -1;
+	while(NULL != lats && NULL != fgets(line, sizeof(line), f)) {
+		double t;
+		int dir = parse_logheader(line, &t);
+		if(1 == dir) {
+			sent = t;
+		} else if(2 == dir && sent >= 0) {
+			if(sent >= windowstart) {
+				double l = t - sent;
+				if(l < 0) l += 86400; // Midnight
+				if(n >= allocated) {
+					allocated *= 2;
+					double *tmp = (double *)realloc(lats, allocated * sizeof(double));
+					if(NULL == tmp) break;
+					lats = tmp;
+				}
+				lats[n++] = l;
+				total += l;
+				lastresponse = t;
+			}
+			sent = -1;
+		}
+	}
+	fclose(f);
+
+	if(NULL == lats) return;
+
+	qsort(lats, n, sizeof(double), cmp_double);
+	res->queries = n;
+	if(lastresponse > windowstart) {
+		res->queryrate = n / (lastresponse - windowstart);
+	}
+	if(n > 0) {
+		res->lat_mean = total / n;
+		res->lat_p50 = percentile(lats, n, 0.50);
+		res->lat_p99 = percentile(lats, n, 0.99);
+		res->lat_max = lats[n-1];
+	}
+	free(lats);
+}
+
+/// Count samples and the span of time they cover in the logger's database
+/** Each ECU that answers gets its own row, all with the same time, so
+     a sample is a distinct time rather than a row
+    \param firsttime filled with the time of the first row */
+static int db_samples(const char *dbname, long *rows, double *firsttime, double *span) {
+	sqlite3 *db;
+	sqlite3_stmt *stmt;
+	*rows = 0;
+	*firsttime = 0;
+	*span = 0;
+
+	if(SQLITE_OK != sqlite3_open(dbname, &db)) {
+		fprintf(stderr, "Couldn't open database %s: %s\n", dbname, sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return 1;
+	}
+	if(SQLITE_OK != sqlite3_prepare_v2(db,
+			"SELECT COUNT(DISTINCT time), MIN(time), MAX(time) FROM obd", -1, &stmt, NULL)) {
+		fprintf(stderr, "Couldn't query database %s: %s\n", dbname, sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return 1;
+	}
+	if(SQLITE_ROW == sqlite3_step(stmt)) {
+		*rows = sqlite3_column_int(stmt, 0);
+		*firsttime = sqlite3_column_double(stmt, 1);
+		*span = sqlite3_column_double(stmt, 2) - *firsttime;
+	}
+	sqlite3_finalize(stmt);
+	sqlite3_close(db);
+	return 0;
+}
+
+/// Everything that's the same for every scenario in a run
+struct obdbench_settings {
+	char *simpath; ///< obdsim executable
+	char *loggerpath; ///< obdgpslogger executable
+	int samplecount; ///< Samples to ask obdgpslogger for
+	int duration; ///< If nonzero, stop obdgpslogger after this many seconds instead
+	int keep; ///< Keep the working directory
+};
+
+/// Run obdgpslogger against obdsim once
+/** \param set settings for this run
+    \param simargs NULL-terminated arguments for obdsim, not including argv[0]
+    \param res filled with the results
+*/
+static void run_scenario(struct obdbench_settings *set, char **simargs, struct obdbench_result *res) {
+	memset(res, 0, sizeof(*res));
+
+	int keep = set->keep;
+
+	char workdir[] = "/tmp/obdbench.XXXXXX";
+	if(NULL == mkdtemp(workdir)) {
+		perror("Couldn't create working directory");
+		return;
+	}
+
+	char simout[4096], loggerout[4096], dbname[4096], seriallog[4096];
+	snprintf(simout, sizeof(simout), "%s/obdsim.out", workdir);
+	snprintf(loggerout, sizeof(loggerout), "%s/obdgpslogger.out", workdir);
+	snprintf(dbname, sizeof(dbname), "%s/bench.db", workdir);
+	snprintf(seriallog, sizeof(seriallog), "%s/serial.log", workdir);
+
+	char *simargv[OBDBENCH_MAXARGS+2];
+	int i;
+	simargv[0] = set->simpath;
+	for(i=0; i<OBDBENCH_MAXARGS && NULL != simargs[i]; i++) {
+		simargv[i+1] = simargs[i];
+	}
+	simargv[i+1] = NULL;
+
+	pid_t simpid = spawn(simargv, simout);
+	if(-1 == simpid) {
+		goto cleanup;
+	}
+
+	char port[4096];
+	if(0 != wait_simport(simpid, simout, port, sizeof(port))) {
+		kill(simpid, SIGTERM);
+		waitpid(simpid, NULL, 0);
+		keep = 1;
+		goto cleanup;
+	}
+
+	char countstr[32];
+	snprintf(countstr, sizeof(countstr), "%i", 0<set->duration?-1:set->samplecount);
+	char *loggerargv[] = { set->loggerpath, "-s", port, "-d", dbname, "-l", seriallog,
+		"-a", "0", "-c", countstr, NULL };
+
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+	pid_t loggerpid = spawn(loggerargv, loggerout);
+	if(-1 == loggerpid) {
+		kill(simpid, SIGTERM);
+		waitpid(simpid, NULL, 0);
+		goto cleanup;
+	}
+
+	int loggerstatus;
+	struct rusage loggerusage;
+	if(0 < set->duration) {
+		// obdgpslogger exits cleanly on SIGTERM
+		while(loggerpid != wait4(loggerpid, &loggerstatus, WNOHANG, &loggerusage)) {
+			gettimeofday(&end, NULL);
+			if(tv_seconds(&end) - tv_seconds(&start) >= set->duration) {
+				kill(loggerpid, SIGTERM);
+				wait4(loggerpid, &loggerstatus, 0, &loggerusage);
+				break;
+			}
+			usleep(50000);
+		}
+	} else {
+		wait4(loggerpid, &loggerstatus, 0, &loggerusage);
+	}
+	gettimeofday(&end, NULL);
+
+	int simstatus;
+	struct rusage simusage;
+	kill(simpid, SIGTERM);
+	wait4(simpid, &simstatus, 0, &simusage);
+
+	res->wall = tv_seconds(&end) - tv_seconds(&start);
+	res->logger_user = tv_seconds(&loggerusage.ru_utime);
+	res->logger_sys = tv_seconds(&loggerusage.ru_stime);
+	res->sim_user = tv_seconds(&simusage.ru_utime);
+	res->sim_sys = tv_seconds(&simusage.ru_stime);
+
+	if(!WIFEXITED(loggerstatus) || 0 != WEXITSTATUS(loggerstatus)) {
+		fprintf(stderr, "obdgpslogger failed. See %s\n", loggerout);
+		keep = 1;
+		goto cleanup;
+	}
+
+	double firsttime;
+	if(0 != db_samples(dbname, &res->samples, &firsttime, &res->samplespan)) {
+		keep = 1;
+		goto cleanup;
+	}
+	if(res->samples > 1 && res->samplespan > 0) {
+		res->samplerate = (res->samples-1) / res->samplespan;
+	}
+
+	struct stat st;
+	if(0 == stat(dbname, &st)) {
+		res->dbbytes = st.st_size;
+		if(res->samples > 0) {
+			res->dbbytespersample = (double)st.st_size / res->samples;
+		}
+	}
+
+	serial_latency(seriallog, time_of_day(firsttime), res);
+
+	res->ok = 1;
+
+cleanup:
+	if(keep) {
+		printf("Kept working directory %s\n", workdir);
+	} else {
+		unlink(simout);
+		unlink(loggerout);
+		unlink(dbname);
+		unlink(seriallog);
+		rmdir(workdir);
+	}
+}
+
+/// Print a human readable summary of one scenario
+static void print_result(const char *name, struct obdbench_result *res) {
+	printf("%s:\n", name);
+	if(!res->ok) {
+		printf("  Failed\n");
+		return;
+	}
+	printf("  Wall time:     %.3fs\n", res->wall);
+	printf("  Samples:       %li in %.3fs, %.2f samples/s\n", res->samples,
+		res->samplespan, res->samplerate);
+	printf("  Queries:       %li, %.2f queries/s\n", res->queries, res->queryrate);
+	printf("  Latency:       mean %.3fms, p50 %.3fms, p99 %.3fms, max %.3fms\n",
+		1000*res->lat_mean, 1000*res->lat_p50, 1000*res->lat_p99, 1000*res->lat_max);
+	printf("  obdgpslogger:  user %.3fs, sys %.3fs\n", res->logger_user, res->logger_sys);
+	printf("  obdsim:        user %.3fs, sys %.3fs\n", res->sim_user, res->sim_sys);
+	printf("  Database:      %li bytes, %.1f bytes/sample\n", res->dbbytes, res->dbbytespersample);
+}
+
+/// Write a string as a JSON string literal
+static void json_string(FILE *f, const char *s) {
+	fputc('"', f);
+	for(; '\0' != *s; s++) {
+		if('"' == *s || '\\' == *s) {
+			fprintf(f, "\\%c", *s);
+		} else if((unsigned char)*s < 0x20) {
+			fprintf(f, "\\u%04x", *s);
+		} else {
+			fputc(*s, f);
+		}
+	}
+	fputc('"', f);
+}
+
+/// Write one scenario's results as a JSON object
+static void json_result(FILE *f, const char *name, char **simargs, struct obdbench_result *res) {
+	int i;
+	fprintf(f, "    {\n      \"name\": ");
+	json_string(f, name);
+	fprintf(f, ",\n      \"obdsim_args\": [");
+	for(i=0; NULL != simargs[i]; i++) {
+		if(i > 0) fprintf(f, ", ");
+		json_string(f, simargs[i]);
+	}
+	fprintf(f, "],\n");
+	fprintf(f, "      \"ok\": %s", res->ok?"true":"false");
+	if(res->ok) {
+		fprintf(f, ",\n"
+			"      \"wall_seconds\": %.6f,\n"
+			"      \"samples\": %li,\n"
+			"      \"samples_per_second\": %.3f,\n"
+			"      \"queries\": %li,\n"
+			"      \"queries_per_second\": %.3f,\n"
+			"      \"latency_ms\": { \"mean\": %.3f, \"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f },\n"
+			"      \"cpu_seconds\": {\n"
+			"        \"obdgpslogger\": { \"user\": %.3f, \"sys\": %.3f },\n"
+			"        \"obdsim\": { \"user\": %.3f, \"sys\": %.3f }\n"
+			"      },\n"
+			"      \"db_bytes\": %li,\n"
+			"      \"db_bytes_per_sample\": %.1f",
+			res->wall, res->samples, res->samplerate, res->queries, res->queryrate,
+			1000*res->lat_mean, 1000*res->lat_p50, 1000*res->lat_p99, 1000*res->lat_max,
+			res->logger_user, res->logger_sys, res->sim_user, res->sim_sys,
+			res->dbbytes, res->dbbytespersample);
+	}
+	fprintf(f, "\n    }");
+}
+
+/// Split a line into whitespace separated words, in place
+/** \return number of words */
+static int split_words(char *line, char **words, int maxwords) {
+	int n = 0;
+	char *saveptr;
+	char *w = strtok_r(line, " \t\r\n", &saveptr);
+	while(NULL != w && n < maxwords) {
+		words[n++] = w;
+		w = strtok_r(NULL, " \t\r\n", &saveptr);
+	}
+	words[n] = NULL;
+	return n;
+}
+
+int main(int argc, char **argv) {
+	struct obdbench_settings set;
+	set.samplecount = OBDBENCH_DEFAULTCOUNT;
+	set.duration = 0;
+	set.simpath = NULL;
+	set.loggerpath = NULL;
+	set.keep = 0;
+
+	char *scenariofile = NULL;
+	char *jsonfile = NULL;
+	char *name = NULL;
+
+	int optc;
+	int mustexit = 0;
+	while ((optc = getopt_long (argc, argv, benchshortopts, benchlongopts, NULL)) != -1) {
+		switch (optc) {
+			case 'h':
+				benchprinthelp(argv[0]);
+				mustexit = 1;
+				break;
+			case 'v':
+				benchprintversion();
+				mustexit = 1;
+				break;
+			case 'c':
+				set.samplecount = atoi(optarg);
+				break;
+			case 't':
+				set.duration = atoi(optarg);
+				break;
+			case 'f':
+				free(scenariofile);
+				scenariofile = strdup(optarg);
+				break;
+			case 'n':
+				free(name);
+				name = strdup(optarg);
+				break;
+			case 'o':
+				free(jsonfile);
+				jsonfile = strdup(optarg);
+				break;
+			case 'S':
+				free(set.simpath);
+				set.simpath = strdup(optarg);
+				break;
+			case 'G':
+				free(set.loggerpath);
+				set.loggerpath = strdup(optarg);
+				break;
+			case 'k':
+				set.keep = 1;
+				break;
+			default:
+				mustexit = 1;
+				break;
+		}
+	}
+	if(mustexit) return 0;
+
+	if(set.samplecount <= 0 && set.duration <= 0) {
+		fprintf(stderr, "Sample count or duration must be positive\n");
+		return 1;
+	}
+
+	if(NULL == set.simpath) set.simpath = find_sibling(argv[0], "obdsim");
+	if(NULL == set.loggerpath) set.loggerpath = find_sibling(argv[0], "obdgpslogger");
+
+	FILE *json = NULL;
+	if(NULL != jsonfile) {
+		if(0 == strcmp(jsonfile, "-")) {
+			json = stdout;
+		} else if(NULL == (json = fopen(jsonfile, "w"))) {
+			perror(jsonfile);
+			return 1;
+		}
+		fprintf(json, "{\n  \"version\": \"%i.%i\",\n  \"timestamp\": %li,\n"
+			"  \"count\": %i,\n  \"duration\": %i,\n  \"scenarios\": [\n",
+			OBDGPSLOGGER_MAJOR_VERSION, OBDGPSLOGGER_MINOR_VERSION, (long)time(NULL),
+			0<set.duration?-1:set.samplecount, set.duration);
+	}
+
+	int failures = 0;
+	int scenarios = 0;
+	struct obdbench_result res;
+
+	if(NULL != scenariofile) {
+		FILE *f = fopen(scenariofile, "r");
+		if(NULL == f) {
+			perror(scenariofile);
+			return 1;
+		}
+		// Each line is "name obdsim-args..."
+		char line[OBDBENCH_MAXLINE];
+		char *words[OBDBENCH_MAXARGS+2];
+		while(NULL != fgets(line, sizeof(line), f)) {
+			if('#' == line[0]) continue;
+			if(0 == split_words(line, words, OBDBENCH_MAXARGS+1)) continue;
+
+			run_scenario(&set, words+1, &res);
+			print_result(words[0], &res);
+			if(!res.ok) failures++;
+			if(NULL != json) {
+				if(scenarios > 0) fprintf(json, ",\n");
+				json_result(json, words[0], words+1, &res);
+			}
+			scenarios++;
+		}
+		fclose(f);
+	}
+
+	if(NULL == scenariofile || optind < argc) {
+		// obdsim gets everything after "--"
+		char **simargs = argv + optind;
+		if(argc - optind > OBDBENCH_MAXARGS) {
+			fprintf(stderr, "Too many obdsim arguments\n");
+			return 1;
+		}
+		const char *n = NULL==name?"default":name;
+		run_scenario(&set, simargs, &res);
+		print_result(n, &res);
+		if(!res.ok) failures++;
+		if(NULL != json) {
+			if(scenarios > 0) fprintf(json, ",\n");
+			json_result(json, n, simargs, &res);
+		}
+		scenarios++;
+	}
+
+	if(NULL != json) {
+		fprintf(json, "\n  ]\n}\n");
+		if(stdout != json) fclose(json);
+	}
+
+	free(scenariofile);
+	free(jsonfile);
+	free(name);
+	free(set.simpath);
+	free(set.loggerpath);
+	return 0==failures?0:1;
+}
+
+void benchprinthelp(const char *argv0) {
+	printf("Usage: %s [params] [-- obdsim params]\n"
+		"   [-c|--count=<number of samples to log>]\n"
+		"   [-t|--duration=<seconds to log for, instead of count>]\n"
+		"   [-f|--scenarios=<file of \"name obdsim-params\" lines>]\n"
+		"   [-n|--name=<name of commandline scenario>]\n"
+		"   [-o|--json=<file to write results to, - for stdout>]\n"
+		"   [-S|--sim=<obdsim executable>]\n"
+		"   [-G|--logger=<obdgpslogger executable>]\n"
+		"   [-k|--keep]\n"
+		"   [-v|--version] [-h|--help]\n", argv0);
+}
+
+void benchprintversion() {
+	printf("Version: %i.%i\n", OBDGPSLOGGER_MAJOR_VERSION, OBDGPSLOGGER_MINOR_VERSION);
+}
+
@@ -0,0 +1,93 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** \file
+ \brief Benchmark obdgpslogger against obdsim
+ */
+#ifndef __OBDBENCH_H
+#define __OBDBENCH_H
+
+#include <getopt.h>
+#include <stdlib.h>
+
+/// Default number of samples to ask the logger for
+#define OBDBENCH_DEFAULTCOUNT 100
+
+/// How long to wait for obdsim to tell us its port [seconds]
+#define OBDBENCH_SIMSTARTTIMEOUT 10
+
+/// getopt() long options
+static const struct option benchlongopts[] = {
+	{ "help", no_argument, NULL, 'h' }, ///< Print the help text
+	{ "version", no_argument, NULL, 'v' }, ///< Print the version text
+	{ "count", required_argument, NULL, 'c' }, ///< Number of samples to log
+	{ "duration", required_argument, NULL, 't' }, ///< Log for this many seconds instead
+	{ "scenarios", required_argument, NULL, 'f' }, ///< Run every scenario in this file
+	{ "name", required_argument, NULL, 'n' }, ///< Name of the scenario on the commandline
+	{ "json", required_argument, NULL, 'o' }, ///< Write results as JSON to this file
+	{ "sim", required_argument, NULL, 'S' }, ///< obdsim executable
+	{ "logger", required_argument, NULL, 'G' }, ///< obdgpslogger executable
+	{ "keep", no_argument, NULL, 'k' }, ///< Keep the working directory
+	{ NULL, 0, NULL, 0 } ///< End
+};
+
+/// getopt() short options
+static const char benchshortopts[] = "hvc:t:f:n:o:S:G:k";
+
+/// Longest line in a scenarios file
+#define OBDBENCH_MAXLINE 4096
+
+/// Most obdsim arguments in a single scenario
+#define OBDBENCH_MAXARGS 64
+
+/// Results of running a single scenario
+struct obdbench_result {
+	int ok; ///< Set if the run completed and results are valid
+	double wall; ///< Time obdgpslogger was running [seconds]
+
+	long samples; ///< Rows in the obd table
+	double samplespan; ///< Time from first to last row [seconds]
+	double samplerate; ///< Samples per second
+
+	long queries; ///< Requests answered during the logging window
+	double queryrate; ///< Queries per second during the logging window
+
+	double lat_mean; ///< Mean request latency [seconds]
+	double lat_p50; ///< Median request latency [seconds]
+	double lat_p99; ///< 99th percentile request latency [seconds]
+	double lat_max; ///< Worst request latency [seconds]
+
+	double logger_user; ///< obdgpslogger user cpu time [seconds]
+	double logger_sys; ///< obdgpslogger system cpu time [seconds]
+	double sim_user; ///< obdsim user cpu time [seconds]
+	double sim_sys; ///< obdsim system cpu time [seconds]
+
+	long dbbytes; ///< Size of the database
+	double dbbytespersample; ///< dbbytes/samples
+};
+
+/// Print Help for --help
+/** \param argv0 your program's argv[0]
+ */
+void benchprinthelp(const char *argv0);
+
+/// Print the version string
+void benchprintversion();
+
+#endif //__OBDBENCH_H
+
@@ -0,0 +1,161 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** \file
+ \brief Microbenchmark PID and column lookups
+
+ Times obdGetCmdForPID and obdGetCmdForColumn against the linear scans
+ they replaced, after checking both give the same answers.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "obdservicecommands.h"
+
+/// Default number of times round each loop
+#define PIDLOOKUPBENCH_DEFAULTLOOPS 200000
+
+/// The linear PID scan obdGetCmdForPID used to do
+static struct obdservicecmd *linear_pid(const unsigned int pid) {
+	int i;
+	int numrows = sizeof(obdcmds_mode1)/sizeof(obdcmds_mode1[0]);
+	for(i=0;i<numrows;i++) {
+		if(pid == obdcmds_mode1[i].cmdid) {
+			return &obdcmds_mode1[i];
+		}
+	}
+	return NULL;
+}
+
+/// The linear column scan obdGetCmdForColumn used to do
+static struct obdservicecmd *linear_column(const char *db_column) {
+	int i;
+	int numrows = sizeof(obdcmds_mode1)/sizeof(obdcmds_mode1[0]);
+	for(i=0;i<numrows;i++) {
+		if(NULL != obdcmds_mode1[i].db_column &&
+				0 == strcmp(db_column, obdcmds_mode1[i].db_column)) {
+			return &obdcmds_mode1[i];
+		}
+	}
+	return NULL;
+}
+
+/// Seconds since some point
+static double now_seconds() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+int main(int argc, char **argv) {
+	long loops = PIDLOOKUPBENCH_DEFAULTLOOPS;
+	if(argc > 1) {
+		loops = atol(argv[1]);
+		if(loops <= 0) {
+			fprintf(stderr, "Usage: %s [loops]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	// Every column name, plus some that aren't
+	const char *columns[0x100];
+	int numcolumns = 0;
+	int i;
+	int numrows = sizeof(obdcmds_mode1)/sizeof(obdcmds_mode1[0]);
+	for(i=0;i<numrows && numcolumns < 0xF0;i++) {
+		if(NULL != obdcmds_mode1[i].db_column) {
+			columns[numcolumns++] = obdcmds_mode1[i].db_column;
+		}
+	}
+	columns[numcolumns++] = "lat";
+	columns[numcolumns++] = "time";
+	columns[numcolumns++] = "";
+	columns[numcolumns++] = "rpmrpm";
+
+	int mismatches = 0;
+	unsigned int pid;
+	for(pid=0;pid<0x200;pid++) {
+		if(linear_pid(pid) != obdGetCmdForPID(pid)) {
+			fprintf(stderr, "PID %02X doesn't match\n", pid);
+			mismatches++;
+		}
+	}
+	for(i=0;i<numcolumns;i++) {
+		if(linear_column(columns[i]) != obdGetCmdForColumn(columns[i])) {
+			fprintf(stderr, "Column \"%s\" doesn't match\n", columns[i]);
+			mismatches++;
+		}
+	}
+	if(mismatches > 0) {
+		return 1;
+	}
+
+	// Something that depends on every result, so nothing is optimised away
+	unsigned long sink = 0;
+	long l;
+	double start, linear, indexed;
+
+	start = now_seconds();
+	for(l=0;l<loops;l++) {
+		for(pid=0;pid<0x60;pid++) {
+			struct obdservicecmd *o = linear_pid(pid);
+			sink += (NULL == o)?0:o->bytes_returned;
+		}
+	}
+	linear = now_seconds() - start;
+
+	start = now_seconds();
+	for(l=0;l<loops;l++) {
+		for(pid=0;pid<0x60;pid++) {
+			struct obdservicecmd *o = obdGetCmdForPID(pid);
+			sink += (NULL == o)?0:o->bytes_returned;
+		}
+	}
+	indexed = now_seconds() - start;
+
+	printf("PID lookup:    linear %6.2f ns, indexed %6.2f ns\n",
+		1e9 * linear / (loops * 0x60), 1e9 * indexed / (loops * 0x60));
+
+	long columnloops = loops / 4 + 1;
+
+	start = now_seconds();
+	for(l=0;l<columnloops;l++) {
+		for(i=0;i<numcolumns;i++) {
+			struct obdservicecmd *o = linear_column(columns[i]);
+			sink += (NULL == o)?0:o->bytes_returned;
+		}
+	}
+	linear = now_seconds() - start;
+
+	start = now_seconds();
+	for(l=0;l<columnloops;l++) {
+		for(i=0;i<numcolumns;i++) {
+			struct obdservicecmd *o = obdGetCmdForColumn(columns[i]);
+			sink += (NULL == o)?0:o->bytes_returned;
+		}
+	}
+	indexed = now_seconds() - start;
+
+	printf("Column lookup: linear %6.2f ns, hashed  %6.2f ns\n",
+		1e9 * linear / (columnloops * numcolumns), 1e9 * indexed / (columnloops * numcolumns));
+
+	return 0 == sink; // Never true; just keeps sink alive
+}
+
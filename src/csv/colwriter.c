@@ -0,0 +1,579 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/** \file
+ \brief Write typed columns in row groups, for reading without parsing
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef OBDPLATFORM_POSIX
+#include <unistd.h>
+#endif //OBDPLATFORM_POSIX
+
+#ifdef OBDPLATFORM_WINDOWS
+#include <io.h>
+#endif //OBDPLATFORM_WINDOWS
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif //O_BINARY
+
+#include "colwriter.h"
+
+/// Version of the footer layout
+#define COLWRITER_VERSION 1
+
+/// Bytes copied at a time by colwriter_append
+#define COLWRITER_COPYSIZE (1024*1024)
+
+/// One value, as whichever type its column holds
+union colwriter_value {
+	double d; //< For COLWRITER_FLOAT64
+	long long i; //< For COLWRITER_INT64
+};
+
+/// A column, and the part of it in the current row group
+struct colwriter_column {
+	char *name; //< The column's name
+	int type; //< COLWRITER_FLOAT64 or COLWRITER_INT64
+	union colwriter_value *vals; //< COLWRITER_GROUPROWS values
+	unsigned char *valid; //< Validity bitmap for vals
+	long nulls; //< Rows in this group without a value
+	long counted; //< Values that went into min and max
+	union colwriter_value min; //< Smallest value in this group
+	union colwriter_value max; //< Largest value in this group
+};
+
+/// Where one column of one row group ended up
+struct colwriter_chunk {
+	unsigned long long validoff; //< File offset of the validity bitmap
+	unsigned long long valsoff; //< File offset of the values
+	unsigned long long nulls; //< Rows without a value
+	union colwriter_value min; //< Smallest value
+	union colwriter_value max; //< Largest value
+};
+
+/// A columnar file being written
+struct colwriter {
+	int fd; //< File descriptor
+	unsigned long long pos; //< Bytes written so far
+	int error; //< Set if any write failed
+
+	struct colwriter_column *cols; //< Every column
+	int colcount; //< Number of columns
+	int col; //< Next column to write in this row
+	int rows; //< Rows in the current group
+
+	unsigned long long *grouprows; //< Rows in each group written
+	struct colwriter_chunk *chunks; //< colcount chunks for each group written
+	long groupcount; //< Number of groups written
+	long groupalloc; //< Groups there's room for in grouprows and chunks
+};
+
+/// A growing buffer to build the footer in
+struct colwriter_buf {
+	unsigned char *data; //< The bytes
+	size_t len; //< Bytes used
+	size_t alloc; //< Bytes allocated
+	int error; //< Set if an allocation failed
+};
+
+/// Find out if this machine is little endian, like the file
+static int colwriter_littleendian() {
+	const unsigned int one = 1;
+	return 1 == *(const unsigned char *)&one;
+}
+
+/// Reverse the bytes in each of count 8 byte values
+static void colwriter_swap(union colwriter_value *v, long count) {
+	long n;
+	for(n=0;n<count;n++) {
+		unsigned char *b = (unsigned char *)&v[n];
+		int i;
+		for(i=0;i<4;i++) {
+			unsigned char t = b[i];
+			b[i] = b[7-i];
+			b[7-i] = t;
+		}
+	}
+}
+
+/// Append bytes to a buffer
+static void colwriter_put(struct colwriter_buf *b, const void *data, size_t len) {
+	if(b->len + len > b->alloc) {
+		size_t alloc = b->alloc?b->alloc*2:4096;
+		while(alloc < b->len + len) alloc *= 2;
+		unsigned char *newdata = (unsigned char *)realloc(b->data, alloc);
+		if(NULL == newdata) {
+			b->error = 1;
+			return;
+		}
+		b->data = newdata;
+		b->alloc = alloc;
+	}
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+}
+
+/// Append a little endian u32 to a buffer
+static void colwriter_put32(struct colwriter_buf *b, unsigned int v) {
+	unsigned char le[4];
+	int i;
+	for(i=0;i<4;i++) le[i] = (v >> (8*i)) & 0xff;
+	colwriter_put(b, le, sizeof(le));
+}
+
+/// Append a little endian u64 to a buffer
+static void colwriter_put64(struct colwriter_buf *b, unsigned long long v) {
+	unsigned char le[8];
+	int i;
+	for(i=0;i<8;i++) le[i] = (v >> (8*i)) & 0xff;
+	colwriter_put(b, le, sizeof(le));
+}
+
+/// Append a value to a buffer, as its bits
+static void colwriter_putvalue(struct colwriter_buf *b, union colwriter_value v) {
+	unsigned long long bits;
+	memcpy(&bits, &v, sizeof(bits));
+	colwriter_put64(b, bits);
+}
+
+/// Read a little endian u32 from a buffer
+/** \return 0 on success, -1 if it runs off the end */
+static int colwriter_get32(const unsigned char *data, size_t len, size_t *pos, unsigned int *v) {
+	if(*pos + 4 > len) return -1;
+	int i;
+	*v = 0;
+	for(i=0;i<4;i++) *v |= (unsigned int)data[*pos + i] << (8*i);
+	*pos += 4;
+	return 0;
+}
+
+/// Read a little endian u64 from a buffer
+/** \return 0 on success, -1 if it runs off the end */
+static int colwriter_get64(const unsigned char *data, size_t len, size_t *pos, unsigned long long *v) {
+	if(*pos + 8 > len) return -1;
+	int i;
+	*v = 0;
+	for(i=0;i<8;i++) *v |= (unsigned long long)data[*pos + i] << (8*i);
+	*pos += 8;
+	return 0;
+}
+
+/// Read a value from a buffer, as its bits
+static int colwriter_getvalue(const unsigned char *data, size_t len, size_t *pos, union colwriter_value *v) {
+	unsigned long long bits;
+	if(0 != colwriter_get64(data, len, pos, &bits)) return -1;
+	memcpy(v, &bits, sizeof(bits));
+	return 0;
+}
+
+/// Write bytes to the file
+static void colwriter_write(struct colwriter *w, const void *data, size_t len) {
+	size_t done = 0;
+	while(done < len && !w->error) {
+		ssize_t n = write(w->fd, (const char *)data + done, len - done);
+		if(n < 0) {
+			if(EINTR == errno) continue;
+			w->error = 1;
+			break;
+		}
+		done += n;
+	}
+	w->pos += len;
+}
+
+/// Make room in the directory for one more group
+/** \return a place for its colcount chunks, or NULL if out of memory */
+static struct colwriter_chunk *colwriter_addgroup(struct colwriter *w, unsigned long long rows) {
+	if(w->groupcount >= w->groupalloc) {
+		long alloc = w->groupalloc?w->groupalloc*2:64;
+		unsigned long long *grouprows = (unsigned long long *)realloc(w->grouprows,
+			alloc * sizeof(*grouprows));
+		if(NULL == grouprows) return NULL;
+		w->grouprows = grouprows;
+		struct colwriter_chunk *chunks = (struct colwriter_chunk *)realloc(w->chunks,
+			alloc * w->colcount * sizeof(*chunks));
+		if(NULL == chunks) return NULL;
+		w->chunks = chunks;
+		w->groupalloc = alloc;
+	}
+	w->grouprows[w->groupcount] = rows;
+	return &w->chunks[w->groupcount++ * w->colcount];
+}
+
+/// Write out the current row group
+static void colwriter_flush(struct colwriter *w) {
+	if(0 == w->rows) return;
+
+	struct colwriter_chunk *chunks = colwriter_addgroup(w, w->rows);
+	if(NULL == chunks) {
+		w->error = 1;
+		return;
+	}
+
+	const size_t validbytes = (w->rows + 63) / 64 * 8;
+	int i;
+	for(i=0;i<w->colcount;i++) {
+		struct colwriter_column *c = &w->cols[i];
+		struct colwriter_chunk *chunk = &chunks[i];
+
+		chunk->validoff = w->pos;
+		colwriter_write(w, c->valid, validbytes);
+
+		if(!colwriter_littleendian()) colwriter_swap(c->vals, w->rows);
+		chunk->valsoff = w->pos;
+		colwriter_write(w, c->vals, w->rows * sizeof(*c->vals));
+
+		chunk->nulls = c->nulls;
+		if(c->counted > 0) {
+			chunk->min = c->min;
+			chunk->max = c->max;
+		} else if(COLWRITER_FLOAT64 == c->type) {
+			chunk->min.d = chunk->max.d = NAN;
+		} else {
+			chunk->min.i = chunk->max.i = 0;
+		}
+
+		memset(c->valid, 0, COLWRITER_GROUPROWS/8);
+		c->nulls = 0;
+		c->counted = 0;
+	}
+	w->rows = 0;
+}
+
+/// Write the footer and the end of the file
+static void colwriter_footer(struct colwriter *w) {
+	struct colwriter_buf b;
+	memset(&b, 0, sizeof(b));
+
+	const unsigned long long footeroffset = w->pos;
+	colwriter_put32(&b, COLWRITER_VERSION);
+	colwriter_put32(&b, w->colcount);
+
+	int i;
+	for(i=0;i<w->colcount;i++) {
+		const unsigned int namelen = strlen(w->cols[i].name);
+		const char zeroes[8] = { 0 };
+		colwriter_put32(&b, w->cols[i].type);
+		colwriter_put32(&b, namelen);
+		colwriter_put(&b, w->cols[i].name, namelen);
+		colwriter_put(&b, zeroes, (8 - namelen%8) % 8);
+	}
+
+	colwriter_put64(&b, w->groupcount);
+	long g;
+	for(g=0;g<w->groupcount;g++) {
+		colwriter_put64(&b, w->grouprows[g]);
+		for(i=0;i<w->colcount;i++) {
+			const struct colwriter_chunk *chunk = &w->chunks[g * w->colcount + i];
+			colwriter_put64(&b, chunk->validoff);
+			colwriter_put64(&b, chunk->valsoff);
+			colwriter_put64(&b, chunk->nulls);
+			colwriter_putvalue(&b, chunk->min);
+			colwriter_putvalue(&b, chunk->max);
+		}
+	}
+
+	colwriter_put64(&b, footeroffset);
+	colwriter_put(&b, COLWRITER_MAGIC, sizeof(COLWRITER_MAGIC));
+
+	if(b.error) {
+		w->error = 1;
+	} else {
+		colwriter_write(w, b.data, b.len);
+	}
+	free(b.data);
+}
+
+/// Free a writer and everything in it
+static void colwriter_free(struct colwriter *w) {
+	int i;
+	if(NULL != w->cols) {
+		for(i=0;i<w->colcount;i++) {
+			free(w->cols[i].name);
+			free(w->cols[i].vals);
+			free(w->cols[i].valid);
+		}
+		free(w->cols);
+	}
+	free(w->grouprows);
+	free(w->chunks);
+	free(w);
+}
+
+struct colwriter *colwriter_open(const char *filename, int colcount,
+		const char **names, const int *types) {
+	struct colwriter *w = (struct colwriter *)calloc(1, sizeof(struct colwriter));
+	if(NULL == w) return NULL;
+	w->fd = -1;
+
+	w->colcount = colcount;
+	if(NULL == (w->cols = (struct colwriter_column *)calloc(colcount, sizeof(*w->cols)))) {
+		colwriter_free(w);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	int i;
+	for(i=0;i<colcount;i++) {
+		struct colwriter_column *c = &w->cols[i];
+		c->type = types[i];
+		c->name = strdup(names[i]);
+		c->vals = (union colwriter_value *)malloc(COLWRITER_GROUPROWS * sizeof(*c->vals));
+		c->valid = (unsigned char *)calloc(COLWRITER_GROUPROWS/8, 1);
+		if(NULL == c->name || NULL == c->vals || NULL == c->valid) {
+			colwriter_free(w);
+			errno = ENOMEM;
+			return NULL;
+		}
+	}
+
+	if(0 > (w->fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC|O_BINARY, 0666))) {
+		int e = errno;
+		colwriter_free(w);
+		errno = e;
+		return NULL;
+	}
+
+	colwriter_write(w, COLWRITER_MAGIC, sizeof(COLWRITER_MAGIC));
+	return w;
+}
+
+int colwriter_close(struct colwriter *w) {
+	if(0 != w->col) colwriter_endrow(w);
+	colwriter_flush(w);
+	colwriter_footer(w);
+
+	int ret = w->error?-1:0;
+	if(0 != close(w->fd)) ret = -1;
+	colwriter_free(w);
+	return ret;
+}
+
+/// The next column in this row, or NULL if the row's full
+static inline struct colwriter_column *colwriter_next(struct colwriter *w) {
+	if(w->col >= w->colcount) return NULL;
+	return &w->cols[w->col++];
+}
+
+/// Mark the current row as having a value in column c
+static inline void colwriter_setvalid(struct colwriter *w, struct colwriter_column *c) {
+	c->valid[w->rows/8] |= 1 << (w->rows%8);
+}
+
+void colwriter_double(struct colwriter *w, double v) {
+	struct colwriter_column *c = colwriter_next(w);
+	if(NULL == c) return;
+
+	if(COLWRITER_INT64 == c->type) {
+		w->col--;
+		colwriter_int(w, (long long)v);
+		return;
+	}
+
+	c->vals[w->rows].d = v;
+	colwriter_setvalid(w, c);
+	if(isnan(v)) return;
+	if(0 == c->counted++) {
+		c->min.d = c->max.d = v;
+	} else {
+		if(v < c->min.d) c->min.d = v;
+		if(v > c->max.d) c->max.d = v;
+	}
+}
+
+void colwriter_int(struct colwriter *w, long long v) {
+	struct colwriter_column *c = colwriter_next(w);
+	if(NULL == c) return;
+
+	if(COLWRITER_FLOAT64 == c->type) {
+		w->col--;
+		colwriter_double(w, (double)v);
+		return;
+	}
+
+	c->vals[w->rows].i = v;
+	colwriter_setvalid(w, c);
+	if(0 == c->counted++) {
+		c->min.i = c->max.i = v;
+	} else {
+		if(v < c->min.i) c->min.i = v;
+		if(v > c->max.i) c->max.i = v;
+	}
+}
+
+void colwriter_null(struct colwriter *w) {
+	struct colwriter_column *c = colwriter_next(w);
+	if(NULL == c) return;
+
+	c->vals[w->rows].i = 0;
+	c->nulls++;
+}
+
+void colwriter_endrow(struct colwriter *w) {
+	while(w->col < w->colcount) {
+		colwriter_null(w);
+	}
+	w->col = 0;
+	if(++w->rows >= COLWRITER_GROUPROWS) {
+		colwriter_flush(w);
+	}
+}
+
+/// Read exactly len bytes from offset in a file
+/** \return 0 on success, -1 otherwise */
+static int colwriter_readat(int fd, unsigned long long offset, void *data, size_t len) {
+	if((off_t)offset != lseek(fd, offset, SEEK_SET)) return -1;
+	size_t done = 0;
+	while(done < len) {
+		ssize_t n = read(fd, (char *)data + done, len - done);
+		if(n < 0 && EINTR == errno) continue;
+		if(n <= 0) return -1;
+		done += n;
+	}
+	return 0;
+}
+
+/// Check a file's footer matches this writer, and add its row groups to the directory
+/** \param shift added to every offset in the footer
+    \return 0 on success, -1 if it doesn't match or can't be read */
+static int colwriter_readfooter(struct colwriter *w, const unsigned char *data, size_t len,
+		unsigned long long shift) {
+	size_t pos = 0;
+	unsigned int version, colcount;
+	if(0 != colwriter_get32(data, len, &pos, &version) || COLWRITER_VERSION != version) return -1;
+	if(0 != colwriter_get32(data, len, &pos, &colcount) || (int)colcount != w->colcount) return -1;
+
+	int i;
+	for(i=0;i<w->colcount;i++) {
+		unsigned int type, namelen;
+		if(0 != colwriter_get32(data, len, &pos, &type) || (int)type != w->cols[i].type) return -1;
+		if(0 != colwriter_get32(data, len, &pos, &namelen)) return -1;
+		if(pos + namelen > len || strlen(w->cols[i].name) != namelen ||
+			0 != memcmp(data + pos, w->cols[i].name, namelen)) return -1;
+		pos += namelen + (8 - namelen%8) % 8;
+	}
+
+	unsigned long long groupcount, g;
+	if(0 != colwriter_get64(data, len, &pos, &groupcount)) return -1;
+	for(g=0;g<groupcount;g++) {
+		unsigned long long rows;
+		if(0 != colwriter_get64(data, len, &pos, &rows)) return -1;
+
+		struct colwriter_chunk *chunks = colwriter_addgroup(w, rows);
+		if(NULL == chunks) return -1;
+		for(i=0;i<w->colcount;i++) {
+			struct colwriter_chunk *chunk = &chunks[i];
+			if(0 != colwriter_get64(data, len, &pos, &chunk->validoff) ||
+				0 != colwriter_get64(data, len, &pos, &chunk->valsoff) ||
+				0 != colwriter_get64(data, len, &pos, &chunk->nulls) ||
+				0 != colwriter_getvalue(data, len, &pos, &chunk->min) ||
+				0 != colwriter_getvalue(data, len, &pos, &chunk->max)) {
+				w->groupcount--;
+				return -1;
+			}
+			chunk->validoff += shift;
+			chunk->valsoff += shift;
+		}
+	}
+	return 0;
+}
+
+/// Copy len bytes from offset in a file onto the end of this one
+static void colwriter_copy(struct colwriter *w, int fd, unsigned long long offset,
+		unsigned long long len) {
+	char *buf = (char *)malloc(COLWRITER_COPYSIZE);
+	if(NULL == buf || (off_t)offset != lseek(fd, offset, SEEK_SET)) {
+		w->error = 1;
+	}
+	while(len > 0 && !w->error) {
+		ssize_t n = read(fd, buf, len<COLWRITER_COPYSIZE?len:COLWRITER_COPYSIZE);
+		if(n < 0 && EINTR == errno) continue;
+		if(n <= 0) {
+			w->error = 1;
+			break;
+		}
+		colwriter_write(w, buf, n);
+		len -= n;
+	}
+	free(buf);
+}
+
+/// colwriter_append, on an open file
+static int colwriter_appendfd(struct colwriter *w, int fd) {
+	const size_t magiclen = sizeof(COLWRITER_MAGIC);
+	const size_t trailerlen = 8 + magiclen;
+
+	struct stat st;
+	if(0 != fstat(fd, &st) || (unsigned long long)st.st_size < magiclen + trailerlen) return -1;
+
+	unsigned char magic[sizeof(COLWRITER_MAGIC)];
+	if(0 != colwriter_readat(fd, 0, magic, magiclen) ||
+		0 != memcmp(magic, COLWRITER_MAGIC, magiclen)) return -1;
+
+	unsigned char trailer[8 + sizeof(COLWRITER_MAGIC)];
+	if(0 != colwriter_readat(fd, st.st_size - trailerlen, trailer, trailerlen) ||
+		0 != memcmp(trailer + 8, COLWRITER_MAGIC, magiclen)) return -1;
+
+	unsigned long long footeroffset;
+	size_t pos = 0;
+	colwriter_get64(trailer, trailerlen, &pos, &footeroffset);
+	if(footeroffset < magiclen || footeroffset > st.st_size - trailerlen) return -1;
+
+	const size_t footerlen = st.st_size - trailerlen - footeroffset;
+	unsigned char *footer = (unsigned char *)malloc(footerlen + 1);
+	if(NULL == footer) return -1;
+	if(0 != colwriter_readat(fd, footeroffset, footer, footerlen)) {
+		free(footer);
+		return -1;
+	}
+
+	// Everything in this file goes after whatever's waiting to be written
+	colwriter_flush(w);
+
+	const long groupcount = w->groupcount;
+	int ret = colwriter_readfooter(w, footer, footerlen, w->pos - magiclen);
+	free(footer);
+	if(0 != ret) {
+		w->groupcount = groupcount;
+		return -1;
+	}
+
+	// Row groups are everything between the magic and the footer
+	colwriter_copy(w, fd, magiclen, footeroffset - magiclen);
+	return w->error?-1:0;
+}
+
+int colwriter_append(struct colwriter *w, const char *filename) {
+	int fd = open(filename, O_RDONLY|O_BINARY);
+	if(fd < 0) return -1;
+
+	int ret = colwriter_appendfd(w, fd);
+	close(fd);
+	return ret;
+}
+
@@ -0,0 +1,96 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/** \file
+ \brief Write typed columns in row groups, for reading without parsing
+
+ Everything is little endian, and every column's values start on an
+ 8 byte boundary so a reader can mmap the file and use them in place.
+
+ \verbatim
+ magic        8 bytes  "OBDCOL1\0"
+ row groups, one after another. For each column in each group:
+   validity   (rows+63)/64*8 bytes. Bit i%8 of byte i/8 is set if
+               row i has a value. Rows without one hold 0
+   values     rows*8 bytes. float64 or int64, by the column's type
+ footer
+   u32 version [1], u32 number of columns
+   for each column: u32 type [1 float64, 2 int64], u32 name length,
+     the name, zero padded to a multiple of 8 bytes
+   u64 number of row groups
+   for each row group: u64 rows, then for each column:
+     u64 validity offset, u64 values offset, u64 null count,
+     min, max [of the column's type, not counting nulls or NaN.
+     NaN for a float64 column with no values; 0 for int64]
+ u64 offset of the footer
+ magic        8 bytes  "OBDCOL1\0"
+ \endverbatim
+ */
+#ifndef __COLWRITER_H
+#define __COLWRITER_H
+
+/// Start and end of every columnar file
+#define COLWRITER_MAGIC "OBDCOL1"
+
+/// Rows in each row group
+#define COLWRITER_GROUPROWS 8192
+
+/// Column holds doubles
+#define COLWRITER_FLOAT64 1
+
+/// Column holds 64 bit integers
+#define COLWRITER_INT64 2
+
+struct colwriter;
+
+/// Open a file for writing columns to
+/** \param filename the file to create or truncate
+    \param colcount number of columns
+    \param names each column's name
+    \param types each column's type, COLWRITER_FLOAT64 or COLWRITER_INT64
+    \return the writer, or NULL on error with errno set
+*/
+struct colwriter *colwriter_open(const char *filename, int colcount,
+	const char **names, const int *types);
+
+/// Write the last row group and the footer, close the file, and free the writer
+/** \return 0 if every write succeeded, -1 otherwise */
+int colwriter_close(struct colwriter *w);
+
+/// Write a number to the next column in this row
+/** Truncated if the column holds integers */
+void colwriter_double(struct colwriter *w, double v);
+
+/// Write an integer to the next column in this row
+void colwriter_int(struct colwriter *w, long long v);
+
+/// Leave the next column in this row without a value
+void colwriter_null(struct colwriter *w);
+
+/// End the current row. Columns not written are null
+void colwriter_endrow(struct colwriter *w);
+
+/// Copy every row group from another columnar file onto the end of this one
+/** \param filename a complete file with the same columns
+    \return 0 on success, -1 on error
+*/
+int colwriter_append(struct colwriter *w, const char *filename);
+
+#endif //__COLWRITER_H
+
@@ -0,0 +1,464 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/** \file
+ \brief Export the join to CSV or columns, split across several threads if asked
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef OBDPLATFORM_POSIX
+#include <pthread.h>
+#include <unistd.h>
+#endif //OBDPLATFORM_POSIX
+
+#ifdef OBDPLATFORM_WINDOWS
+#include <io.h>
+#endif //OBDPLATFORM_WINDOWS
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif //O_BINARY
+
+#include "csvexport.h"
+#include "csvwriter.h"
+#include "colwriter.h"
+#include "obdjoin.h"
+
+#include "sqlite3.h"
+
+/// One time range of an export
+struct csvexport_part {
+	const struct csvexport *ex; //< The export this is part of
+	char filename[4096]; //< Where this part goes
+	double from; //< Rows after this time, if > 0
+	double until; //< Rows before this time, if > 0
+	int header; //< Set if this part starts with the header row
+	int ret; //< 0 once written successfully
+	struct colwriter *col; //< Set if this part's columnar writer is left open
+#ifdef OBDPLATFORM_POSIX
+	pthread_t thread; //< The thread writing it
+	int started; //< Set if thread was started
+#endif //OBDPLATFORM_POSIX
+};
+
+/// Rows written so far, by all parts
+static long csvexport_rows = 0;
+
+/// Rows there are to write, for progress
+static double csvexport_expected = 0;
+
+#ifdef OBDPLATFORM_POSIX
+/// Parts count their rows from their own threads
+static pthread_mutex_t csvexport_lock = PTHREAD_MUTEX_INITIALIZER;
+#define CSVEXPORT_LOCK() pthread_mutex_lock(&csvexport_lock)
+#define CSVEXPORT_UNLOCK() pthread_mutex_unlock(&csvexport_lock)
+#else
+#define CSVEXPORT_LOCK()
+#define CSVEXPORT_UNLOCK()
+#endif //OBDPLATFORM_POSIX
+
+/// Count some more rows as written, and print where we're up to
+static void csvexport_progress(const struct csvexport *ex, long rows) {
+	CSVEXPORT_LOCK();
+	csvexport_rows += rows;
+	printf("%f\n", 100.0f * csvexport_rows/csvexport_expected);
+	fflush(stdout);
+	CSVEXPORT_UNLOCK();
+}
+
+/// Whichever writer a part is using
+struct csvexport_out {
+	struct csvwriter *csv; //< CSV, or NULL
+	struct colwriter *col; //< Columns, or NULL
+};
+
+/// Write a number to the next cell
+static inline void csvexport_double(struct csvexport_out *o, double v) {
+	if(NULL != o->col) colwriter_double(o->col, v);
+	else csvwriter_double(o->csv, v);
+}
+
+/// Write an integer to the next cell
+static inline void csvexport_int(struct csvexport_out *o, long long v) {
+	if(NULL != o->col) colwriter_int(o->col, v);
+	else csvwriter_int(o->csv, v);
+}
+
+/// Leave the next cell empty
+static inline void csvexport_null(struct csvexport_out *o) {
+	if(NULL != o->col) colwriter_null(o->col);
+	else csvwriter_null(o->csv);
+}
+
+/// End the current row
+static inline void csvexport_endrow(struct csvexport_out *o) {
+	if(NULL != o->col) colwriter_endrow(o->col);
+	else csvwriter_endrow(o->csv);
+}
+
+/// Open a columnar file, typing obd columns by what the table declares them as
+static struct colwriter *csvexport_opencolumns(const struct csvexport *ex,
+		const char *filename, sqlite3_stmt *rows) {
+	int *types = (int *)malloc(ex->col_count * sizeof(int));
+	if(NULL == types) return NULL;
+
+	int i;
+	for(i=0;i<ex->col_count;i++) {
+		types[i] = COLWRITER_FLOAT64;
+	}
+	for(i=0;i<ex->obd_col_count;i++) {
+		const char *declared = sqlite3_column_decltype(rows, i);
+		if(NULL != declared && NULL != strstr(declared, "INT")) {
+			types[i] = COLWRITER_INT64;
+		}
+	}
+	// The join adds gps lon,lat,alt and then trip
+	types[ex->col_count-1] = COLWRITER_INT64;
+
+	struct colwriter *w = colwriter_open(filename, ex->col_count, ex->columnnames, types);
+	free(types);
+	return w;
+}
+
+/// Write one part, on its own database connection
+/** \param keepopen leave a columnar writer open in p->col, for more to be appended */
+static int csvexport_write(struct csvexport_part *p, int keepopen) {
+	const struct csvexport *ex = p->ex;
+	sqlite3 *db;
+	int i;
+
+	if(SQLITE_OK != sqlite3_open_v2(ex->databasename, &db, SQLITE_OPEN_READONLY, NULL)) {
+		fprintf(stderr, "Can't open database %s: %s\n", ex->databasename, sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return 1;
+	}
+
+	struct obdjoin *join = obdjoin_openwhere(db, ex->select_cols, "lon,lat,alt",
+		p->from, p->until, 0, ex->tolerance, ex->filter, ex->params, ex->paramcount);
+	if(NULL == join) {
+		sqlite3_close(db);
+		return 1;
+	}
+
+	struct csvexport_out out;
+	out.csv = NULL;
+	out.col = NULL;
+	if(CSVEXPORT_COLUMNS == ex->format) {
+		out.col = csvexport_opencolumns(ex, p->filename, join->rows);
+	} else {
+		out.csv = csvwriter_open(p->filename, ex->compress);
+	}
+	if(NULL == out.csv && NULL == out.col) {
+		perror(p->filename);
+		obdjoin_close(join);
+		sqlite3_close(db);
+		return 1;
+	}
+
+	if(p->header && NULL != out.csv) {
+		for(i=0;i<ex->col_count;i++) {
+			csvwriter_text(out.csv, ex->columnnames[i]);
+		}
+		csvwriter_endrow(out.csv);
+	}
+
+	long current_row = 0;
+	while(obdjoin_step(join)) {
+		for(i=0;i<ex->obd_col_count;i++) {
+			switch(sqlite3_column_type(join->rows, i)) {
+				case SQLITE_NULL:
+					csvexport_null(&out);
+					break;
+				case SQLITE_INTEGER:
+					csvexport_int(&out, sqlite3_column_int64(join->rows, i));
+					break;
+				default:
+					csvexport_double(&out, sqlite3_column_double(join->rows, i));
+					break;
+			}
+		}
+		for(i=0;i<3;i++) {
+			if(NULL == join->gps || join->gps->isnull[i]) {
+				csvexport_null(&out);
+			} else {
+				csvexport_double(&out, join->gps->vals[i]);
+			}
+		}
+		if(NULL == join->trip) {
+			csvexport_null(&out);
+		} else {
+			csvexport_int(&out, join->trip->tripid);
+		}
+		csvexport_endrow(&out);
+
+		if(ex->show_progress) {
+			current_row++;
+			if(0 == current_row%50) {
+				csvexport_progress(ex, 50);
+			}
+		}
+	}
+	obdjoin_close(join);
+	sqlite3_close(db);
+
+	if(NULL != out.col && keepopen) {
+		p->col = out.col;
+		return 0;
+	}
+	if(0 != (NULL != out.col?colwriter_close(out.col):csvwriter_close(out.csv))) {
+		fprintf(stderr, "Error writing %s\n", p->filename);
+		return 1;
+	}
+	return 0;
+}
+
+#ifdef OBDPLATFORM_POSIX
+/// Thread entry point for a part
+static void *csvexport_thread(void *arg) {
+	struct csvexport_part *p = (struct csvexport_part *)arg;
+	p->ret = csvexport_write(p, p->header);
+	return NULL;
+}
+#endif //OBDPLATFORM_POSIX
+
+/// Get one double from "SELECT what FROM obd WHERE time>a AND time<b [AND filter] rest"
+/** \return 1 if there was a non-NULL value, 0 otherwise */
+static int csvexport_getdouble(const struct csvexport *ex, sqlite3 *db,
+		const char *what, const char *rest, double a, double b, double *ret) {
+	char *sql;
+	if(NULL != ex->filter && '\0' != *ex->filter) {
+		sql = sqlite3_mprintf("SELECT %s FROM obd WHERE time>?1 AND time<?2 AND (%s) %s",
+			what, ex->filter, rest);
+	} else {
+		sql = sqlite3_mprintf("SELECT %s FROM obd WHERE time>?1 AND time<?2 %s", what, rest);
+	}
+	if(NULL == sql) return 0;
+
+	sqlite3_stmt *stmt;
+	if(SQLITE_OK != sqlite3_prepare_v2(db, sql, -1, &stmt, NULL)) {
+		fprintf(stderr, "Error preparing %s: %s\n", sql, sqlite3_errmsg(db));
+		sqlite3_free(sql);
+		return 0;
+	}
+	sqlite3_free(sql);
+
+	sqlite3_bind_double(stmt, 1, a);
+	sqlite3_bind_double(stmt, 2, b);
+	int i;
+	for(i=0;NULL != ex->filter && i<ex->paramcount;i++) {
+		sqlite3_bind_double(stmt, 3 + i, ex->params[i]);
+	}
+
+	int found = 0;
+	if(SQLITE_ROW == sqlite3_step(stmt) && SQLITE_NULL != sqlite3_column_type(stmt, 0)) {
+		*ret = sqlite3_column_double(stmt, 0);
+		found = 1;
+	}
+	sqlite3_finalize(stmt);
+	return found;
+}
+
+/// Count the rows the export will write
+static double csvexport_count(const struct csvexport *ex) {
+	sqlite3 *db;
+	double count = 0;
+	if(SQLITE_OK == sqlite3_open_v2(ex->databasename, &db, SQLITE_OPEN_READONLY, NULL)) {
+		csvexport_getdouble(ex, db, "count(*)", "",
+			ex->starttime>0?ex->starttime:-1e300, ex->endtime>0?ex->endtime:1e300, &count);
+	}
+	sqlite3_close(db);
+	return count;
+}
+
+/// Split the export's time range into about jobs ranges of equal rows
+/** Every boundary is halfway between two rows' times, so no row is on
+     one and the strict comparisons obdjoin makes never lose a row.
+    \param bounds filled with the start of each range, and the end of the last
+    \return number of ranges, between 1 and jobs
+*/
+static int csvexport_split(const struct csvexport *ex, int jobs, double *bounds) {
+	int parts = 1;
+	bounds[0] = ex->starttime;
+
+	sqlite3 *db;
+	if(SQLITE_OK != sqlite3_open_v2(ex->databasename, &db, SQLITE_OPEN_READONLY, NULL)) {
+		sqlite3_close(db);
+		bounds[1] = ex->endtime;
+		return 1;
+	}
+
+	// Unbounded ends, as the join treats them
+	const double lo = ex->starttime>0?ex->starttime:-1e300;
+	const double hi = ex->endtime>0?ex->endtime:1e300;
+
+	double count = 0;
+	csvexport_getdouble(ex, db, "count(*)", "", lo, hi, &count);
+
+	int k;
+	for(k=1;k<jobs;k++) {
+		char rest[64];
+		snprintf(rest, sizeof(rest), "ORDER BY time LIMIT 1 OFFSET %li", (long)(k * count / jobs));
+
+		double after, before;
+		if(!csvexport_getdouble(ex, db, "time", rest, lo, hi, &after)) break;
+		if(!csvexport_getdouble(ex, db, "max(time)", "", lo, after, &before)) continue;
+
+		double b = before + (after - before) / 2;
+		if(b <= before || b >= after || b <= 0) continue; // No room between them
+		if(parts > 1 && b <= bounds[parts-1]) continue; // Lots of rows at one time
+
+		bounds[parts++] = b;
+	}
+	bounds[parts] = ex->endtime;
+
+	sqlite3_close(db);
+	return parts;
+}
+
+/// Append one file to another, then delete it
+static int csvexport_append(const char *dst, const char *src) {
+	int in = open(src, O_RDONLY|O_BINARY);
+	if(in < 0) {
+		perror(src);
+		return 1;
+	}
+	int out = open(dst, O_WRONLY|O_APPEND|O_BINARY);
+	if(out < 0) {
+		perror(dst);
+		close(in);
+		return 1;
+	}
+
+	char *buf = (char *)malloc(CSVWRITER_BUFSIZE);
+	int ret = (NULL == buf);
+	while(0 == ret) {
+		ssize_t n = read(in, buf, CSVWRITER_BUFSIZE);
+		if(n < 0 && EINTR == errno) continue;
+		if(n <= 0) {
+			ret = (n < 0);
+			break;
+		}
+		ssize_t done = 0;
+		while(done < n) {
+			ssize_t w = write(out, buf + done, n - done);
+			if(w < 0) {
+				if(EINTR == errno) continue;
+				ret = 1;
+				break;
+			}
+			done += w;
+		}
+	}
+	if(0 != ret) perror(dst);
+
+	free(buf);
+	close(in);
+	if(0 != close(out)) ret = 1;
+	unlink(src);
+	return ret;
+}
+
+int csvexport_run(const struct csvexport *ex, const char *outfilename, int jobs) {
+#ifndef OBDPLATFORM_POSIX
+	// No threads to run the parts on
+	jobs = 1;
+#endif //OBDPLATFORM_POSIX
+	if(jobs < 1) jobs = 1;
+	if(jobs > CSVEXPORT_MAXJOBS) jobs = CSVEXPORT_MAXJOBS;
+
+	csvexport_rows = 0;
+	if(ex->show_progress) {
+		csvexport_expected = csvexport_count(ex);
+	}
+
+	double bounds[CSVEXPORT_MAXJOBS+1];
+	int parts = 1;
+	if(jobs > 1) {
+		parts = csvexport_split(ex, jobs, bounds);
+	} else {
+		bounds[0] = ex->starttime;
+		bounds[1] = ex->endtime;
+	}
+
+	struct csvexport_part part[CSVEXPORT_MAXJOBS];
+	int i;
+	for(i=0;i<parts;i++) {
+		struct csvexport_part *p = &part[i];
+		memset(p, 0, sizeof(*p));
+		p->ex = ex;
+		p->from = bounds[i];
+		p->until = bounds[i+1];
+		p->header = (0 == i);
+		p->ret = 1;
+		// The first part goes straight to the output; the rest are appended to it
+		if(0 == i) {
+			snprintf(p->filename, sizeof(p->filename), "%s", outfilename);
+		} else {
+			snprintf(p->filename, sizeof(p->filename), "%s.part%i", outfilename, i);
+		}
+	}
+
+	if(1 == parts) {
+		return csvexport_write(&part[0], 0);
+	}
+
+#ifdef OBDPLATFORM_POSIX
+	for(i=0;i<parts;i++) {
+		if(0 == pthread_create(&part[i].thread, NULL, csvexport_thread, &part[i])) {
+			part[i].started = 1;
+		} else {
+			perror("Couldn't create export thread");
+			part[i].ret = csvexport_write(&part[i], part[i].header);
+		}
+	}
+	for(i=0;i<parts;i++) {
+		if(part[i].started) pthread_join(part[i].thread, NULL);
+	}
+#endif //OBDPLATFORM_POSIX
+
+	int ret = 0;
+	for(i=0;i<parts;i++) {
+		if(0 != part[i].ret) ret = 1;
+	}
+	for(i=1;i<parts;i++) {
+		if(0 != ret) {
+			unlink(part[i].filename);
+		} else if(NULL != part[0].col) {
+			if(0 != colwriter_append(part[0].col, part[i].filename)) {
+				fprintf(stderr, "Error appending %s to %s\n", part[i].filename, outfilename);
+				ret = 1;
+			}
+			unlink(part[i].filename);
+		} else {
+			ret = csvexport_append(outfilename, part[i].filename);
+		}
+	}
+	if(NULL != part[0].col && 0 != colwriter_close(part[0].col)) {
+		fprintf(stderr, "Error writing %s\n", outfilename);
+		ret = 1;
+	}
+	return ret;
+}
+
@@ -0,0 +1,68 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/** \file
+ \brief Export the join to CSV or columns, split across several threads if asked
+ */
+#ifndef __CSVEXPORT_H
+#define __CSVEXPORT_H
+
+/// Most partitions an export can be split into
+#define CSVEXPORT_MAXJOBS 64
+
+/// Write CSV
+#define CSVEXPORT_CSV 0
+
+/// Write typed columns, laid out as in colwriter.h
+#define CSVEXPORT_COLUMNS 1
+
+/// Everything that's the same for every partition of an export
+struct csvexport {
+	const char *databasename; //< Database to read. Each partition opens its own connection
+	const char *select_cols; //< Columns from the obd table, comma separated
+	int obd_col_count; //< Number of columns in select_cols
+	const char **columnnames; //< Every column's name, for the header row
+	int col_count; //< Number of columnnames. The join adds gps lon,lat,alt and trip
+	double starttime; //< Only rows after this time, if > 0
+	double endtime; //< Only rows before this time, if > 0
+	double tolerance; //< Most seconds between a row and its gps fix
+	const char *filter; //< Condition on the obd table, with a ? for each of params, or NULL
+	const double *params; //< Values for filter's ?s
+	int paramcount; //< Number of params
+	int format; //< CSVEXPORT_CSV or CSVEXPORT_COLUMNS
+	int compress; //< Write gzip. CSV only
+	int show_progress; //< Print parsable progress
+};
+
+/// Export everything to a file
+/** With more than one job, the rows are split into that many time
+     ranges of about the same number of rows, each written by its own
+     thread to its own file, then appended in order. Compressed
+     output is then several gzip members one after another, which is
+     still a valid gzip file. Columnar parts have their row groups
+     copied onto the first part's, under one footer.
+    \param ex what to export
+    \param outfilename the file to write
+    \param jobs number of partitions to split the export into
+    \return 0 on success, nonzero on failure
+*/
+int csvexport_run(const struct csvexport *ex, const char *outfilename, int jobs);
+
+#endif //__CSVEXPORT_H
+
@@ -0,0 +1,283 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/** \file
+ \brief Write CSV a row at a time, through one large buffer
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <float.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef OBDPLATFORM_POSIX
+#include <unistd.h>
+#endif //OBDPLATFORM_POSIX
+
+#ifdef OBDPLATFORM_WINDOWS
+#include <io.h>
+#endif //OBDPLATFORM_WINDOWS
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif //O_BINARY
+
+#ifdef HAVE_ZLIB
+#include "zlib.h"
+#endif //HAVE_ZLIB
+
+#include "csvwriter.h"
+
+/// Most digits after the point tried before falling back to printf
+#define CSVWRITER_MAXDECIMALS 9
+
+/// A CSV file being written
+struct csvwriter {
+	int fd; //< File descriptor, if not compressing
+#ifdef HAVE_ZLIB
+	gzFile gz; //< gzip handle, if compressing
+#endif //HAVE_ZLIB
+	char *buf; //< Output waiting to be written
+	size_t len; //< Bytes in buf
+	int error; //< Set if any write failed
+};
+
+/// Powers of ten that are exact in a double
+static const double csvwriter_pow10[CSVWRITER_MAXDECIMALS+1] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9
+};
+
+/// Write out everything in the buffer
+static void csvwriter_flush(struct csvwriter *w) {
+	if(0 == w->len) return;
+
+#ifdef HAVE_ZLIB
+	if(NULL != w->gz) {
+		if(gzwrite(w->gz, w->buf, w->len) != (int)w->len) {
+			w->error = 1;
+		}
+		w->len = 0;
+		return;
+	}
+#endif //HAVE_ZLIB
+
+	size_t done = 0;
+	while(done < w->len) {
+		ssize_t n = write(w->fd, w->buf + done, w->len - done);
+		if(n < 0) {
+			if(EINTR == errno) continue;
+			w->error = 1;
+			break;
+		}
+		done += n;
+	}
+	w->len = 0;
+}
+
+/// Make sure there's room for n more bytes in the buffer
+static inline void csvwriter_reserve(struct csvwriter *w, size_t n) {
+	if(w->len + n > CSVWRITER_BUFSIZE) {
+		csvwriter_flush(w);
+	}
+}
+
+struct csvwriter *csvwriter_open(const char *filename, int compress) {
+	struct csvwriter *w = (struct csvwriter *)malloc(sizeof(struct csvwriter));
+	if(NULL == w) return NULL;
+
+	w->buf = (char *)malloc(CSVWRITER_BUFSIZE);
+	if(NULL == w->buf) {
+		free(w);
+		return NULL;
+	}
+	w->len = 0;
+	w->error = 0;
+	w->fd = -1;
+
+#ifdef HAVE_ZLIB
+	w->gz = NULL;
+	if(compress) {
+		if(NULL == (w->gz = gzopen(filename, "wb"))) {
+			if(0 == errno) errno = ENOMEM;
+			free(w->buf);
+			free(w);
+			return NULL;
+		}
+		return w;
+	}
+#endif //HAVE_ZLIB
+
+	if(0 > (w->fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC|O_BINARY, 0666))) {
+		free(w->buf);
+		free(w);
+		return NULL;
+	}
+	return w;
+}
+
+int csvwriter_close(struct csvwriter *w) {
+	csvwriter_flush(w);
+
+#ifdef HAVE_ZLIB
+	if(NULL != w->gz) {
+		if(Z_OK != gzclose(w->gz)) w->error = 1;
+	} else
+#endif //HAVE_ZLIB
+	if(0 != close(w->fd)) {
+		w->error = 1;
+	}
+
+	int ret = w->error?-1:0;
+	free(w->buf);
+	free(w);
+	return ret;
+}
+
+void csvwriter_text(struct csvwriter *w, const char *s) {
+	size_t len = strlen(s);
+	while(len > 0) {
+		csvwriter_reserve(w, 1);
+		size_t room = CSVWRITER_BUFSIZE - w->len;
+		size_t n = len<room?len:room;
+		memcpy(w->buf + w->len, s, n);
+		w->len += n;
+		s += n;
+		len -= n;
+	}
+	csvwriter_reserve(w, 1);
+	w->buf[w->len++] = ',';
+}
+
+void csvwriter_double(struct csvwriter *w, double v) {
+	csvwriter_reserve(w, CSVWRITER_MAXNUMBER+1);
+	w->len += csvwriter_formatdouble(w->buf + w->len, v);
+	w->buf[w->len++] = ',';
+}
+
+/// Digits of an unsigned integer, backwards from end. Returns the first one
+static inline char *csvwriter_utoa(char *end, unsigned long long n) {
+	do {
+		*--end = '0' + (n % 10);
+		n /= 10;
+	} while(n > 0);
+	return end;
+}
+
+void csvwriter_int(struct csvwriter *w, long long v) {
+	char digits[24];
+	char *end = digits + sizeof(digits);
+	char *start = csvwriter_utoa(end, v<0?-(unsigned long long)v:(unsigned long long)v);
+	if(v < 0) *--start = '-';
+
+	csvwriter_reserve(w, (end - start) + 1);
+	memcpy(w->buf + w->len, start, end - start);
+	w->len += end - start;
+	w->buf[w->len++] = ',';
+}
+
+void csvwriter_null(struct csvwriter *w) {
+	csvwriter_reserve(w, 1);
+	w->buf[w->len++] = ',';
+}
+
+void csvwriter_endrow(struct csvwriter *w) {
+	csvwriter_reserve(w, 1);
+	w->buf[w->len++] = '\n';
+}
+
+/// Find out if d reads back as the float f
+/** d is what a decimal string became as a double. It would become f
+     when read as a float too, except when d landed exactly halfway
+     between two floats; then the decimal itself might have been
+     either side, so say no and let the caller try another one */
+static int csvwriter_isfloat(double d, float f) {
+	float df = (float)d;
+	if(df != f) return 0;
+	if((double)df == d) return 1;
+
+	float other = nextafterf(df, d > df?HUGE_VALF:-HUGE_VALF);
+	return d != ((double)df + (double)other) / 2.0;
+}
+
+int csvwriter_formatdouble(char *out, double v) {
+	if(!isfinite(v)) {
+		return snprintf(out, CSVWRITER_MAXNUMBER, "%g", v);
+	}
+
+	const int isfloat = ((double)(float)v == v);
+	const float f = (float)v;
+	const double a = fabs(v);
+
+	// Try the fewest digits after the point that still read back as
+	//  v. Integers and decimals up to 2^53 are exact in a double, and
+	//  dividing two exact values rounds just like strtod would
+	int k;
+	for(k=0;k<=CSVWRITER_MAXDECIMALS;k++) {
+		double scaled = a * csvwriter_pow10[k];
+		if(scaled >= 9007199254740992.0) break;
+
+		double r = floor(scaled + 0.5);
+		double d = r / csvwriter_pow10[k];
+		if(v < 0) d = -d;
+		if(isfloat?csvwriter_isfloat(d, f):(d == v)) {
+			unsigned long long n = (unsigned long long)r;
+
+			// Trailing zeros after the point don't change anything
+			while(k > 0 && 0 == n % 10) {
+				n /= 10;
+				k--;
+			}
+
+			char digits[24];
+			char *end = digits + sizeof(digits);
+			char *start = csvwriter_utoa(end, n);
+			// Leading zeros, so there's at least one before the point
+			while(end - start <= k) *--start = '0';
+
+			char *p = out;
+			if(v < 0 && 0 != n) *p++ = '-';
+			int whole = (end - start) - k;
+			memcpy(p, start, whole);
+			p += whole;
+			if(k > 0) {
+				*p++ = '.';
+				memcpy(p, start + whole, k);
+				p += k;
+			}
+			*p = '\0';
+			return p - out;
+		}
+	}
+
+	// Very big, very small, or lots of digits. Let printf do it. Any
+	//  shorter string that reads back is what %g rounds to at the
+	//  fewest digits that's always enough, so start there
+	int prec;
+	int len = 0;
+	for(prec=isfloat?FLT_DIG:DBL_DIG;prec<=17;prec++) {
+		len = snprintf(out, CSVWRITER_MAXNUMBER, "%.*g", prec, v);
+		if(isfloat?(strtof(out, NULL) == f):(strtod(out, NULL) == v)) break;
+	}
+	return len;
+}
+
@@ -0,0 +1,73 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/** \file
+ \brief Write CSV a row at a time, through one large buffer
+ */
+#ifndef __CSVWRITER_H
+#define __CSVWRITER_H
+
+/// Size of the output buffer. Each write or gzwrite is this big
+#define CSVWRITER_BUFSIZE (1024*1024)
+
+/// Longest string csvwriter_formatdouble can produce, including the nul
+#define CSVWRITER_MAXNUMBER 32
+
+struct csvwriter;
+
+/// Open a file for writing CSV to
+/** \param filename the file to create or truncate
+    \param compress write gzip instead. Ignored without zlib
+    \return the writer, or NULL on error with errno set
+*/
+struct csvwriter *csvwriter_open(const char *filename, int compress);
+
+/// Flush whatever's left, close the file, and free the writer
+/** \return 0 if every write succeeded, -1 otherwise */
+int csvwriter_close(struct csvwriter *w);
+
+/// Write a cell with this text in it, as is
+void csvwriter_text(struct csvwriter *w, const char *s);
+
+/// Write a cell with a number in it
+/** See csvwriter_formatdouble for what it looks like */
+void csvwriter_double(struct csvwriter *w, double v);
+
+/// Write a cell with an integer in it
+void csvwriter_int(struct csvwriter *w, long long v);
+
+/// Write an empty cell, for a value that isn't there
+void csvwriter_null(struct csvwriter *w);
+
+/// End the current row
+void csvwriter_endrow(struct csvwriter *w);
+
+/// Format a number as the shortest string that reads back as it
+/** Values that are exactly a float, which is everything the logger
+     converted from an OBD reply, are written as the shortest string
+     that reads back as that float. So 0.1f comes out as "0.1",
+     not "0.100000001". Other values read back as the same double.
+    \param out at least CSVWRITER_MAXNUMBER chars
+    \param v the number
+    \return length of the string written to out
+*/
+int csvwriter_formatdouble(char *out, double v);
+
+#endif //__CSVWRITER_H
+
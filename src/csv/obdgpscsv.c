@@ -23,22 +23,19 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <errno.h>
 
-#ifdef HAVE_ZLIB
-#include "zlib.h"
-#endif //HAVE_ZLIB
-
 #include "obdconfig.h"
+#include "obdservicecommands.h"
 #include "obdgpscsv.h"
+#include "csvexport.h"
+#include "obdjoin.h"
 
 #include "sqlite3.h"
 
 int main(int argc, char **argv) {
 
-	/// Output file
-	FILE *outfile;
-
 	/// Database to dump
 	sqlite3 *db;
 
@@ -61,13 +58,28 @@ int main(int argc, char **argv) {
 	double starttime = -1;
 	double endtime = -1;
 
-#ifdef HAVE_ZLIB
+	/// Furthest apart, in seconds, an obd row and gps fix can be and still match
+	double tolerance = OBDJOIN_DEFAULTTOLERANCE;
+
 	/// Set if we should actually compress
 	int compress_output = 0;
 
-	/// gzip handle
-	gzFile *gz_outfile;
-#endif //HAVE_ZLIB
+	/// Number of partitions to split the export into, each with its own thread
+	int jobs = 1;
+
+	/// CSVEXPORT_CSV or CSVEXPORT_COLUMNS
+	int format = CSVEXPORT_CSV;
+
+	/// Comma separated obd columns to export. NULL for all of them
+	char *columns = NULL;
+
+	/// Trip to export, if have_trip is set
+	sqlite3_int64 tripid = 0;
+	int have_trip = 0;
+
+	/// Conditions rows have to meet, as the user wrote them
+	const char *predicates[CSV_MAXPREDICATES];
+	int predicatecount = 0;
 
 	while ((optc = getopt_long (argc, argv, csvshortopts, csvlongopts, NULL)) != -1) {
 		switch (optc) {
@@ -88,11 +100,46 @@ int main(int argc, char **argv) {
 			case 's':
 				starttime = atof(optarg);
 				break;
+			case 'T':
+				tolerance = atof(optarg);
+				break;
+			case 'j':
+				jobs = atoi(optarg);
+				break;
+			case 'f':
+				if(0 == strcmp(optarg, "csv")) {
+					format = CSVEXPORT_CSV;
+				} else if(0 == strcmp(optarg, "columns")) {
+					format = CSVEXPORT_COLUMNS;
+				} else {
+					fprintf(stderr, "Unknown format %s\n", optarg);
+					csvprinthelp(argv[0]);
+					mustexit = 1;
+				}
+				break;
 #ifdef HAVE_ZLIB
 			case 'z':
 				compress_output = 1;
 				break;
 #endif //HAVE_ZLIB
+			case 'c':
+				if(NULL != columns) {
+					free(columns);
+				}
+				columns = strdup(optarg);
+				break;
+			case 't':
+				tripid = strtoll(optarg, NULL, 10);
+				have_trip = 1;
+				break;
+			case 'w':
+				if(predicatecount >= CSV_MAXPREDICATES) {
+					fprintf(stderr, "At most %i --where options\n", CSV_MAXPREDICATES);
+					mustexit = 1;
+					break;
+				}
+				predicates[predicatecount++] = optarg;
+				break;
 			case 'd':
 				if(NULL != databasename) {
 					free(databasename);
@@ -117,7 +164,15 @@ int main(int argc, char **argv) {
 		databasename = strdup(OBD_DEFAULT_DATABASE);
 	}
 
-	if(NULL == outfilename) {
+	if(CSVEXPORT_COLUMNS == format && compress_output) {
+		// Columns are meant to be mapped straight from the file
+		fprintf(stderr, "Not compressing columnar output\n");
+		compress_output = 0;
+	}
+
+	if(NULL == outfilename && CSVEXPORT_COLUMNS == format) {
+		outfilename = strdup(DEFAULT_COLUMNSFILENAME);
+	} else if(NULL == outfilename) {
 #ifdef HAVE_ZLIB
 		// If they don't specify a filename, we'll automatically suffix .gz if appropriate
 		if(compress_output) {
@@ -168,13 +223,19 @@ column, "mpg", that is the miles per gallon
 	int have_vss = 0; // have a column named "vss" [vehicle speed]
 	int have_maf = 0; // have a column named "maf" [mass air flow]
 
-	const char *columnnames[0x6C]; // Given we only have 0x4C definitions, I'd hope this is enough...
+	// Every OBD column, the obd table's own columns [time, trip, ecu...],
+	//  and the extras added below
+	const char *columnnames[OBDCMDS_MODE1_COLUMNS + 16];
 	int col_count = 0;
 
 	while(SQLITE_ROW == sqlite3_step(pragma_stmt)) {
 		const char *columnname = sqlite3_column_text(pragma_stmt, 1);
-		char obdcolumn[20];
+		char obdcolumn[OBDCMDS_MODE1_MAXCOLUMNLEN + 16];
 		if(NULL == columnname) continue;
+		if(col_count >= (int)(sizeof(columnnames)/sizeof(columnnames[0])) - 5) {
+			fprintf(stderr, "Too many columns in obd table, ignoring %s\n", columnname);
+			continue;
+		}
 
 		snprintf(obdcolumn, sizeof(obdcolumn), "obd.%s", columnname);
 
@@ -186,159 +247,92 @@ column, "mpg", that is the miles per gallon
 	if(have_vss && have_maf) {
 		columnnames[col_count++] = strdup("(7.107*obd.vss/obd.maf) as mpg");
 	}
-	columnnames[col_count++] = strdup("gps.lon");
-	columnnames[col_count++] = strdup("gps.lat");
-	columnnames[col_count++] = strdup("gps.alt");
-	columnnames[col_count++] = strdup("trip.tripid");
-
 	sqlite3_finalize(pragma_stmt);
 
-// If progress is requested, then calculate [roughly] number of rows we expect
-	long num_expected_rows = 0;
-	if(show_progress) {
-		char progress_sql[] = "SELECT count(*) AS c FROM obd";
-		sqlite3_stmt *progress_stmt;
-
-		rc = sqlite3_prepare_v2(db, progress_sql, -1, &progress_stmt, &dbend);
-
-		if(SQLITE_OK != rc) {
-			fprintf(stderr,"Couldn't get progress info in database %s: %s\n", databasename, sqlite3_errmsg(db));
-		} else {
-			while(SQLITE_ROW == sqlite3_step(progress_stmt)) {
-				num_expected_rows = (long)sqlite3_column_double(progress_stmt,0);
-			}
-		}
-
-		sqlite3_finalize(progress_stmt);
-	}
-
-
-// Second, build the SQL SELECT statement to pull the columns we just found
-
-	char select_sql[4096] = "SELECT ";
-	// Would rather do a full outer join, but sqlite doesn't support that yet
-	char end_select_sql[] = " FROM obd LEFT JOIN gps ON obd.time=gps.time LEFT JOIN trip ON obd.time>trip.start AND obd.time<trip.end ";
-
+	// Conditions are checked against every column, not just the exported ones
+	char filter[CSV_MAXPREDICATES * (OBDCMDS_MODE1_MAXCOLUMNLEN + 16)] = "";
+	double params[CSV_MAXPREDICATES];
 	int i;
-	for(i=0;i<col_count-1;i++) {
-		strncat(select_sql, columnnames[i], sizeof(select_sql)-strlen(columnnames[i])-strlen(select_sql)-1);
-		strncat(select_sql, ", ", sizeof(select_sql)-strlen(", ")-strlen(select_sql)-1);
-		// Yay C ...
-	}
-	strncat(select_sql, columnnames[i], sizeof(select_sql)-strlen(columnnames[i])-strlen(select_sql)-1);
-	strncat(select_sql, end_select_sql, sizeof(select_sql)-strlen(end_select_sql)-strlen(select_sql)-1);
-
-	char where_clause[1024] = "\0";
-	if(starttime>0 && endtime>0) {
-		snprintf(where_clause, sizeof(where_clause), " WHERE obd.time>%f AND obd.time<%f ", starttime, endtime);
-	} else if(endtime>0) { // Didn't set a starttime
-		snprintf(where_clause, sizeof(where_clause), " WHERE obd.time<%f ", endtime);
-	} else if(starttime>0) { // Didn't set an endtime
-		snprintf(where_clause, sizeof(where_clause), " WHERE obd.time>%f ", starttime);
+	for(i=0;i<predicatecount;i++) {
+		char condition[OBDCMDS_MODE1_MAXCOLUMNLEN + 16];
+		if(0 != csvparsepredicate(predicates[i], columnnames, col_count,
+				condition, sizeof(condition), &params[i])) {
+			fprintf(stderr, "Can't use --where %s. Expected column<op>number, "
+				"with op one of = != < <= > >=, and column in the obd table\n", predicates[i]);
+			sqlite3_close(db);
+			exit(1);
+		}
+		if(i > 0) strcat(filter, " AND ");
+		strcat(filter, condition);
 	}
-	strncat(select_sql, where_clause, sizeof(select_sql)-strlen(where_clause)-strlen(select_sql)-1);
-
-	// printf("Select: \n %s\n", select_sql);
 
-	sqlite3_stmt *select_stmt; // Our actual select statement
-	
-	rc = sqlite3_prepare_v2(db, select_sql, -1, &select_stmt, &dbend);
-
-	if(SQLITE_OK != rc) {
-		printf("Error attempting to select:\n%s\n%s\n", select_sql, sqlite3_errmsg(db));
+	if(NULL != columns && 0 != csvprojectcolumns(columns, columnnames, &col_count)) {
 		sqlite3_close(db);
 		exit(1);
 	}
 
-
-#ifdef HAVE_ZLIB
-	if(compress_output) {
-		if(NULL == (gz_outfile = gzopen(outfilename, "wb"))) {
-			fprintf(stderr,"Error opening file with gzopen. Exiting\n");
+	if(have_trip) {
+		double tripstart, tripend;
+		if(0 != csvtriprange(db, tripid, &tripstart, &tripend)) {
+			fprintf(stderr, "No trip %lli in database %s\n", (long long)tripid, databasename);
 			sqlite3_close(db);
 			exit(1);
 		}
-	} else {
-#endif // HAVE_ZLIB
-		if(NULL == (outfile = fopen(outfilename, "w"))) {
-			perror(outfilename);
-			sqlite3_close(db);
-			exit(1);
-		}
-#ifdef HAVE_ZLIB
+		// Just the part of the trip inside --start and --end, if they're given
+		if(starttime <= 0 || tripstart > starttime) starttime = tripstart;
+		if(tripend > 0 && (endtime <= 0 || tripend < endtime)) endtime = tripend;
+		if(endtime > 0 && endtime <= starttime) endtime = starttime;
 	}
-#endif // HAVE_ZLIB
 
+	// Everything up to here comes from the obd table. The rest, the join adds
+	int obd_col_count = col_count;
+	columnnames[col_count++] = strdup("gps.lon");
+	columnnames[col_count++] = strdup("gps.lat");
+	columnnames[col_count++] = strdup("gps.alt");
+	columnnames[col_count++] = strdup("trip.tripid");
 
-	/* Getting to here means our SQL select statement is prepared,
-	the output file is open for writing, and columnnames[] is packed with
-	col_count columns */
-
-	// Line of output
-	char out_line[4096] = "\0";
-	char out_item[64] = "\0";
-	for(i=0;i<col_count;i++) {
-		snprintf(out_item, sizeof(out_item), "%s,", columnnames[i]);
-		strncat(out_line, out_item, sizeof(out_line)-strlen(out_item)-strlen(out_line)-1);
-	}
-	strncat(out_line, "\n", sizeof(out_line)-strlen("\n")-strlen(out_line)-1);
-
-#ifdef HAVE_ZLIB
-	if(compress_output) {
-		gzwrite(gz_outfile, out_line, strlen(out_line));
-	} else {
-#endif //HAVE_ZLIB
-		fprintf(outfile,"%s", out_line);
-#ifdef HAVE_ZLIB
-	}
-#endif //HAVE_ZLIB
-
-// Thirdly, iterate through the whole database dumping to CSV
-	long current_row = 0;
-	while(SQLITE_ROW == sqlite3_step(select_stmt)) {
-		out_line[0] = '\0';
-		for(i=0;i<col_count;i++) {
-			snprintf(out_item, sizeof(out_item), "%f,", sqlite3_column_double(select_stmt, i));
-			strncat(out_line, out_item, sizeof(out_line)-strlen(out_item)-strlen(out_line)-1);
-		}
-		strncat(out_line, "\n", sizeof(out_line)-strlen("\n")-strlen(out_line)-1);
 
-#ifdef HAVE_ZLIB
-		if(compress_output) {
-			gzwrite(gz_outfile, out_line, strlen(out_line));
-		} else {
-#endif //HAVE_ZLIB
-			fprintf(outfile,"%s", out_line);
-#ifdef HAVE_ZLIB
-		}
-#endif //HAVE_ZLIB
+// Second, build the list of columns to select from the obd table
 
-		if(show_progress) {
-			current_row++;
-			if(0 == current_row%50) {
-				printf("%f\n", 100.0f * current_row/num_expected_rows);
-				fflush(stdout);
-			}
-		}
-	}
-	sqlite3_finalize(select_stmt);
+	char select_cols[4096] = "";
 
-#ifdef HAVE_ZLIB
-	if(compress_output) {
-		gzclose(gz_outfile);
-	} else {
-#endif //HAVE_ZLIB
-		fclose(outfile);
-#ifdef HAVE_ZLIB
+	for(i=0;i<obd_col_count-1;i++) {
+		strncat(select_cols, columnnames[i], sizeof(select_cols)-strlen(columnnames[i])-strlen(select_cols)-1);
+		strncat(select_cols, ", ", sizeof(select_cols)-strlen(", ")-strlen(select_cols)-1);
+		// Yay C ...
 	}
-#endif //HAVE_ZLIB
+	strncat(select_cols, columnnames[i], sizeof(select_cols)-strlen(columnnames[i])-strlen(select_cols)-1);
 
+	// The parts of the export open their own connections
 	sqlite3_close(db);
 
+	struct csvexport ex;
+	ex.databasename = databasename;
+	ex.select_cols = select_cols;
+	ex.obd_col_count = obd_col_count;
+	ex.columnnames = columnnames;
+	ex.col_count = col_count;
+	ex.starttime = starttime;
+	ex.endtime = endtime;
+	ex.tolerance = tolerance;
+	ex.filter = filter;
+	ex.params = params;
+	ex.paramcount = predicatecount;
+	ex.format = format;
+	ex.compress = compress_output;
+	ex.show_progress = show_progress;
+
+// Thirdly, iterate through the whole database dumping it out
+	int export_failed = (0 != csvexport_run(&ex, outfilename, jobs));
+
+	for(i=0;i<col_count;i++) {
+		free((char *)columnnames[i]);
+	}
+	free(columns);
 	free(outfilename);
 	free(databasename);
 
-	return 0;
+	return export_failed?1:0;
 }
 
 void csvprinthelp(const char *argv0) {
@@ -348,6 +342,12 @@ void csvprinthelp(const char *argv0) {
 		"   [-d|--db<=" OBD_DEFAULT_DATABASE ">]\n"
 		"   [-s|--start=<time>]\n"
 		"   [-e|--end=<time>]\n"
+		"   [-T|--tolerance=<seconds>]\n"
+		"   [-j|--jobs=<number of threads>]\n"
+		"   [-f|--format=<csv|columns>]\n"
+		"   [-c|--columns=<obd column>[,<obd column>...]]\n"
+		"   [-t|--trip=<trip id>]\n"
+		"   [-w|--where=<obd column><op><number>]\n"
 #ifdef HAVE_ZLIB
 		"   [-z|--gzip]\n"
 #endif //HAVE_ZLIB
@@ -358,3 +358,119 @@ void csvprintversion() {
 	printf("Version: %i.%i\n", OBDGPSLOGGER_MAJOR_VERSION, OBDGPSLOGGER_MINOR_VERSION);
 }
 
+int csvprojectcolumns(const char *columns, const char **columnnames, int *col_count) {
+	const char *projected[OBDCMDS_MODE1_COLUMNS + 16];
+	int projected_count = 0;
+
+	char *copy = strdup(columns);
+	char *saveptr = NULL;
+	char *name;
+	int i;
+	for(name = strtok_r(copy, ", ", &saveptr); NULL != name;
+			name = strtok_r(NULL, ", ", &saveptr)) {
+		char obdcolumn[OBDCMDS_MODE1_MAXCOLUMNLEN + 16];
+		snprintf(obdcolumn, sizeof(obdcolumn), "obd.%s", name);
+
+		const char *found = NULL;
+		for(i=0;i<*col_count;i++) {
+			if(0 == strcmp(columnnames[i], obdcolumn)) {
+				found = columnnames[i];
+			} else if(0 == strcmp(name, "mpg") &&
+					NULL != strstr(columnnames[i], " as mpg")) {
+				found = columnnames[i];
+			}
+		}
+		if(NULL == found) {
+			fprintf(stderr, "No column %s in obd table\n", name);
+			free(copy);
+			for(i=0;i<projected_count;i++) free((char *)projected[i]);
+			return -1;
+		}
+		if(projected_count >= (int)(sizeof(projected)/sizeof(projected[0])) - 5) {
+			fprintf(stderr, "Too many columns, ignoring %s\n", name);
+			continue;
+		}
+		projected[projected_count++] = strdup(found);
+	}
+	free(copy);
+
+	if(0 == projected_count) {
+		fprintf(stderr, "No columns in --columns %s\n", columns);
+		return -1;
+	}
+
+	for(i=0;i<*col_count;i++) {
+		free((char *)columnnames[i]);
+	}
+	for(i=0;i<projected_count;i++) {
+		columnnames[i] = projected[i];
+	}
+	*col_count = projected_count;
+	return 0;
+}
+
+int csvparsepredicate(const char *predicate, const char **columnnames, int col_count,
+		char *sql, int sqllen, double *param) {
+	// Longer operators first, so "<=" isn't read as "<"
+	static const char *ops[] = { "<=", ">=", "!=", "<>", "==", "<", ">", "=" };
+
+	const char *p = predicate;
+	while(isspace((unsigned char)*p)) p++;
+	const char *name = p;
+	while(isalnum((unsigned char)*p) || '_' == *p) p++;
+	int namelen = p - name;
+	while(isspace((unsigned char)*p)) p++;
+	if(0 == namelen || namelen > OBDCMDS_MODE1_MAXCOLUMNLEN) return -1;
+
+	const char *op = NULL;
+	int i;
+	for(i=0;i<(int)(sizeof(ops)/sizeof(ops[0]));i++) {
+		if(0 == strncmp(p, ops[i], strlen(ops[i]))) {
+			op = ops[i];
+			p += strlen(op);
+			break;
+		}
+	}
+	if(NULL == op) return -1;
+
+	char *numend;
+	*param = strtod(p, &numend);
+	if(numend == p) return -1;
+	while(isspace((unsigned char)*numend)) numend++;
+	if('\0' != *numend) return -1;
+
+	char obdcolumn[OBDCMDS_MODE1_MAXCOLUMNLEN + 16];
+	snprintf(obdcolumn, sizeof(obdcolumn), "obd.%.*s", namelen, name);
+	for(i=0;i<col_count;i++) {
+		if(0 == strcmp(columnnames[i], obdcolumn)) {
+			snprintf(sql, sqllen, "%s%s?", obdcolumn, op);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int csvtriprange(sqlite3 *db, sqlite3_int64 tripid, double *start, double *end) {
+	sqlite3_stmt *stmt;
+	if(SQLITE_OK != sqlite3_prepare_v2(db, "SELECT start,end,"
+			"(SELECT min(start) FROM trip WHERE start>t.start) "
+			"FROM trip AS t WHERE tripid=?", -1, &stmt, NULL)) {
+		fprintf(stderr, "Couldn't look up trip: %s\n", sqlite3_errmsg(db));
+		return -1;
+	}
+	sqlite3_bind_int64(stmt, 1, tripid);
+
+	int ret = -1;
+	if(SQLITE_ROW == sqlite3_step(stmt)) {
+		*start = sqlite3_column_double(stmt, 0);
+		*end = sqlite3_column_double(stmt, 1);
+		if(*end < *start) {
+			*end = (SQLITE_NULL == sqlite3_column_type(stmt, 2))?-1:
+				sqlite3_column_double(stmt, 2);
+		}
+		ret = 0;
+	}
+	sqlite3_finalize(stmt);
+	return ret;
+}
+
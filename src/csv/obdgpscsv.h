@@ -25,14 +25,28 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <getopt.h>
 
+#include "sqlite3.h"
+
 /// Default out filename
 #define DEFAULT_OUTFILENAME "./obdlogger.csv"
 
+/// Default out filename for --format=columns
+#define DEFAULT_COLUMNSFILENAME "./obdlogger.obdcol"
+
+/// Most --where options
+#define CSV_MAXPREDICATES 16
+
 /// getopt_long long options
 static const struct option csvlongopts[] = {
 	{ "help", no_argument, NULL, 'h' }, ///< Print the help text
 	{ "start", required_argument, NULL, 's' }, ///< Dump starting with this time
 	{ "end", required_argument, NULL, 'e' }, ///< Dump ending with this time
+	{ "tolerance", required_argument, NULL, 'T' }, ///< Match gps fixes this many seconds away
+	{ "jobs", required_argument, NULL, 'j' }, ///< Split the export across this many threads
+	{ "format", required_argument, NULL, 'f' }, ///< csv or columns
+	{ "columns", required_argument, NULL, 'c' }, ///< Only export these obd columns
+	{ "trip", required_argument, NULL, 't' }, ///< Only export this trip
+	{ "where", required_argument, NULL, 'w' }, ///< Only export rows where column<op>number
 	{ "version", no_argument, NULL, 'v' }, ///< Print the version text
 	{ "progress", no_argument, NULL, 'p' }, ///< Print parsable progress
 	{ "db", required_argument, NULL, 'd' }, ///< Database file
@@ -45,7 +59,7 @@ static const struct option csvlongopts[] = {
 
 
 /// getopt() short options
-static const char csvshortopts[] = "hs:e:vpd:o:"
+static const char csvshortopts[] = "hs:e:T:j:f:c:t:w:vpd:o:"
 #ifdef HAVE_ZLIB
 	"z"
 #endif //HAVE_ZLIB
@@ -59,6 +73,36 @@ void csvprinthelp(const char *argv0);
 /// Print the version string
 void csvprintversion();
 
+/// Cut the obd columns down to the ones asked for, in the order asked for
+/** \param columns comma separated obd column names, and optionally mpg
+    \param columnnames the obd columns, as "obd.name", strdup()ed. Replaced
+      with the ones asked for
+    \param col_count number of columnnames. Replaced with the new number
+    \return 0 on success, -1 if a column doesn't exist
+*/
+int csvprojectcolumns(const char *columns, const char **columnnames, int *col_count);
+
+/// Turn "column<op>number" into a condition on the obd table
+/** The column has to be one of columnnames; the number is left as a ?
+     to be bound, rather than put in the SQL
+    \param predicate what the user asked for, eg "vss>0"
+    \param columnnames the obd columns, as "obd.name"
+    \param col_count number of columnnames
+    \param sql filled with the condition
+    \param sqllen size of sql
+    \param param filled with the number
+    \return 0 on success, -1 if it can't be parsed
+*/
+int csvparsepredicate(const char *predicate, const char **columnnames, int col_count,
+	char *sql, int sqllen, double *param);
+
+/// Find when a trip started and ended
+/** A trip that never ended runs until the next one starts
+    \param end set to -1 if it still hasn't
+    \return 0 on success, -1 if there's no such trip
+*/
+int csvtriprange(sqlite3 *db, sqlite3_int64 tripid, double *start, double *end);
+
 
 #endif //__OBDGPSKML_H
 
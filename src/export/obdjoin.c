@@ -0,0 +1,213 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/** \file
+ \brief Line up obd, gps and trip rows by time, in one pass
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "obdjoin.h"
+
+#include "sqlite3.h"
+
+/// Prepare "SELECT cols,time FROM table", ordered by time, between start and end
+/** \param inclusive set to keep rows at exactly start or end
+    \param filter extra condition, with a ? for each of params, or NULL */
+static sqlite3_stmt *obdjoin_prepare(sqlite3 *db, const char *cols, const char *table,
+		double start, double end, int inclusive,
+		const char *filter, const double *params, int paramcount) {
+	const char *eq = inclusive?"=":"";
+	char where[64] = "";
+	if(start > 0 && end > 0) {
+		snprintf(where, sizeof(where), " WHERE time>%s?1 AND time<%s?2", eq, eq);
+	} else if(start > 0) {
+		snprintf(where, sizeof(where), " WHERE time>%s?1", eq);
+	} else if(end > 0) {
+		snprintf(where, sizeof(where), " WHERE time<%s?2", eq);
+	}
+
+	char *sql;
+	if(NULL != filter && '\0' != *filter) {
+		sql = sqlite3_mprintf("SELECT %s,time FROM %s%s%s(%s) ORDER BY time", cols, table,
+			where, ('\0' == *where)?" WHERE ":" AND ", filter);
+	} else {
+		sql = sqlite3_mprintf("SELECT %s,time FROM %s%s ORDER BY time", cols, table, where);
+	}
+	if(NULL == sql) return NULL;
+
+	sqlite3_stmt *stmt;
+	int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+	if(SQLITE_OK != rc) {
+		fprintf(stderr, "Error preparing select(%i):\n%s\n%s\n", rc, sql, sqlite3_errmsg(db));
+		sqlite3_free(sql);
+		return NULL;
+	}
+	sqlite3_free(sql);
+
+	if(start > 0) sqlite3_bind_double(stmt, 1, start);
+	if(end > 0) sqlite3_bind_double(stmt, 2, end);
+
+	// The filter's ?s come last, so sqlite numbers them after ?1 and ?2
+	int first = sqlite3_bind_parameter_count(stmt) - paramcount + 1;
+	int i;
+	for(i=0;NULL != filter && i<paramcount;i++) {
+		sqlite3_bind_double(stmt, first + i, params[i]);
+	}
+	return stmt;
+}
+
+/// Read every trip, ordered by start
+static int obdjoin_loadtrips(sqlite3 *db, struct obdjoin *j) {
+	sqlite3_stmt *stmt;
+	int rc = sqlite3_prepare_v2(db, "SELECT tripid,start,end FROM trip ORDER BY start", -1, &stmt, NULL);
+	if(SQLITE_OK != rc) {
+		fprintf(stderr, "Error preparing trip select(%i): %s\n", rc, sqlite3_errmsg(db));
+		return -1;
+	}
+
+	int size = 0;
+	while(SQLITE_ROW == sqlite3_step(stmt)) {
+		if(j->tripcount >= size) {
+			size = (0 == size)?16:size*2;
+			struct obdjoin_trip *trips = (struct obdjoin_trip *)realloc(j->trips, size * sizeof(struct obdjoin_trip));
+			if(NULL == trips) {
+				fprintf(stderr, "Couldn't allocate memory for trips\n");
+				sqlite3_finalize(stmt);
+				return -1;
+			}
+			j->trips = trips;
+		}
+		struct obdjoin_trip *t = &j->trips[j->tripcount++];
+		t->tripid = sqlite3_column_int64(stmt, 0);
+		t->start = sqlite3_column_double(stmt, 1);
+		t->end = sqlite3_column_double(stmt, 2);
+	}
+	sqlite3_finalize(stmt);
+	return 0;
+}
+
+/// Read the next gps row into r
+static void obdjoin_fetchgps(struct obdjoin *j, struct obdjoin_gpsrow *r) {
+	if(SQLITE_ROW != sqlite3_step(j->gps_stmt)) {
+		r->valid = 0;
+		return;
+	}
+	int i;
+	for(i=0;i<j->gpscols;i++) {
+		r->isnull[i] = (SQLITE_NULL == sqlite3_column_type(j->gps_stmt, i));
+		r->vals[i] = sqlite3_column_double(j->gps_stmt, i);
+	}
+	r->time = sqlite3_column_double(j->gps_stmt, j->gpscols);
+	r->valid = 1;
+}
+
+struct obdjoin *obdjoin_open(sqlite3 *db, const char *obdcols, const char *gpscols,
+		double start, double end, double tolerance) {
+	return obdjoin_openwhere(db, obdcols, gpscols, start, end, 0, tolerance, NULL, NULL, 0);
+}
+
+struct obdjoin *obdjoin_openwhere(sqlite3 *db, const char *obdcols, const char *gpscols,
+		double start, double end, int inclusive, double tolerance,
+		const char *filter, const double *params, int paramcount) {
+	struct obdjoin *j = (struct obdjoin *)malloc(sizeof(struct obdjoin));
+	if(NULL == j) return NULL;
+	memset(j, 0, sizeof(*j));
+	j->tolerance = tolerance<0?0:tolerance;
+
+	if(NULL == obdcols) {
+		j->rows = obdjoin_prepare(db, gpscols, "gps", start, end, inclusive,
+			filter, params, paramcount);
+	} else {
+		j->rows = obdjoin_prepare(db, obdcols, "obd", start, end, inclusive,
+			filter, params, paramcount);
+		// Fixes just outside the range can still be nearest to rows inside it
+		j->gps_stmt = obdjoin_prepare(db, gpscols, "gps",
+			start>0?start-j->tolerance:start, end>0?end+j->tolerance:end, inclusive,
+			NULL, NULL, 0);
+		if(NULL == j->gps_stmt) {
+			obdjoin_close(j);
+			return NULL;
+		}
+		j->gpscols = sqlite3_column_count(j->gps_stmt) - 1;
+		if(j->gpscols > OBDJOIN_MAXGPSCOLS) {
+			fprintf(stderr, "Too many gps columns: %i, at most %i\n", j->gpscols, OBDJOIN_MAXGPSCOLS);
+			obdjoin_close(j);
+			return NULL;
+		}
+		obdjoin_fetchgps(j, &j->gpsnext);
+	}
+	if(NULL == j->rows || 0 != obdjoin_loadtrips(db, j)) {
+		obdjoin_close(j);
+		return NULL;
+	}
+	j->rowcols = sqlite3_column_count(j->rows) - 1;
+
+	return j;
+}
+
+int obdjoin_step(struct obdjoin *j) {
+	if(SQLITE_ROW != sqlite3_step(j->rows)) {
+		return 0;
+	}
+	const double t = sqlite3_column_double(j->rows, j->rowcols);
+	j->time = t;
+
+	// Rows come in time order, so the gps cursor only ever moves forward
+	if(NULL != j->gps_stmt) {
+		while(j->gpsnext.valid && j->gpsnext.time <= t) {
+			j->gpsprev = j->gpsnext;
+			obdjoin_fetchgps(j, &j->gpsnext);
+		}
+
+		// Nearest fix, and the earlier one if they're equally near
+		j->gps = NULL;
+		if(j->gpsprev.valid && t - j->gpsprev.time <= j->tolerance) {
+			j->gps = &j->gpsprev;
+		}
+		if(j->gpsnext.valid && j->gpsnext.time - t <= j->tolerance &&
+			(NULL == j->gps || j->gpsnext.time - t < t - j->gpsprev.time)) {
+			j->gps = &j->gpsnext;
+		}
+	}
+
+	// Same for trips. One that never ended runs until the next starts
+	while(j->tripcurr + 1 < j->tripcount && j->trips[j->tripcurr + 1].start < t) {
+		j->tripcurr++;
+	}
+	j->trip = NULL;
+	if(j->tripcurr < j->tripcount) {
+		const struct obdjoin_trip *trip = &j->trips[j->tripcurr];
+		if(trip->start < t && (t < trip->end || trip->end < trip->start)) {
+			j->trip = trip;
+		}
+	}
+
+	return 1;
+}
+
+void obdjoin_close(struct obdjoin *j) {
+	if(NULL == j) return;
+	if(NULL != j->rows) sqlite3_finalize(j->rows);
+	if(NULL != j->gps_stmt) sqlite3_finalize(j->gps_stmt);
+	free(j->trips);
+	free(j);
+}
+
@@ -0,0 +1,110 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/** \file
+ \brief Line up obd, gps and trip rows by time, in one pass
+
+ Each table is read once, ordered by time, and merged as it streams
+ past. The rows come from obd [or gps, if no obd columns are asked
+ for]; each is given the nearest gps fix within a tolerance, and the
+ trip it falls in. Replaces SQL joins that matched gps on exact time
+ equality and trips with a range condition sqlite runs as a nested loop.
+ */
+#ifndef __OBDJOIN_H
+#define __OBDJOIN_H
+
+#include "sqlite3.h"
+
+/// Most columns that can be asked for from the gps table
+#define OBDJOIN_MAXGPSCOLS 16
+
+/// Default tolerance. Only fixes logged at the same time match
+#define OBDJOIN_DEFAULTTOLERANCE 0.0
+
+/// A gps row, held while the merge moves past it
+struct obdjoin_gpsrow {
+	int valid; //< Set if this holds a row
+	double time; //< When the logger wrote the fix
+	double vals[OBDJOIN_MAXGPSCOLS]; //< The gps columns asked for
+	int isnull[OBDJOIN_MAXGPSCOLS]; //< Set for each column that was NULL
+};
+
+/// A trip
+struct obdjoin_trip {
+	sqlite3_int64 tripid; //< The trip's id
+	double start; //< When it started
+	double end; //< When it ended. Less than start if it never did
+};
+
+/// A join in progress
+struct obdjoin {
+	sqlite3_stmt *rows; //< Current row. The columns asked for, then time
+	int rowcols; //< Number of columns asked for in rows
+	double time; //< Time of the current row
+	const struct obdjoin_gpsrow *gps; //< gps fix for the current row, or NULL
+	const struct obdjoin_trip *trip; //< Trip the current row is in, or NULL
+
+	sqlite3_stmt *gps_stmt; //< gps table, ordered by time. NULL if rows is gps
+	int gpscols; //< Number of columns asked for from gps
+	struct obdjoin_gpsrow gpsprev; //< Latest fix at or before time
+	struct obdjoin_gpsrow gpsnext; //< Earliest fix after time
+	double tolerance; //< Furthest apart a row and fix can be and still match
+
+	struct obdjoin_trip *trips; //< Every trip, ordered by start
+	int tripcount; //< Number of trips
+	int tripcurr; //< Latest trip to have started by time
+};
+
+/// Start a join
+/** \param db the database
+    \param obdcols comma separated expressions on the obd table. If NULL,
+      rows come from the gps table instead and gps is always NULL
+    \param gpscols comma separated expressions on the gps table
+    \param start only rows after this time. Ignored if <= 0
+    \param end only rows before this time. Ignored if <= 0
+    \param tolerance most seconds between a row and its gps fix
+    \return the join, or NULL on error
+*/
+struct obdjoin *obdjoin_open(sqlite3 *db, const char *obdcols, const char *gpscols,
+	double start, double end, double tolerance);
+
+/// Start a join, keeping only the rows that meet a condition
+/** Like obdjoin_open. The filter is ANDed onto the rows' WHERE clause,
+     and only affects which rows there are, not which gps fixes or
+     trips they're matched to.
+    \param inclusive set to also keep rows at exactly start or end. The
+      logger starts and ends a trip at the times of its first and last rows
+    \param filter an SQL condition on the rows' table, with a plain ?
+      for each of params. NULL for every row
+    \param params values bound to the filter's ?s, in order
+    \param paramcount number of params
+*/
+struct obdjoin *obdjoin_openwhere(sqlite3 *db, const char *obdcols, const char *gpscols,
+	double start, double end, int inclusive, double tolerance,
+	const char *filter, const double *params, int paramcount);
+
+/// Move to the next row
+/** \return 1 if there is one, 0 when there are no more rows */
+int obdjoin_step(struct obdjoin *j);
+
+/// Finish with a join
+void obdjoin_close(struct obdjoin *j);
+
+#endif //__OBDJOIN_H
+
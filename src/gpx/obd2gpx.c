@@ -28,6 +28,7 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "obd2gpx.h"
 #include "obdconfig.h"
+#include "obdjoin.h"
 
 #include "sqlite3.h"
 
@@ -88,14 +89,10 @@ int main(int argc, char **argv) {
 		exit(1);
 	}
 
-	char select_sql[4096] = "SELECT lat,lon,alt,time,trip FROM gps WHERE trip IS NOT NULL ORDER BY trip,time";
-
-	sqlite3_stmt *select_stmt; // Our actual select statement
-	
-	rc = sqlite3_prepare_v2(db, select_sql, -1, &select_stmt, NULL);
-
-	if(SQLITE_OK != rc) {
-		printf("Error attempting to prepare select(%i): %s\n", rc, sqlite3_errmsg(db));
+	// Every fix the logger put in a trip, in time order
+	struct obdjoin *join = obdjoin_openwhere(db, NULL, "lat,lon,alt,trip", -1, -1, 0,
+		OBDJOIN_DEFAULTTOLERANCE, "trip IS NOT NULL", NULL, 0);
+	if(NULL == join) {
 		sqlite3_close(db);
 		exit(1);
 	}
@@ -103,6 +100,7 @@ int main(int argc, char **argv) {
 
 	if(NULL == (outfile = fopen(outfilename, "w"))) {
 		perror(outfilename);
+		obdjoin_close(join);
 		sqlite3_close(db);
 		exit(1);
 	}
@@ -111,12 +109,12 @@ int main(int argc, char **argv) {
 
 	int currtrip = -1;
 
-	while(SQLITE_ROW == sqlite3_step(select_stmt)) {
-		double lat = sqlite3_column_double(select_stmt, 0);
-		double lon = sqlite3_column_double(select_stmt, 1);
-		double alt = sqlite3_column_double(select_stmt, 2);
-		time_t datatime = sqlite3_column_int64(select_stmt, 3);
-		int trip = sqlite3_column_int64(select_stmt, 4);
+	while(obdjoin_step(join)) {
+		double lat = sqlite3_column_double(join->rows, 0);
+		double lon = sqlite3_column_double(join->rows, 1);
+		double alt = sqlite3_column_double(join->rows, 2);
+		time_t datatime = (time_t)join->time;
+		int trip = sqlite3_column_int(join->rows, 3);
 
 		if(currtrip != trip) {
 			if(currtrip > -1) gpx_endtrip(outfile);
@@ -142,10 +140,10 @@ int main(int argc, char **argv) {
 		fprintf(outfile, "\t\t\t</trkpt>\n");
 		currtrip = trip;
 	}
-	gpx_endtrip(outfile);
+	if(currtrip > -1) gpx_endtrip(outfile);
 
 	gpx_writetail(outfile);
-	sqlite3_finalize(select_stmt);
+	obdjoin_close(join);
 
 	fclose(outfile);
 
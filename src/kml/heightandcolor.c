@@ -27,32 +27,35 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 #include <math.h>
 #include <time.h>
 
-#include "singleheight.h"
+#include "heightandcolor.h"
+#include "obdjoin.h"
 
 #include "sqlite3.h"
 
-void kmlvalueheightcolor(sqlite3 *db, FILE *f, const char *name, const char *desc, const char *columnname, int height, const char *col, int numcols, int defaultvis, double start, double end, int trip) {
+void kmlvalueheightcolor(sqlite3 *db, FILE *f, const char *name, const char *desc, const char *columnname, int height, const char *col, int numcols, int defaultvis, double start, double end, int trip, int ecu, double tolerance) {
 	int rc; // return from sqlite
-	sqlite3_stmt *stmt; // sqlite statement
 	const char *dbend; // ignored handle for sqlite
 
-	char select_sql[2048]; // the select statement
+	char select_cols[2048]; // height and color, from the obd table
 
-	snprintf(select_sql,sizeof(select_sql),
-					"SELECT %i*%s/(SELECT MAX(%s) FROM obd "
-						"WHERE trip=%i) "
-					"AS height,gps.lat, gps.lon, %s "
-					"FROM obd INNER JOIN gps ON obd.time=gps.time "
-					"WHERE obd.trip=%i",
-					height, columnname, columnname, trip, col, trip);
+	// Each ECU that replied has its own rows; only graph one of them
+	char ecufilter[32] = "";
+	if(ecu >= 0) {
+		snprintf(ecufilter, sizeof(ecufilter), " AND ecu=%i", ecu);
+	}
 
-	// printf("select sql:\n%s\n", select_sql);
+	snprintf(select_cols,sizeof(select_cols),
+					"%i*%s/(SELECT MAX(%s) FROM obd "
+						"WHERE trip=%i%s), %s",
+					height, columnname, columnname, trip, ecufilter, col);
 
-	rc = sqlite3_prepare_v2(db, select_sql, -1, &stmt, &dbend);
+	// Each row of the trip, with its gps fix
+	double params[2] = { trip, ecu };
+	struct obdjoin *join = obdjoin_openwhere(db, select_cols, "lat,lon", start, end<start?-1:end, 1,
+		tolerance, (ecu >= 0)?"trip=? AND ecu=?":"trip=?", params, (ecu >= 0)?2:1);
 
-	if(rc != SQLITE_OK) {
-		printf("SQL Error in valueheightcolor: %i, %s\n", rc, sqlite3_errmsg(db));
-		printf("SQL: %s\n", select_sql);
+	if(NULL == join) {
+		printf("Couldn't join obd and gps in valueheightcolor\n");
 		return;
 	} else {
 
@@ -64,11 +67,11 @@ void kmlvalueheightcolor(sqlite3 *db, FILE *f, const char *name, const char *des
 			char percentile_sql[2048]; // the actual sql
 			snprintf(percentile_sql, sizeof(percentile_sql),
 				"SELECT %s AS ckobd FROM obd "
-				"WHERE vss>0 AND obd.trip=%i "
+				"WHERE vss>0 AND obd.trip=%i%s "
 				"ORDER BY ckobd "
 				"LIMIT 1 OFFSET (SELECT %i*COUNT(*)/100 FROM obd "
-					"WHERE vss>0 AND obd.trip=%i)",
-				col, trip, i*100/numcols, trip);
+					"WHERE vss>0 AND obd.trip=%i%s)",
+				col, trip, ecufilter, i*100/numcols, trip, ecufilter);
 
 			// printf("Percentile sql:\n%s\n", percentile_sql);
 
@@ -77,6 +80,7 @@ void kmlvalueheightcolor(sqlite3 *db, FILE *f, const char *name, const char *des
 
 			if(rc != SQLITE_OK) {
 				printf("SQL Error in valueheightcolor percentile prepare: %i, %s\n", rc, sqlite3_errmsg(db));
+				obdjoin_close(join);
 				return;
 			}
 			sqlite3_step(pstmt);
@@ -136,14 +140,21 @@ void kmlvalueheightcolor(sqlite3 *db, FILE *f, const char *name, const char *des
 
 		fprintf(f, placehead, styleprefix, 0);
 
-		while(SQLITE_DONE != sqlite3_step(stmt)) {
+		while(obdjoin_step(join)) {
+			if(NULL == join->gps) continue;
+
+			double currpos[3];
+			currpos[2] = join->gps->vals[1];
+			currpos[1] = join->gps->vals[0];
+			currpos[0] = sqlite3_column_double(join->rows, 0);
+
 			if(0 == have_firstpos) {
-				firstpos[2] = sqlite3_column_double(stmt, 2);
-				firstpos[1] = sqlite3_column_double(stmt, 1);
-				firstpos[0] = sqlite3_column_double(stmt, 0);
+				firstpos[2] = currpos[2];
+				firstpos[1] = currpos[1];
+				firstpos[0] = currpos[0];
 				have_firstpos = 1;
 			}
-			double perc = sqlite3_column_double(stmt, 3);
+			double perc = sqlite3_column_double(join->rows, 1);
 			for(i=0;i<numcols;i++) {
 				if(percentileposition[i] > perc) break;
 			}
@@ -156,10 +167,10 @@ void kmlvalueheightcolor(sqlite3 *db, FILE *f, const char *name, const char *des
 					fprintf(f, "%f,%f,%f\n", lastpos[2], lastpos[1], lastpos[0]);
 				}
 			}
-			fprintf(f, "%f,%f,%f\n", sqlite3_column_double(stmt, 2),sqlite3_column_double(stmt, 1),sqlite3_column_double(stmt, 0));
-			lastpos[2] = sqlite3_column_double(stmt, 2);
-			lastpos[1] = sqlite3_column_double(stmt, 1);
-			lastpos[0] = sqlite3_column_double(stmt, 0);
+			fprintf(f, "%f,%f,%f\n", currpos[2], currpos[1], currpos[0]);
+			lastpos[2] = currpos[2];
+			lastpos[1] = currpos[1];
+			lastpos[0] = currpos[0];
 
 			lastpercentile = i;
 		}
@@ -194,7 +205,7 @@ void kmlvalueheightcolor(sqlite3 *db, FILE *f, const char *name, const char *des
 		fprintf(f,"</Document>\n");
 	}
 
-	sqlite3_finalize(stmt);
+	obdjoin_close(join);
 
 }
 
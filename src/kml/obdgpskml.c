@@ -30,6 +30,7 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 #include "justgps.h"
 #include "singleheight.h"
 #include "heightandcolor.h"
+#include "obdjoin.h"
 
 #include "sqlite3.h"
 
@@ -40,6 +41,14 @@ static int show_progress;
 /** \return 0 for success, -1 for invalid */
 static int checktripcolumns(sqlite3 *db);
 
+/// Check for the ecu column in the obd table
+/** \return 0 if it's there, -1 if the log is from before it was added */
+static int checkecucolumn(sqlite3 *db);
+
+/// Find the first ECU in the log
+/** \return the lowest ecu in the obd table, or -1 if there isn't one */
+static int firstecu(sqlite3 *db);
+
 /// Check for speed colum in gps table
 /** \return 0 for success, -1 for invalid */
 static int checkgps_speedtime(sqlite3 *db);
@@ -64,6 +73,12 @@ int main(int argc, char **argv) {
 	/// Max altitiude to chart to
 	int maxaltitude = DEFAULT_MAXALTITUDE;
 
+	/// Furthest apart, in seconds, an obd row and gps fix can be and still match
+	double tolerance = OBDJOIN_DEFAULTTOLERANCE;
+
+	/// ECU to graph rows from. -1 for the first in the log
+	int ecu = -1;
+
 	/// getopt's current option
 	int optc;
 
@@ -104,6 +119,12 @@ int main(int argc, char **argv) {
 			case 'a':
 				maxaltitude = atoi(optarg);
 				break;
+			case 'T':
+				tolerance = atof(optarg);
+				break;
+			case 'e':
+				ecu = atoi(optarg);
+				break;
 			default:
 				kmlprinthelp(argv[0]);
 				mustexit = 1;
@@ -153,7 +174,14 @@ int main(int argc, char **argv) {
 		"<description>OBD GPS Logger [http://icculus.org/obdgpslogger] was used to log a car journey and export this kml file</description>\n",
 		kmlfoldername);
 
-	writekmlgraphs(db,outfile,maxaltitude);
+	// Each ECU that replied has its own rows at the same times
+	if(0 != checkecucolumn(db)) {
+		ecu = -1;
+	} else if(ecu < 0) {
+		ecu = firstecu(db);
+	}
+
+	writekmlgraphs(db,outfile,maxaltitude,tolerance,ecu);
 
 
 	fprintf(outfile,"</Folder>\n</kml>\n\n");
@@ -164,7 +192,7 @@ int main(int argc, char **argv) {
 	return 0;
 }
 
-void writekmlgraphs(sqlite3 *db, FILE *f, int maxaltitude) {
+void writekmlgraphs(sqlite3 *db, FILE *f, int maxaltitude, double tolerance, int ecu) {
 	// Before entering this function, you should have written all the xml fluff
 	//  that comes at the top of the kml file, and be ready to dump the other fluff afterwards
 	
@@ -236,7 +264,7 @@ void writekmlgraphs(sqlite3 *db, FILE *f, int maxaltitude) {
 
 			kmlvalueheight(db,f, graphname, "", "rpm", maxaltitude, 0,
 				sqlite3_column_double(trip_stmt, 1), sqlite3_column_double(trip_stmt, 2),
-				sqlite3_column_int(trip_stmt, 0));
+				sqlite3_column_int(trip_stmt, 0), ecu, tolerance);
 		}
 	}
 	if(rc != SQLITE_ROW && rc != SQLITE_DONE && rc != SQLITE_OK) {
@@ -267,7 +295,7 @@ void writekmlgraphs(sqlite3 *db, FILE *f, int maxaltitude) {
 			kmlvalueheightcolor(db,f,graphname, "",
 				"vss",maxaltitude, "(710.7*vss/(rpm*(map/iat)))", 5, 1,
 				sqlite3_column_double(trip_stmt, 1), sqlite3_column_double(trip_stmt, 2),
-				sqlite3_column_int(trip_stmt,0));
+				sqlite3_column_int(trip_stmt,0), ecu, tolerance);
 		}
 	}
 	if(rc != SQLITE_ROW && rc != SQLITE_DONE && rc != SQLITE_OK) {
@@ -291,7 +319,7 @@ void writekmlgraphs(sqlite3 *db, FILE *f, int maxaltitude) {
 			kmlvalueheightcolor(db,f,graphname, "",
 				"vss",maxaltitude, "(710.7*vss/maf)", 5, 1,
 				sqlite3_column_double(trip_stmt, 1), sqlite3_column_double(trip_stmt, 2),
-				sqlite3_column_int(trip_stmt,0));
+				sqlite3_column_int(trip_stmt,0), ecu, tolerance);
 		}
 	}
 	if(rc != SQLITE_ROW && rc != SQLITE_DONE && rc != SQLITE_OK) {
@@ -320,7 +348,7 @@ void writekmlgraphs(sqlite3 *db, FILE *f, int maxaltitude) {
 
 			kmlvalueheight(db,f, graphname, "", "(vss/rpm)", maxaltitude, 0,
 				sqlite3_column_double(trip_stmt, 1), sqlite3_column_double(trip_stmt, 2),
-				sqlite3_column_int(trip_stmt,0));
+				sqlite3_column_int(trip_stmt,0), ecu, tolerance);
 		}
 	}
 	if(rc != SQLITE_ROW && rc != SQLITE_DONE && rc != SQLITE_OK) {
@@ -345,7 +373,7 @@ void writekmlgraphs(sqlite3 *db, FILE *f, int maxaltitude) {
 
 			kmlvalueheight(db,f, graphname, "", "vss", maxaltitude, 0,
 				sqlite3_column_double(trip_stmt, 1), sqlite3_column_double(trip_stmt, 2),
-				sqlite3_column_int(trip_stmt,0));
+				sqlite3_column_int(trip_stmt,0), ecu, tolerance);
 		}
 	}
 	if(rc != SQLITE_ROW && rc != SQLITE_DONE && rc != SQLITE_OK) {
@@ -370,7 +398,7 @@ void writekmlgraphs(sqlite3 *db, FILE *f, int maxaltitude) {
 			kmlvalueheightcolor(db,f,graphname, "",
 				"vss",maxaltitude, "rpm", 5, 0,
 				sqlite3_column_double(trip_stmt, 1), sqlite3_column_double(trip_stmt, 2),
-				sqlite3_column_int(trip_stmt,0));
+				sqlite3_column_int(trip_stmt,0), ecu, tolerance);
 		}
 	}
 	if(rc != SQLITE_ROW && rc != SQLITE_DONE && rc != SQLITE_OK) {
@@ -417,6 +445,53 @@ int checkgps_speedtime(sqlite3 *db) {
 	return -1;
 }
 
+static int checkecucolumn(sqlite3 *db) {
+	char pragma_sql[] = "PRAGMA table_info(obd)";
+
+	sqlite3_stmt *pragma_stmt;
+	int rc;
+
+	if(SQLITE_OK != (rc = sqlite3_prepare_v2(db, pragma_sql, -1, &pragma_stmt, NULL))) {
+		fprintf(stderr, "Error preparing stmt \"%s\" (%i): %s\n", pragma_sql, rc, sqlite3_errmsg(db));
+		return -1;
+	}
+
+	int found_ecu = 0;
+
+	while(SQLITE_ROW == sqlite3_step(pragma_stmt)) {
+		if(0 == strcmp("ecu", sqlite3_column_text(pragma_stmt, 1))) {
+			found_ecu = 1;
+		}
+	}
+
+	sqlite3_finalize(pragma_stmt);
+
+	if(found_ecu) return 0;
+
+	return -1;
+}
+
+static int firstecu(sqlite3 *db) {
+	char ecu_sql[] = "SELECT MIN(ecu) FROM obd";
+
+	sqlite3_stmt *ecu_stmt;
+	int rc;
+
+	if(SQLITE_OK != (rc = sqlite3_prepare_v2(db, ecu_sql, -1, &ecu_stmt, NULL))) {
+		fprintf(stderr, "Error preparing stmt \"%s\" (%i): %s\n", ecu_sql, rc, sqlite3_errmsg(db));
+		return -1;
+	}
+
+	int ecu = -1;
+	if(SQLITE_ROW == sqlite3_step(ecu_stmt) && SQLITE_NULL != sqlite3_column_type(ecu_stmt, 0)) {
+		ecu = sqlite3_column_int(ecu_stmt, 0);
+	}
+
+	sqlite3_finalize(ecu_stmt);
+
+	return ecu;
+}
+
 static int checktripcolumns_internal(sqlite3 *db, const char *tablename) {
 	char pragma_sql[512];
 	snprintf(pragma_sql, sizeof(pragma_sql), "PRAGMA table_info(%s)", tablename);
@@ -465,6 +540,8 @@ void kmlprinthelp(const char *argv0) {
 		"   [-d|--db[=" OBD_DEFAULT_DATABASE "]]\n"
 		"   [-n|--name[=" DEFAULT_KMLFOLDERNAME "]]\n"
 		"   [-a|--altitude[=%i]]\n"
+		"   [-T|--tolerance[=<seconds>]]\n"
+		"   [-e|--ecu[=<first in the log>]]\n"
 		"   [-p|--progress]\n"
 		"   [-v|--version] [-h|--help]\n", argv0, DEFAULT_MAXALTITUDE);
 }
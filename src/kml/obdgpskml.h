@@ -44,20 +44,24 @@ static const struct option kmllongopts[] = {
 	{ "out", required_argument, NULL, 'o' }, ///< Output file
 	{ "name", required_argument, NULL, 'n' }, ///< The "name" for this kml file
 	{ "altitude", required_argument, NULL, 'a' }, ///< Max altitude
+	{ "tolerance", required_argument, NULL, 'T' }, ///< Match gps fixes this many seconds away
+	{ "ecu", required_argument, NULL, 'e' }, ///< Only graph this ECU's rows
 	{ NULL, 0, NULL, 0 } ///< End
 };
 
 
 /// getopt() short options
-static const char kmlshortopts[] = "hvpd:o:a:n:";
+static const char kmlshortopts[] = "hvpd:o:a:n:T:e:";
 
 
 /// Write the actual graphs
 /** \param db a valid, open, sqlite3 database
  \param f an open file handle, ready to fprintf() KML folders
  \param maxaltitude altitude to normalise to
+ \param tolerance how many seconds apart an obd row and gps fix can be
+ \param ecu only graph rows from this ecu. -1 if the log has no ecu column
 */
-void writekmlgraphs(sqlite3 *db, FILE *f, int maxaltitude);
+void writekmlgraphs(sqlite3 *db, FILE *f, int maxaltitude, double tolerance, int ecu);
 
 /// Print Help for --help
 /** \param argv0 your program's argv[0]
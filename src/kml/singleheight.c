@@ -28,15 +28,15 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 #include <time.h>
 
 #include "singleheight.h"
+#include "obdjoin.h"
 
 #include "sqlite3.h"
 
 /// A distance greater than this is considered to be not zero
 #define EPSILONDIST 0.000001
 
-void kmlvalueheight(sqlite3 *db, FILE *f, const char *name, const char *desc, const char *columnname, int height, int defaultvis, double start, double end, int trip) {
+void kmlvalueheight(sqlite3 *db, FILE *f, const char *name, const char *desc, const char *columnname, int height, int defaultvis, double start, double end, int trip, int ecu, double tolerance) {
 	int rc; // return from sqlite
-	sqlite3_stmt *stmt; // sqlite statement
 	const char *dbend; // ignored handle for sqlite
 
 	// For normalising the data
@@ -44,9 +44,15 @@ void kmlvalueheight(sqlite3 *db, FILE *f, const char *name, const char *desc, co
 	sqlite3_stmt *normal_stmt;
 	char normal_sql[1024];
 	
+	// Each ECU that replied has its own rows; only graph one of them
+	char ecufilter[32] = "";
+	if(ecu >= 0) {
+		snprintf(ecufilter, sizeof(ecufilter), " AND ecu=%i", ecu);
+	}
+
 	snprintf(normal_sql, sizeof(normal_sql),
-			"SELECT %i/(SELECT MAX(%s) FROM obd WHERE trip=%i)",
-			height, columnname, trip
+			"SELECT %i/(SELECT MAX(%s) FROM obd WHERE trip=%i%s)",
+			height, columnname, trip, ecufilter
 			);
 	rc = sqlite3_prepare_v2(db, normal_sql, -1, &normal_stmt, &dbend);
 	if(SQLITE_OK != rc) {
@@ -63,22 +69,13 @@ void kmlvalueheight(sqlite3 *db, FILE *f, const char *name, const char *desc, co
 	}
 	sqlite3_finalize(normal_stmt);
 	
-	// And the actual output
-	char select_sql[2048]; // the select statement
-
-	snprintf(select_sql,sizeof(select_sql),
-					"SELECT T1.obdkmlthing AS height,gps.lat,gps.lon "
-					"FROM (SELECT %s AS obdkmlthing,time FROM obd WHERE trip=%i) AS T1 "
-					"INNER JOIN gps "
-					"ON T1.time=gps.time "
-					"WHERE gps.trip=%i ",
-					columnname, trip, trip);
+	// And the actual output. Each row of the trip, with its gps fix
+	double params[2] = { trip, ecu };
+	struct obdjoin *join = obdjoin_openwhere(db, columnname, "lat,lon,trip", start, end<start?-1:end, 1,
+		tolerance, (ecu >= 0)?"trip=? AND ecu=?":"trip=?", params, (ecu >= 0)?2:1);
 
-	rc = sqlite3_prepare_v2(db, select_sql, -1, &stmt, &dbend);
-
-	if(SQLITE_OK != rc) {
-		printf("SQL Error in valueheight: %i, %s\n", rc, sqlite3_errmsg(db));
-		printf("SQL: %s\n", select_sql);
+	if(NULL == join) {
+		printf("Couldn't join obd and gps in valueheight\n");
 		return;
 	} else {
 
@@ -111,24 +108,26 @@ void kmlvalueheight(sqlite3 *db, FILE *f, const char *name, const char *desc, co
 		long outputcount = 0;
 
 		double totalheight = 0;
-		while(SQLITE_ROW == sqlite3_step(stmt)) {
+		while(obdjoin_step(join)) {
+			if(NULL == join->gps) continue;
+			if(join->gps->isnull[2] || join->gps->vals[2] != trip) continue;
 			rowcount++;
 
+			double currpos[3];
+			currpos[2] = join->gps->vals[1];
+			currpos[1] = join->gps->vals[0];
+			currpos[0] = sqlite3_column_double(join->rows, 0);
+
 			if(0 == have_firstpos) {
-				firstpos[2] = sqlite3_column_double(stmt, 2);
-				firstpos[1] = sqlite3_column_double(stmt, 1);
-				firstpos[0] = sqlite3_column_double(stmt, 0);
+				firstpos[2] = currpos[2];
+				firstpos[1] = currpos[1];
+				firstpos[0] = currpos[0];
 				have_firstpos = 1;
 			}
 
-			double currpos[3];
-			currpos[2] = sqlite3_column_double(stmt, 2);
-			currpos[1] = sqlite3_column_double(stmt, 1);
-			currpos[0] = sqlite3_column_double(stmt, 0);
-
 			float delta = sqrt((currpos[2] - lastpos[2]) * (currpos[2] - lastpos[2]) +
 					(currpos[1] - lastpos[1]) * (currpos[1] - lastpos[1]));
-			float height = normalfactor * sqlite3_column_double(stmt, 0);
+			float height = normalfactor * currpos[0];
 			if(delta > EPSILONDIST) {
 				ismoving = 1;
 			}
@@ -181,7 +180,7 @@ void kmlvalueheight(sqlite3 *db, FILE *f, const char *name, const char *desc, co
 		fprintf(f,"</Document>\n");
 	}
 
-	sqlite3_finalize(stmt);
+	obdjoin_close(join);
 }
 
 
@@ -41,8 +41,11 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
  \param defaultvis the default visilibity [1 for on, 0 for off]
  \param start the start time we want to pull data for
  \param end the end time we want to pull data for
+ \param trip the trip we want to pull data for
+ \param ecu the ecu we want to pull data for. -1 for every row
+ \param tolerance how many seconds apart a row and gps fix can be
  */
-void kmlvalueheight(sqlite3 *db, FILE *f, const char *name, const char *desc, const char *columnname, int height, int defaultvis, double start, double end, int trip);
+void kmlvalueheight(sqlite3 *db, FILE *f, const char *name, const char *desc, const char *columnname, int height, int defaultvis, double start, double end, int trip, int ecu, double tolerance);
 
 
 #endif //__SINGLEHEIGHT_H
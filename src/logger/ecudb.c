@@ -85,7 +85,7 @@ sqlite3_int64 getecuid(sqlite3 *db, const char *vin, long ecu) {
 
 	sqlite3_finalize(stmt);
 
-	return -1;
+	return retvalue;
 }
 
 sqlite3_int64 createecu(sqlite3 *db, const char *vin, long ecu, const char *ecudesc) {
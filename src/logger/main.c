@@ -94,6 +94,28 @@ static void catch_tripstartsignal(int sig) {
 	sig_starttrip = 1;
 }
 
+/// Find which of our ECUs a reply came from
+/** ECUs that didn't answer when capabilities were asked for are added,
+     while there's room.
+ \return index into ecuaddrs and ecuids, or -1 if there's no room */
+static int findecu(unsigned int *ecuaddrs, sqlite3_int64 *ecuids, int *ecucount,
+		sqlite3 *db, unsigned int ecu) {
+	int e;
+	for(e=0;e<*ecucount;e++) {
+		if(ecu == ecuaddrs[e]) return e;
+	}
+	if(*ecucount >= OBDCAPABILITIES_MAXECUS) return -1;
+
+	char ecudesc[32];
+	snprintf(ecudesc, sizeof(ecudesc), "%X", ecu);
+	fprintf(stderr, "Logging new ECU %s\n", ecudesc);
+
+	e = (*ecucount)++;
+	ecuaddrs[e] = ecu;
+	ecuids[e] = createecu(db, NULL, ecu, ecudesc);
+	return e;
+}
+
 int main(int argc, char** argv) {
 	/// Serial port full path to open
 	char *serialport = NULL;
@@ -125,6 +147,9 @@ int main(int argc, char** argv) {
 	/// Enable elm optimisations
 	int enable_optimisations = 0;
 
+	/// Don't turn on headers, so only log one ECU
+	int single_ecu = 0;
+
 	/// Enable serial logging
 	int enable_seriallog = 0;
 
@@ -173,6 +198,9 @@ int main(int argc, char** argv) {
 			case 'o':
 				enable_optimisations = 1;
 				break;
+			case 'e':
+				single_ecu = 1;
+				break;
 			case 't':
 				spam_stdout = 1;
 				break;
@@ -281,6 +309,15 @@ int main(int argc, char** argv) {
 		fprintf(stderr, "Successfully connected to serial port. Will log obd data\n");
 	}
 
+	// With headers on, every ECU's reply to a command can be logged
+	enum obd_header_format obd_headers = OBD_HEADERS_NONE;
+	if(-1 != obd_serial_port && !single_ecu) {
+		obd_headers = obdenableheaders(obd_serial_port);
+		if(OBD_HEADERS_NONE == obd_headers) {
+			fprintf(stderr, "Couldn't turn on headers. Only logging one ECU\n");
+		}
+	}
+
 	// Just figure out our car's OBD port capabilities and print them
 	if(showcapabilities) {
 		printobdcapabilities(obd_serial_port);
@@ -363,7 +400,13 @@ int main(int argc, char** argv) {
 	struct obdservicecmd **wishlist_cmds = NULL;
 	obd_configCmds(log_columns, &wishlist_cmds);
 
-	void *obdcaps = getobdcapabilities(obd_serial_port,wishlist_cmds);
+	struct obdcapabilities *obdcaps = getobdcapabilities(obd_serial_port,wishlist_cmds);
+	if(NULL == obdcaps) {
+		fprintf(stderr, "Couldn't allocate capabilities\n");
+		closedb(db);
+		closeserial(obd_serial_port);
+		exit(1);
+	}
 
 	obd_freeConfigCmds(wishlist_cmds);
 	wishlist_cmds=NULL;
@@ -383,17 +426,44 @@ int main(int argc, char** argv) {
 
 	// All of these have obdnumcols-1 since the last column is time
 	int cmdlist[obdnumcols-1]; // Commands to send [index into obdcmds_mode1]
+	int cmdecus[obdnumcols-1]; // Number of ECUs that claim each command
 
 	int i,j;
-	for(i=0,j=0; i<sizeof(obdcmds_mode1)/sizeof(obdcmds_mode1[0]); i++) {
-		if(NULL != obdcmds_mode1[i].db_column) {
-			if(isobdcapabilitysupported(obdcaps,i)) {
-				cmdlist[j] = i;
-				j++;
-			}
+	int pid;
+	for(pid=obdcapset_next(&obdcaps->all,1,-1), j=0; pid>=0; pid=obdcapset_next(&obdcaps->all,1,pid)) {
+		struct obdservicecmd *cmd = obdGetCmdForPID(pid);
+		if(NULL != cmd && NULL != cmd->db_column) {
+			cmdlist[j] = cmd - obdcmds_mode1;
+			cmdecus[j] = obdcapabilities_ecusfor(obdcaps, 0x01, pid);
+			j++;
 		}
 	}
 
+	// Each ECU we log rows for. Without headers, there's one and it's ecu 0
+	int ecucount = 0;
+	unsigned int ecuaddrs[OBDCAPABILITIES_MAXECUS]; // Who each ECU replies as
+	sqlite3_int64 ecuids[OBDCAPABILITIES_MAXECUS]; // Its ecuid in the ecu table
+	if(OBD_HEADERS_NONE == obd_headers) {
+		ecuaddrs[0] = 0;
+		ecuids[0] = 0;
+		ecucount = 1;
+	} else {
+		for(i=0;i<obdcaps->ecu_count;i++) {
+			char ecudesc[32];
+			snprintf(ecudesc, sizeof(ecudesc), "%X", obdcaps->ecuids[i]);
+			ecuaddrs[ecucount] = obdcaps->ecuids[i];
+			ecuids[ecucount] = createecu(db, NULL, obdcaps->ecuids[i], ecudesc);
+			fprintf(stderr, "Logging ECU %s, %i PIDs\n", ecudesc,
+				obdcapset_count(&obdcaps->ecus[i], 0x01));
+			ecucount++;
+		}
+	}
+
+	// This time round, each ECU's values and which ones it sent. The
+	//  flag on the end is set if it sent anything at all
+	double ecuvals[OBDCAPABILITIES_MAXECUS][obdnumcols];
+	int ecuhasval[OBDCAPABILITIES_MAXECUS][obdnumcols];
+
 	freeobdcapabilities(obdcaps);
 	// We create the gps table even if gps is disabled, so that other
 	//  SQL commands expecting the table to at least exist will work.
@@ -498,25 +568,43 @@ int main(int argc, char** argv) {
 		enum obd_serial_status obdstatus;
 		if(-1 < obd_serial_port) {
 
+			memset(ecuhasval, 0, sizeof(ecuhasval));
+
 			// Get all the OBD data
 			for(i=0; i<obdnumcols-1; i++) {
-				float val;
-				unsigned int cmdid = obdcmds_mode1[cmdlist[i]].cmdid;
-				int numbytes = enable_optimisations?obdcmds_mode1[cmdlist[i]].bytes_returned:0;
-				OBDConvFunc conv = obdcmds_mode1[cmdlist[i]].conv;
+				struct obdservicecmd *cmd = &obdcmds_mode1[cmdlist[i]];
+				int numresponses = 0;
+				if(enable_optimisations) {
+					numresponses = (OBD_HEADERS_NONE == obd_headers)?cmd->bytes_returned:cmdecus[i];
+				}
 
-				obdstatus = getobdvalue(obd_serial_port, cmdid, &val, numbytes, conv);
-				if(OBD_SUCCESS == obdstatus) {
+				struct obdecureply replies[OBD_MAXREPLIES];
+				int numreplies;
+				obdstatus = getobdreplies(obd_serial_port, 0x01, cmd->cmdid, numresponses,
+					replies, sizeof(replies)/sizeof(replies[0]), &numreplies, 0);
+				if(OBD_SUCCESS != obdstatus) {
+					break;
+				}
+
+				int r;
+				for(r=0; r<numreplies; r++) {
+					int e = findecu(ecuaddrs, ecuids, &ecucount, db, replies[r].ecu);
+					if(-1 == e || ecuhasval[e][i]) continue;
+
+					float val = obdreplyvalue(&replies[r], cmd->conv);
+					ecuvals[e][i] = val;
+					ecuhasval[e][i] = 1;
+					ecuhasval[e][obdnumcols-1] = 1;
+
+					// Only the first ECU goes anywhere but the database
+					if(0 != e) continue;
 #ifdef HAVE_DBUS
-					obddbussignalpid(&obdcmds_mode1[cmdlist[i]], val);
+					obddbussignalpid(cmd, val);
 #endif //HAVE_DBUS
 					if(spam_stdout) {
-						printf("%s=%f\n", obdcmds_mode1[cmdlist[i]].db_column, val);
+						printf("%s=%f\n", cmd->db_column, val);
 					}
-					sqlite3_bind_double(obdinsert, i+1, (double)val);
-					// printf("cmd: %02X, val: %f\n",obdcmds_mode1[cmdlist[i]].cmdid,val);
-				} else {
-					break;
+					// printf("cmd: %02X, val: %f\n",cmd->cmdid,val);
 				}
 			}
 
@@ -527,13 +615,29 @@ int main(int argc, char** argv) {
 					currenttrip = starttrip(db, time_insert);
 					ontrip = 1;
 				}
-				sqlite3_bind_double(obdinsert, i+1, time_insert);
-				sqlite3_bind_int64(obdinsert, i+2, currenttrip);
 
-				// Do the OBD insert
-				rc = sqlite3_step(obdinsert);
-				if(SQLITE_DONE != rc) {
-					printf("sqlite3 obd insert failed(%i): %s\n", rc, sqlite3_errmsg(db));
+				// One row for each ECU that said anything
+				int e;
+				for(e=0; e<ecucount; e++) {
+					if(!ecuhasval[e][obdnumcols-1]) continue;
+
+					for(i=0; i<obdnumcols-1; i++) {
+						if(ecuhasval[e][i]) {
+							sqlite3_bind_double(obdinsert, i+1, ecuvals[e][i]);
+						} else {
+							sqlite3_bind_null(obdinsert, i+1);
+						}
+					}
+					sqlite3_bind_double(obdinsert, i+1, time_insert);
+					sqlite3_bind_int64(obdinsert, i+2, currenttrip);
+					sqlite3_bind_int64(obdinsert, i+3, ecuids[e]);
+
+					// Do the OBD insert
+					rc = sqlite3_step(obdinsert);
+					if(SQLITE_DONE != rc) {
+						printf("sqlite3 obd insert failed(%i): %s\n", rc, sqlite3_errmsg(db));
+					}
+					sqlite3_reset(obdinsert);
 				}
 			} else if(OBD_ERROR == obdstatus) {
 				fprintf(stderr, "Received OBD_ERROR from serial read. Exiting\n");
@@ -720,6 +824,7 @@ void printhelp(const char *argv0) {
 				"   [-t|--spam-stdout]\n"
 				"   [-p|--capabilities]\n"
 				"   [-o|--enable-optimisations]\n"
+				"   [-e|--single-ecu]\n"
 				"   [-u|--output-log <filename>]\n"
 #ifdef OBDPLATFORM_POSIX
 				"   [-m|--daemonise]\n"
@@ -42,6 +42,7 @@ static const struct option longopts[] = {
 	{ "modifybaud", required_argument, NULL, 'B' }, ///< Upgrade to this baudrate
 	{ "log-columns", required_argument, NULL, 'i' }, ///< Log these columns
 	{ "enable-optimisations", no_argument, NULL, 'o' }, ///< Enable elm optimisations
+	{ "single-ecu", no_argument, NULL, 'e' }, ///< Don't turn on headers; log whatever answers first
 #ifdef OBDPLATFORM_POSIX
 	{ "daemon", no_argument, NULL, 'm' }, ///< Daemonise
 #endif //OBDPLATFORM_POSIX
@@ -49,7 +50,7 @@ static const struct option longopts[] = {
 };
 
 /// getopt() short options
-static const char shortopts[] = "htd:i:b:vs:l:c:a:opu:B:"
+static const char shortopts[] = "htd:i:b:vs:l:c:a:opu:B:e"
 #ifdef OBDPLATFORM_POSIX
 	"m"
 #endif //OBDPLATFORM_POSIX
@@ -34,10 +34,10 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 
 
 /// Create the obd table in the database
-int createobdtable(sqlite3 *db, void *obdcaps) {
+int createobdtable(sqlite3 *db, const struct obdcapabilities *obdcaps) {
 		// TODO calculate buffer size and create correct sized one,
 		//   otherwise this could overflow if obdservicecommands contains a *lot* of non-NULL fields
-	int i;
+	int pid;
 
 	/// sqlite3 return status
 	int rc;
@@ -60,9 +60,10 @@ int createobdtable(sqlite3 *db, void *obdcaps) {
 	if(0 == obdtable_rows) { // ie, if the table didn't exist
 
 		char create_stmt[4096] = "CREATE TABLE obd (";
-		for(i=0; i<sizeof(obdcmds_mode1)/sizeof(obdcmds_mode1[0]); i++) {
-			if(NULL != obdcmds_mode1[i].db_column && isobdcapabilitysupported(obdcaps,i)) {
-				strcat(create_stmt,obdcmds_mode1[i].db_column);
+		for(pid=obdcapset_next(&obdcaps->all,1,-1); pid>=0; pid=obdcapset_next(&obdcaps->all,1,pid)) {
+			struct obdservicecmd *cmd = obdGetCmdForPID(pid);
+			if(NULL != cmd && NULL != cmd->db_column) {
+				strcat(create_stmt,cmd->db_column);
 				strcat(create_stmt," REAL,");
 			}
 		}
@@ -77,31 +78,50 @@ int createobdtable(sqlite3 *db, void *obdcaps) {
 		}
 
 	} else { // If the table already existed
-		for(i=0; i<sizeof(obdcmds_mode1)/sizeof(obdcmds_mode1[0]); i++) {
-			if(NULL != obdcmds_mode1[i].db_column && isobdcapabilitysupported(obdcaps,i)) {
+		for(pid=obdcapset_next(&obdcaps->all,1,-1); pid>=0; pid=obdcapset_next(&obdcaps->all,1,pid)) {
+			struct obdservicecmd *cmd = obdGetCmdForPID(pid);
+			if(NULL != cmd && NULL != cmd->db_column) {
 				sqlite3_reset(pragma_stmt);
 				int found_row = 0;
 
 				while(SQLITE_ROW == sqlite3_step(pragma_stmt)) {
-					if(0 == strcmp(obdcmds_mode1[i].db_column ,sqlite3_column_text(pragma_stmt, 1))) {
+					if(0 == strcmp(cmd->db_column ,sqlite3_column_text(pragma_stmt, 1))) {
 						found_row = 1;
 					}
 				}
 
 				if(found_row) {
-					// printf("Found row %s already in database\n", obdcmds_mode1[i].db_column);
+					// printf("Found row %s already in database\n", cmd->db_column);
 				} else {
 					char sql[512];
-					snprintf(sql, sizeof(sql), "ALTER TABLE obd ADD %s REAL", obdcmds_mode1[i].db_column);
+					snprintf(sql, sizeof(sql), "ALTER TABLE obd ADD %s REAL", cmd->db_column);
 					if(SQLITE_OK != (rc = sqlite3_exec(db, sql, NULL, NULL, &errmsg))) {
-						fprintf(stderr, "Unable to add column %s to database (%i): %s\n", obdcmds_mode1[i].db_column, rc, errmsg);
+						fprintf(stderr, "Unable to add column %s to database (%i): %s\n", cmd->db_column, rc, errmsg);
 						sqlite3_free(errmsg);
 					} else {
-						printf("Added column %s to database\n", obdcmds_mode1[i].db_column);
+						printf("Added column %s to database\n", cmd->db_column);
 					}
 				}
 			}
 		}
+
+		// Databases from before each ECU got its own rows
+		sqlite3_reset(pragma_stmt);
+		int found_ecu = 0;
+		while(SQLITE_ROW == sqlite3_step(pragma_stmt)) {
+			if(0 == strcmp("ecu", sqlite3_column_text(pragma_stmt, 1))) {
+				found_ecu = 1;
+			}
+		}
+		if(!found_ecu) {
+			char sql[] = "ALTER TABLE obd ADD ecu INTEGER DEFAULT 0";
+			if(SQLITE_OK != (rc = sqlite3_exec(db, sql, NULL, NULL, &errmsg))) {
+				fprintf(stderr, "Unable to add column ecu to database (%i): %s\n", rc, errmsg);
+				sqlite3_free(errmsg);
+			} else {
+				printf("Added column ecu to database\n");
+			}
+		}
 	}
 
 	sqlite3_finalize(pragma_stmt);
@@ -124,25 +144,27 @@ int createobdtable(sqlite3 *db, void *obdcaps) {
 	return 0;
 }
  
-int createobdinsertstmt(sqlite3 *db,sqlite3_stmt **ret_stmt, void *obdcaps) {
+int createobdinsertstmt(sqlite3 *db,sqlite3_stmt **ret_stmt, const struct obdcapabilities *obdcaps) {
 		// TODO calculate buffer size and create correct sized one,
 		//   otherwise this could overflow if obdservicecommands contains a *lot* of non-NULL fields
 	int i;
+	int pid;
 
 	int columncount = 0;
 	char insert_sql[4096] = "INSERT INTO obd (";
-	for(i=0; i<sizeof(obdcmds_mode1)/sizeof(obdcmds_mode1[0]); i++) {
-		if(NULL != obdcmds_mode1[i].db_column  && isobdcapabilitysupported(obdcaps,i)) {
-			strcat(insert_sql,obdcmds_mode1[i].db_column);
+	for(pid=obdcapset_next(&obdcaps->all,1,-1); pid>=0; pid=obdcapset_next(&obdcaps->all,1,pid)) {
+		struct obdservicecmd *cmd = obdGetCmdForPID(pid);
+		if(NULL != cmd && NULL != cmd->db_column) {
+			strcat(insert_sql,cmd->db_column);
 			strcat(insert_sql,",");
 			columncount++;
 		}
 	}
-	strcat(insert_sql,"time,trip) VALUES (");
+	strcat(insert_sql,"time,trip,ecu) VALUES (");
 	for(i=0; i<columncount; i++) {
 		strcat(insert_sql,"?,");
 	}
-	strcat(insert_sql,"?,?)");
+	strcat(insert_sql,"?,?,?)");
 
 	columncount++; // for time
 	// printf("insert_sql:\n  %s\n", insert_sql);
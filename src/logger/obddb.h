@@ -26,10 +26,12 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "sqlite3.h"
 
+struct obdcapabilities;
+
 /// Create the obd table in the database
 /** \param obdcaps the obdcapabilities returned from getobdcapabilities
  */
-int createobdtable(sqlite3 *db, void *obdcaps);
+int createobdtable(sqlite3 *db, const struct obdcapabilities *obdcaps);
 
 /// Prepare the sqlite3 insert statement for the obd table
 /**
@@ -38,7 +40,7 @@ int createobdtable(sqlite3 *db, void *obdcaps);
  \param obdcaps the obdcapabilities returned from getobdcapabilities
  \return number of columns in the insert statement, or zero on fail
  */
-int createobdinsertstmt(sqlite3 *db, sqlite3_stmt **ret_stmt, void *obdcaps);
+int createobdinsertstmt(sqlite3 *db, sqlite3_stmt **ret_stmt, const struct obdcapabilities *obdcaps);
 
 /// Begin a transaction
 int obdbegintransaction(sqlite3 *db);
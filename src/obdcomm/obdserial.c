@@ -27,7 +27,9 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 #include "obdserial.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -45,6 +47,9 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 /// Handle to the serial log
 static FILE *seriallog = NULL;
 
+/// What the headers on replies look like. Set by obdenableheaders
+static enum obd_header_format obd_headers = OBD_HEADERS_NONE;
+
 /// Guess the baudrate
 /** return -1 on error, or baudrate on success */
 static long guessbaudrate(int fd);
@@ -58,20 +63,21 @@ static long upgradebaudrate(int fd, long baudrate_target, long current_baudrate)
 static void appendseriallog(const char *line, int out) {
 	if(NULL != seriallog) {
 		char timestr[200];
+		struct timeval tv;
 		time_t t;
 		struct tm *tmp;
 
-		t = time(NULL);
+		// Sub-second resolution so logs can be replayed with their original timing
+		gettimeofday(&tv, NULL);
+		t = tv.tv_sec;
 		tmp = localtime(&t);
 		if (tmp == NULL) {
 			snprintf(timestr, sizeof(timestr), "Unknown time");
-		}
-
-		if (strftime(timestr, sizeof(timestr), "%H:%M:%S", tmp) == 0) {
+		} else if (strftime(timestr, sizeof(timestr), "%H:%M:%S", tmp) == 0) {
 			snprintf(timestr, sizeof(timestr), "Unknown time");
 		}
 
-		fprintf(seriallog, "%s(%s): '%s'\n", timestr, out==SERIAL_OUT?"out":"in", line);
+		fprintf(seriallog, "%s.%06li(%s): '%s'\n", timestr, (long)tv.tv_usec, out==SERIAL_OUT?"out":"in", line);
 		fflush(seriallog);
 	}
 }
@@ -674,8 +680,86 @@ static enum obd_serial_status parseobdline(const char *line, unsigned int mode,
 }
 
 
-enum obd_serial_status getobdbytes(int fd, unsigned int mode, unsigned int cmd, int numbytes_expected,
-	unsigned int *retvals, unsigned int retvals_size, int *numbytes_returned, int quiet) {
+/// Parse a line that starts with a header
+/** Works out who it's from, then strips the header and the PCI byte or
+     checksum and parses what's left with parseobdline */
+static enum obd_serial_status parseheaderline(const char *line, unsigned int mode, unsigned int cmd,
+	struct obdecureply *reply, int quiet) {
+
+	int idlen; // Hex digits in the header
+	int has_pci; // Set if there's a CAN PCI byte after the header
+	int has_checksum; // Set if there's a checksum byte on the end
+	switch(obd_headers) {
+		case OBD_HEADERS_J1850:
+			idlen = 6; has_pci = 0; has_checksum = 1;
+			break;
+		case OBD_HEADERS_CAN11:
+			idlen = 3; has_pci = 1; has_checksum = 0;
+			break;
+		case OBD_HEADERS_CAN29:
+			idlen = 8; has_pci = 1; has_checksum = 0;
+			break;
+		default:
+			return OBD_UNPARSABLE;
+	}
+
+	// Spaces may or may not be on
+	char hex[256];
+	int n = 0;
+	const char *c;
+	for(c=line; '\0' != *c && n < sizeof(hex)-1; c++) {
+		if(' ' == *c) continue;
+		if(!isxdigit((unsigned char)*c)) {
+			if(!quiet)
+				fprintf(stderr, "Couldn't parse line for %02X %02X: %s\n", mode, cmd, line);
+			return OBD_UNPARSABLE;
+		}
+		hex[n++] = *c;
+	}
+	hex[n] = '\0';
+
+	if(n <= idlen + 2*has_pci + 2*has_checksum + 4 || 0 != (n - idlen) % 2) {
+		if(!quiet)
+			fprintf(stderr, "Couldn't parse line for %02X %02X: %s\n", mode, cmd, line);
+		return OBD_UNPARSABLE;
+	}
+
+	char id[9];
+	memcpy(id, hex, idlen);
+	id[idlen] = '\0';
+	unsigned long header = strtoul(id, NULL, 16);
+	reply->ecu = (OBD_HEADERS_J1850 == obd_headers)?(header & 0xFF):header;
+
+	char *payload = hex + idlen;
+	int payloadlen = n - idlen;
+	if(has_pci) {
+		unsigned int pci;
+		sscanf(payload, "%2x", &pci);
+		// Only single frames. Nothing in modes 01 or 02 needs more
+		if(0 != (pci & 0xF0) || 2*(int)(pci & 0x0F) > payloadlen - 2) {
+			if(!quiet)
+				fprintf(stderr, "Unsupported CAN frame for %02X %02X: %s\n", mode, cmd, line);
+			return OBD_UNPARSABLE;
+		}
+		payload += 2;
+		payloadlen = 2*(pci & 0x0F);
+	}
+	if(has_checksum) {
+		payloadlen -= 2;
+	}
+	payload[payloadlen] = '\0';
+
+	unsigned int vals_read;
+	enum obd_serial_status ret = parseobdline(payload, mode, cmd,
+		reply->bytes, OBD_MAXREPLYBYTES, &vals_read, quiet);
+	if(OBD_SUCCESS == ret) {
+		reply->numbytes = vals_read < OBD_MAXREPLYBYTES?vals_read:OBD_MAXREPLYBYTES;
+	}
+	return ret;
+}
+
+enum obd_serial_status getobdreplies(int fd, unsigned int mode, unsigned int cmd, int numresponses,
+	struct obdecureply *replies, int maxreplies, int *numreplies, int quiet) {
 
 	char sendbuf[20]; // Command to send
 	int sendbuflen; // Number of bytes in the send buffer
@@ -684,13 +768,15 @@ enum obd_serial_status getobdbytes(int fd, unsigned int mode, unsigned int cmd,
 
 	int nbytes; // Number of bytes read
 
+	*numreplies = 0;
+
 	if(mode == 0x03 || mode == 0x04) {
 		sendbuflen = snprintf(sendbuf,sizeof(sendbuf),"%02X" OBDCMD_NEWLINE, mode);
 	} else {
-		if(0 == numbytes_expected) {
+		if(0 == numresponses) {
 			sendbuflen = snprintf(sendbuf,sizeof(sendbuf),"%02X%02X" OBDCMD_NEWLINE, mode, cmd);
 		} else {
-			sendbuflen = snprintf(sendbuf,sizeof(sendbuf),"%02X%02X%01X" OBDCMD_NEWLINE, mode, cmd, numbytes_expected);
+			sendbuflen = snprintf(sendbuf,sizeof(sendbuf),"%02X%02X%01X" OBDCMD_NEWLINE, mode, cmd, numresponses);
 		}
 	}
 
@@ -736,44 +822,53 @@ enum obd_serial_status getobdbytes(int fd, unsigned int mode, unsigned int cmd,
 		2) For each line, if it's a regular line, parse it
 		3) If it has a colon near the start, it means it's a multi-line response
 		4) So go into crazy C string handling mode.
+		5) With headers on, each line is one ECU's whole reply
 	*/
 
 	char *line = strtok(retbuf, "\r\n>");
 
-	int values_returned = 0;
 	enum obd_serial_status ret = OBD_ERROR;
-	while(NULL != line) {
+	while(NULL != line && *numreplies < maxreplies) {
 		char *colon;
 		int joined_lines = 0; // Set if we joined some lines together
 		char longline[1024] = "\0"; // Catenate other lines into this
 
 		char *parseline = line; // The line to actually parse.
 
-		while(NULL != line && NULL != (colon = strstr(line, ":"))) {
+		while(OBD_HEADERS_NONE == obd_headers &&
+				NULL != line && NULL != (colon = strstr(line, ":"))) {
 			// printf("Colon line: %s\n", line);
 			strncat(longline, colon+1, sizeof(longline)-strlen(longline)-1);
 			parseline = longline;
 			joined_lines = 1;
 			line = strtok(NULL, "\r\n>");
 		}
+
 		// We gracefully handle these lines without
 		//   needing to actually parse them
-		if(3 >= strlen(parseline)) continue;
-
-		// printf("parseline: %s\n", parseline);
-
-		unsigned int local_rets[20];
-		unsigned int vals_read;
-
-		ret = parseobdline(parseline, mode, cmd,
-			local_rets, sizeof(local_rets)/sizeof(local_rets[0]), &vals_read, quiet);
+		if(3 < strlen(parseline)) {
+			// printf("parseline: %s\n", parseline);
+
+			struct obdecureply *reply = &replies[*numreplies];
+			memset(reply, 0, sizeof(*reply));
+
+			// Only complain about the first line. Anything after that is a bonus
+			int linequiet = quiet || *numreplies > 0;
+
+			if(OBD_HEADERS_NONE == obd_headers) {
+				unsigned int vals_read;
+				ret = parseobdline(parseline, mode, cmd,
+					reply->bytes, OBD_MAXREPLYBYTES, &vals_read, linequiet);
+				if(OBD_SUCCESS == ret) {
+					reply->numbytes = vals_read < OBD_MAXREPLYBYTES?vals_read:OBD_MAXREPLYBYTES;
+				}
+			} else {
+				ret = parseheaderline(parseline, mode, cmd, reply, linequiet);
+			}
 
-		if(OBD_SUCCESS == ret) {
-			int i;
-			for(i=0; i<vals_read; i++, values_returned++) {
-				retvals[values_returned] = local_rets[i];
+			if(OBD_SUCCESS == ret) {
+				(*numreplies)++;
 			}
-			break;
 		}
 
 		if(0 == joined_lines) {
@@ -781,33 +876,104 @@ enum obd_serial_status getobdbytes(int fd, unsigned int mode, unsigned int cmd,
 			line = strtok(NULL, "\r\n>");
 		}
 	}
-	*numbytes_returned = values_returned;
-	if(0 == values_returned) return ret;
+	if(0 == *numreplies) return ret;
 	return OBD_SUCCESS;
 }
 
-enum obd_serial_status getobdvalue(int fd, unsigned int cmd, float *ret, int numbytes, OBDConvFunc conv) {
-	int numbytes_returned;
-	unsigned int obdbytes[4];
+enum obd_serial_status getobdbytes(int fd, unsigned int mode, unsigned int cmd, int numbytes_expected,
+	unsigned int *retvals, unsigned int retvals_size, int *numbytes_returned, int quiet) {
 
-	enum obd_serial_status ret_status = getobdbytes(fd, 0x01, cmd, numbytes,
-		obdbytes, sizeof(obdbytes)/sizeof(obdbytes[0]), &numbytes_returned, 0);
+	struct obdecureply replies[OBD_MAXREPLIES];
+	int numreplies;
+
+	*numbytes_returned = 0;
 
-	if(OBD_SUCCESS != ret_status) return ret_status;
+	enum obd_serial_status ret = getobdreplies(fd, mode, cmd, numbytes_expected,
+		replies, sizeof(replies)/sizeof(replies[0]), &numreplies, quiet);
+	if(0 == numreplies) return ret;
 
+	// Whoever answered first
+	int i;
+	for(i=0; i<replies[0].numbytes && i<retvals_size; i++) {
+		retvals[i] = replies[0].bytes[i];
+	}
+	*numbytes_returned = i;
+	return OBD_SUCCESS;
+}
+
+float obdreplyvalue(const struct obdecureply *reply, OBDConvFunc conv) {
 	if(NULL == conv) {
 		int i;
-		*ret = 0;
-		for(i=0;i<numbytes_returned;i++) {
-			*ret = *ret * 256;
-			*ret = *ret + obdbytes[i];
+		float ret = 0;
+		for(i=0;i<reply->numbytes;i++) {
+			ret = ret * 256;
+			ret = ret + reply->bytes[i];
 		}
-	} else {
-		*ret = conv(obdbytes[0], obdbytes[1], obdbytes[2], obdbytes[3]);
+		return ret;
 	}
+	return conv(reply->bytes[0], reply->bytes[1], reply->bytes[2], reply->bytes[3]);
+}
+
+enum obd_serial_status getobdvalue(int fd, unsigned int cmd, float *ret, int numbytes, OBDConvFunc conv) {
+	struct obdecureply replies[OBD_MAXREPLIES];
+	int numreplies;
+
+	enum obd_serial_status ret_status = getobdreplies(fd, 0x01, cmd, numbytes,
+		replies, sizeof(replies)/sizeof(replies[0]), &numreplies, 0);
+
+	if(0 == numreplies) return ret_status;
+
+	*ret = obdreplyvalue(&replies[0], conv);
 	return OBD_SUCCESS;
 }
 
+enum obd_header_format obdenableheaders(int fd) {
+	char retbuf[4096];
+	enum obd_header_format format = OBD_HEADERS_NONE;
+
+	obd_headers = OBD_HEADERS_NONE;
+
+	// Which protocol. "A6" if it was found automatically
+	char dpn_cmd[] = "ATDPN" OBDCMD_NEWLINE;
+	appendseriallog(dpn_cmd, SERIAL_OUT);
+	if(write(fd, dpn_cmd, strlen(dpn_cmd)) < (int)strlen(dpn_cmd) ||
+			0 >= readserialdata(fd, retbuf, sizeof(retbuf))) {
+		return OBD_HEADERS_NONE;
+	}
+
+	char *p = retbuf;
+	while('\0' != *p && !isxdigit((unsigned char)*p)) p++;
+	if('A' == *p && isxdigit((unsigned char)p[1])) p++;
+
+	switch(*p) {
+		case '1': case '2': case '3': case '4': case '5':
+			format = OBD_HEADERS_J1850;
+			break;
+		case '6': case '8':
+			format = OBD_HEADERS_CAN11;
+			break;
+		case '7': case '9':
+			format = OBD_HEADERS_CAN29;
+			break;
+		default:
+			// J1939 and user CAN could be anything
+			return OBD_HEADERS_NONE;
+	}
+
+	char h_cmd[] = "ATH1" OBDCMD_NEWLINE;
+	appendseriallog(h_cmd, SERIAL_OUT);
+	if(write(fd, h_cmd, strlen(h_cmd)) < (int)strlen(h_cmd) ||
+			0 >= readserialdata(fd, retbuf, sizeof(retbuf))) {
+		return OBD_HEADERS_NONE;
+	}
+	if(NULL == strstr(retbuf, "OK")) {
+		return OBD_HEADERS_NONE;
+	}
+
+	obd_headers = format;
+	return format;
+}
+
 int getnumobderrors(int fd) {
 	int numbytes_returned;
 	unsigned int obdbytes[4];
@@ -37,9 +37,30 @@ enum obd_serial_status {
 	OBD_ERROR ///< Some other error
 };
 
+/// How replies are addressed. Set by obdenableheaders
+enum obd_header_format {
+	OBD_HEADERS_NONE, ///< Headers are off. Every reply looks like it's from ECU 0
+	OBD_HEADERS_J1850, ///< Three header bytes, source last, and a trailing checksum [J1850, ISO 9141, KWP]
+	OBD_HEADERS_CAN11, ///< An 11 bit CAN id, then a PCI byte
+	OBD_HEADERS_CAN29 ///< A 29 bit CAN id, then a PCI byte
+};
+
 /// The timeout for serial reads in general, measured in usec
 #define OBDCOMM_TIMEOUT 10000000l
 
+/// Most ECUs' replies kept from a single command
+#define OBD_MAXREPLIES 8
+
+/// Most data bytes kept from a single ECU's reply
+#define OBD_MAXREPLYBYTES 20
+
+/// One ECU's reply to a command
+struct obdecureply {
+	unsigned int ecu; ///< Who replied. The CAN id, or the J1850/ISO source address. 0 if headers are off
+	unsigned int bytes[OBD_MAXREPLYBYTES]; ///< Data bytes, after the mode and PID. Zero past numbytes
+	int numbytes; ///< Number of bytes filled in
+};
+
 /// Open the serial port and set appropriate options
 /**
  \param portfilename path and filename of the serial port
@@ -96,6 +117,32 @@ enum obd_serial_status getobdvalue(int fd, unsigned int cmd, float *ret, int num
 enum obd_serial_status getobdbytes(int fd, unsigned int mode, unsigned int cmd, int numbytes_expected,
         unsigned int *retvals, unsigned int retvals_size, int *numbytes_returned, int quiet);
 
+/// Turn on headers, so each ECU's replies can be told apart
+/** Asks which protocol is in use, then sends ATH1. After this every
+     function here understands headers.
+ \param fd the serial port opened with openserial
+ \return the header format, or OBD_HEADERS_NONE if they couldn't be turned on
+ */
+enum obd_header_format obdenableheaders(int fd);
+
+/// Get every ECU's reply to an OBD command
+/** Everything that answers in the same round trip is returned
+ \param fd the serial port opened with openserial
+ \param mode the obd service mode
+ \param cmd the obd service command
+ \param numresponses how many replies to wait for [optimisation]. Set to zero to wait for the timeout
+ \param replies array of maxreplies to fill
+ \param numreplies tells you how many of replies were filled
+ \param quiet set to not complain on stderr
+ \return something from the obd_serial_status enum
+*/
+enum obd_serial_status getobdreplies(int fd, unsigned int mode, unsigned int cmd, int numresponses,
+	struct obdecureply *replies, int maxreplies, int *numreplies, int quiet);
+
+/// Convert a reply to a value
+/** \param conv the convert function. If NULL, the bytes are read as one big-endian number */
+float obdreplyvalue(const struct obdecureply *reply, OBDConvFunc conv);
+
 /// Get the number of errors codes the car claims to currently have
 int getnumobderrors(int fd);
 
@@ -18,19 +18,123 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "obdservicecommands.h"
 #include "supportedcommands.h"
 #include "obdserial.h"
 
-/// Opaque structure. Don't ever use it, use iscapabilitysupported()
-/* This is likely to change. Don't ever use it.
- Internal note: things existing in this ordered linked list implies
- they're supported  */
-struct obdcapabilities {
-	unsigned int pid; //< The PID this is for
-	struct obdcapabilities *next; //< Linked lists suck.
-};
+/// Bits in each word of a struct obdcapset
+#define OBDCAPSET_WORDBITS 64
+
+/// Words per mode in a struct obdcapset
+#define OBDCAPSET_WORDS (OBDCAPSET_PIDS/OBDCAPSET_WORDBITS)
+
+#ifdef __GNUC__
+#define obdcapset_popcount(w) __builtin_popcountll(w)
+#define obdcapset_ctz(w) __builtin_ctzll(w)
+#else
+static int obdcapset_popcount(unsigned long long w) {
+	int n = 0;
+	for(; 0 != w; w &= w-1) n++;
+	return n;
+}
+
+static int obdcapset_ctz(unsigned long long w) {
+	int n = 0;
+	for(; 0 == (w & 1); w >>= 1) n++;
+	return n;
+}
+#endif //__GNUC__
+
+void obdcapset_clear(struct obdcapset *set) {
+	memset(set, 0, sizeof(*set));
+}
+
+void obdcapset_add(struct obdcapset *set, unsigned int mode, unsigned int pid) {
+	if(mode < 1 || mode > OBDCAPSET_MODES || pid >= OBDCAPSET_PIDS) return;
+	set->bits[mode-1][pid/OBDCAPSET_WORDBITS] |= 1ull << (pid%OBDCAPSET_WORDBITS);
+}
+
+int obdcapset_has(const struct obdcapset *set, unsigned int mode, unsigned int pid) {
+	if(mode < 1 || mode > OBDCAPSET_MODES || pid >= OBDCAPSET_PIDS) return 0;
+	return 0 != (set->bits[mode-1][pid/OBDCAPSET_WORDBITS] & (1ull << (pid%OBDCAPSET_WORDBITS)));
+}
+
+void obdcapset_addbitmap(struct obdcapset *set, unsigned int mode, unsigned int base,
+		unsigned long bitmap) {
+	int currbit;
+	unsigned int pid;
+	for(pid=base+1, currbit=31 ; currbit>=0 ; currbit--, pid++) {
+		if(bitmap & ((unsigned long)1<<currbit)) {
+			obdcapset_add(set, mode, pid);
+		}
+	}
+}
+
+void obdcapset_fromwishlist(struct obdcapset *set, struct obdservicecmd **wishlist) {
+	obdcapset_clear(set);
+
+	unsigned int mode;
+	int i;
+	for(mode=1;mode<=OBDCAPSET_MODES;mode++) {
+		if(NULL == wishlist) {
+			for(i=0;i<OBDCMDS_MODE1_COUNT-1;i++) {
+				obdcapset_add(set, mode, obdcmds_mode1[i].cmdid);
+			}
+		} else {
+			for(i=0;NULL != wishlist[i];i++) {
+				obdcapset_add(set, mode, wishlist[i]->cmdid);
+			}
+		}
+	}
+}
+
+void obdcapset_intersect(struct obdcapset *dst, const struct obdcapset *src) {
+	int m, w;
+	for(m=0;m<OBDCAPSET_MODES;m++) {
+		for(w=0;w<OBDCAPSET_WORDS;w++) {
+			dst->bits[m][w] &= src->bits[m][w];
+		}
+	}
+}
+
+void obdcapset_union(struct obdcapset *dst, const struct obdcapset *src) {
+	int m, w;
+	for(m=0;m<OBDCAPSET_MODES;m++) {
+		for(w=0;w<OBDCAPSET_WORDS;w++) {
+			dst->bits[m][w] |= src->bits[m][w];
+		}
+	}
+}
+
+int obdcapset_count(const struct obdcapset *set, unsigned int mode) {
+	if(mode < 1 || mode > OBDCAPSET_MODES) return 0;
+
+	int count = 0;
+	int w;
+	for(w=0;w<OBDCAPSET_WORDS;w++) {
+		count += obdcapset_popcount(set->bits[mode-1][w]);
+	}
+	return count;
+}
+
+int obdcapset_next(const struct obdcapset *set, unsigned int mode, int pid) {
+	if(mode < 1 || mode > OBDCAPSET_MODES) return -1;
+
+	int next = pid + 1;
+	if(next < 0) next = 0;
+	while(next < OBDCAPSET_PIDS) {
+		int w = next / OBDCAPSET_WORDBITS;
+		// Everything in this word from next upwards
+		unsigned long long word = set->bits[mode-1][w] >> (next % OBDCAPSET_WORDBITS);
+		if(0 != word) {
+			return next + obdcapset_ctz(word);
+		}
+		next = (w+1) * OBDCAPSET_WORDBITS;
+	}
+	return -1;
+}
 
 void printobdcapabilities(int obd_serial_port) {
 	if(-1 == obd_serial_port) {
@@ -41,14 +145,22 @@ void printobdcapabilities(int obd_serial_port) {
 	printf("Your OBD Device claims to support PIDs:\n");
 	printf("PID: [column] human_name\n");
 
-	struct obdcapabilities *caps = (struct obdcapabilities *)getobdcapabilities(obd_serial_port, NULL);
-	struct obdcapabilities *currcap;
-	for(currcap = caps; NULL != currcap; currcap = currcap->next) {
-		if(currcap->pid > sizeof(obdcmds_mode1)/sizeof(obdcmds_mode1[0])) {
-			printf("%02X: unknown\n", currcap->pid);
+	struct obdcapabilities *caps = getobdcapabilities(obd_serial_port, NULL);
+	int pid;
+	for(pid=obdcapset_next(&caps->all,1,-1); pid>=0; pid=obdcapset_next(&caps->all,1,pid)) {
+		struct obdservicecmd *cmd = obdGetCmdForPID(pid);
+		if(NULL == cmd) {
+			printf("%02X: unknown\n", pid);
 		} else {
-			const char *db_column = (NULL == obdcmds_mode1[currcap->pid].db_column)?"unknown":obdcmds_mode1[currcap->pid].db_column;
-			printf("%02X: [%s] %s\n", currcap->pid, db_column, obdcmds_mode1[currcap->pid].human_name);
+			const char *db_column = (NULL == cmd->db_column)?"unknown":cmd->db_column;
+			printf("%02X: [%s] %s\n", pid, db_column, cmd->human_name);
+		}
+	}
+
+	if(caps->ecu_count > 1) {
+		int i;
+		for(i=0;i<caps->ecu_count;i++) {
+			printf("ECU %X: %i PIDs\n", caps->ecuids[i], obdcapset_count(&caps->ecus[i], 1));
 		}
 	}
 
@@ -56,111 +168,80 @@ void printobdcapabilities(int obd_serial_port) {
 }
 
 /// Internal only.
-/** Assumes that caps already contains 0100, since that's hardcoded in by getobdcapabilities */
-void getobdcapabilities_guess(int obd_serial_port, struct obdservicecmd **wishlist, struct obdcapabilities *caps) {
+/** Asks for every PID in turn, and adds it for whichever ECUs answer */
+static void getobdcapabilities_guess(int obd_serial_port, struct obdcapabilities *caps) {
 	unsigned int currpid;
 
-	struct obdcapabilities *curr_cap = caps;
-
-	int bytes_returned;
-	enum obd_serial_status cap_status;
-	unsigned int obdbytes[4];
+	struct obdecureply replies[OBD_MAXREPLIES];
+	int numreplies;
 	
 	for(currpid = 0x01; currpid < 0x52; currpid++) {
-		cap_status = getobdbytes(obd_serial_port, 0x01, currpid, 0,
-			obdbytes, sizeof(obdbytes)/sizeof(obdbytes[0]), &bytes_returned, 1);
-
-		if(OBD_SUCCESS == cap_status && bytes_returned > 0) {
-			int in_wishlist = 1;
-			if(wishlist != NULL) {
-				in_wishlist = 0;
-				int i;
-				for(i=0;NULL != wishlist[i];i++) {
-					if(wishlist[i]->cmdid == currpid) {
-						in_wishlist = 1;
-						break;
-					}
-				}
-			}
-
-			if(in_wishlist) {
-				struct obdcapabilities *nextcap = (struct obdcapabilities *)malloc(sizeof(struct obdcapabilities));
-				nextcap->next = NULL;
-				nextcap->pid = currpid;
-				curr_cap->next = nextcap;
-				curr_cap = nextcap;
+		getobdreplies(obd_serial_port, 0x01, currpid, 0,
+			replies, sizeof(replies)/sizeof(replies[0]), &numreplies, 1);
+
+		int r;
+		for(r=0;r<numreplies;r++) {
+			struct obdcapset *set = obdcapabilities_ecu(caps, replies[r].ecu);
+			if(NULL != set && replies[r].numbytes > 0) {
+				obdcapset_add(set, 0x01, currpid);
 			}
 		}
 	}
 }
 
-void *getobdcapabilities(int obd_serial_port, struct obdservicecmd **wishlist) {
+struct obdcapabilities *getobdcapabilities(int obd_serial_port, struct obdservicecmd **wishlist) {
 	struct obdcapabilities *caps = (struct obdcapabilities *)malloc(sizeof(struct obdcapabilities));
-	caps->next = NULL;
-	caps->pid = 0x00;
-	struct obdcapabilities *curr_cap = caps;
+	if(NULL == caps) return NULL;
+	memset(caps, 0, sizeof(*caps));
 
-	unsigned int obdbytes[4];
-	int bytes_returned;
+	struct obdecureply replies[OBD_MAXREPLIES];
+	int numreplies;
 	enum obd_serial_status cap_status;
 	unsigned int current_cmd = 0x00;
 
-	// getobdcapabilities_guess(obd_serial_port, wishlist, caps);
-	// return caps;
-
 	// Set if we should try to guess, instead;
 	int must_guess = 0;
 
 	while(1) {
 
-		cap_status = getobdbytes(obd_serial_port, 0x01, current_cmd, 0,
-			obdbytes, sizeof(obdbytes)/sizeof(obdbytes[0]), &bytes_returned, 1);
+		cap_status = getobdreplies(obd_serial_port, 0x01, current_cmd, 0,
+			replies, sizeof(replies)/sizeof(replies[0]), &numreplies, 1);
+
+		int valid = 0; // Number of ECUs that sent a whole bitmap
+		int anything = 0; // Set if any ECU claims any PID
+		int more = 0; // Set if any ECU has more PIDs past this block
+		int r;
+		for(r=0;OBD_SUCCESS == cap_status && r<numreplies;r++) {
+			if(4 != replies[r].numbytes) continue;
+			valid++;
+
+			unsigned long val;
+			val = (unsigned long)replies[r].bytes[0]*(256*256*256) +
+				(unsigned long)replies[r].bytes[1]*(256*256) +
+				(unsigned long)replies[r].bytes[2]*(256) +
+				(unsigned long)replies[r].bytes[3];
+
+			if(0 != val) anything = 1;
+			if(val & 0x01) more = 1;
+
+			struct obdcapset *set = obdcapabilities_ecu(caps, replies[r].ecu);
+			if(NULL != set) {
+				obdcapset_addbitmap(set, 0x01, current_cmd, val);
+			}
+		}
 
-		if(OBD_SUCCESS != cap_status || 4 != bytes_returned) {
+		if(0 == valid) {
 			fprintf(stderr, "Couldn't get obd bytes for cmd %02X\n", current_cmd);
-			return caps;
+			break;
 		}
 
-		unsigned long val;
-		val = (unsigned long)obdbytes[0]*(256*256*256) +
-			(unsigned long)obdbytes[1]*(256*256) +
-			(unsigned long)obdbytes[2]*(256) +
-			(unsigned long)obdbytes[3];
-
-		if(0x00 == current_cmd && 0 == val) {
+		if(0x00 == current_cmd && !anything) {
 			// If this is 0x20, then the car must have provided *something*
 			must_guess = 1;
 			break;
 		}
 
-		int currbit;
-		int c;
-		for(c=current_cmd+1, currbit=31 ; currbit>=0 ; currbit--, c++) {
-			// "cleaner" would be to set wishlist to be the whole obdcmd list and do the search
-			//  But no point for the actual logic we need, here.
-			int in_wishlist = 1;
-			if(wishlist != NULL) {
-				in_wishlist = 0;
-				int i;
-				for(i=0;NULL != wishlist[i];i++) {
-					if(wishlist[i]->cmdid == c) {
-						in_wishlist = 1;
-						break;
-					}
-				}
-			}
-			if(val & ((unsigned long)1<<currbit)) {
-				if(in_wishlist) {
-					struct obdcapabilities *nextcap = (struct obdcapabilities *)malloc(sizeof(struct obdcapabilities));
-					nextcap->next = NULL;
-					nextcap->pid = c;
-					curr_cap->next = nextcap;
-					curr_cap = nextcap;
-				}
-			}
-		}
-
-		if(obdbytes[3]&0x01) {
+		if(more && current_cmd < 0xE0) {
 			current_cmd += 0x20;
 		} else {
 			break;
@@ -169,28 +250,64 @@ void *getobdcapabilities(int obd_serial_port, struct obdservicecmd **wishlist) {
 
 	if(must_guess) {
 		fprintf(stderr, "Warning: Car reported no PIDs supported. Experimentally guessing instead\n");
-		getobdcapabilities_guess(obd_serial_port, wishlist, caps);
+		getobdcapabilities_guess(obd_serial_port, caps);
+	}
+
+	// Something must have answered 0100, or we wouldn't have got this far
+	if(0 == caps->ecu_count) {
+		obdcapabilities_ecu(caps, 0);
+	}
+
+	struct obdcapset wished;
+	obdcapset_fromwishlist(&wished, wishlist);
+
+	int i;
+	for(i=0;i<caps->ecu_count;i++) {
+		if(NULL != wishlist) {
+			obdcapset_intersect(&caps->ecus[i], &wished);
+		}
+		obdcapset_add(&caps->ecus[i], 0x01, 0x00);
 	}
 
+	obdcapabilities_merge(caps);
 	return caps;
 }
 
-void freeobdcapabilities(void *caps) {
-	struct obdcapabilities *freeme = (struct obdcapabilities *)caps;
-	do {
-		struct obdcapabilities *next = freeme->next;
-		free(freeme);
-		freeme = next;
-	} while(NULL != freeme);
+void freeobdcapabilities(struct obdcapabilities *caps) {
+	free(caps);
 }
 
-int isobdcapabilitysupported(void *caps, const unsigned int pid) {
-	struct obdcapabilities *currcap = (struct obdcapabilities *)caps;
+struct obdcapset *obdcapabilities_ecu(struct obdcapabilities *caps, unsigned int ecuid) {
+	int i;
+	for(i=0;i<caps->ecu_count;i++) {
+		if(ecuid == caps->ecuids[i]) return &caps->ecus[i];
+	}
+	if(caps->ecu_count >= OBDCAPABILITIES_MAXECUS) return NULL;
+
+	i = caps->ecu_count++;
+	caps->ecuids[i] = ecuid;
+	obdcapset_clear(&caps->ecus[i]);
+	return &caps->ecus[i];
+}
+
+void obdcapabilities_merge(struct obdcapabilities *caps) {
+	obdcapset_clear(&caps->all);
+	int i;
+	for(i=0;i<caps->ecu_count;i++) {
+		obdcapset_union(&caps->all, &caps->ecus[i]);
+	}
+}
 
-	for(; NULL != currcap; currcap = currcap->next) {
-		if(pid == currcap->pid) return 1;
-		if(pid < currcap->pid) break; // They're stored in order
+int obdcapabilities_ecusfor(const struct obdcapabilities *caps, unsigned int mode, unsigned int pid) {
+	int count = 0;
+	int i;
+	for(i=0;i<caps->ecu_count;i++) {
+		count += obdcapset_has(&caps->ecus[i], mode, pid);
 	}
-	return 0;
+	return count;
+}
+
+int isobdcapabilitysupported(const struct obdcapabilities *caps, const unsigned int pid) {
+	return obdcapset_has(&caps->all, 0x01, pid);
 }
 
@@ -21,25 +21,106 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "obdservicecommands.h"
 
+/// Modes a capability set covers, starting at mode 01
+#define OBDCAPSET_MODES 2
+
+/// PIDs a capability set covers in each mode
+#define OBDCAPSET_PIDS 256
+
+/// Most ECUs whose capabilities are kept separately
+#define OBDCAPABILITIES_MAXECUS 8
+
+/// A set of supported PIDs in modes 01 and 02
+/** Fixed size and no pointers, so it can live on the stack and be copied
+     with =. Treat it as opaque and use the obdcapset_ functions */
+struct obdcapset {
+	unsigned long long bits[OBDCAPSET_MODES][OBDCAPSET_PIDS/64]; //< Bit pid%64 of bits[mode-1][pid/64]
+};
+
+/// Everything a vehicle claims to support
+struct obdcapabilities {
+	struct obdcapset all; //< Union of every ECU's set
+	int ecu_count; //< Number of ECUs in ecus
+	unsigned int ecuids[OBDCAPABILITIES_MAXECUS]; //< The header each ECU answers from. 0 if unknown
+	struct obdcapset ecus[OBDCAPABILITIES_MAXECUS]; //< What each ECU claims
+};
+
+/// Empty a set
+void obdcapset_clear(struct obdcapset *set);
+
+/// Add a PID to a set
+/** Modes and PIDs out of range are ignored */
+void obdcapset_add(struct obdcapset *set, unsigned int mode, unsigned int pid);
+
+/// Find out if a PID is in a set
+/** \return 1 for "yes", 0 for "no" */
+int obdcapset_has(const struct obdcapset *set, unsigned int mode, unsigned int pid);
+
+/// Add the PIDs from a "PIDs supported" reply
+/** \param set the set to add to
+    \param mode the mode the reply was for
+    \param base the PID asked for; 0x00, 0x20, 0x40...
+    \param bitmap the four bytes returned, A in the top byte. Bit 31 is PID base+1
+ */
+void obdcapset_addbitmap(struct obdcapset *set, unsigned int mode, unsigned int base,
+	unsigned long bitmap);
+
+/// Make a set of every PID in a wishlist, in every mode
+/** \param wishlist NULL-sentinel'd list of PIDs. If NULL, every PID in obdcmds_mode1 */
+void obdcapset_fromwishlist(struct obdcapset *set, struct obdservicecmd **wishlist);
+
+/// Remove everything from dst that isn't also in src
+void obdcapset_intersect(struct obdcapset *dst, const struct obdcapset *src);
+
+/// Add everything in src to dst
+void obdcapset_union(struct obdcapset *dst, const struct obdcapset *src);
+
+/// Count the PIDs in a set for one mode
+int obdcapset_count(const struct obdcapset *set, unsigned int mode);
+
+/// Walk the PIDs in a set, in order
+/** for(pid=obdcapset_next(set,1,-1); pid>=0; pid=obdcapset_next(set,1,pid))
+    \param pid the last PID returned, or -1 to start
+    \return the next PID in the set after pid, or -1 if there are no more
+ */
+int obdcapset_next(const struct obdcapset *set, unsigned int mode, int pid);
+
+
 /// Print the capabilities this device claims
 void printobdcapabilities(int obd_serial_port);
 
 /// Get the capabilities this device claims
-/** Be sure to pass the return value to freecapabilities when you're done
+/** Be sure to pass the return value to freecapabilities when you're done.
+  Only mode 01 is asked for. If obdenableheaders has been called, each
+   ECU that answers gets its own set.
   \param wishlist NULL-sentinel'd list of PIDs. If NULL, assume they want to search all obd obdcmds
-  \return an opaque type you then pass to iscapabilitysupported
+  \return what's supported, intersected with the wishlist
   */
-void *getobdcapabilities(int obd_serial_port, struct obdservicecmd **wishlist);
+struct obdcapabilities *getobdcapabilities(int obd_serial_port, struct obdservicecmd **wishlist);
 
 /// Free the values returned from getcapabilities
-void freeobdcapabilities(void *caps);
+void freeobdcapabilities(struct obdcapabilities *caps);
+
+/// Get the set for one ECU, adding it if it isn't there yet
+/** Call obdcapabilities_merge once you've finished filling it
+    \param caps the capabilities to look in
+    \param ecuid the header the ECU answers from
+    \return the ECU's set, or NULL if there's no room for another ECU
+ */
+struct obdcapset *obdcapabilities_ecu(struct obdcapabilities *caps, unsigned int ecuid);
+
+/// Recompute the union of every ECU's set
+void obdcapabilities_merge(struct obdcapabilities *caps);
+
+/// Count the ECUs that support a PID
+int obdcapabilities_ecusfor(const struct obdcapabilities *caps, unsigned int mode, unsigned int pid);
 
 /// Find out if a pid is supported
 /** \param caps the value returned by getcapabilities
     \param pid the PID we want to know if it's supported
-	\return 1 for "yes", 0 for "no".
+	\return 1 for "yes", 0 for "no". Mode 01, by any ECU
  */
-int isobdcapabilitysupported(void *caps, const unsigned int pid);
+int isobdcapabilitysupported(const struct obdcapabilities *caps, const unsigned int pid);
 
 #endif // __SUPPORTEDCOMMANDS_H
 
@@ -0,0 +1,268 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** \file
+ \brief Generate obdcmds_mode1 and everything derived from it
+
+ Run at build time on obdpids.def. Writes three files to the directory
+ given on the commandline:
+  obdpids.c     the obdcmds_mode1 table
+  obdpidinfo.h  sizes and bitmaps derived from the table
+  obdpidindex.h a direct index from PID to row, and a perfect hash
+                from column name to row
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "obdcolumnhash.h"
+
+/// One row of obdpids.def, as values and as the text it was written as
+struct pidrow {
+	unsigned int pid; //< PID
+	int bytes; //< Bytes returned
+	const char *db_column; //< Column name, or NULL
+	const char *src_db_column; //< Column name as written
+	const char *src_human_name; //< Human name as written
+	const char *src_min; //< Min value as written
+	const char *src_max; //< Max value as written
+	const char *src_units; //< Units as written
+	const char *src_conv; //< Conversion function name
+	const char *src_convrev; //< Reverse conversion function name
+};
+
+#define OBDPID(pid, bytes, db_column, human_name, min, max, units, conv, convrev) \
+	{ pid, bytes, db_column, #db_column, #human_name, #min, #max, #units, #conv, #convrev },
+
+/// Every row in obdpids.def
+static const struct pidrow rows[] = {
+#include "obdpids.def"
+};
+
+#undef OBDPID
+
+/// Number of rows in obdpids.def. The table gets one more, as a terminator
+#define ROWCOUNT ((int)(sizeof(rows)/sizeof(rows[0])))
+
+/// Give up on a hash size after trying this many seeds
+#define GENOBDPIDS_MAXSEEDS 1000000
+
+/// Try to place every column with this seed
+/** \return 0 if every column got its own slot */
+static int try_seed(unsigned int seed, short *table, int size) {
+	int i;
+	for(i=0;i<size;i++) table[i] = -1;
+
+	for(i=0;i<ROWCOUNT;i++) {
+		const char *col = rows[i].db_column;
+		if(NULL == col) continue;
+
+		int slot = obdcolumnhash(col, seed) & (size-1);
+		if(-1 == table[slot]) {
+			table[slot] = i;
+		} else if(0 != strcmp(col, rows[table[slot]].db_column)) {
+			return 1;
+		}
+		// Else a repeated column name; the first one wins, as it always has
+	}
+	return 0;
+}
+
+/// Print an array of shorts, sixteen to a line
+static void print_table(FILE *f, const char *name, const short *table, int size) {
+	int i;
+	fprintf(f, "static const short %s[%i] = {", name, size);
+	for(i=0;i<size;i++) {
+		fprintf(f, "%s%i%s", 0==i%16?"\n\t":"", table[i], i<size-1?", ":"");
+	}
+	fprintf(f, "\n};\n\n");
+}
+
+/// Open dir/name for writing
+static FILE *open_output(const char *dir, const char *name) {
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	FILE *f = fopen(path, "w");
+	if(NULL == f) {
+		perror(path);
+	}
+	return f;
+}
+
+/// Close a file, and complain if anything went wrong writing it
+static int close_output(FILE *f, const char *name) {
+	if(ferror(f) || 0 != fclose(f)) {
+		fprintf(stderr, "Error writing %s\n", name);
+		return 1;
+	}
+	return 0;
+}
+
+/// Write the table itself
+static int write_table(const char *dir) {
+	FILE *f = open_output(dir, "obdpids.c");
+	if(NULL == f) return 1;
+
+	fprintf(f, "/* Generated by genobdpids from obdpids.def. Do not edit */\n\n");
+	fprintf(f, "#include \"obdservicecommands.h\"\n\n");
+	fprintf(f, "struct obdservicecmd obdcmds_mode1[OBDCMDS_MODE1_COUNT] = {\n");
+	int i;
+	for(i=0;i<ROWCOUNT;i++) {
+		const struct pidrow *r = &rows[i];
+		fprintf(f, "\t{ 0x%02X, %i, %s, %s, %s, %s, %s, %s, %s },\n",
+			r->pid, r->bytes, r->src_db_column, r->src_human_name,
+			r->src_min, r->src_max, r->src_units, r->src_conv, r->src_convrev);
+	}
+	fprintf(f, "\t{ 0x00, 0, NULL, NULL, 0, 0, NULL, NULL, NULL }\n");
+	fprintf(f, "};\n\n");
+
+	return close_output(f, "obdpids.c");
+}
+
+/// Write sizes and bitmaps
+static int write_info(const char *dir) {
+	FILE *f = open_output(dir, "obdpidinfo.h");
+	if(NULL == f) return 1;
+
+	int columns = 0;
+	int maxbytes = 0;
+	int maxcolumnlen = 0;
+	unsigned int maxpid = 0;
+	unsigned int bitmaps[8];
+	memset(bitmaps, 0, sizeof(bitmaps));
+
+	int i;
+	for(i=0;i<ROWCOUNT;i++) {
+		const struct pidrow *r = &rows[i];
+		if(NULL != r->db_column) {
+			columns++;
+			if((int)strlen(r->db_column) > maxcolumnlen) maxcolumnlen = strlen(r->db_column);
+		}
+		if(r->bytes > maxbytes) maxbytes = r->bytes;
+		if(r->pid > maxpid) maxpid = r->pid;
+		// Bitmaps as mode 01 PIDs 00, 20, 40... would report them
+		if(r->pid > 0 && r->pid <= 0x100) {
+			bitmaps[(r->pid-1)/32] |= 1u << (31 - (r->pid-1)%32);
+		}
+	}
+
+	fprintf(f, "/* Generated by genobdpids from obdpids.def. Do not edit */\n\n");
+	fprintf(f, "#ifndef __OBDPIDINFO_H\n#define __OBDPIDINFO_H\n\n");
+	fprintf(f, "/// Number of rows in obdcmds_mode1, including the terminator\n");
+	fprintf(f, "#define OBDCMDS_MODE1_COUNT %i\n\n", ROWCOUNT+1);
+	fprintf(f, "/// Number of rows in obdcmds_mode1 with a db_column\n");
+	fprintf(f, "#define OBDCMDS_MODE1_COLUMNS %i\n\n", columns);
+	fprintf(f, "/// Length of the longest db_column, not including the nul\n");
+	fprintf(f, "#define OBDCMDS_MODE1_MAXCOLUMNLEN %i\n\n", maxcolumnlen);
+	fprintf(f, "/// Most bytes returned by any PID\n");
+	fprintf(f, "#define OBDCMDS_MODE1_MAXBYTES %i\n\n", maxbytes);
+	fprintf(f, "/// Highest PID in obdcmds_mode1\n");
+	fprintf(f, "#define OBDCMDS_MODE1_MAXPID 0x%02X\n\n", maxpid);
+	fprintf(f, "/// PIDs in obdcmds_mode1, as mode 01 PID n would report them\n");
+	for(i=0;i<8;i++) {
+		fprintf(f, "#define OBDCMDS_MODE1_PIDS_%02X 0x%08Xu\n", i*0x20, bitmaps[i]);
+	}
+	fprintf(f, "\n#endif // __OBDPIDINFO_H\n");
+
+	return close_output(f, "obdpidinfo.h");
+}
+
+/// Write the lookup indexes
+static int write_index(const char *dir) {
+	// Direct index from PID. Repeated PIDs are found at their first row
+	short pidindex[0x100];
+	int i;
+	for(i=0;i<0x100;i++) pidindex[i] = -1;
+	for(i=0;i<ROWCOUNT;i++) {
+		unsigned int pid = rows[i].pid;
+		if(pid < 0x100 && -1 == pidindex[pid]) {
+			pidindex[pid] = i;
+		}
+	}
+
+	// Smallest power of two with room for every column twice over, then
+	//  bigger until a seed works
+	int columns = 0;
+	for(i=0;i<ROWCOUNT;i++) {
+		if(NULL != rows[i].db_column) columns++;
+	}
+	int size = 1;
+	while(size < 2*columns) size *= 2;
+
+	short *hashtable = NULL;
+	unsigned int seed = 0;
+	int found = 0;
+	while(!found && size <= 0x10000) {
+		hashtable = (short *)realloc(hashtable, size * sizeof(short));
+		for(seed=0;seed<GENOBDPIDS_MAXSEEDS;seed++) {
+			if(0 == try_seed(seed, hashtable, size)) {
+				found = 1;
+				break;
+			}
+		}
+		if(!found) size *= 2;
+	}
+	if(!found) {
+		fprintf(stderr, "Couldn't find a perfect hash for %i columns\n", columns);
+		free(hashtable);
+		return 1;
+	}
+
+	FILE *f = open_output(dir, "obdpidindex.h");
+	if(NULL == f) {
+		free(hashtable);
+		return 1;
+	}
+
+	fprintf(f, "/* Generated by genobdpids from obdpids.def. Do not edit */\n\n");
+	fprintf(f, "#ifndef __OBDPIDINDEX_H\n#define __OBDPIDINDEX_H\n\n");
+	fprintf(f, "/// Row in obdcmds_mode1 for each PID, or -1\n");
+	print_table(f, "obdpid_index", pidindex, 0x100);
+	fprintf(f, "/// Seed for obdcolumnhash that gives every column its own slot\n");
+	fprintf(f, "#define OBDCOLUMN_HASHSEED %uu\n\n", seed);
+	fprintf(f, "/// Number of slots in obdcolumn_hash. Always a power of two\n");
+	fprintf(f, "#define OBDCOLUMN_HASHSIZE %i\n\n", size);
+	fprintf(f, "/// Row in obdcmds_mode1 for each hash slot, or -1\n");
+	print_table(f, "obdcolumn_hash", hashtable, size);
+	fprintf(f, "#endif // __OBDPIDINDEX_H\n");
+
+	free(hashtable);
+	return close_output(f, "obdpidindex.h");
+}
+
+int main(int argc, char **argv) {
+	if(argc < 2) {
+		fprintf(stderr, "Usage: %s <output directory>\n", argv[0]);
+		return 1;
+	}
+
+	int i;
+	for(i=1;i<ROWCOUNT;i++) {
+		if(rows[i].pid < rows[i-1].pid) {
+			fprintf(stderr, "obdpids.def isn't sorted at PID %02X\n", rows[i].pid);
+			return 1;
+		}
+	}
+
+	if(0 != write_table(argv[1])) return 1;
+	if(0 != write_info(argv[1])) return 1;
+	if(0 != write_index(argv[1])) return 1;
+	return 0;
+}
+
@@ -0,0 +1,42 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** \file
+ \brief Hash used to look up OBD service commands by column name
+ */
+#ifndef __OBDCOLUMNHASH_H
+#define __OBDCOLUMNHASH_H
+
+/// FNV-1a, starting from seed instead of the usual offset basis
+/** genobdpids searches for a seed that puts every column in its own
+     slot, so the lookup is one hash and one strcmp */
+static unsigned int obdcolumnhash(const char *s, unsigned int seed) {
+	unsigned int h = 2166136261u ^ seed;
+	for(;'\0' != *s;s++) {
+		h ^= (unsigned char)*s;
+		h *= 16777619u;
+	}
+	// FNV's low bits only depend on the low bits of the seed; mix the rest in
+	h ^= h >> 16;
+	h *= 0x45D9F3Bu;
+	h ^= h >> 16;
+	return h;
+}
+
+#endif // __OBDCOLUMNHASH_H
+
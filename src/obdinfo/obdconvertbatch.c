@@ -0,0 +1,177 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/** \file
+ \brief Convert many samples of one PID at once
+*/
+
+#include "obdconvertbatch.h"
+#include "obdconvertfunctions.h"
+#include "obdservicecommands.h"
+
+/// One conversion, and its reverse, as a straight line
+/** value = ((raw + pre) * mul) / div + post
+    raw = (long)(((value + revpre) * revmul) / revdiv) + revpost
+    where raw is A, or A*256+B. Multiplying or dividing by one and adding
+    zero are exact, so a single form matches every function bit for bit */
+struct obdlinearconv {
+	OBDConvFunc conv; //< Single-sample function this stands in for
+	OBDConvRevFunc convrev; //< Single-sample reverse function this stands in for
+	int bytes; //< 1 if raw is A, 2 if raw is A*256+B
+	float pre; //< Added to raw first
+	float mul; //< Then multiplied by this
+	float div; //< Then divided by this
+	float post; //< Then this is added
+	float revpre; //< Added to value first
+	float revmul; //< Then multiplied by this
+	float revdiv; //< Then divided by this
+	long revpost; //< Added after truncating to an integer
+};
+
+#define OBDLINEAR(fn, bytes, pre, mul, div, post, revpre, revmul, revdiv, revpost) \
+	{ obdConvert_##fn, obdRevConvert_##fn, bytes, pre, mul, div, post, revpre, revmul, revdiv, revpost }
+
+/// Every function in obdconvertfunctions.c and obdrevconvertfunctions.c
+/** If you change one of those, change it here too. convertbench
+     checks these against them for every possible input */
+static const struct obdlinearconv obdlinearconvs[] = {
+	OBDLINEAR(04,    1,    0.0f, 100.0f,      255.0f,    0.0f,     0.0f, 255.0f,  100.0f,        0),
+	OBDLINEAR(05,    1,    0.0f,   1.0f,        1.0f,  -40.0f,    40.0f,   1.0f,    1.0f,        0),
+	OBDLINEAR(06_09, 1, -128.0f, 100.0f,      128.0f,    0.0f,     0.0f, 128.0f,  100.0f,      128),
+	OBDLINEAR(0A,    1,    0.0f,   3.0f,        1.0f,    0.0f,     0.0f,   1.0f,    3.0f,        0),
+	OBDLINEAR(0B,    1,    0.0f,   1.0f,        1.0f,    0.0f,     0.0f,   1.0f,    1.0f,        0),
+	OBDLINEAR(0C,    2,    0.0f,   1.0f,        4.0f,    0.0f,     0.0f,   4.0f,    1.0f,        0),
+	OBDLINEAR(0D,    1,    0.0f,   1.0f,        1.0f,    0.0f,     0.0f,   1.0f,    1.0f,        0),
+	OBDLINEAR(0E,    1,    0.0f,   1.0f,        2.0f,  -64.0f,    64.0f,   2.0f,    1.0f,        0),
+	OBDLINEAR(0F,    1,    0.0f,   1.0f,        1.0f,  -40.0f,    40.0f,   1.0f,    1.0f,        0),
+	OBDLINEAR(10,    2,    0.0f,   1.0f,      100.0f,    0.0f,     0.0f, 100.0f,    1.0f,        0),
+	OBDLINEAR(11,    1,    0.0f, 100.0f,      255.0f,    0.0f,     0.0f, 255.0f,  100.0f,        0),
+	OBDLINEAR(14_1B, 1,    0.0f,   0.005f,      1.0f,    0.0f,     0.0f,   1.0f,    0.005f,      0),
+	OBDLINEAR(1F,    2,    0.0f,   1.0f,        1.0f,    0.0f,     0.0f,   1.0f,    1.0f,        0),
+	OBDLINEAR(21,    2,    0.0f,   1.0f,        1.0f,    0.0f,     0.0f,   1.0f,    1.0f,        0),
+	OBDLINEAR(22,    2,    0.0f,   0.079f,      1.0f,    0.0f,     0.0f,   1.0f,    0.079f,      0),
+	OBDLINEAR(23,    2,    0.0f,  10.0f,        1.0f,    0.0f,     0.0f,   1.0f,   10.0f,        0),
+	OBDLINEAR(24_2B, 2,    0.0f,   0.0000305f,  1.0f,    0.0f,     0.0f,   1.0f,    0.0000305f,  0),
+	OBDLINEAR(2C,    1,    0.0f, 100.0f,      255.0f,    0.0f,     0.0f, 255.0f,  100.0f,        0),
+	OBDLINEAR(2D,    1,    0.0f,   0.78125f,    1.0f, -100.0f,   100.0f,   1.0f,    0.78125f,    0),
+	OBDLINEAR(2E,    1,    0.0f, 100.0f,      255.0f,    0.0f,     0.0f, 255.0f,  100.0f,        0),
+	OBDLINEAR(2F,    1,    0.0f, 100.0f,      255.0f,    0.0f,     0.0f, 255.0f,  100.0f,        0),
+	OBDLINEAR(30,    1,    0.0f,   1.0f,        1.0f,    0.0f,     0.0f,   1.0f,    1.0f,        0),
+	OBDLINEAR(31,    2,    0.0f,   1.0f,        1.0f,    0.0f,     0.0f,   1.0f,    1.0f,        0),
+	OBDLINEAR(32,    2,    0.0f,   1.0f,        4.0f, -8192.0f, 8192.0f,   4.0f,    1.0f,        0),
+	OBDLINEAR(33,    1,    0.0f,   1.0f,        1.0f,    0.0f,     0.0f,   1.0f,    1.0f,        0),
+	OBDLINEAR(34_3B, 2,    0.0f,   0.0000305f,  1.0f,    0.0f,     0.0f,   1.0f,    0.0000305f,  0),
+	OBDLINEAR(3C_3F, 2,    0.0f,   1.0f,       10.0f,  -40.0f,    40.0f,  10.0f,    1.0f,        0),
+	OBDLINEAR(42,    2,    0.0f,   1.0f,     1000.0f,    0.0f,     0.0f, 1000.0f,   1.0f,        0),
+	OBDLINEAR(43,    2,    0.0f, 100.0f,      255.0f,    0.0f,     0.0f, 255.0f,  100.0f,        0),
+	OBDLINEAR(44,    2,    0.0f,   0.0000305f,  1.0f,    0.0f,     0.0f,   1.0f,    0.0000305f,  0),
+	OBDLINEAR(45,    1,    0.0f, 100.0f,      255.0f,    0.0f,     0.0f, 255.0f,  100.0f,        0),
+	OBDLINEAR(46,    1,    0.0f,   1.0f,        1.0f,  -40.0f,    40.0f,   1.0f,    1.0f,        0),
+	OBDLINEAR(47_4B, 1,    0.0f, 100.0f,      255.0f,    0.0f,     0.0f, 255.0f,  100.0f,        0),
+	OBDLINEAR(4C,    1,    0.0f, 100.0f,      255.0f,    0.0f,     0.0f, 255.0f,  100.0f,        0),
+	OBDLINEAR(4D,    2,    0.0f,   1.0f,        1.0f,    0.0f,     0.0f,   1.0f,    1.0f,        0),
+	OBDLINEAR(4E,    2,    0.0f,   1.0f,        1.0f,    0.0f,     0.0f,   1.0f,    1.0f,        0),
+	OBDLINEAR(52,    1,    0.0f, 100.0f,      255.0f,    0.0f,     0.0f, 255.0f,  100.0f,        0),
+};
+
+/// Find the straight line for this PID
+/** A short scan, but it's once per batch rather than once per sample */
+static const struct obdlinearconv *obdbatch_find(unsigned int pid) {
+	struct obdservicecmd *cmd = obdGetCmdForPID(pid);
+	if(NULL == cmd || NULL == cmd->conv) return NULL;
+
+	size_t i;
+	for(i=0;i<sizeof(obdlinearconvs)/sizeof(obdlinearconvs[0]);i++) {
+		const struct obdlinearconv *l = &obdlinearconvs[i];
+		if(l->conv == cmd->conv && l->convrev == cmd->convrev) {
+			return l;
+		}
+	}
+	return NULL;
+}
+
+int obdHasConvertBatch(unsigned int pid) {
+	return NULL != obdbatch_find(pid);
+}
+
+/// Forward conversion loops, for whichever type out is
+/** Kept free of calls and branches so they vectorise. The expression
+     is float throughout, so a double out is widened after rounding */
+#define OBDBATCH_CONVERT(l, raw, stride, out, count) do { \
+	const float pre = (l)->pre; \
+	const float mul = (l)->mul; \
+	const float div = (l)->div; \
+	const float post = (l)->post; \
+	size_t i; \
+	if(1 == (l)->bytes) { \
+		for(i=0;i<(count);i++) { \
+			float r = (float)(raw)[i*(stride)]; \
+			(out)[i] = ((r + pre) * mul) / div + post; \
+		} \
+	} else { \
+		for(i=0;i<(count);i++) { \
+			float r = (float)((raw)[i*(stride)] * 256 + (raw)[i*(stride)+1]); \
+			(out)[i] = ((r + pre) * mul) / div + post; \
+		} \
+	} \
+} while(0)
+
+int obdConvertBatch(unsigned int pid, const unsigned char *raw, size_t stride,
+		float *out, size_t count) {
+	const struct obdlinearconv *l = obdbatch_find(pid);
+	if(NULL == l) return -1;
+
+	OBDBATCH_CONVERT(l, raw, stride, out, count);
+	return 0;
+}
+
+int obdConvertBatchd(unsigned int pid, const unsigned char *raw, size_t stride,
+		double *out, size_t count) {
+	const struct obdlinearconv *l = obdbatch_find(pid);
+	if(NULL == l) return -1;
+
+	OBDBATCH_CONVERT(l, raw, stride, out, count);
+	return 0;
+}
+
+int obdRevConvertBatch(unsigned int pid, const float *vals, size_t count,
+		unsigned char *raw, size_t stride) {
+	const struct obdlinearconv *l = obdbatch_find(pid);
+	if(NULL == l) return -1;
+
+	const float pre = l->revpre;
+	const float mul = l->revmul;
+	const float div = l->revdiv;
+	const long post = l->revpost;
+	size_t i;
+	if(1 == l->bytes) {
+		for(i=0;i<count;i++) {
+			long r = (long)(((vals[i] + pre) * mul) / div) + post;
+			raw[i*stride] = (unsigned char)r;
+		}
+	} else {
+		for(i=0;i<count;i++) {
+			long r = (long)(((vals[i] + pre) * mul) / div);
+			raw[i*stride] = (unsigned char)(r / 256);
+			raw[i*stride+1] = (unsigned char)(r % 256);
+		}
+	}
+	return l->bytes;
+}
+
@@ -0,0 +1,83 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the 
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/** \file
+ \brief Convert many samples of one PID at once
+
+ obdConvert_* and obdRevConvert_* take one sample per call. Everything
+ those functions compute is linear in the value made of the first one or
+ two bytes, so here each is described as a scale and offset instead, and
+ whole arrays are converted by loops with no calls or branches in them
+ that the compiler can vectorise.
+
+ Results are bit-for-bit the same as calling the single-sample functions;
+ the operations are done in the same order, in single precision.
+
+ Samples are packed bytes, [A,B,C,D] for one sample followed by the next.
+ */
+#ifndef __OBDCONVERTBATCH_H
+#define __OBDCONVERTBATCH_H
+
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif //  __cplusplus
+
+/// Convert count raw samples of pid to values
+/** \param pid the mode 01 PID the samples are for
+    \param raw the first sample's A byte
+    \param stride bytes from one sample to the next
+    \param out filled with count values
+    \param count number of samples
+    \return 0 on success, -1 if there's no batch conversion for this PID
+*/
+int obdConvertBatch(unsigned int pid, const unsigned char *raw, size_t stride,
+	float *out, size_t count);
+
+/// Convert count raw samples of pid to values, as doubles
+/** Converted in single precision exactly as obdConvertBatch, then widened.
+    Parameters and return as obdConvertBatch */
+int obdConvertBatchd(unsigned int pid, const unsigned char *raw, size_t stride,
+	double *out, size_t count);
+
+/// Convert count values of pid back to raw samples
+/** Only the bytes the single-sample function would fill are written;
+     the rest of each stride is left alone.
+    \param pid the mode 01 PID the values are for
+    \param vals count values
+    \param count number of values
+    \param raw where the first sample's A byte goes
+    \param stride bytes from one sample to the next
+    \return number of bytes filled per sample, as OBDConvRevFunc,
+      or -1 if there's no batch conversion for this PID
+*/
+int obdRevConvertBatch(unsigned int pid, const float *vals, size_t count,
+	unsigned char *raw, size_t stride);
+
+/// Find out if pid can be converted in batches
+/** \return 1 if obdConvertBatch and obdRevConvertBatch work for pid, 0 otherwise */
+int obdHasConvertBatch(unsigned int pid);
+
+#ifdef __cplusplus
+}
+#endif //  __cplusplus
+
+#endif //__OBDCONVERTBATCH_H
+
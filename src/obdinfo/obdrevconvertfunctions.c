@@ -18,37 +18,40 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 
 /** \file
   \brief Functions to convert from values back to OBDII output
+  Everything goes through long on the way to unsigned int; converting a
+   negative float straight to unsigned is undefined, and does differ
+   between targets.
 */
 
 // http://en.wikipedia.org/wiki/Table_of_OBD-II_Codes
 
 
 int obdRevConvert_04    (float val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
-	*A = (unsigned int)(255.0f*val/100.0f);
+	*A = (unsigned int)(long)(255.0f*val/100.0f);
 	return 1;
 }
 
 
 int obdRevConvert_05    (float val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
-	*A = (unsigned int)(val+40);
+	*A = (unsigned int)(long)(val+40);
 	return 1;
 }
 
 
 int obdRevConvert_06_09 (float val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
-	*A = (unsigned int)(128.0f*val/100.0f) + 128;
+	*A = (unsigned int)(long)(128.0f*val/100.0f) + 128;
 	return 1;
 }
 
 
 int obdRevConvert_0A    (float val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
-	*A = (unsigned int)(val/3.0f);
+	*A = (unsigned int)(long)(val/3.0f);
 	return 1;
 }
 
 
 int obdRevConvert_0B    (float val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
-	*A = (unsigned int)val;
+	*A = (unsigned int)(long)val;
 	return 1;
 }
 
@@ -62,19 +65,19 @@ int obdRevConvert_0C    (float val, unsigned int *A, unsigned int *B, unsigned i
 
 
 int obdRevConvert_0D    (float val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
-	*A = (unsigned int)val;
+	*A = (unsigned int)(long)val;
 	return 1;
 }
 
 
 int obdRevConvert_0E    (float val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
-	*A = (unsigned int)((val + 64.0f) * 2.0f);
+	*A = (unsigned int)(long)((val + 64.0f) * 2.0f);
 	return 1;
 }
 
 
 int obdRevConvert_0F    (float val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
-	*A = (unsigned int)(val+40);
+	*A = (unsigned int)(long)(val+40);
 	return 1;
 }
 
@@ -88,13 +91,13 @@ int obdRevConvert_10    (float val, unsigned int *A, unsigned int *B, unsigned i
 
 
 int obdRevConvert_11    (float val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
-	*A = (unsigned int)(255.0f*val/100.0f);
+	*A = (unsigned int)(long)(255.0f*val/100.0f);
 	return 1;
 }
 
 
 int obdRevConvert_14_1B (float val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
-	*A = (unsigned int)(val / 0.005f);
+	*A = (unsigned int)(long)(val / 0.005f);
 	return 1;
 }
 
@@ -138,31 +141,31 @@ int obdRevConvert_24_2B (float val, unsigned int *A, unsigned int *B, unsigned i
 
 
 int obdRevConvert_2C    (float val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
-	*A = (unsigned int)(255.0f*val/100.0f);
+	*A = (unsigned int)(long)(255.0f*val/100.0f);
 	return 1;
 }
 
 
 int obdRevConvert_2D    (float val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
-	*A = (unsigned int)((val + 100.0f) / 0.78125f);
+	*A = (unsigned int)(long)((val + 100.0f) / 0.78125f);
 	return 1;
 }
 
 
 int obdRevConvert_2E    (float val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
-	*A = (unsigned int)(255.0f*val/100.0f);
+	*A = (unsigned int)(long)(255.0f*val/100.0f);
 	return 1;
 }
 
 
 int obdRevConvert_2F    (float val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
-	*A = (unsigned int)(255.0f*val/100.0f);
+	*A = (unsigned int)(long)(255.0f*val/100.0f);
 	return 1;
 }
 
 
 int obdRevConvert_30    (float val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
-	*A = (unsigned int)val;
+	*A = (unsigned int)(long)val;
 	return 1;
 }
 
@@ -184,7 +187,7 @@ int obdRevConvert_32    (float val, unsigned int *A, unsigned int *B, unsigned i
 
 
 int obdRevConvert_33    (float val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
-	*A = (unsigned int)val;
+	*A = (unsigned int)(long)val;
 	return 1;
 }
 
@@ -231,25 +234,25 @@ int obdRevConvert_44    (float val, unsigned int *A, unsigned int *B, unsigned i
 
 
 int obdRevConvert_45    (float val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
-	*A = (unsigned int)(255.0f*val/100.0f);
+	*A = (unsigned int)(long)(255.0f*val/100.0f);
 	return 1;
 }
 
 
 int obdRevConvert_46    (float val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
-	*A = (unsigned int)(val+40);
+	*A = (unsigned int)(long)(val+40);
 	return 1;
 }
 
 
 int obdRevConvert_47_4B (float val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
-	*A = (unsigned int)(255.0f*val/100.0f);
+	*A = (unsigned int)(long)(255.0f*val/100.0f);
 	return 1;
 }
 
 
 int obdRevConvert_4C    (float val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
-	*A = (unsigned int)(255.0f*val/100.0f);
+	*A = (unsigned int)(long)(255.0f*val/100.0f);
 	return 1;
 }
 
@@ -269,7 +272,7 @@ int obdRevConvert_4E    (float val, unsigned int *A, unsigned int *B, unsigned i
 
 
 int obdRevConvert_52    (float val, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
-	*A = (unsigned int)(255.0f*val/100.0f);
+	*A = (unsigned int)(long)(255.0f*val/100.0f);
 	return 1;
 }
 
@@ -22,70 +22,36 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
  */
 
 #include "obdservicecommands.h"
+#include "obdcolumnhash.h"
+#include "obdpidindex.h" // Generated from obdpids.def by genobdpids
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 struct obdservicecmd *obdGetCmdForColumn(const char *db_column) {
-	int i;
-	int numrows = sizeof(obdcmds_mode1)/sizeof(obdcmds_mode1[0]);
-	for(i=0;i<numrows;i++) {
-		struct obdservicecmd *o = &obdcmds_mode1[i];
-		if(NULL == o->db_column) {
-			continue;
-		}
-
-		if(0 == strcmp(db_column,o->db_column)) {
-			return o;
-		}
-	}
-	return NULL;
-}
-
-/// O(log(n)) PID finder
-/** Profiling, it usually ends up slower than the linear one, which is
-because we're normally in the lower end of the PID scale and the linear
-one is much simpler */
-static struct obdservicecmd *obdGetCmdForPID_recursive(const unsigned int pid,
-	const int first_idx, const int last_idx) {
-
-	// printf("%i %i\n", first_idx, last_idx);
-
-	// const unsigned int first_pid = obdcmds_mode1[first_idx].cmdid;
-	const unsigned int last_pid = obdcmds_mode1[last_idx].cmdid;
-
-	// if(pid == first_pid) return &obdcmds_mode1[first_idx];
-	if(pid == last_pid) return &obdcmds_mode1[last_idx];
-
-	if(first_idx >= last_idx) {
+	int idx = obdcolumn_hash[obdcolumnhash(db_column, OBDCOLUMN_HASHSEED) & (OBDCOLUMN_HASHSIZE-1)];
+	if(-1 == idx) {
 		return NULL;
 	}
 
-	int middle_idx = (last_idx + first_idx)/2;
-	const unsigned int middle_pid = obdcmds_mode1[middle_idx].cmdid;
-
-	if(pid == middle_pid) return &obdcmds_mode1[middle_idx];
-
-	if(middle_pid < pid) {
-		return obdGetCmdForPID_recursive(pid, middle_idx+1, last_idx-1);
-	} else {
-		return obdGetCmdForPID_recursive(pid, first_idx, middle_idx-1);
+	// Every column has its own slot, but anything else can land in one too
+	struct obdservicecmd *o = &obdcmds_mode1[idx];
+	if(0 != strcmp(db_column, o->db_column)) {
+		return NULL;
 	}
+	return o;
 }
 
 struct obdservicecmd *obdGetCmdForPID(const unsigned int pid) {
-	int i;
-	int numrows = sizeof(obdcmds_mode1)/sizeof(obdcmds_mode1[0]);
-	for(i=0;i<numrows;i++) {
-		struct obdservicecmd *o = &obdcmds_mode1[i];
-
-		if(pid == o->cmdid) {
-			return o;
-		}
+	if(pid >= sizeof(obdpid_index)/sizeof(obdpid_index[0])) {
+		return NULL;
 	}
-	return NULL;
 
-	// return obdGetCmdForPID_recursive(pid, 0, sizeof(obdcmds_mode1)/sizeof(obdcmds_mode1[0]));
+	int idx = obdpid_index[pid];
+	if(-1 == idx) {
+		return NULL;
+	}
+	return &obdcmds_mode1[idx];
 }
 
 int obderrconvert_r(char *buf, int n, unsigned int A, unsigned int B) {
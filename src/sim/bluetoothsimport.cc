@@ -76,6 +76,10 @@ BluetoothSimPort::~BluetoothSimPort() {
 	close(s);
 }
 
+int BluetoothSimPort::getListenFd() {
+	return s;
+}
+
 void BluetoothSimPort::closeCurrentConnection() {
 	if(isConnected()) {
 		close(fd);
@@ -109,6 +113,7 @@ int BluetoothSimPort::tryConnection() {
 			return -1;
 		}
 		printf("Bluetooth connected: %s\n", getPort());
+		hungup = 0;
 		fcntl(fd ,F_SETFL,O_NONBLOCK);
 
 		return fd;
@@ -51,6 +51,9 @@ private:
 	/// Close currently connected instance
 	virtual void closeCurrentConnection();
 
+	/// Wait on the listening socket while not connected
+	virtual int getListenFd();
+
 	/// Two locations
 	struct sockaddr_rc loc_addr, rem_addr;
 
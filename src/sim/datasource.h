@@ -27,6 +27,19 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 extern "C" {
 #endif //__cplusplus
 
+struct timeval;
+
+#ifndef OBDSIM_VALUE_DEFINED
+#define OBDSIM_VALUE_DEFINED
+/// One PID's part of a batch request. See getvalues
+/** Also declared, identically, in simdl_datasource.h */
+struct obdsim_value {
+	unsigned int pid; //< The PID being asked for
+	unsigned int abcd[4]; //< Four values to fill
+	int count; //< Number of values filled, as getvalue would return it
+};
+#endif //OBDSIM_VALUE_DEFINED
+
 /// Declare a generator by building one of these structs
 struct obdsim_generator {
 	/// Get a human-friendly name for this generator
@@ -73,8 +86,37 @@ struct obdsim_generator {
 	/// Called to signify that error codes should be cleared
 	/** \return -1 on error, 0 on success */
 	int (*clearerrorcodes)(void *gen);
+
+	/// Optional. Get values for several PIDs at once
+	/** Should give the same answers as calling getvalue on each PID in
+	     turn, except that they're all taken at one moment. If left NULL,
+	     the sim calls getvalue for each PID instead.
+	 \param mode the mode of the request
+	 \param values pid is set in each. Fill in abcd and count
+	 \param count number of values
+	 \return 0 on success, or -1 for "must exit"
+	*/
+	int (*getvalues)(void *gen, unsigned int mode, struct obdsim_value *values, int count);
+
+	/// Optional. Tell the sim when error codes change, instead of being polled
+	/** Called once, after create. From then on the sim only calls
+	     geterrorcodes when notify has been called, or after it's
+	     cleared the codes itself. notify may be called from any thread,
+	     and is cheap; freeze frames are taken later, not inside it
+	 \param notify call this whenever the set of error codes changes
+	 \param cookie pass this to notify
+	 \return 0 if notify will be called, anything else to carry on being polled
+	*/
+	int (*seterrornotify)(void *gen, void (*notify)(void *cookie), void *cookie);
 };
 
+/// Get the current time, as the sim sees it
+/** Use this instead of gettimeofday() so that time-based values keep
+     up when the sim runs in virtual time [--virtual-time]
+    \return 0 on success, -1 on failure, as gettimeofday()
+*/
+int obdsim_gettimeofday(struct timeval *tv);
+
 #ifdef __cplusplus
 }
 #endif //__cplusplus
@@ -0,0 +1,239 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** \file
+ \brief Ask all the ECUs for a value at once
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef OBDPLATFORM_POSIX
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#endif //OBDPLATFORM_POSIX
+
+#ifdef OBDPLATFORM_WINDOWS
+#include <windows.h>
+#include "windowssimport.h" // Contains implementation of gettimeofday for windows
+#endif //OBDPLATFORM_WINDOWS
+
+#include "obdsim.h"
+#include "datasource.h"
+#include "simclock.h"
+#include "ecupool.h"
+
+/// Ask a single ECU for its values
+static void ecupool_runjob(struct ecupool_job *job, unsigned int mode,
+		const unsigned int *pids, int pidcount) {
+	int i;
+	for(i=0;i<pidcount;i++) {
+		job->values[i].pid = pids[i];
+		job->values[i].count = 0;
+	}
+
+	struct obdgen_ecu *e = job->ecu;
+	obdsim_lockecu(e);
+	job->ret = obdsim_getvalues(e, mode, job->values, pidcount);
+	obdsim_unlockecu(e);
+}
+
+#ifdef OBDPLATFORM_POSIX
+
+/// Longest queue of outstanding jobs. Past this, requests run their own
+#define ECUPOOL_QUEUESIZE (OBDSIM_MAXECUS * 16)
+
+/// A job waiting for a worker
+struct ecupool_entry {
+	struct ecupool_job *job; //< The job
+	unsigned int mode; //< Mode being asked for
+	const unsigned int *pids; //< PIDs being asked for
+	int pidcount; //< Number of PIDs
+};
+
+/// Worker threads, each of which can call into any ECU
+struct ecupool {
+	pthread_t threads[OBDSIM_MAXECUS]; //< The workers
+	int threadcount; //< Number of workers
+
+	pthread_mutex_t lock; //< Protects everything below here
+	pthread_cond_t work; //< Signalled when there's something in the queue
+	pthread_cond_t done; //< Broadcast whenever any job is done
+
+	struct ecupool_entry queue[ECUPOOL_QUEUESIZE]; //< Ring of waiting jobs
+	int queuehead; //< Next entry to take
+	int queuecount; //< Number of entries waiting
+	int mustexit; //< Set when the workers should stop
+};
+
+/// Take jobs off the queue until told to stop
+static void *ecupool_worker(void *arg) {
+	struct ecupool *pool = (struct ecupool *)arg;
+
+	pthread_mutex_lock(&pool->lock);
+	while(1) {
+		while(0 == pool->queuecount && !pool->mustexit) {
+			pthread_cond_wait(&pool->work, &pool->lock);
+		}
+		if(pool->mustexit) break;
+
+		struct ecupool_entry entry = pool->queue[pool->queuehead];
+		pool->queuehead = (pool->queuehead + 1) % ECUPOOL_QUEUESIZE;
+		pool->queuecount--;
+		pthread_mutex_unlock(&pool->lock);
+
+		ecupool_runjob(entry.job, entry.mode, entry.pids, entry.pidcount);
+
+		pthread_mutex_lock(&pool->lock);
+		entry.job->done = 1;
+		pthread_cond_broadcast(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+struct ecupool *ecupool_create(struct simsettings *ss) {
+	// Nothing to overlap with one ECU
+	if(ss->ecu_count < 2) return NULL;
+
+	struct ecupool *pool = (struct ecupool *)malloc(sizeof(struct ecupool));
+	if(NULL == pool) return NULL;
+
+	pool->threadcount = 0;
+	pool->queuehead = 0;
+	pool->queuecount = 0;
+	pool->mustexit = 0;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	int i;
+	for(i=0;i<ss->ecu_count;i++) {
+		if(0 != pthread_create(&pool->threads[i], NULL, ecupool_worker, pool)) {
+			perror("Couldn't create ECU worker thread");
+			break;
+		}
+		pool->threadcount++;
+	}
+
+	if(0 == pool->threadcount) {
+		ecupool_destroy(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+void ecupool_destroy(struct ecupool *pool) {
+	if(NULL == pool) return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->mustexit = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	int i;
+	for(i=0;i<pool->threadcount;i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+void ecupool_getvalues(struct ecupool *pool, struct ecupool_job *jobs,
+		int jobcount, unsigned int mode, const unsigned int *pids, int pidcount,
+		const struct timeval *start) {
+
+	int i;
+	for(i=0;i<jobcount;i++) {
+		jobs[i].done = 0;
+		jobs[i].ret = 0;
+	}
+
+	if(NULL != pool && jobcount > 1) {
+		pthread_mutex_lock(&pool->lock);
+		for(i=0;i<jobcount;i++) {
+			if(pool->queuecount >= ECUPOOL_QUEUESIZE) break;
+			struct ecupool_entry *entry = &pool->queue[
+				(pool->queuehead + pool->queuecount) % ECUPOOL_QUEUESIZE];
+			entry->job = &jobs[i];
+			entry->mode = mode;
+			entry->pids = pids;
+			entry->pidcount = pidcount;
+			pool->queuecount++;
+		}
+		int queued = i;
+		pthread_cond_broadcast(&pool->work);
+		pthread_mutex_unlock(&pool->lock);
+
+		// Anything that didn't fit in the queue, do here
+		for(;i<jobcount;i++) {
+			ecupool_runjob(&jobs[i], mode, pids, pidcount);
+			jobs[i].done = 1;
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		for(i=0;i<queued;i++) {
+			while(!jobs[i].done) {
+				pthread_cond_wait(&pool->done, &pool->lock);
+			}
+		}
+		pthread_mutex_unlock(&pool->lock);
+	} else {
+		for(i=0;i<jobcount;i++) {
+			ecupool_runjob(&jobs[i], mode, pids, pidcount);
+			jobs[i].done = 1;
+		}
+	}
+
+	// Whatever time the generators took counts towards the delays
+	if(jobcount > 0) {
+		obdsim_sleepuntil(start, jobs[jobcount-1].due);
+	}
+}
+
+#else //OBDPLATFORM_POSIX
+
+struct ecupool *ecupool_create(struct simsettings *ss) {
+	return NULL;
+}
+
+void ecupool_destroy(struct ecupool *pool) {
+}
+
+void ecupool_getvalues(struct ecupool *pool, struct ecupool_job *jobs,
+		int jobcount, unsigned int mode, const unsigned int *pids, int pidcount,
+		const struct timeval *start) {
+
+	int i;
+	for(i=0;i<jobcount;i++) {
+		ecupool_runjob(&jobs[i], mode, pids, pidcount);
+		jobs[i].done = 1;
+	}
+
+	if(jobcount > 0) {
+		obdsim_sleepuntil(start, jobs[jobcount-1].due);
+	}
+}
+
+#endif //OBDPLATFORM_POSIX
+
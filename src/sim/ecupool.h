@@ -0,0 +1,66 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** \file
+ \brief Ask all the ECUs for a value at once
+*/
+#ifndef __ECUPOOL_H
+#define __ECUPOOL_H
+
+#ifdef OBDPLATFORM_POSIX
+#include <sys/time.h>
+#endif //OBDPLATFORM_POSIX
+
+#include "obdsim.h"
+
+/// One ECU's part of a request
+struct ecupool_job {
+	struct obdgen_ecu *ecu; //< The ECU to ask
+	long due; //< When this ECU's answer is due, ms after the request arrived
+	struct obdsim_value values[OBDSIM_MAXREQUESTPIDS]; //< One for each PID asked for
+	int ret; //< What obdsim_getvalues returned
+	int done; //< Set once values and ret are filled in
+};
+
+/// Start the worker threads
+/** \param ss the sim settings. ECUs must already be created
+    \return the pool, or NULL if ECUs should just be asked one at a time
+*/
+struct ecupool *ecupool_create(struct simsettings *ss);
+
+/// Stop the worker threads and free the pool
+void ecupool_destroy(struct ecupool *pool);
+
+/// Ask every ECU in jobs for values, and wait until they're all due
+/** Generators are all called straight away, in parallel if there's a
+     pool. Returns once every job is done and at least its due
+     time has passed, so the reply takes as long as the slowest of
+     [customdelay, generator], not the sum of them all.
+    \param pool the pool. If NULL, call the generators in this thread
+    \param jobs one job per ECU to ask, sorted by due
+    \param jobcount number of jobs
+    \param mode the mode to ask for
+    \param pids,pidcount the PIDs to ask for; at most OBDSIM_MAXREQUESTPIDS
+    \param start when the request arrived
+*/
+void ecupool_getvalues(struct ecupool *pool, struct ecupool_job *jobs,
+	int jobcount, unsigned int mode, const unsigned int *pids, int pidcount,
+	const struct timeval *start);
+
+#endif //__ECUPOOL_H
+
@@ -0,0 +1,382 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** \file
+  \brief A port that sits in front of another one and misbehaves on purpose
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#ifdef OBDPLATFORM_POSIX
+#include <pthread.h>
+#endif //OBDPLATFORM_POSIX
+
+#include "obdsim.h"
+#include "simresponse.h"
+#include "simclock.h"
+#include "faultsimport.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif //M_PI
+
+/// Each kind of damage that can be done to a reply
+enum faultsim_kind {
+	FAULTSIM_NODATA, // Replace the reply with NO DATA
+	FAULTSIM_BUSBUSY, // Replace the reply with BUS BUSY
+	FAULTSIM_CANERROR, // Replace the reply with CAN ERROR
+	FAULTSIM_TRUNCATE, // Cut the reply off part way through a line
+	FAULTSIM_CORRUPT, // Flip a bit in one byte of the reply
+	FAULTSIM_DROPPROMPT, // Leave the prompt off the end
+	FAULTSIM_KINDCOUNT // Number of kinds
+};
+
+/// Name of each kind, as used in the spec and the counters
+static const char *faultsim_names[FAULTSIM_KINDCOUNT] = {
+	"nodata", "busy", "canerror", "truncate", "corrupt", "dropprompt"
+};
+
+/// Shapes the latency can take
+enum faultsim_dist {
+	FAULTSIM_UNIFORM, // latency, plus or minus up to jitter
+	FAULTSIM_NORMAL, // latency, with a standard deviation of jitter
+	FAULTSIM_EXP // latency, plus an exponential tail with mean jitter
+};
+
+/// Everything needed to inject faults, and how many have been
+struct faultsim {
+	long latency; //< Base delay before each reply [ms]
+	long jitter; //< How far the delay wanders [ms]; meaning depends on dist
+	enum faultsim_dist dist; //< How the delay is distributed
+	double rates[FAULTSIM_KINDCOUNT]; //< Chance of each kind on each reply
+	unsigned long long seed; //< Every port's random state starts from this
+
+#ifdef OBDPLATFORM_POSIX
+	pthread_mutex_t lock; //< Protects everything below here
+#endif //OBDPLATFORM_POSIX
+	int portcount; //< Ports created so far, so they get different random states
+	long writes; //< Replies passed through
+	long delayed; //< Replies that were delayed
+	double delaytotal; //< Sum of all delays [ms]
+	long delaymax; //< Longest delay [ms]
+	long counts[FAULTSIM_KINDCOUNT]; //< Replies damaged each way
+};
+
+#ifdef OBDPLATFORM_POSIX
+#define FAULTSIM_LOCK(f) pthread_mutex_lock(&(f)->lock)
+#define FAULTSIM_UNLOCK(f) pthread_mutex_unlock(&(f)->lock)
+#else
+#define FAULTSIM_LOCK(f)
+#define FAULTSIM_UNLOCK(f)
+#endif //OBDPLATFORM_POSIX
+
+/// Parse a chance, either as a fraction or with a trailing %
+static int faultsim_parserate(const char *s, double *rate) {
+	char *end;
+	double r = strtod(s, &end);
+	if(end == s) return -1;
+	if('%' == *end) {
+		r /= 100.0;
+		end++;
+	}
+	if('\0' != *end || r < 0.0 || r > 1.0) return -1;
+	*rate = r;
+	return 0;
+}
+
+/// Parse a number of milliseconds
+static int faultsim_parsems(const char *s, long *ms) {
+	char *end;
+	long l = strtol(s, &end, 10);
+	if(end == s || '\0' != *end || l < 0) return -1;
+	*ms = l;
+	return 0;
+}
+
+/// Parse one name=value from the spec
+static int faultsim_parseone(struct faultsim *f, const char *name, const char *value) {
+	int i;
+	for(i=0;i<FAULTSIM_KINDCOUNT;i++) {
+		if(0 == strcmp(name, faultsim_names[i])) {
+			return faultsim_parserate(value, &f->rates[i]);
+		}
+	}
+
+	if(0 == strcmp(name, "latency")) {
+		return faultsim_parsems(value, &f->latency);
+	} else if(0 == strcmp(name, "jitter")) {
+		return faultsim_parsems(value, &f->jitter);
+	} else if(0 == strcmp(name, "dist")) {
+		if(0 == strcmp(value, "uniform")) f->dist = FAULTSIM_UNIFORM;
+		else if(0 == strcmp(value, "normal")) f->dist = FAULTSIM_NORMAL;
+		else if(0 == strcmp(value, "exp")) f->dist = FAULTSIM_EXP;
+		else return -1;
+		return 0;
+	} else if(0 == strcmp(name, "seed")) {
+		char *end;
+		f->seed = strtoull(value, &end, 0);
+		return (end == value || '\0' != *end)?-1:0;
+	}
+	return -1;
+}
+
+struct faultsim *faultsim_create(const char *spec) {
+	struct faultsim *f = (struct faultsim *)malloc(sizeof(struct faultsim));
+	if(NULL == f) return NULL;
+	memset(f, 0, sizeof(*f));
+	f->dist = FAULTSIM_UNIFORM;
+
+	char *copy = strdup(spec); // Because strtok needs non-const
+	char *tok;
+	int errors = 0;
+	for(tok = strtok(copy, ","); NULL != tok; tok = strtok(NULL, ",")) {
+		char *eq = strchr(tok, '=');
+		if(NULL != eq) {
+			*eq = '\0';
+			if(0 == faultsim_parseone(f, tok, eq+1)) continue;
+			*eq = '=';
+		}
+		fprintf(stderr, "Couldn't parse fault \"%s\"\n", tok);
+		errors++;
+	}
+	free(copy);
+
+	double buserrors = f->rates[FAULTSIM_NODATA] + f->rates[FAULTSIM_BUSBUSY] +
+		f->rates[FAULTSIM_CANERROR];
+	if(buserrors > 1.0) {
+		fprintf(stderr, "nodata, busy and canerror add up to more than 1\n");
+		errors++;
+	}
+
+	if(errors > 0) {
+		free(f);
+		return NULL;
+	}
+
+#ifdef OBDPLATFORM_POSIX
+	pthread_mutex_init(&f->lock, NULL);
+#endif //OBDPLATFORM_POSIX
+	return f;
+}
+
+void faultsim_destroy(struct faultsim *f) {
+	if(NULL == f) return;
+#ifdef OBDPLATFORM_POSIX
+	pthread_mutex_destroy(&f->lock);
+#endif //OBDPLATFORM_POSIX
+	free(f);
+}
+
+void faultsim_printcounters(struct faultsim *f) {
+	if(NULL == f) return;
+
+	FAULTSIM_LOCK(f);
+	printf("Faults: %li replies, %li delayed [avg %.1fms, max %lims]",
+		f->writes, f->delayed,
+		f->delayed>0?f->delaytotal/f->delayed:0.0, f->delaymax);
+	int i;
+	for(i=0;i<FAULTSIM_KINDCOUNT;i++) {
+		printf(", %li %s", f->counts[i], faultsim_names[i]);
+	}
+	printf("\n");
+	FAULTSIM_UNLOCK(f);
+}
+
+FaultSimPort::FaultSimPort(OBDSimPort *port, struct faultsim *faults) {
+	mPort = port;
+	mFaults = faults;
+	mLastWasAT = 0;
+
+	FAULTSIM_LOCK(faults);
+	int portnum = faults->portcount++;
+	FAULTSIM_UNLOCK(faults);
+	mRandom = faults->seed + 0x9E3779B97F4A7C15ull * (portnum + 1);
+
+	setUsable(port->isUsable());
+}
+
+FaultSimPort::~FaultSimPort() {
+}
+
+double FaultSimPort::random01() {
+	// splitmix64
+	unsigned long long z = (mRandom += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	z = z ^ (z >> 31);
+	return (z >> 11) * (1.0/9007199254740992.0);
+}
+
+char *FaultSimPort::getPort() {
+	return mPort->getPort();
+}
+
+void FaultSimPort::setEcho(int yes) {
+	mPort->setEcho(yes);
+}
+
+int FaultSimPort::getEcho() {
+	return mPort->getEcho();
+}
+
+int FaultSimPort::startLog(const char *filename) {
+	return mPort->startLog(filename);
+}
+
+void FaultSimPort::endLog() {
+	mPort->endLog();
+}
+
+void FaultSimPort::writeLog(const char *data, int out) {
+	mPort->writeLog(data, out);
+}
+
+int FaultSimPort::waitReadable(long timeout_us) {
+	return mPort->waitReadable(timeout_us);
+}
+
+char *FaultSimPort::readLine() {
+	char *line = mPort->readLine();
+	if(NULL == line) return NULL;
+
+	const char *p = line;
+	while(isspace(*p)) p++;
+	// A blank line repeats the last command, so leave mLastWasAT alone
+	if('\0' != *p) {
+		mLastWasAT = ('A' == toupper(p[0]) && 'T' == toupper(p[1]));
+	}
+	return line;
+}
+
+void FaultSimPort::replaceReply(char *buf, size_t bufsize, const char *msg) {
+	const char *nl = (NULL != strstr(buf, "\r\n"))?"\r\n":"\r";
+	size_t len = strlen(buf);
+	int prompt = (len > 0 && ELM_PROMPT[0] == buf[len-1]);
+	snprintf(buf, bufsize, "%s%s%s%s", nl, msg, nl, prompt?ELM_PROMPT:"");
+}
+
+void FaultSimPort::writeData(const char *data, int logdata) {
+	struct faultsim *f = mFaults;
+
+	long delay = 0;
+	if(f->latency > 0 || f->jitter > 0) {
+		double d = f->latency;
+		double u = random01();
+		switch(f->dist) {
+			case FAULTSIM_NORMAL: {
+				// Box-Muller
+				double v = random01();
+				d += f->jitter * sqrt(-2.0 * log(1.0 - u)) * cos(2.0 * M_PI * v);
+				break;
+			}
+			case FAULTSIM_EXP:
+				d += f->jitter * -log(1.0 - u);
+				break;
+			case FAULTSIM_UNIFORM:
+			default:
+				d += f->jitter * (2.0 * u - 1.0);
+				break;
+		}
+		delay = d>0?(long)(d + 0.5):0;
+	}
+
+	int hit[FAULTSIM_KINDCOUNT];
+	memset(hit, 0, sizeof(hit));
+
+	// Only one bus error per reply, and never in answer to an AT command
+	if(!mLastWasAT) {
+		double r = random01();
+		int i;
+		for(i=FAULTSIM_NODATA;i<=FAULTSIM_CANERROR;i++) {
+			if(r < f->rates[i]) {
+				hit[i] = 1;
+				break;
+			}
+			r -= f->rates[i];
+		}
+	}
+	int i;
+	for(i=FAULTSIM_TRUNCATE;i<FAULTSIM_KINDCOUNT;i++) {
+		hit[i] = (f->rates[i] > 0.0 && random01() < f->rates[i]);
+	}
+
+	FAULTSIM_LOCK(f);
+	f->writes++;
+	if(delay > 0) {
+		f->delayed++;
+		f->delaytotal += delay;
+		if(delay > f->delaymax) f->delaymax = delay;
+	}
+	for(i=0;i<FAULTSIM_KINDCOUNT;i++) {
+		f->counts[i] += hit[i];
+	}
+	FAULTSIM_UNLOCK(f);
+
+	if(delay > 0) {
+		obdsim_sleep(delay);
+	}
+
+	int damaged = 0;
+	for(i=0;i<FAULTSIM_KINDCOUNT;i++) damaged |= hit[i];
+	size_t len = strlen(data);
+	char buf[OBDSIM_RESPONSE_SIZE];
+	if(!damaged || len >= sizeof(buf)) {
+		mPort->writeData(data, logdata);
+		return;
+	}
+	memcpy(buf, data, len+1);
+
+	if(hit[FAULTSIM_NODATA]) replaceReply(buf, sizeof(buf), ELM_NODATA_PROMPT);
+	if(hit[FAULTSIM_BUSBUSY]) replaceReply(buf, sizeof(buf), ELM_BUSBUSY_PROMPT);
+	if(hit[FAULTSIM_CANERROR]) replaceReply(buf, sizeof(buf), ELM_CANERROR_PROMPT);
+
+	len = strlen(buf);
+	int prompt = (len > 0 && ELM_PROMPT[0] == buf[len-1]);
+	size_t bodylen = prompt?len-1:len;
+
+	if(hit[FAULTSIM_TRUNCATE]) {
+		// Cut somewhere between the leading and trailing line endings
+		size_t start = 0, end = bodylen;
+		while(start < end && ('\r' == buf[start] || '\n' == buf[start])) start++;
+		while(end > start && ('\r' == buf[end-1] || '\n' == buf[end-1])) end--;
+		if(end > start) {
+			const char *nl = (NULL != strstr(buf, "\r\n"))?"\r\n":"\r";
+			size_t cut = start + (size_t)(random01() * (end - start));
+			snprintf(buf + cut, sizeof(buf) - cut, "%s%s", nl, prompt?ELM_PROMPT:"");
+			len = strlen(buf);
+			bodylen = prompt?len-1:len;
+		}
+	}
+
+	if(hit[FAULTSIM_CORRUPT] && bodylen > 0) {
+		size_t pos = (size_t)(random01() * bodylen);
+		char c = buf[pos] ^ (char)(1 << (int)(random01() * 7));
+		buf[pos] = ('\0' == c)?'?':c;
+	}
+
+	if(hit[FAULTSIM_DROPPROMPT] && prompt) {
+		buf[len-1] = '\0';
+	}
+
+	mPort->writeData(buf, logdata);
+}
+
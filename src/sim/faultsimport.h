@@ -0,0 +1,101 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** \file
+  \brief A port that sits in front of another one and misbehaves on purpose
+*/
+
+#ifndef __FAULTSIMPORT_H
+#define __FAULTSIMPORT_H
+
+#include "simport.h"
+
+/// Parse a fault spec
+/** spec is a comma-separated list of name=value. See the obdsim man page
+    \return the faults to inject, or NULL if spec couldn't be parsed
+*/
+struct faultsim *faultsim_create(const char *spec);
+
+/// Free faults created by faultsim_create
+void faultsim_destroy(struct faultsim *f);
+
+/// Print how many of each kind of fault have been injected so far
+void faultsim_printcounters(struct faultsim *f);
+
+/// Wraps another port, injecting faults into everything written to it
+/** Several of these can share one faultsim; the counters are shared too */
+class FaultSimPort : public OBDSimPort {
+public:
+	/// Constructor
+	/** \param port the port to wrap. Not deleted with this
+	    \param faults the faults to inject */
+	FaultSimPort(OBDSimPort *port, struct faultsim *faults);
+
+	/// Destructor
+	virtual ~FaultSimPort();
+
+	/// Get the wrapped port's name
+	virtual char *getPort();
+
+	/// Enable or disable echo on the wrapped port
+	virtual void setEcho(int yes);
+
+	/// Find out if echo is set on the wrapped port
+	virtual int getEcho();
+
+	/// Start logging on the wrapped port
+	virtual int startLog(const char *filename);
+
+	/// Stop logging on the wrapped port
+	virtual void endLog();
+
+	/// Delay and damage data, then write it to the wrapped port
+	virtual void writeData(const char *data, int log=1);
+
+	/// Write to the wrapped port's logfile
+	virtual void writeLog(const char *data, int out);
+
+	/// Read a line from the wrapped port
+	virtual char *readLine();
+
+	/// Wait on the wrapped port
+	virtual int waitReadable(long timeout_us);
+
+protected:
+	/// A random number in [0,1)
+	double random01();
+
+	/// Replace the bus part of a reply with msg, keeping its line endings
+	void replaceReply(char *buf, size_t bufsize, const char *msg);
+
+	/// The port everything is passed through to
+	OBDSimPort *mPort;
+
+	/// Faults to inject
+	struct faultsim *mFaults;
+
+	/// This port's random state, so ports don't have to share one
+	unsigned long long mRandom;
+
+	/// Set when the last line read was an AT command
+	/** Those are answered by the elm itself, so never get bus errors */
+	int mLastWasAT;
+};
+
+#endif //__FAULTSIMPORT_H
+
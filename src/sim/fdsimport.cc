@@ -28,6 +28,8 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 #include <fcntl.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/time.h>
+#include <sys/types.h>
 
 #include "simport.h"
 #include "fdsimport.h"
@@ -35,6 +37,7 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 
 FDSimPort::FDSimPort() {
 	readbuf_pos = 0;
+	hungup = 0;
 	setConnected(0);
 	memset(readbuf, '\0', sizeof(readbuf));
 	memset(lastread, '\0', sizeof(lastread));
@@ -49,6 +52,44 @@ char *FDSimPort::getPort() {
 	return portname;
 }
 
+int FDSimPort::getListenFd() {
+	return -1;
+}
+
+int FDSimPort::waitReadable(long timeout_us) {
+	// A whole line may already be waiting from the last read
+	if(NULL != strpbrk(readbuf, "\r\n")) {
+		return 1;
+	}
+
+	int waitfd = -1;
+	if(isConnected() && !hungup) {
+		waitfd = fd;
+	} else if(!isConnected()) {
+		waitfd = getListenFd();
+	}
+
+	struct timeval selecttime;
+	if(timeout_us < 0) timeout_us = 0;
+	selecttime.tv_sec = timeout_us / 1000000l;
+	selecttime.tv_usec = timeout_us % 1000000l;
+
+	if(-1 == waitfd) {
+		// Nothing to wait on; check again once the timeout is up
+		select(0,NULL,NULL,NULL,&selecttime);
+		return 1;
+	}
+
+	fd_set readset;
+	FD_ZERO(&readset);
+	FD_SET(waitfd, &readset);
+	int ret = select(waitfd+1, &readset, NULL, NULL, &selecttime);
+	if(-1 == ret && EINTR != errno) {
+		perror("Error waiting for input");
+	}
+	return ret>0?1:0;
+}
+
 char *FDSimPort::readLine() {
 	int nbytes; // Number of bytes read
 	char *currpos = readbuf + readbuf_pos;
@@ -61,10 +102,20 @@ char *FDSimPort::readLine() {
 		}
 	}
 
-	nbytes = read(fd, currpos, sizeof(readbuf)-readbuf_pos);
+	if(readbuf_pos >= (int)sizeof(readbuf)-1) {
+		// Line too long to be anything we understand; throw it away
+		readbuf_pos = 0;
+		readbuf[0] = '\0';
+		currpos = readbuf;
+	}
+
+	nbytes = read(fd, currpos, sizeof(readbuf)-readbuf_pos-1);
 
 	if(-1 == nbytes && (errno != EAGAIN && errno != EWOULDBLOCK)) {
-		perror("Error reading from fd");
+		if(!hungup) {
+			perror("Error reading from fd");
+		}
+		hungup = 1;
 		closeCurrentConnection();
 		setConnected(0);
 		return NULL;
@@ -72,12 +123,15 @@ char *FDSimPort::readLine() {
 
 	if(0 == nbytes) {
 		// Zero represents EOF
+		hungup = 1;
 		closeCurrentConnection();
 		setConnected(0);
 		return NULL;
 	}
 
 	if(0 < nbytes) {
+		hungup = 0;
+		currpos[nbytes] = '\0';
 		writeLog(currpos, SERIAL_IN);
 		if(getEcho()) {
 			writeData(currpos, 0);
@@ -85,24 +139,23 @@ char *FDSimPort::readLine() {
 
 		// printf("Read %i bytes. strn is now '%s'\n", nbytes, readbuf);
 		readbuf_pos += nbytes;
-		char *lineend = strstr(readbuf, "\r");
-		if(NULL == lineend) { // Just in case
-			char *lineend = strstr(readbuf, "\n");
-		}
+	}
 
-		if(NULL != lineend) {
-			int length = lineend - readbuf;
-			strncpy(lastread, readbuf, length);
-			lastread[length]='\0';
+	// Even without a new read, there may be another line already buffered
+	char *lineend = strpbrk(readbuf, "\r\n");
 
-			while(*lineend == '\r' || *lineend == '\n') {
-				lineend++;
-			}
-			memmove(readbuf, lineend, sizeof(readbuf) - (lineend - readbuf));
-			readbuf_pos -= (lineend - readbuf);
+	if(NULL != lineend) {
+		int length = lineend - readbuf;
+		strncpy(lastread, readbuf, length);
+		lastread[length]='\0';
 
-			return lastread;
+		while(*lineend == '\r' || *lineend == '\n') {
+			lineend++;
 		}
+		readbuf_pos -= (lineend - readbuf);
+		memmove(readbuf, lineend, readbuf_pos + 1);
+
+		return lastread;
 	}
 	return NULL;
 }
@@ -39,6 +39,9 @@ public:
 	/// Write some data to the virtual port
 	virtual void writeData(const char *data, int log=1);
 
+	/// Block until there's input on the port, or a connection to accept
+	virtual int waitReadable(long timeout_us);
+
 protected:
 	/// Constructor. Can't construct one of these
 	FDSimPort();
@@ -56,6 +59,10 @@ protected:
 	/// Close one connection, but not entire process
 	virtual void closeCurrentConnection() = 0;
 
+	/// fd to wait on for new connections while not connected
+	/** \return -1 if there's nothing to wait on */
+	virtual int getListenFd();
+
 	/// The connected client
 	int fd;
 
@@ -74,6 +81,11 @@ protected:
 	/// Current position in the read buffer
 	int readbuf_pos;
 
+	/// Set when the last read failed or hit EOF
+	/** A hung-up pty stays readable until something reopens it, so
+	     we can't just wait on it in that state */
+	int hungup;
+
 private:
 	/// In case we need to set status
 	virtual void setConnected(int yes);
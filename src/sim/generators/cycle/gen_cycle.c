@@ -28,25 +28,50 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "datasource.h"
 #include "obdservicecommands.h"
+#include "obdconvertbatch.h"
 
 #define DEFAULT_CYCLE_S 30
 #define DEFAULT_CYCLE_GEARS 6
+#define DEFAULT_CYCLE_RESOLUTION 4096
 #define US_TO_SEC 1000000
 
+/// Cycle doesn't know anything about PIDs at or above this
+#define CYCLE_MAXPID 0x60
+
 /// The void * generator for cycle
 struct cycle_gen {
 	float cycle_length; // Time for a complete cycle
 	struct timeval firsttime; // The last first that we pulled values
 	unsigned char gears; // Time through current cycle
+	int resolution; // Number of samples in each waveform
+	int counts[CYCLE_MAXPID]; // Number of values each PID returns. 0 if it isn't supported
+	unsigned char *waves[CYCLE_MAXPID]; // Four bytes per sample for each supported PID, indexed by phase
+	unsigned char *wavestore; // All of waves, in one allocation
 };
 
+/// Work out every supported PID's values over a whole cycle
+/** \return 0 on success, 1 if it couldn't allocate the tables */
+static int cycle_buildwaves(struct cycle_gen *g);
+
+/// Convert a fraction of the way through the cycle into a PID's values
+/** \return the same as getvalue */
+static int cycle_computevalue(struct cycle_gen *g, struct obdservicecmd *cmd, float cyclefraction,
+		unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+
+/// Work out which sample in the waveforms corresponds to newtime
+static int cycle_phase(struct cycle_gen *g, const struct timeval *newtime);
+
+/// Look up the value of PID at a phase. Returns the same as getvalue
+static int cycle_valueat(struct cycle_gen *g, unsigned int PID, int phase,
+		unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+
 const char *cycle_simgen_name() {
 	return "Cycle";
 }
 
 const char *cycle_simgen_longdesc() {
 	return "Cycle through a wide range of valid OBDII values\n"
-		"Seed: [cycle-length-in-seconds[,number-of-gears]]";
+		"Seed: [cycle-length-in-seconds[,number-of-gears[,samples-per-cycle]]]";
 }
 
 int cycle_simgen_create(void **gen, const char *seed) {
@@ -57,8 +82,9 @@ int cycle_simgen_create(void **gen, const char *seed) {
 	}
 
 	g->cycle_length = DEFAULT_CYCLE_S;
-	gettimeofday(&g->firsttime, NULL);
+	obdsim_gettimeofday(&g->firsttime);
 	g->gears = DEFAULT_CYCLE_GEARS;
+	g->resolution = DEFAULT_CYCLE_RESOLUTION;
 
 	if(NULL != seed && '\0' != *seed) {
 		char *seedcpy = strdup(seed);
@@ -78,23 +104,63 @@ int cycle_simgen_create(void **gen, const char *seed) {
 					g->gears = gears;
 					printf("Setting gears to %i\n", g->gears);
 				}
+
+				tok = strtok(NULL, ", ");
+				if(NULL != tok) {
+					int resolution = atoi(tok);
+					if(0 < resolution) {
+						g->resolution = resolution;
+						printf("Setting resolution to %i samples per cycle\n", g->resolution);
+					}
+				}
 			}
 		}
 		free(seedcpy);
 	}
 
+	if(0 != cycle_buildwaves(g)) {
+		fprintf(stderr, "Couldn't allocate memory for cycle waveforms\n");
+		free(g);
+		return 1;
+	}
+
 	*gen = g;
 	return 0;
 }
 
 void cycle_simgen_destroy(void *gen) {
-	free(gen);
+	struct cycle_gen *g = (struct cycle_gen *)gen;
+	free(g->wavestore);
+	free(g);
 }
 
 int cycle_simgen_getvalue(void *gen, unsigned int mode, unsigned int PID, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	struct cycle_gen *g = (struct cycle_gen *)gen;
+	struct timeval newtime;
+	obdsim_gettimeofday(&newtime);
+	return cycle_valueat(g, PID, cycle_phase(g, &newtime), A, B, C, D);
+}
 
+int cycle_simgen_getvalues(void *gen, unsigned int mode, struct obdsim_value *values, int count) {
 	struct cycle_gen *g = (struct cycle_gen *)gen;
 
+	// One timestamp for the whole batch
+	struct timeval newtime;
+	obdsim_gettimeofday(&newtime);
+	int phase = cycle_phase(g, &newtime);
+
+	int i;
+	for(i=0;i<count;i++) {
+		unsigned int *abcd = values[i].abcd;
+		values[i].count = cycle_valueat(g, values[i].pid, phase,
+			abcd+0, abcd+1, abcd+2, abcd+3);
+	}
+	return 0;
+}
+
+static int cycle_valueat(struct cycle_gen *g, unsigned int PID, int phase,
+		unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+
 	if(0x00 == PID || 0x20 == PID || 0x40 == PID) {
 		*A = 0xFF;
 		*B = 0xFF;
@@ -103,36 +169,104 @@ int cycle_simgen_getvalue(void *gen, unsigned int mode, unsigned int PID, unsign
 		return 4;
 	}
 
-	if(0x60 <= PID) return 0;
+	if(CYCLE_MAXPID <= PID || 0 == g->counts[PID]) return 0;
 
-	struct timeval newtime;
-	gettimeofday(&newtime, NULL);
+	const unsigned char *sample = g->waves[PID] + 4*phase;
+	*A = sample[0];
+	*B = sample[1];
+	*C = sample[2];
+	*D = sample[3];
+	return g->counts[PID];
+}
 
-	float dt = (newtime.tv_sec - g->firsttime.tv_sec)
-				+ ((float)((long)newtime.tv_usec - (long)g->firsttime.tv_usec) / (float)US_TO_SEC);
+static int cycle_phase(struct cycle_gen *g, const struct timeval *newtime) {
+	long long dt = (long long)(newtime->tv_sec - g->firsttime.tv_sec) * US_TO_SEC
+				+ ((long)newtime->tv_usec - (long)g->firsttime.tv_usec);
 
 	if(dt < 0) {
-		printf("Cycle dt<0! dt: %f , newtime: %li %li , firsttime: %li %li\n",
+		printf("Cycle dt<0! dt: %lli us , newtime: %li %li , firsttime: %li %li\n",
 						dt,
-						(long)newtime.tv_sec, (long)newtime.tv_usec,
+						(long)newtime->tv_sec, (long)newtime->tv_usec,
 						(long)g->firsttime.tv_sec, (long)g->firsttime.tv_usec
 						);
 		dt = 0; // Kluuuuudge
 	}
 
-	while(dt > g->cycle_length) {
-		dt -= g->cycle_length;
+	long long cycle_us = (long long)(g->cycle_length * US_TO_SEC);
+	dt %= cycle_us;
+
+	return (int)(dt * g->resolution / cycle_us);
+}
+
+static int cycle_buildwaves(struct cycle_gen *g) {
+	int pidcount = 0;
+	unsigned int PID;
+	for(PID=0;PID<CYCLE_MAXPID;PID++) {
+		g->counts[PID] = 0;
+		g->waves[PID] = NULL;
+
+		if(0x00 == PID || 0x20 == PID || 0x40 == PID) continue;
+		struct obdservicecmd *cmd = obdGetCmdForPID(PID);
+		if(NULL == cmd || NULL == cmd->convrev) continue;
+		pidcount++;
+	}
+
+	g->wavestore = (unsigned char *)malloc((size_t)pidcount * g->resolution * 4);
+	if(NULL == g->wavestore && pidcount > 0) {
+		return 1;
 	}
 
-	struct obdservicecmd *cmd = obdGetCmdForPID(PID);
-	if(NULL == cmd || NULL == cmd->convrev) {
-		return 0;
+	// One wave's worth of values, for PIDs that can be converted in one go
+	float *vals = (float *)malloc((size_t)g->resolution * sizeof(float));
+
+	unsigned char *wave = g->wavestore;
+	for(PID=0;PID<CYCLE_MAXPID;PID++) {
+		if(0x00 == PID || 0x20 == PID || 0x40 == PID) continue;
+		struct obdservicecmd *cmd = obdGetCmdForPID(PID);
+		if(NULL == cmd || NULL == cmd->convrev) continue;
+
+		g->waves[PID] = wave;
+		int phase;
+
+		// Everything but RPM is a straight sweep from min to max
+		if(NULL != vals && NULL != cmd->db_column && 0 != strcmp(cmd->db_column, "rpm") &&
+				obdHasConvertBatch(PID)) {
+			float min = cmd->min_value;
+			float max = cmd->max_value;
+			for(phase=0;phase<g->resolution;phase++) {
+				float cyclefraction = (float)phase/(float)g->resolution;
+				vals[phase] = min + cyclefraction * (max-min);
+			}
+			memset(wave, 0, (size_t)g->resolution * 4);
+			g->counts[PID] = obdRevConvertBatch(PID, vals, g->resolution, wave, 4);
+			wave += (size_t)g->resolution * 4;
+			continue;
+		}
+
+		for(phase=0;phase<g->resolution;phase++) {
+			unsigned int abcd[4] = { 0, 0, 0, 0 };
+			int count = cycle_computevalue(g, cmd, (float)phase/(float)g->resolution,
+				abcd+0, abcd+1, abcd+2, abcd+3);
+			if(0 == phase) g->counts[PID] = count;
+
+			wave[0] = abcd[0];
+			wave[1] = abcd[1];
+			wave[2] = abcd[2];
+			wave[3] = abcd[3];
+			wave += 4;
+		}
 	}
+	free(vals);
+	return 0;
+}
+
+static int cycle_computevalue(struct cycle_gen *g, struct obdservicecmd *cmd, float cyclefraction,
+		unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+
 	float min = cmd->min_value;
 	float max = cmd->max_value;
 	OBDConvRevFunc conv = cmd->convrev;
 
-	float cyclefraction = dt/g->cycle_length;
 	float val = min + cyclefraction * (max-min);
 
 	// RPM gets special treatment
@@ -171,6 +305,7 @@ struct obdsim_generator obdsimgen_cycle = {
 	cycle_simgen_getvalue,
 	cycle_simgen_idle,
 	NULL,
-	NULL
+	NULL,
+	cycle_simgen_getvalues
 };
 
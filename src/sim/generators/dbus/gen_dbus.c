@@ -120,12 +120,16 @@ int dbus_simgen_create(void **gen, const char *seed) {
 		} else if(2 == sscanf(line, "map %i -> %x", &map_from, &map_to)) {
 			struct obdservicecmd *cmd = obdGetCmdForPID(map_to);
 
-			printf("DBus Config, map %i -> 0x%02X (%s)\n", map_from, map_to, cmd->human_name);
-
 			if(NULL == cmd) {
 				fprintf(stderr, "DBus Config, Cannot find obdservice command for PID %02X\n", map_to);
 				continue;
 			}
+			if(NULL == cmd->convrev) {
+				fprintf(stderr, "DBus Config, Cannot convert values for PID %02X\n", map_to);
+				continue;
+			}
+
+			printf("DBus Config, map %i -> 0x%02X (%s)\n", map_from, map_to, cmd->human_name);
 
 			struct dbus_simvals *v = (struct dbus_simvals *)malloc(sizeof(struct dbus_simvals));
 			v->map_from = map_from;
@@ -42,6 +42,9 @@ struct dlopen_gen {
 	int (*simdl_idle)(void *gen, int timems);
 	int (*simdl_geterrorcodes)(void *gen, unsigned int *errorcodes, int num_codes, int *mil);
 	int (*simdl_clearerrorcodes)(void *gen);
+	void (*simdl_setclock)(int (*gettime)(struct timeval *tv));
+	int (*simdl_getvalues)(void *gen, unsigned int mode, struct obdsim_value *values, int count);
+	int (*simdl_seterrornotify)(void *gen, void (*notify)(void *cookie), void *cookie);
 };
 
 const char *dlopen_simgen_name() {
@@ -135,8 +138,30 @@ int dlopen_simgen_create(void **gen, const char *seed) {
 		fprintf(stderr, "Couldn't find symbol simdl_clearerrorcodes in library [Not Fatal]: %s\n", error);
 	}
 
+	*(void **)(&g->simdl_setclock) = dlsym(handle, "simdl_setclock");
+	if(NULL != (error = dlerror())) {
+		// Plenty of plugins don't care what time it is
+		g->simdl_setclock = NULL;
+	}
+
+	*(void **)(&g->simdl_getvalues) = dlsym(handle, "simdl_getvalues");
+	if(NULL != (error = dlerror())) {
+		// Older plugins only have simdl_getvalue
+		g->simdl_getvalues = NULL;
+	}
+
+	*(void **)(&g->simdl_seterrornotify) = dlsym(handle, "simdl_seterrornotify");
+	if(NULL != (error = dlerror())) {
+		// Without it, errors are polled
+		g->simdl_seterrornotify = NULL;
+	}
+
 	printf("Successfully dlopen'd sim generator %s, %s\n", libname, g->simdl_name());
 
+	if(NULL != g->simdl_setclock) {
+		g->simdl_setclock(obdsim_gettimeofday);
+	}
+
 	if(1 == g->simdl_create(&(g->gen_gen), subseed)) {
 		fprintf(stderr, "dlopene'd library reported error on creation\n");
 		dlclose(handle);
@@ -162,6 +187,22 @@ int dlopen_simgen_getvalue(void *gen, unsigned int mode, unsigned int PID, unsig
 	return g->simdl_getvalue(g->gen_gen, mode, PID, A, B, C, D);
 }
 
+int dlopen_simgen_getvalues(void *gen, unsigned int mode, struct obdsim_value *values, int count) {
+	struct dlopen_gen *g = (struct dlopen_gen *)gen;
+	if(NULL != g->simdl_getvalues) {
+		return g->simdl_getvalues(g->gen_gen, mode, values, count);
+	}
+
+	int i;
+	for(i=0;i<count;i++) {
+		unsigned int *abcd = values[i].abcd;
+		values[i].count = g->simdl_getvalue(g->gen_gen, mode, values[i].pid,
+			abcd+0, abcd+1, abcd+2, abcd+3);
+		if(-1 == values[i].count) return -1;
+	}
+	return 0;
+}
+
 int dlopen_simgen_idle(void *gen, int idlems) {
 	struct dlopen_gen *g = (struct dlopen_gen *)gen;
 	if(NULL != g->simdl_idle) {
@@ -186,6 +227,14 @@ int dlopen_simgen_clearerrorcodes(void *gen) {
 	return 0;
 }
 
+int dlopen_simgen_seterrornotify(void *gen, void (*notify)(void *cookie), void *cookie) {
+	struct dlopen_gen *g = (struct dlopen_gen *)gen;
+	if(NULL != g->simdl_seterrornotify) {
+		return g->simdl_seterrornotify(g->gen_gen, notify, cookie);
+	}
+	return 1;
+}
+
 // Declare our obdsim_generator. This is pulled in as an extern in obdsim.c
 struct obdsim_generator obdsimgen_dlopen = {
 	dlopen_simgen_name,
@@ -195,6 +244,8 @@ struct obdsim_generator obdsimgen_dlopen = {
 	dlopen_simgen_getvalue,
 	dlopen_simgen_idle,
 	dlopen_simgen_geterrorcodes,
-	dlopen_simgen_clearerrorcodes
+	dlopen_simgen_clearerrorcodes,
+	dlopen_simgen_getvalues,
+	dlopen_simgen_seterrornotify
 };
 
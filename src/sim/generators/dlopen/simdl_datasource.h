@@ -20,6 +20,18 @@
 extern "C" {
 #endif //__cplusplus
 
+struct timeval;
+
+#ifndef OBDSIM_VALUE_DEFINED
+#define OBDSIM_VALUE_DEFINED
+/// One PID's part of a batch request. See simdl_getvalues
+struct obdsim_value {
+	unsigned int pid; //< The PID being asked for
+	unsigned int abcd[4]; //< Four values to fill
+	int count; //< Number of values filled, as simdl_getvalue would return it
+};
+#endif //OBDSIM_VALUE_DEFINED
+
 /// Get a human-friendly name for this generator
 const char *simdl_name();
 
@@ -60,6 +72,35 @@ int simdl_geterrorcodes(void *gen, unsigned int *errorcodes, int num_codes, int
 /** \return -1 on error, 0 on success */
 int simdl_clearerrorcodes(void *gen);
 
+/// Optional. Called before simdl_create with the sim's clock
+/** Use gettime instead of gettimeofday() to keep up when the sim is
+     running in virtual time [--virtual-time]
+    \param gettime behaves as gettimeofday(tv, NULL)
+*/
+void simdl_setclock(int (*gettime)(struct timeval *tv));
+
+/// Optional. Get values for several PIDs at once
+/** Same as calling simdl_getvalue on each PID in turn, but all taken
+     at one moment. Without it, simdl_getvalue is called for each PID
+    \param gen opaque data generator
+    \param mode the mode of this request
+    \param values pid is set in each. Fill in abcd and count
+    \param count number of values
+    \return 0 on success, -1 for "must exit"
+*/
+int simdl_getvalues(void *gen, unsigned int mode, struct obdsim_value *values, int count);
+
+/// Optional. Tell the sim when error codes change, instead of being polled
+/** Called once, after simdl_create. From then on simdl_geterrorcodes is
+     only called after notify, or after the codes have been cleared.
+     notify may be called from any thread
+    \param gen opaque data generator
+    \param notify call this whenever the set of error codes changes
+    \param cookie pass this to notify
+    \return 0 if notify will be called, anything else to carry on being polled
+*/
+int simdl_seterrornotify(void *gen, void (*notify)(void *cookie), void *cookie);
+
 #ifdef __cplusplus
 }
 #endif //__cplusplus
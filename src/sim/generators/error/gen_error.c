@@ -87,6 +87,11 @@ int error_simgen_clearerrorcodes(void *gen) {
 	return 0;
 }
 
+int error_simgen_seterrornotify(void *gen, void (*notify)(void *cookie), void *cookie) {
+	// Our errors never change, so there's never anything to tell
+	return 0;
+}
+
 // Declare our obdsim_generator. This is pulled in as an extern in obdsim.c
 struct obdsim_generator obdsimgen_error = {
 	error_simgen_name,
@@ -96,6 +101,8 @@ struct obdsim_generator obdsimgen_error = {
 	error_simgen_getvalue,
 	NULL,
 	error_simgen_geterrorcodes,
-	error_simgen_clearerrorcodes
+	error_simgen_clearerrorcodes,
+	NULL,
+	error_simgen_seterrornotify
 };
 
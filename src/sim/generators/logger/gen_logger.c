@@ -26,6 +26,8 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 #include <sys/time.h>
 #include <unistd.h>
 #include <string.h>
+#include <math.h>
+#include <signal.h>
 
 #include "sqlite3.h"
 
@@ -35,47 +37,158 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 /// This is the void * generator
 struct logger_gen {
 	sqlite3 *db; //< The sqlite3 database
-	struct timeval simstart;  // The time that the simulation began
+	struct timeval simstart;  // The time that playback last started or resumed
 	double min_databasetime; // The earliest time in the database
 	double max_databasetime; // The latest time in the database
 	unsigned long supportedpids_00; // Supported pids according to 0100
 	unsigned long supportedpids_20; // Supported pids according to 0120
 	unsigned long supportedpids_40; // Supported pids according to 0140
 	unsigned long supportedpids_60; // Supported pids according to 0160
+
+	int rowcount; //< Rows in the in-memory index. Zero means look everything up in SQL
+	double *times; //< Time of each row, ascending
+	double *values[0x100]; //< values[pid][row]. NULL if the log doesn't have that pid. NAN for NULL
+	double *indexstore; //< Everything times and values point into
+	int cursor; //< First row at or after the time of the last lookup
+
+	char filter[64]; //< Extra SQL condition to select a trip and ECU, eg " AND trip=12 AND ecu=1"
+	double windowstart; //< Playback starts here, log time
+	double windowend; //< Playback wraps back to windowstart here, log time
+	double speed; //< Playback speed multiplier
+	double position; //< Log time at simstart
+	int paused; //< Set while playback is paused
+	int pausecount; //< Pause/resume requests already acted on
+	int seekcount; //< Seek requests already acted on
 };
 
+/// Number of times SIGUSR1 [pause/resume] has been received
+static volatile sig_atomic_t logger_pauserequests = 0;
+
+/// Number of times SIGUSR2 [seek to start] has been received
+static volatile sig_atomic_t logger_seekrequests = 0;
+
+/// Count pause and seek requests. Every Logger generator acts on them
+static void logger_sighandler(int sig) {
+	if(SIGUSR1 == sig) logger_pauserequests++;
+	else if(SIGUSR2 == sig) logger_seekrequests++;
+}
+
+/// Parse the options after the filename in the seed
+/** \param g the generator to set options on
+    \param opts comma-separated name=value pairs. Modified
+    \param trip set to the trip requested, or -1 for all of them
+    \param ecu set to the ecu requested, or -1 for the first in the log
+    \param start,end set to the window requested, seconds from the start. Negative if not set
+    \return 0 on success
+*/
+static int logger_parseopts(struct logger_gen *g, char *opts, long *trip, long *ecu,
+	double *start, double *end);
+
+/// Work out the log time we're playing right now
+static double logger_playposition(struct logger_gen *g);
+
+/// Act on any pause or seek requests since we last looked
+static void logger_checkcontrol(struct logger_gen *g);
+
+/// Load the time and every PID column of the log into memory
+/** \param g the generator, with db open
+    \param pids the PIDs of the columns to load
+    \param columns the names of the columns to load
+    \param colcount number of pids and columns
+    \return 0 on success. Leaves rowcount at zero on failure
+*/
+static int logger_loadindex(struct logger_gen *g, const unsigned int *pids,
+	const char **columns, int colcount);
+
+/// Find the interpolated value of a pid at seltime using the in-memory index
+static double logger_indexlookup(struct logger_gen *g, unsigned int pid, double seltime);
+
+/// Find the interpolated value of a column at seltime using SQL
+static double logger_sqllookup(struct logger_gen *g, const char *column, double seltime);
+
+/// Fill in one of the 0x00/0x20/0x40/0x60 "supported PIDs" bitmaps
+static int logger_supportedpids(struct logger_gen *g, unsigned int PID,
+		unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+
+/// Look up a real value at seltime. Returns the same as getvalue
+static int logger_valueat(struct logger_gen *g, unsigned int PID, double seltime,
+		unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D);
+
 const char *logger_simgen_name() {
 	return "Logger";
 }
 
 const char *logger_simgen_longdesc() {
 	return "Read Logfile created by obdgpslogger, simulate and interpolate\n"
-		"Seed: <obdgpslogger logfile>";
+		"Seed: <obdgpslogger logfile>[,trip=<n>][,ecu=<n>][,start=<s>][,end=<s>][,speed=<n>x]\n"
+		"  trip   Only play back this trip\n"
+		"  ecu    Play back this ECU's rows [default the first in the log]\n"
+		"  start  Start this many seconds into the log [or trip]\n"
+		"  end    Wrap around this many seconds into the log [or trip]\n"
+		"  speed  Play back this many times faster than real time\n"
+		"Send SIGUSR1 to pause or resume, SIGUSR2 to seek back to the start";
 }
 
 int logger_simgen_create(void **gen, const char *seed) {
-	const char *filename = seed;
-	if(NULL == filename || 0 == strlen(filename)) {
+	if(NULL == seed || 0 == strlen(seed)) {
 		fprintf(stderr, "Must use filename of log as the seed\n");
 		return 1;
 	}
 
+	struct logger_gen *g = (struct logger_gen *)malloc(sizeof(struct logger_gen));
+	if(NULL == g) {
+		fprintf(stderr,"Couldn't allocate memory for logger generator\n");
+		return 1;
+	}
+
+	g->filter[0] = '\0';
+	g->speed = 1.0;
+	g->paused = 0;
+	g->pausecount = logger_pauserequests;
+	g->seekcount = logger_seekrequests;
+
+	char *seedcpy = strdup(seed);
+	char *filename = seedcpy;
+	char *opts = strchr(seedcpy, ',');
+	long trip = -1;
+	long ecu = -1;
+	double start = -1;
+	double end = -1;
+	if(NULL != opts) {
+		*opts = '\0';
+		opts++;
+		if(0 != logger_parseopts(g, opts, &trip, &ecu, &start, &end)) {
+			free(seedcpy);
+			free(g);
+			return 1;
+		}
+	}
+	if(trip >= 0) {
+		snprintf(g->filter, sizeof(g->filter), " AND trip=%li", trip);
+	}
+
 	sqlite3 *db;
 	int rc;
 	rc = sqlite3_open_v2(filename, &db, SQLITE_OPEN_READONLY, NULL);
 	if( SQLITE_OK != rc ) {
 		fprintf(stderr, "Can't open database %s: %s\n", filename, sqlite3_errmsg(db));
 		sqlite3_close(db);
+		free(seedcpy);
+		free(g);
 		return 1;
 	}
-
-	struct logger_gen *g = (struct logger_gen *)malloc(sizeof(struct logger_gen));
-	if(NULL == g) {
-		fprintf(stderr,"Couldn't allocate memory for logger generator\n");
-		return 1;
-	}
+	free(seedcpy);
 
 	g->db = db;
+	g->rowcount = 0;
+	g->times = NULL;
+	g->indexstore = NULL;
+	g->cursor = 0;
+	memset(g->values, 0, sizeof(g->values));
+
+	unsigned int pids[0x100]; // PIDs with columns in the log
+	const char *columns[0x100]; // Their column names
+	int colcount = 0;
 
 	// Get the supported PIDs according to the database
 	g->supportedpids_00 = 0x01; // We can support getting higher PIDs without supporting anything else
@@ -83,6 +196,8 @@ int logger_simgen_create(void **gen, const char *seed) {
 	g->supportedpids_40 = 0x00;
 	g->supportedpids_60 = 0x00;
 
+	int hasecu = 0; // Set if the log has an ecu column
+
 	sqlite3_stmt *pragma_stmt; // The stmt for gathering table_info
 	const char *dbend; // ignored handle for sqlite
 	rc = sqlite3_prepare_v2(g->db, "PRAGMA table_info(obd)", -1, &pragma_stmt, &dbend);
@@ -100,6 +215,10 @@ int logger_simgen_create(void **gen, const char *seed) {
 		if(0 == strcmp(columnname, "time") || 0 == strcmp(columnname, "trip")) {
 			continue;
 		}
+		if(0 == strcmp(columnname, "ecu")) {
+			hasecu = 1;
+			continue;
+		}
 
 		struct obdservicecmd *cmd = obdGetCmdForColumn(columnname);
 
@@ -107,9 +226,19 @@ int logger_simgen_create(void **gen, const char *seed) {
 			printf("Couldn't find cmd for column %s\n", columnname);
 			continue;
 		}
+		if(NULL == cmd->convrev) {
+			// Can't turn logged values back into a reply
+			continue;
+		}
 
 		unsigned int pid = cmd->cmdid;
 
+		if(colcount < (int)(sizeof(pids)/sizeof(pids[0])) && pid < 0x100) {
+			pids[colcount] = pid;
+			columns[colcount] = cmd->db_column;
+			colcount++;
+		}
+
 		if(pid <= 0x20) {
 			g->supportedpids_00 |= ((unsigned long)1<<(0x20 - pid));
 		} else if(pid > 0x20 && pid <= 0x40) {
@@ -126,12 +255,34 @@ int logger_simgen_create(void **gen, const char *seed) {
 	sqlite3_finalize(pragma_stmt);
 	// Got the supported PIDs
 
+	// Each ECU that replied has its own rows at the same times. Play back one
+	if(hasecu) {
+		if(ecu < 0) {
+			char ecu_select_sql[128];
+			snprintf(ecu_select_sql, sizeof(ecu_select_sql), "SELECT MIN(ecu) FROM obd WHERE time IS NOT NULL%s", g->filter);
+
+			sqlite3_stmt *select_ecu_stmt;
+			rc = sqlite3_prepare_v2(g->db, ecu_select_sql, -1, &select_ecu_stmt, &dbend);
+			if(SQLITE_OK == rc && SQLITE_ROW == sqlite3_step(select_ecu_stmt) &&
+				SQLITE_NULL != sqlite3_column_type(select_ecu_stmt, 0)) {
+				ecu = sqlite3_column_int64(select_ecu_stmt, 0);
+			}
+			sqlite3_finalize(select_ecu_stmt);
+		}
+		if(ecu >= 0) {
+			size_t len = strlen(g->filter);
+			snprintf(g->filter + len, sizeof(g->filter) - len, " AND ecu=%li", ecu);
+		}
+	} else if(ecu >= 0) {
+		fprintf(stderr, "Log has no ecu column, playing back every row\n");
+	}
+
 
 	// Get the starting time of the database
 	char time_select_sql[2048];
 
 	// Taking our best guess means interpolating the value.
-	snprintf(time_select_sql, sizeof(time_select_sql), "SELECT MIN(obd.time), MAX(obd.time) FROM obd");
+	snprintf(time_select_sql, sizeof(time_select_sql), "SELECT MIN(obd.time), MAX(obd.time) FROM obd WHERE time IS NOT NULL%s", g->filter);
 
 	sqlite3_stmt *select_time_stmt; // Our actual select statement
 	rc = sqlite3_prepare_v2(g->db, time_select_sql, -1, &select_time_stmt, &dbend);
@@ -151,7 +302,41 @@ int logger_simgen_create(void **gen, const char *seed) {
 	sqlite3_finalize(select_time_stmt);
 	// Got the start time of the database
 
-	if(0 != gettimeofday(&(g->simstart), NULL)) {
+	if(g->max_databasetime <= g->min_databasetime) {
+		if(trip >= 0) {
+			fprintf(stderr, "Not enough data to play back trip %li\n", trip);
+		} else {
+			fprintf(stderr, "Not enough data to play back\n");
+		}
+		sqlite3_close(db);
+		free(g);
+		return 1;
+	}
+
+	g->windowstart = g->min_databasetime;
+	g->windowend = g->max_databasetime;
+	if(start > 0) g->windowstart += start;
+	if(end > 0 && g->min_databasetime + end < g->windowend) g->windowend = g->min_databasetime + end;
+	if(g->windowend <= g->windowstart) {
+		fprintf(stderr, "Logger playback window is empty\n");
+		sqlite3_close(db);
+		free(g);
+		return 1;
+	}
+	g->position = g->windowstart;
+	printf("Logger playing back %.1f seconds of log at %gx\n",
+		g->windowend - g->windowstart, g->speed);
+
+#ifdef SIGUSR1
+	signal(SIGUSR1, logger_sighandler);
+	signal(SIGUSR2, logger_sighandler);
+#endif //SIGUSR1
+
+	if(0 != logger_loadindex(g, pids, columns, colcount)) {
+		printf("Couldn't load log into memory, falling back to SQL lookups\n");
+	}
+
+	if(0 != obdsim_gettimeofday(&(g->simstart))) {
 		fprintf(stderr, "Couldn't get time of day\n");
 		sqlite3_close(db);
 		free(g);
@@ -165,6 +350,7 @@ int logger_simgen_create(void **gen, const char *seed) {
 void logger_simgen_destroy(void *gen) {
 	struct logger_gen *g = gen;
 	sqlite3_close(g->db);
+	free(g->indexstore);
 	free(gen);
 }
 
@@ -172,56 +358,285 @@ int logger_simgen_getvalue(void *gen, unsigned int mode, unsigned int PID, unsig
 	struct logger_gen *g = gen;
 
 	if(0x00 == PID || 0x20 == PID || 0x40 == PID || 0x60 == PID) {
-			unsigned long bits;
-			if(0x00 == PID) bits = g->supportedpids_00;
-			else if(0x20 == PID) bits = g->supportedpids_20;
-			else if(0x40 == PID) bits = g->supportedpids_40;
-			else if(0x60 == PID) bits = g->supportedpids_60;
-			else return 0;
+		return logger_supportedpids(g, PID, A, B, C, D);
+	}
+
+	// Getting here means we need to look up a real value.
+	logger_checkcontrol(g);
+	return logger_valueat(g, PID, logger_playposition(g), A, B, C, D);
+}
 
-			*D = bits & 0xFF;
-			bits >>= 8;
-			*C = bits & 0xFF;
-			bits >>= 8;
-			*B = bits & 0xFF;
-			bits >>= 8;
-			*A = bits & 0xFF;
+int logger_simgen_getvalues(void *gen, unsigned int mode, struct obdsim_value *values, int count) {
+	struct logger_gen *g = gen;
+
+	// Every value in the batch comes from the same moment in the log
+	logger_checkcontrol(g);
+	double seltime = logger_playposition(g);
 
-			return 4;
+	int i;
+	for(i=0;i<count;i++) {
+		unsigned int PID = values[i].pid;
+		unsigned int *abcd = values[i].abcd;
+		if(0x00 == PID || 0x20 == PID || 0x40 == PID || 0x60 == PID) {
+			values[i].count = logger_supportedpids(g, PID, abcd+0, abcd+1, abcd+2, abcd+3);
+		} else {
+			values[i].count = logger_valueat(g, PID, seltime, abcd+0, abcd+1, abcd+2, abcd+3);
+		}
 	}
+	return 0;
+}
 
+static int logger_supportedpids(struct logger_gen *g, unsigned int PID,
+		unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	unsigned long bits;
+	if(0x00 == PID) bits = g->supportedpids_00;
+	else if(0x20 == PID) bits = g->supportedpids_20;
+	else if(0x40 == PID) bits = g->supportedpids_40;
+	else if(0x60 == PID) bits = g->supportedpids_60;
+	else return 0;
+
+	*D = bits & 0xFF;
+	bits >>= 8;
+	*C = bits & 0xFF;
+	bits >>= 8;
+	*B = bits & 0xFF;
+	bits >>= 8;
+	*A = bits & 0xFF;
+
+	return 4;
+}
+
+static int logger_valueat(struct logger_gen *g, unsigned int PID, double seltime,
+		unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
 	struct obdservicecmd *cmd = obdGetCmdForPID(PID);
-	if(NULL == cmd || NULL == cmd->db_column || 0 == strlen(cmd->db_column)) {
+	if(NULL == cmd || NULL == cmd->db_column || 0 == strlen(cmd->db_column) || NULL == cmd->convrev) {
 			fprintf(stderr, "Requested unsupported PID\n");
 			return 0;
 	}
 
-	// Getting here means we need to look up a real value.
-	struct timeval currtime;
-	if(0 != gettimeofday(&currtime, NULL)) {
-			fprintf(stderr, "Couldn't get time of day\n");
+	double val;
+	if(g->rowcount > 0) {
+		if(PID >= 0x100 || NULL == g->values[PID]) {
 			return 0;
+		}
+		val = logger_indexlookup(g, PID, seltime);
+	} else {
+		val = logger_sqllookup(g, cmd->db_column, seltime);
+	}
+
+	return cmd->convrev(val, A, B, C, D);
+}
+
+static int logger_parseopts(struct logger_gen *g, char *opts, long *trip, long *ecu,
+		double *start, double *end) {
+
+	char *tok;
+	for(tok = strtok(opts, ","); NULL != tok; tok = strtok(NULL, ",")) {
+		while(' ' == *tok) tok++;
+		char *val = strchr(tok, '=');
+		if(NULL == val) {
+			fprintf(stderr, "Logger option \"%s\" needs a value\n", tok);
+			return 1;
+		}
+		*val = '\0';
+		val++;
+
+		char *endp;
+		if(0 == strcmp(tok, "trip")) {
+			*trip = strtol(val, &endp, 10);
+		} else if(0 == strcmp(tok, "ecu")) {
+			*ecu = strtol(val, &endp, 10);
+		} else if(0 == strcmp(tok, "start")) {
+			*start = strtod(val, &endp);
+		} else if(0 == strcmp(tok, "end")) {
+			*end = strtod(val, &endp);
+		} else if(0 == strcmp(tok, "speed")) {
+			g->speed = strtod(val, &endp);
+			if('x' == *endp || 'X' == *endp) endp++;
+			if(g->speed <= 0) {
+				fprintf(stderr, "Logger speed must be more than zero\n");
+				return 1;
+			}
+		} else {
+			fprintf(stderr, "Unknown Logger option \"%s\"\n", tok);
+			return 1;
+		}
+
+		if(endp == val || '\0' != *endp) {
+			fprintf(stderr, "Couldn't parse Logger option %s=%s\n", tok, val);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static double logger_playposition(struct logger_gen *g) {
+	double pos = g->position;
+	if(!g->paused) {
+		struct timeval currtime;
+		obdsim_gettimeofday(&currtime);
+		double dt = (currtime.tv_sec - g->simstart.tv_sec) +
+			(double)(currtime.tv_usec - g->simstart.tv_usec)/1000000.0;
+		pos += dt * g->speed;
 	}
-	struct timeval dt;
-	dt.tv_sec = currtime.tv_sec - g->simstart.tv_sec;
-	dt.tv_usec = currtime.tv_usec - g->simstart.tv_usec;
 
-	// Time we're aiming for in the SELECT, taking into account when the database starts
-	double seltime = g->min_databasetime + (double)dt.tv_sec+(double)dt.tv_usec/1000000.0f;
+	double windowlen = g->windowend - g->windowstart;
+	if(pos > g->windowend) {
+		pos = g->windowstart + fmod(pos - g->windowstart, windowlen);
+	}
+	return pos;
+}
 
-	while(seltime > g->max_databasetime) {
-		seltime -= (g->max_databasetime - g->min_databasetime);
+static void logger_checkcontrol(struct logger_gen *g) {
+	int pauses = logger_pauserequests;
+	int seeks = logger_seekrequests;
+
+	if(seeks != g->seekcount) {
+		g->seekcount = seeks;
+		g->position = g->windowstart;
+		obdsim_gettimeofday(&g->simstart);
+		printf("Logger seeking to start\n");
 	}
 
+	if(pauses != g->pausecount) {
+		int toggle = (pauses - g->pausecount) & 1;
+		g->pausecount = pauses;
+		if(toggle) {
+			// Remember where we are, and carry on from there
+			g->position = logger_playposition(g);
+			obdsim_gettimeofday(&g->simstart);
+			g->paused = !g->paused;
+			printf("Logger %s\n", g->paused?"paused":"resumed");
+		}
+	}
+}
+
+static int logger_loadindex(struct logger_gen *g, const unsigned int *pids,
+		const char **columns, int colcount) {
+
+	sqlite3_stmt *stmt;
+	const char *dbend; // ignored handle for sqlite
+
+	char sql[4096];
+
+	// Find out how much room we need
+	snprintf(sql, sizeof(sql), "SELECT COUNT(*) FROM obd WHERE time IS NOT NULL%s", g->filter);
+	int rc = sqlite3_prepare_v2(g->db, sql, -1, &stmt, &dbend);
+	if(SQLITE_OK != rc) {
+		sqlite3_finalize(stmt);
+		return 1;
+	}
+	int rowcount = 0;
+	if(SQLITE_ROW == sqlite3_step(stmt)) {
+		rowcount = sqlite3_column_int(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+	if(rowcount <= 0) {
+		return 1;
+	}
+
+	// One contiguous array for times, then one per column
+	g->indexstore = (double *)malloc(sizeof(double) * (size_t)rowcount * (colcount + 1));
+	if(NULL == g->indexstore) {
+		return 1;
+	}
+
+	int sqllen = snprintf(sql, sizeof(sql), "SELECT time");
+	int i;
+	for(i=0;i<colcount && sqllen < (int)sizeof(sql);i++) {
+		sqllen += snprintf(sql+sqllen, sizeof(sql)-sqllen, ",%s", columns[i]);
+	}
+	if(sqllen < (int)sizeof(sql)) {
+		sqllen += snprintf(sql+sqllen, sizeof(sql)-sqllen, " FROM obd WHERE time IS NOT NULL%s ORDER BY time", g->filter);
+	}
+	if(sqllen >= (int)sizeof(sql)) {
+		free(g->indexstore);
+		g->indexstore = NULL;
+		return 1;
+	}
+
+	rc = sqlite3_prepare_v2(g->db, sql, -1, &stmt, &dbend);
+	if(SQLITE_OK != rc) {
+		printf("Couldn't prepare select %s: %s\n", sql, sqlite3_errmsg(g->db));
+		sqlite3_finalize(stmt);
+		free(g->indexstore);
+		g->indexstore = NULL;
+		return 1;
+	}
+
+	g->times = g->indexstore;
+	for(i=0;i<colcount;i++) {
+		g->values[pids[i]] = g->indexstore + (size_t)rowcount * (i+1);
+	}
+
+	int row = 0;
+	while(row < rowcount && SQLITE_ROW == sqlite3_step(stmt)) {
+		g->times[row] = sqlite3_column_double(stmt, 0);
+		for(i=0;i<colcount;i++) {
+			if(SQLITE_NULL == sqlite3_column_type(stmt, i+1)) {
+				g->values[pids[i]][row] = NAN;
+			} else {
+				g->values[pids[i]][row] = sqlite3_column_double(stmt, i+1);
+			}
+		}
+		row++;
+	}
+	sqlite3_finalize(stmt);
+
+	g->rowcount = row;
+	g->cursor = 0;
+	printf("Loaded %i rows, %i columns of the log into memory\n", row, colcount);
+	return 0;
+}
+
+static double logger_indexlookup(struct logger_gen *g, unsigned int pid, double seltime) {
+	const double *t = g->times;
+	int n = g->rowcount;
+	int idx = g->cursor;
+
+	// Usually we're at the same place as last time, or just after it
+	if(idx < n && t[idx] >= seltime && (0 == idx || t[idx-1] < seltime)) {
+		// Still in the same place
+	} else if(idx+1 < n && t[idx+1] >= seltime && t[idx] < seltime) {
+		idx++;
+	} else {
+		// First row at or after seltime
+		int lo = 0;
+		int hi = n;
+		while(lo < hi) {
+			int mid = lo + (hi-lo)/2;
+			if(t[mid] < seltime) lo = mid+1;
+			else hi = mid;
+		}
+		idx = lo;
+	}
+	g->cursor = idx;
+
+	const double *v = g->values[pid];
+	if(idx >= n) return isnan(v[n-1])?0:v[n-1];
+	if(0 == idx) return isnan(v[0])?0:v[0];
+
+	double s = v[idx-1];
+	double e = v[idx];
+	if(isnan(s) && isnan(e)) return 0;
+	if(isnan(s)) return e;
+	if(isnan(e)) return s;
+
+	double dt = t[idx] - t[idx-1];
+	if(dt <= 0) return e;
+	return s + ((seltime - t[idx-1])/dt)*(e - s);
+}
+
+static double logger_sqllookup(struct logger_gen *g, const char *column, double seltime) {
 	char sql[2048];
 
 	// Taking our best guess means interpolating the value.
 	snprintf(sql, sizeof(sql), "SELECT "
 				"(s.%s + ((%f-s.time)/(e.time-s.time))*(e.%s - s.%s)) AS est%s "
 				"FROM obd s, obd e "
-				"WHERE s.time = (SELECT MAX(obd.time) FROM obd WHERE time < %f) "
-				"AND     e.time = (SELECT MIN(obd.time) FROM obd WHERE time >= %f)",
-				cmd->db_column, seltime, cmd->db_column, cmd->db_column, cmd->db_column, seltime, seltime);
+				"WHERE s.time = (SELECT MAX(obd.time) FROM obd WHERE time < %f%s) "
+				"AND     e.time = (SELECT MIN(obd.time) FROM obd WHERE time >= %f%s)",
+				column, seltime, column, column, column, seltime, g->filter, seltime, g->filter);
 
 	// printf("SQL Select:\n%s\n", sql);
 
@@ -238,14 +653,15 @@ int logger_simgen_getvalue(void *gen, unsigned int mode, unsigned int PID, unsig
 	sqlite3_step(select_stmt); // We only step once - that's all we asked for.
 
 	double val = sqlite3_column_double(select_stmt, 0);
-	int retval = cmd->convrev(val, A, B, C, D);
 
 	sqlite3_finalize(select_stmt);
 
-	return retval;
+	return val;
 }
 
 int logger_simgen_idle(void *gen, int idlems) {
+	struct logger_gen *g = gen;
+	logger_checkcontrol(g);
 	return 0;
 }
 
@@ -258,6 +674,7 @@ struct obdsim_generator obdsimgen_logger = {
         logger_simgen_getvalue,
 	logger_simgen_idle,
 	NULL,
-	NULL
+	NULL,
+	logger_simgen_getvalues
 };
 
@@ -22,32 +22,90 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "datasource.h"
 #include "obdservicecommands.h"
 
+/// Default number of sets of random values to make up front
+#define DEFAULT_RANDOM_TABLESIZE 65536
+
+/// Random only answers PIDs below this
+#define RANDOM_MAXPID 0x20
+
+/// The void * generator for random
+struct random_gen {
+	int tablesize; // Number of sets of values in table
+	unsigned char *table; // Four random bytes per set, made at create time
+	int cursor; // Next set of values to hand out
+	int counts[RANDOM_MAXPID]; // Number of values each PID returns
+};
+
 const char *random_simgen_name() {
 	return "Random";
 }
 
 const char *random_simgen_longdesc() {
 	return "Generate random numbers\n"
-		"Seed: [random number seed]";
+		"Seed: [random number seed[,number of values to pregenerate]]";
 }
 
 int random_simgen_create(void **gen, const char *seed) {
+	struct random_gen *g = (struct random_gen *)malloc(sizeof(struct random_gen));
+	if(NULL == g) {
+		fprintf(stderr, "Couldn't allocate memory for random generator\n");
+		return 1;
+	}
+	g->tablesize = DEFAULT_RANDOM_TABLESIZE;
+	g->cursor = 0;
+
 	if(NULL != seed && '\0' != *seed) {
 		int s = atoi(seed);
 		printf("Seeding RNG with %i\n", s);
 		srand(s);
+
+		const char *size = strchr(seed, ',');
+		if(NULL != size && 0 < atoi(size+1)) {
+			g->tablesize = atoi(size+1);
+			printf("Pregenerating %i values\n", g->tablesize);
+		}
+	}
+
+	g->table = (unsigned char *)malloc((size_t)g->tablesize * 4);
+	if(NULL == g->table) {
+		fprintf(stderr, "Couldn't allocate memory for random values\n");
+		free(g);
+		return 1;
 	}
+
+	// Same values, in the same order, as calling rand() for each request
+	int i;
+	for(i=0;i<g->tablesize*4;i++) {
+		g->table[i] = ((unsigned int) rand()) & 0xFF;
+	}
+
+	unsigned int PID;
+	for(PID=0;PID<RANDOM_MAXPID;PID++) {
+		g->counts[PID] = 4;
+		struct obdservicecmd *cmd = obdGetCmdForPID(PID);
+		if(NULL != cmd && 0 < cmd->bytes_returned && cmd->bytes_returned <= 4) {
+			g->counts[PID] = cmd->bytes_returned;
+		}
+	}
+
+	*gen = g;
 	return 0;
 }
 
 void random_simgen_destroy(void *gen) {
+	struct random_gen *g = (struct random_gen *)gen;
+	free(g->table);
+	free(g);
 }
 
 int random_simgen_getvalue(void *gen, unsigned int mode, unsigned int PID, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	struct random_gen *g = (struct random_gen *)gen;
+
 	if(0x00 == PID) {
 		// We're capable of pulling *anything* out of our collective asses!
 		*A = 0xFF;
@@ -56,23 +114,20 @@ int random_simgen_getvalue(void *gen, unsigned int mode, unsigned int PID, unsig
 		*D = 0xFE;
 		return 4;
 	}
-	if(0x20 <= PID) return 0;
-
-	*A = ((unsigned int) rand()) & 0xFF;
-	*B = ((unsigned int) rand()) & 0xFF;
-	*C = ((unsigned int) rand()) & 0xFF;
-	*D = ((unsigned int) rand()) & 0xFF;
-
-	struct obdservicecmd *cmd = obdGetCmdForPID(PID);
-	if(NULL != cmd && 0 < cmd->bytes_returned) {
-		if(cmd->bytes_returned > 4) {
-			// Not really ideal...
-			return 4;
-		}
-		return cmd->bytes_returned;
+	if(RANDOM_MAXPID <= PID) return 0;
+
+	const unsigned char *values = g->table + 4*g->cursor;
+	*A = values[0];
+	*B = values[1];
+	*C = values[2];
+	*D = values[3];
+
+	g->cursor++;
+	if(g->cursor >= g->tablesize) {
+		g->cursor = 0;
 	}
 
-	return 4;
+	return g->counts[PID];
 }
 
 int random_simgen_idle(void *gen, int idlems) {
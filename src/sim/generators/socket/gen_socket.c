@@ -23,25 +23,113 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
 
 #include "datasource.h"
 
+/// Most adapters one generator can talk to
+#define SOCKET_MAXLINKS 8
+
+/// Default time allowed to connect, or for any one command, ms
+#define SOCKET_DEFAULT_TIMEOUT 1000
+
+/// Time allowed for an adapter to reset [ATZ], ms. Real ones take about a second
+#define SOCKET_RESET_TIMEOUT 5000
+
+/// Default age at which a cached value is asked for again, ms
+#define SOCKET_DEFAULT_MAXAGE 200
+
+/// First wait before reconnecting, ms. Doubles each failure
+#define SOCKET_BACKOFF_MIN 250
+
+/// Longest wait before reconnecting, ms
+#define SOCKET_BACKOFF_MAX 8000
+
+/// Sent to each adapter after it connects, in order
+static const char *socket_initcmds[] = { "ATZ\r", "ATE0\r", "ATS0\r" };
+
+/// What a connection to one adapter is doing
+enum socket_linkstate {
+	SOCKET_LINK_DOWN, //< Not connected. Reconnect at retry
+	SOCKET_LINK_CONNECTING, //< Waiting for connect() to finish
+	SOCKET_LINK_INIT, //< Sending socket_initcmds
+	SOCKET_LINK_IDLE, //< Ready for a request
+	SOCKET_LINK_BUSY //< Waiting for the answer to a request
+};
+
+/// One upstream adapter
+struct socket_link {
+	char name[128]; //< host:port, for messages
+	struct sockaddr_storage addr; //< Where to connect
+	socklen_t addrlen; //< Length of addr
+	int handle; //< Socket, or -1
+	enum socket_linkstate state; //< What it's doing
+	int initstep; //< Next of socket_initcmds to send
+	unsigned int pid; //< PID being asked for, when BUSY
+	long long deadline; //< Give up on whatever's in progress at this time, ms
+	long long retry; //< When DOWN, reconnect at this time, ms
+	long backoff; //< Next wait before reconnecting, ms
+	char buf[1024]; //< Response read so far
+	int buflen; //< Bytes in buf
+};
+
+/// Last known value of a PID
+struct socket_value {
+	int valid; //< Set once we've had an answer
+	int count; //< Number of values. 0 if the adapter had NO DATA
+	unsigned int abcd[4]; //< The values
+	long long received; //< When it arrived, ms
+	int wanted; //< Set when someone would like it asked for again
+	int inflight; //< Set while a link is asking for it
+};
+
+/// The void * generator for socket
 struct socket_gen {
-	int handle; // Actual handle
+	struct socket_link links[SOCKET_MAXLINKS]; //< The adapters
+	int linkcount; //< Number of adapters
+	long timeout; //< Time allowed to connect, or for a command, ms
+	long maxage; //< Cached values older than this are asked for again, ms
+	struct socket_value cache[0x100]; //< Mode 01 values, by PID
+	unsigned int nextpid; //< Where to start looking for wanted PIDs. Keeps it fair
 };
 
-// Do a command
-/** \param cmd the command to send
-   \param ret shove the returned stuff in this
-   \param n allocated size of ret
-   \return number of bytes copied into ret, or -1 on failure
-*/
-static int gen_dosockcmd(struct socket_gen *g, const char *cmd, char *ret, int n);
+/// Real time, in ms. Network deadlines have nothing to do with the sim's clock
+static long long socket_now();
+
+/// Start connecting a link
+static void socket_connect(struct socket_gen *g, struct socket_link *l);
+
+/// Drop a link's connection and schedule a reconnect
+static void socket_disconnect(struct socket_gen *g, struct socket_link *l, const char *why);
+
+/// Send a command on a link
+/** \param timeout time allowed for the answer, ms
+    \return 0 on success, -1 on failure [the link is disconnected] */
+static int socket_send(struct socket_gen *g, struct socket_link *l, const char *cmd, long timeout);
+
+/// Send the next of socket_initcmds on a link
+static void socket_sendinit(struct socket_gen *g, struct socket_link *l);
+
+/// Deal with a complete response [up to the prompt] on a link
+static void socket_response(struct socket_gen *g, struct socket_link *l);
+
+/// Do whatever network work there is, waiting at most timeoutms for some
+static void socket_pump(struct socket_gen *g, long timeoutms);
+
+/// Find out if any link is up, or on its way up
+static int socket_anyup(struct socket_gen *g);
+
+/// Parse one "host:port" adapter address into a link
+/** \return 0 on success, 1 on failure */
+static int socket_addlink(struct socket_gen *g, char *hostport);
 
 const char *socket_simgen_name() {
 	return "Socket";
@@ -49,7 +137,7 @@ const char *socket_simgen_name() {
 
 const char *socket_simgen_longdesc() {
 	return "Connect to a wifi/network OBDII device\n"
-		"Seed: <host:port>";
+		"Seed: <host:port>[,<host:port>...][,timeout=<ms>][,maxage=<ms>]";
 }
 
 int socket_simgen_create(void **gen, const char *seed) {
@@ -63,15 +151,177 @@ int socket_simgen_create(void **gen, const char *seed) {
 		fprintf(stderr, "Couldn't allocate memory for socket generator\n");
 		return 1;
 	}
+	memset(g, 0, sizeof(*g));
+	g->timeout = SOCKET_DEFAULT_TIMEOUT;
+	g->maxage = SOCKET_DEFAULT_MAXAGE;
 
 	// Parse the seed
 	char *seedcopy = strdup(seed); // Because strtok needs non-const.
+	char *saveptr = NULL;
+	char *tok;
+	for(tok = strtok_r(seedcopy, ",", &saveptr); NULL != tok;
+			tok = strtok_r(NULL, ",", &saveptr)) {
+		if(0 == strncmp(tok, "timeout=", 8)) {
+			g->timeout = atol(tok+8);
+		} else if(0 == strncmp(tok, "maxage=", 7)) {
+			g->maxage = atol(tok+7);
+		} else if(0 != socket_addlink(g, tok)) {
+			break;
+		}
+	}
+	free(seedcopy);
+
+	if(NULL != tok || 0 == g->linkcount || g->timeout <= 0) {
+		if(0 == g->linkcount) {
+			fprintf(stderr, "Must pass at least one \"ip-or-hostname:port\" in the seed\n");
+		}
+		free(g);
+		return 1;
+	}
+
+	// Give them a chance to come up, so the first requests get answers.
+	//  Any that don't will keep retrying
+	int i;
+	for(i=0;i<g->linkcount;i++) {
+		socket_connect(g, &g->links[i]);
+	}
+	long long deadline = socket_now() + g->timeout + SOCKET_RESET_TIMEOUT;
+	while(socket_now() < deadline) {
+		int pending = 0;
+		for(i=0;i<g->linkcount;i++) {
+			if(SOCKET_LINK_CONNECTING == g->links[i].state ||
+					SOCKET_LINK_INIT == g->links[i].state) {
+				pending++;
+			}
+		}
+		if(0 == pending) break;
+		socket_pump(g, deadline - socket_now());
+	}
+
+	for(i=0;i<g->linkcount;i++) {
+		if(SOCKET_LINK_IDLE != g->links[i].state) {
+			fprintf(stderr, "Socket adapter %s isn't up yet; will keep trying\n", g->links[i].name);
+		}
+	}
 
-	char *node;
-	node = strtok(seedcopy, ": "); // Allow them to separate with a space
-	char *service;
-	service = strtok(NULL, ": ");
+	*gen = g;
+	return 0;
+}
 
+void socket_simgen_destroy(void *gen) {
+	struct socket_gen *g = gen;
+	int i;
+	for(i=0;i<g->linkcount;i++) {
+		if(-1 != g->links[i].handle && -1 == close(g->links[i].handle)) {
+			perror("Error closing socket");
+		}
+	}
+	free(gen);
+}
+
+int socket_simgen_getvalues(void *gen, unsigned int mode, struct obdsim_value *values, int count) {
+	struct socket_gen *g = gen;
+	int i;
+
+	// Pick up anything that's arrived
+	socket_pump(g, 0);
+
+	int missing = 0;
+	long long now = socket_now();
+	for(i=0;i<count;i++) {
+		values[i].count = 0;
+		if(0x01 != mode || values[i].pid >= 0x100) continue;
+
+		struct socket_value *v = &g->cache[values[i].pid];
+		if(!v->valid) {
+			v->wanted = 1;
+			missing++;
+		} else if(now - v->received >= g->maxage) {
+			// Answer with what we've got; a fresh one will be along shortly
+			v->wanted = 1;
+		}
+	}
+
+	// Nothing to answer with for some of them. Wait, but not too long
+	if(missing > 0) {
+		long long deadline = now + g->timeout;
+		while(socket_anyup(g) && (now = socket_now()) < deadline) {
+			socket_pump(g, deadline - now);
+
+			missing = 0;
+			for(i=0;i<count;i++) {
+				if(0x01 == mode && values[i].pid < 0x100 && !g->cache[values[i].pid].valid) {
+					missing++;
+				}
+			}
+			if(0 == missing) break;
+		}
+	}
+
+	for(i=0;i<count;i++) {
+		if(0x01 != mode || values[i].pid >= 0x100) continue;
+
+		struct socket_value *v = &g->cache[values[i].pid];
+		if(v->valid) {
+			memcpy(values[i].abcd, v->abcd, sizeof(values[i].abcd));
+			values[i].count = v->count;
+		}
+	}
+	return 0;
+}
+
+int socket_simgen_getvalue(void *gen, unsigned int mode, unsigned int PID, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
+	struct obdsim_value value;
+	value.pid = PID;
+	socket_simgen_getvalues(gen, mode, &value, 1);
+
+	*A = value.abcd[0];
+	*B = value.abcd[1];
+	*C = value.abcd[2];
+	*D = value.abcd[3];
+	return value.count;
+}
+
+int socket_simgen_idle(void *gen, int idlems) {
+	// Keep the requests flowing and the links up, but never block
+	socket_pump((struct socket_gen *)gen, 0);
+	return 0;
+}
+
+// Declare our obdsim_generator. This is pulled in as an extern in obdsim.c
+struct obdsim_generator obdsimgen_socket = {
+	socket_simgen_name,
+	socket_simgen_longdesc,
+	socket_simgen_create,
+	socket_simgen_destroy,
+	socket_simgen_getvalue,
+	socket_simgen_idle,
+	NULL,
+	NULL,
+	socket_simgen_getvalues
+};
+
+static long long socket_now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (long long)tv.tv_sec * 1000ll + tv.tv_usec / 1000;
+}
+
+static int socket_addlink(struct socket_gen *g, char *hostport) {
+	if(g->linkcount >= SOCKET_MAXLINKS) {
+		fprintf(stderr, "Too many socket adapters. At most %i\n", SOCKET_MAXLINKS);
+		return 1;
+	}
+	struct socket_link *l = &g->links[g->linkcount];
+	snprintf(l->name, sizeof(l->name), "%s", hostport);
+
+	char *saveptr = NULL;
+	char *node = strtok_r(hostport, ": ", &saveptr); // Allow them to separate with a space
+	char *service = strtok_r(NULL, ": ", &saveptr);
+	if(NULL == node || NULL == service) {
+		fprintf(stderr, "Couldn't understand socket adapter \"%s\". Must be ip-or-hostname:port\n", l->name);
+		return 1;
+	}
 
 	// Actually get the address for connecting
 	struct addrinfo hints;
@@ -87,133 +337,259 @@ int socket_simgen_create(void **gen, const char *seed) {
 
 	if(0 != getaddrinfo(node, service, &hints, &res)) {
 		perror("getaddrinfo error");
-		free(seedcopy);
-		free(g);
 		return 1;
 	}
 
-	// Done with those for now. node and service are now invalid
-	free(seedcopy);
-
 	if(NULL == res) {
-		fprintf(stderr, "getaddrinfo didn't return anything for \"%s\"\n", seed);
-		free(g);
+		fprintf(stderr, "getaddrinfo didn't return anything for \"%s\"\n", l->name);
 		return 1;
 	}
 
-	// Create the socket
-	if(0 > (g->handle = socket(res->ai_family, res->ai_socktype, res->ai_protocol))) {
+	memcpy(&l->addr, res->ai_addr, res->ai_addrlen);
+	l->addrlen = res->ai_addrlen;
+	freeaddrinfo(res);
+
+	l->handle = -1;
+	l->state = SOCKET_LINK_DOWN;
+	l->backoff = SOCKET_BACKOFF_MIN;
+	l->retry = 0;
+	g->linkcount++;
+	return 0;
+}
+
+static void socket_connect(struct socket_gen *g, struct socket_link *l) {
+	l->buflen = 0;
+	l->initstep = 0;
+
+	if(0 > (l->handle = socket(l->addr.ss_family, SOCK_STREAM, IPPROTO_TCP))) {
 		perror("Couldn't create socket");
-		freeaddrinfo(res);
-		free(g);
-		return 1;
+		l->handle = -1;
+		socket_disconnect(g, l, NULL);
+		return;
 	}
 
-	// Attempt to connect
-	if(0 > connect(g->handle, res->ai_addr, res->ai_addrlen)) {
-		perror("Couldn't connect to host");
-		freeaddrinfo(res);
-		free(g);
-		return 1;
+	int flags = fcntl(l->handle, F_GETFL, 0);
+	fcntl(l->handle, F_SETFL, flags | O_NONBLOCK);
+
+	l->deadline = socket_now() + g->timeout;
+	if(0 == connect(l->handle, (struct sockaddr *)&l->addr, l->addrlen)) {
+		l->state = SOCKET_LINK_INIT;
+		socket_sendinit(g, l);
+	} else if(EINPROGRESS == errno) {
+		l->state = SOCKET_LINK_CONNECTING;
+	} else {
+		socket_disconnect(g, l, strerror(errno));
 	}
+}
 
-	// Don't need this anymore
-	freeaddrinfo(res);
-
-	// Should be connected if we're here. Do some commands
+static void socket_disconnect(struct socket_gen *g, struct socket_link *l, const char *why) {
+	if(NULL != why) {
+		fprintf(stderr, "Socket adapter %s: %s. Reconnecting in %lims\n",
+			l->name, why, l->backoff);
+	}
 
-	char atretvalue[1024];
+	if(-1 != l->handle) {
+		close(l->handle);
+		l->handle = -1;
+	}
 
-	if(-1 == gen_dosockcmd(g, "ATZ\n", atretvalue, sizeof(atretvalue))) {
-		close(g->handle);
-		free(g);
-		return -1;
+	// Whatever it was asking for needs asking again
+	if(SOCKET_LINK_BUSY == l->state) {
+		g->cache[l->pid].inflight = 0;
+		g->cache[l->pid].wanted = 1;
 	}
 
-	if(-1 == gen_dosockcmd(g, "ATE0\n", atretvalue, sizeof(atretvalue))) {
-		close(g->handle);
-		free(g);
-		return -1;
+	l->state = SOCKET_LINK_DOWN;
+	l->retry = socket_now() + l->backoff;
+	l->backoff *= 2;
+	if(l->backoff > SOCKET_BACKOFF_MAX) {
+		l->backoff = SOCKET_BACKOFF_MAX;
 	}
+}
 
-	if(-1 == gen_dosockcmd(g, "ATS0\n", atretvalue, sizeof(atretvalue))) {
-		close(g->handle);
-		free(g);
+static int socket_send(struct socket_gen *g, struct socket_link *l, const char *cmd, long timeout) {
+	size_t len = strlen(cmd);
+	if(write(l->handle, cmd, len) != (ssize_t)len) {
+		socket_disconnect(g, l, "couldn't write");
 		return -1;
 	}
-
-	*gen = g;
+	l->buflen = 0;
+	l->deadline = socket_now() + timeout;
 	return 0;
 }
 
-void socket_simgen_destroy(void *gen) {
-	struct socket_gen *g = gen;
-	if(-1 == close(g->handle)) {
-		perror("Error closing socket");
-	}
-	free(gen);
+static void socket_sendinit(struct socket_gen *g, struct socket_link *l) {
+	socket_send(g, l, socket_initcmds[l->initstep],
+		0 == l->initstep?SOCKET_RESET_TIMEOUT:g->timeout);
 }
 
-int socket_simgen_getvalue(void *gen, unsigned int mode, unsigned int PID, unsigned int *A, unsigned int *B, unsigned int *C, unsigned int *D) {
-	char cmd[32];
-	snprintf(cmd, sizeof(cmd), "%02X %02X\n", mode, PID);
-
-	char retbuf[1024];
-	if(-1 == gen_dosockcmd((struct socket_gen *)gen, cmd, retbuf, sizeof(retbuf))) {
-		return -1;
+static void socket_response(struct socket_gen *g, struct socket_link *l) {
+	if(SOCKET_LINK_INIT == l->state) {
+		l->initstep++;
+		if(l->initstep < (int)(sizeof(socket_initcmds)/sizeof(socket_initcmds[0]))) {
+			socket_sendinit(g, l);
+		} else {
+			printf("Socket adapter %s is ready\n", l->name);
+			l->state = SOCKET_LINK_IDLE;
+			l->backoff = SOCKET_BACKOFF_MIN;
+		}
+		return;
 	}
 
-	unsigned int response;
-	unsigned int retmode;
-	int count = sscanf(retbuf, "%2x %2x %2x %2x %2x %2x", &response, &retmode,
-			A,B,C,D);
+	if(SOCKET_LINK_BUSY != l->state) return;
+
+	// Find a line answering our request. Anything else [NO DATA,
+	//  SEARCHING..., ?] means there's no value
+	struct socket_value *v = &g->cache[l->pid];
+	v->count = 0;
+
+	char *saveptr = NULL;
+	char *line;
+	for(line = strtok_r(l->buf, "\r\n>", &saveptr); NULL != line;
+			line = strtok_r(NULL, "\r\n>", &saveptr)) {
+		unsigned int bytes[6];
+		int nbytes = 0;
+		int nibbles = 0;
+		char *c;
+		for(c=line;'\0' != *c && nbytes < 6;c++) {
+			int nibble;
+			if(' ' == *c) continue;
+			else if(*c >= '0' && *c <= '9') nibble = *c - '0';
+			else if(*c >= 'A' && *c <= 'F') nibble = *c - 'A' + 10;
+			else if(*c >= 'a' && *c <= 'f') nibble = *c - 'a' + 10;
+			else break;
+
+			if(0 == nibbles%2) bytes[nbytes] = nibble << 4;
+			else bytes[nbytes++] |= nibble;
+			nibbles++;
+		}
 
-	return (count<2?0:count-2);
+		if(nbytes >= 2 && 0x41 == bytes[0] && l->pid == bytes[1]) {
+			v->count = nbytes - 2;
+			int j;
+			for(j=0;j<v->count;j++) {
+				v->abcd[j] = bytes[j+2];
+			}
+			break;
+		}
+	}
+
+	v->valid = 1;
+	v->inflight = 0;
+	v->received = socket_now();
+	l->state = SOCKET_LINK_IDLE;
 }
 
-int socket_simgen_idle(void *gen, int idlems) {
+static int socket_anyup(struct socket_gen *g) {
+	int i;
+	for(i=0;i<g->linkcount;i++) {
+		if(SOCKET_LINK_DOWN != g->links[i].state) return 1;
+	}
 	return 0;
 }
 
-// Declare our obdsim_generator. This is pulled in as an extern in obdsim.c
-struct obdsim_generator obdsimgen_socket = {
-	socket_simgen_name,
-	socket_simgen_longdesc,
-	socket_simgen_create,
-	socket_simgen_destroy,
-	socket_simgen_getvalue,
-	socket_simgen_idle,
-	NULL,
-	NULL
-};
+static void socket_pump(struct socket_gen *g, long timeoutms) {
+	int i;
+	long long now = socket_now();
+
+	// Send any wanted PIDs to idle links
+	for(i=0;i<g->linkcount;i++) {
+		struct socket_link *l = &g->links[i];
+		if(SOCKET_LINK_IDLE != l->state) continue;
+
+		int j;
+		for(j=0;j<0x100;j++) {
+			unsigned int pid = (g->nextpid + j) & 0xFF;
+			struct socket_value *v = &g->cache[pid];
+			if(v->wanted && !v->inflight) {
+				// Trailing 1: answer as soon as one ECU has, not after a timeout
+				char cmd[16];
+				snprintf(cmd, sizeof(cmd), "01%02X1\r", pid);
+				if(0 == socket_send(g, l, cmd, g->timeout)) {
+					v->wanted = 0;
+					v->inflight = 1;
+					l->pid = pid;
+					l->state = SOCKET_LINK_BUSY;
+				}
+				g->nextpid = pid + 1;
+				break;
+			}
+		}
+	}
 
-static int gen_dosockcmd(struct socket_gen *g, const char *cmd, char *ret, int n) {
-	printf("Sending \"%s\" to network socket\n", cmd);
+	// Wait for something to happen, but not past any deadline
+	struct pollfd fds[SOCKET_MAXLINKS];
+	struct socket_link *fdlinks[SOCKET_MAXLINKS];
+	int nfds = 0;
+	for(i=0;i<g->linkcount;i++) {
+		struct socket_link *l = &g->links[i];
+		long long until;
+		if(SOCKET_LINK_DOWN == l->state) {
+			until = l->retry - now;
+		} else if(SOCKET_LINK_IDLE == l->state) {
+			continue;
+		} else {
+			until = l->deadline - now;
+			fds[nfds].fd = l->handle;
+			fds[nfds].events = (SOCKET_LINK_CONNECTING == l->state)?POLLOUT:POLLIN;
+			fds[nfds].revents = 0;
+			fdlinks[nfds] = l;
+			nfds++;
+		}
+		if(until < timeoutms) timeoutms = until;
+	}
+	if(timeoutms < 0) timeoutms = 0;
 
-	if(write(g->handle, cmd, strlen(cmd)) != strlen(cmd)) {
-		perror("Couldn't write to network socket");
-		return -1;
+	if(nfds > 0 || timeoutms > 0) {
+		if(-1 == poll(fds, nfds, timeoutms) && EINTR != errno) {
+			perror("Socket generator poll");
+		}
 	}
 
-	memset(ret, '\0', n);
+	for(i=0;i<nfds;i++) {
+		struct socket_link *l = fdlinks[i];
+		if(0 == fds[i].revents) continue;
+
+		if(SOCKET_LINK_CONNECTING == l->state) {
+			int err = 0;
+			socklen_t errlen = sizeof(err);
+			getsockopt(l->handle, SOL_SOCKET, SO_ERROR, &err, &errlen);
+			if(0 != err) {
+				socket_disconnect(g, l, strerror(err));
+				continue;
+			}
+			l->state = SOCKET_LINK_INIT;
+			socket_sendinit(g, l);
+			continue;
+		}
 
-	int done = 0;
-	int totalread = 0;
-	char *curr_ret = ret;
-	while(!done && totalread < n) {
-		int nread = read(g->handle, curr_ret, n-totalread);
-		if(-1 == nread) {
-			perror("Network read error");
-			return -1;
+		int nread = read(l->handle, l->buf + l->buflen, sizeof(l->buf) - l->buflen - 1);
+		if(nread <= 0) {
+			if(-1 == nread && (EAGAIN == errno || EINTR == errno)) continue;
+			socket_disconnect(g, l, 0 == nread?"connection closed":strerror(errno));
+			continue;
 		}
-		totalread += nread;
-		if(NULL != strstr(ret, ">")) {
-			done = 1;
+		l->buflen += nread;
+		l->buf[l->buflen] = '\0';
+
+		if(NULL != strchr(l->buf, '>')) {
+			socket_response(g, l);
+		} else if(l->buflen >= (int)sizeof(l->buf) - 1) {
+			socket_disconnect(g, l, "response too long");
 		}
 	}
 
-	printf("Socket returned: \"%s\"\n", ret);
-
-	return totalread;
+	// Anything that's taken too long, or is due another try
+	now = socket_now();
+	for(i=0;i<g->linkcount;i++) {
+		struct socket_link *l = &g->links[i];
+		if(SOCKET_LINK_DOWN == l->state) {
+			if(now >= l->retry) {
+				socket_connect(g, l);
+			}
+		} else if(SOCKET_LINK_IDLE != l->state && now >= l->deadline) {
+			socket_disconnect(g, l, "timed out");
+		}
+	}
 }
 
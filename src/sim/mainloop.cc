@@ -42,23 +42,25 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 #include "simport.h"
 #include "datasource.h"
 #include "mainloop.h"
+#include "ecupool.h"
+#include "simclock.h"
+#include "faultsimport.h"
 
 void main_loop(OBDSimPort *sp, struct simsettings *ss) {
 
 	char *line; // Single line from the other end of the device
-	char previousline[1024] = "GARBAGE"; // Blank lines mean re-run previous command
+
+	// This connection's elm settings
+	struct elmsession elm;
+	obdsim_copyelmsession(&elm, &ss->elm);
 
 	// Benchmarking
 	struct timeval benchmarkstart; // Occasionally dump benchmark numbers
-	struct timeval benchmarkend; // Occasionally dump benchmark numbers
 	int benchmarkcountgood = 0;
 	int benchmarkcounttotal = 0;
-	float benchmarkdelta; // Time between benchmarkstart and benchmarkend
-
-	const char *newline_cr = "\r";
-	const char *newline_crlf = "\r\n";
+	float benchmarkdelta; // Time between benchmarkstart and now
 
-	sp->setEcho(ss->e_echo);
+	sp->setEcho(elm.e_echo);
 
 	int mustexit = 0;
 
@@ -67,27 +69,22 @@ void main_loop(OBDSimPort *sp, struct simsettings *ss) {
 		mustexit = 1;
 	}
 
-	while(!mustexit) {
-		// Begin main loop by idling for OBDSIM_SLEEPTIME ms
-		struct timeval starttime; // start time through loop
-		struct timeval endtime; // end time through loop
-		struct timeval selecttime; // =endtime-starttime [for select()]
+	// Generator idle() callbacks run on this timer, instead of every time round
+	struct timeval nextidle;
+	gettimeofday(&nextidle, NULL);
 
-		struct timeval timeouttime; // Used anytime we need a simulated timeout
+	while(!mustexit) {
+		struct timeval now; // Time at the top of the loop
 
-		if(0 != gettimeofday(&starttime,NULL)) {
-			perror("Couldn't gettimeofday for sim mainloop starttime");
+		if(0 != gettimeofday(&now,NULL)) {
+			perror("Couldn't gettimeofday for sim mainloop");
 			break;
 		}
 
 
 		if(ss->benchmark > 0) {
-			if(0 != gettimeofday(&benchmarkend, NULL)) {
-				fprintf(stderr, "Couldn't gettimeofday for benchmarking\n");
-				break;
-			}
-			benchmarkdelta = (benchmarkend.tv_sec - benchmarkstart.tv_sec) +
-					((float)(benchmarkend.tv_usec - benchmarkstart.tv_usec))/1000000.0f;
+			benchmarkdelta = (now.tv_sec - benchmarkstart.tv_sec) +
+					((float)(now.tv_usec - benchmarkstart.tv_usec))/1000000.0f;
 			if(ss->benchmark <= benchmarkdelta) {
 				printf("%f seconds. %i samples, %i queries. %.2f s/s, %.2f q/s\n",
 					benchmarkdelta,
@@ -95,329 +92,415 @@ void main_loop(OBDSimPort *sp, struct simsettings *ss) {
 					benchmarkcounttotal,
 					(float)benchmarkcountgood/benchmarkdelta,
 					(float)benchmarkcounttotal/benchmarkdelta);
-				gettimeofday(&benchmarkstart,NULL);
+				faultsim_printcounters(ss->faults);
+				benchmarkstart = now;
 				benchmarkcountgood = 0;
 				benchmarkcounttotal = 0;
 			}
 		}
 
+		long untilidle = obdsim_idle(ss, &now, &nextidle, &mustexit);
+		if(mustexit) break;
 
-		int i;
-		for(i=0;i<ss->ecu_count;i++) {
-			if(NULL != ss->ecus[i].simgen->idle) {
-				if(0 != ss->ecus[i].simgen->idle(ss->ecus[i].dg,OBDSIM_SLEEPTIME/(ss->ecu_count * 1000))) {
-					mustexit = 1;
-					break;
-				}
-			}
-		}
+		// Sleep until there's something to read or the next idle is due
+		if(0 >= sp->waitReadable(untilidle)) continue;
 
-		obdsim_freezeframes(ss->ecus, ss->ecu_count);
+		// Now the actual choise-response thing
+		line = sp->readLine(); // This is the input line
 
-		if(0 != gettimeofday(&endtime,NULL)) {
-			perror("Couldn't gettimeofday for sim mainloop endtime");
-			break;
-		}
+		if(NULL == line) continue;
 
-		selecttime.tv_sec = endtime.tv_sec - starttime.tv_sec;
-		if (selecttime.tv_sec != 0) {
-				endtime.tv_usec += 1000000*selecttime.tv_sec;
-				selecttime.tv_sec = 0;
-		}
-		selecttime.tv_usec = (OBDSIM_SLEEPTIME) - (endtime.tv_usec - starttime.tv_usec);
-		if(selecttime.tv_usec > 0) {
-			select(0,NULL,NULL,NULL,&selecttime);
+		benchmarkcounttotal++;
+
+		switch(obdsim_handleline(ss, &elm, sp, line)) {
+			case OBDSIM_LINE_SAMPLE:
+				benchmarkcountgood++;
+				break;
+			case OBDSIM_LINE_EXIT:
+				mustexit = 1;
+				break;
+			case OBDSIM_LINE_QUERY:
+			default:
+				break;
 		}
+	}
 
+	obdsim_freeelmsession(&elm);
+}
 
-		// Now the actual choise-response thing
-		line = sp->readLine(); // This is the input line
-		char response[1024]; // This is the response
+long obdsim_idle(struct simsettings *ss, struct timeval *now,
+		struct timeval *nextidle, int *mustexit) {
 
-		if(NULL == line) continue;
-		if(0 == strlen(line)) {
-			line = previousline;
-		} else {
-			strncpy(previousline, line, sizeof(previousline));
+	long untilidle = (nextidle->tv_sec - now->tv_sec) * 1000000l +
+			(nextidle->tv_usec - now->tv_usec);
+	if(untilidle > 0) {
+		return untilidle;
+	}
+
+	int i;
+	for(i=0;i<ss->ecu_count;i++) {
+		if(NULL != ss->ecus[i].simgen->idle) {
+			obdsim_lockecu(&ss->ecus[i]);
+			int idleret = ss->ecus[i].simgen->idle(ss->ecus[i].dg,OBDSIM_SLEEPTIME/(ss->ecu_count * 1000));
+			obdsim_unlockecu(&ss->ecus[i]);
+			if(0 != idleret) {
+				*mustexit = 1;
+				break;
+			}
 		}
+	}
 
-		benchmarkcounttotal++;
+	obdsim_freezeframes(ss->ecus, ss->ecu_count);
 
-		for(i=strlen(line)-1;i>=0;i--) { // Strlen is expensive, kids.
-			line[i] = toupper(line[i]);
-		}
+	// Schedule from now; if we fell behind, don't try to catch up
+	untilidle = OBDSIM_IDLEPERIOD;
+	nextidle->tv_sec = now->tv_sec;
+	nextidle->tv_usec = now->tv_usec + untilidle;
+	if(nextidle->tv_usec >= 1000000) {
+		nextidle->tv_sec += nextidle->tv_usec / 1000000;
+		nextidle->tv_usec %= 1000000;
+	}
+	return untilidle;
+}
 
-		// printf("obdsim got request: %s\n", line);
+int obdsim_handleline(struct simsettings *ss, struct elmsession *elm,
+		OBDSimPort *sp, char *line) {
 
-		if(NULL != strstr(line, "EXIT")) {
-			printf("Received EXIT via serial port. Sim Exiting\n");
-			mustexit=1;
-			continue;
+	struct simresponse *out = &elm->out; // Whole reply, written in one go at the end
+	struct timeval requeststart; // ECU delays and timeouts are measured from here
+	int mustexit = 0;
+	int i;
+
+	obdsim_gettimeofday(&requeststart);
+
+	if(0 == strlen(line)) {
+		line = elm->previousline;
+	} else {
+		strncpy(elm->previousline, line, sizeof(elm->previousline));
+		elm->previousline[sizeof(elm->previousline)-1] = '\0';
+	}
+
+	for(i=strlen(line)-1;i>=0;i--) { // Strlen is expensive, kids.
+		line[i] = toupper(line[i]);
+	}
+
+	// printf("obdsim got request: %s\n", line);
+
+	if(NULL != strstr(line, "EXIT")) {
+		printf("Received EXIT via serial port. Sim Exiting\n");
+		return OBDSIM_LINE_EXIT;
+	}
+
+	simresponse_reset(out);
+
+	if('A' == line[0] && 'T' == line[1]) {
+		char response[1024]; // AT commands fill this in
+
+		if(0 == parse_ATcmd(ss,elm,sp,line,response,sizeof(response))) {
+			snprintf(response, sizeof(response), "%s", ELM_QUERY_PROMPT);
 		}
 
-		// If we recognised the command
-		int command_recognised = 0;
+		// After parsing, since the command may have changed the linefeed setting
+		simresponse_newline(out, elm->e_linefeed);
+		simresponse_append(out, response);
+		simresponse_newline(out, elm->e_linefeed);
+		simresponse_append(out, ELM_PROMPT);
+		sp->writeData(out->buf);
 
-		if('A' == line[0] && 'T' == line[1]) {
+		return OBDSIM_LINE_QUERY;
+	}
 
-			command_recognised = parse_ATcmd(ss,sp,line,response,sizeof(response));
 
-			if(0 == command_recognised) {
-				snprintf(response, sizeof(response), "%s", ELM_QUERY_PROMPT);
-			}
+	int num_vals_read; // Number of values parsed from the sscanf line
+	int vals[3]; // Read up to three vals
+	num_vals_read = sscanf(line, "%02x %02x %x", &vals[0], &vals[1], &vals[2]);
 
-			sp->writeData(ss->e_linefeed?newline_crlf:newline_cr);
-			sp->writeData(response);
-			sp->writeData(ss->e_linefeed?newline_crlf:newline_cr);
-			sp->writeData(ELM_PROMPT);
+	// Mode 01 PIDs being asked for. On CAN there may be several
+	unsigned int pids[OBDSIM_MAXREQUESTPIDS];
+	int pidcount = 0;
+	// Set if they told us how many responses to expect, so we needn't wait for the timeout
+	int responsehint = (num_vals_read > 2);
 
-			continue;
+	if(num_vals_read >= 2 && 0x01 == vals[0]) {
+		if(OBDHEADER_CAN11 == elm->e_protocol->headertype ||
+				OBDHEADER_CAN29 == elm->e_protocol->headertype) {
+			pidcount = obdsim_parsepids(line, pids, OBDSIM_MAXREQUESTPIDS, &responsehint);
+		} else {
+			pids[0] = vals[1];
+			pidcount = 1;
 		}
+	}
 
+	int responsecount = 0;
 
-		int num_vals_read; // Number of values parsed from the sscanf line
-		int vals[3]; // Read up to three vals
-		num_vals_read = sscanf(line, "%02x %02x %x", &vals[0], &vals[1], &vals[2]);
+	// Every time we check an ecu, we accumulate time from ecu delays [ms]
+	long accumulated_time = 0;
+	// Part of accumulating time is finding out how many ECUs have replied
+	int ecu_replycount = 0;
 
-		int responsecount = 0;
+	simresponse_newline(out, elm->e_linefeed);
 
-		// Every time we check an ecu, we accumulate time from ecu delays [ms]
-		long accumulated_time = 0;
-		// Part of accumulating time is finding out how many ECUs have replied
-		int ecu_replycount = 0;
+	// There has *got* to be a better way to do the following complete mess
 
-		sp->writeData(ss->e_linefeed?newline_crlf:newline_cr);
+	if(num_vals_read <= 0) { // Couldn't parse
 
-		// There has *got* to be a better way to do the following complete mess
+		simresponse_append(out, ELM_QUERY_PROMPT);
+		simresponse_newline(out, elm->e_linefeed);
+		responsecount++;
+	} else if(num_vals_read == 1) { // Only got one valid thing [assume it's mode]
 
-		if(num_vals_read <= 0) { // Couldn't parse
+		if(0x03 == vals[0] || 0x07 == vals[0]) { // Get error codes
+			unsigned int errorcodes[20];
+			for(i=0;i<ss->ecu_count;i++) {
+				if(NULL != ss->ecus[i].simgen->geterrorcodes) {
+					int errorcount;
+					int mil = 0;
+					obdsim_lockecu(&ss->ecus[i]);
+					errorcount = ss->ecus[i].simgen->geterrorcodes(ss->ecus[i].dg,
+						errorcodes, (sizeof(errorcodes)/sizeof(errorcodes[0]))/2, &mil);
+					obdsim_unlockecu(&ss->ecus[i]);
 
-			snprintf(response, sizeof(response), "%s", ELM_QUERY_PROMPT);
-			sp->writeData(response);
-			sp->writeData(ss->e_linefeed?newline_crlf:newline_cr);
-			responsecount++;
-		} else if(num_vals_read == 1) { // Only got one valid thing [assume it's mode]
-
-			if(0x03 == vals[0] || 0x07 == vals[0]) { // Get error codes
-				unsigned int errorcodes[20];
-				for(i=0;i<ss->ecu_count;i++) {
-					if(NULL != ss->ecus[i].simgen->geterrorcodes) {
-						int errorcount;
-						int mil = 0;
-						errorcount = ss->ecus[i].simgen->geterrorcodes(ss->ecus[i].dg,
-							errorcodes, (sizeof(errorcodes)/sizeof(errorcodes[0]))/2, &mil);
-
-						if(0 == errorcount) continue;
-
-						char header[16] = "\0";
-						if(ss->e_headers) {
-							render_obdheader(header, sizeof(header), ss->e_protocol, &ss->ecus[i], 7, ss->e_spaces, ss->e_dlc);
-						}
+					if(0 == errorcount) continue;
 
-						int j;
-						for(j=0;j<errorcount;j+=3) {
-							char shortbuf[32];
-							snprintf(shortbuf, sizeof(shortbuf), "%s%02X%s%02X%s%02X%s%02X%s%02X%s%02X",
-									ss->e_spaces?" ":"", errorcodes[j*2],
-									ss->e_spaces?" ":"", errorcodes[j*2+1],
-
-									ss->e_spaces?" ":"", (errorcount-j)>1?errorcodes[(j+1)*2]:0x00,
-									ss->e_spaces?" ":"", (errorcount-j)>1?errorcodes[(j+1)*2+1]:0x00,
-
-									ss->e_spaces?" ":"", (errorcount-j)>2?errorcodes[(j+2)*2]:0x00,
-									ss->e_spaces?" ":"", (errorcount-j)>2?errorcodes[(j+2)*2+1]:0x00
-									);
-							// printf("shortbuf: '%s'   i: %i\n", shortbuf, abcd[i]);
-							snprintf(response, sizeof(response), "%s%02X%s",
-									header, 0x43, shortbuf);
-							sp->writeData(response);
-							sp->writeData(ss->e_linefeed?newline_crlf:newline_cr);
-							responsecount++;
+					int j;
+					for(j=0;j<errorcount;j+=3) {
+						if(elm->e_headers) {
+							render_obdheader(out, elm->e_protocol, &ss->ecus[i], 7, elm->e_spaces, elm->e_dlc);
+						}
+						simresponse_appendbyte(out, 0x43, 0);
+
+						// Three codes to a line, padded with zeroes
+						int k;
+						for(k=0;k<3;k++) {
+							int present = (errorcount-j)>k;
+							simresponse_appendbyte(out, present?errorcodes[(j+k)*2]:0x00, elm->e_spaces);
+							simresponse_appendbyte(out, present?errorcodes[(j+k)*2+1]:0x00, elm->e_spaces);
 						}
+						simresponse_newline(out, elm->e_linefeed);
+						responsecount++;
 					}
 				}
-			} else if(0x04 == vals[0]) { // Reset error codes
-				for(i=0;i<ss->ecu_count;i++) {
-					if(NULL != ss->ecus[i].simgen->clearerrorcodes) {
-						ss->ecus[i].simgen->clearerrorcodes(ss->ecus[i].dg);
-					}
+			}
+		} else if(0x04 == vals[0]) { // Reset error codes
+			for(i=0;i<ss->ecu_count;i++) {
+				if(NULL != ss->ecus[i].simgen->clearerrorcodes) {
+					obdsim_lockecu(&ss->ecus[i]);
+					ss->ecus[i].simgen->clearerrorcodes(ss->ecus[i].dg);
+					obdsim_unlockecu(&ss->ecus[i]);
+					ss->ecus[i].errorschanged = 1;
 				}
-				snprintf(response, sizeof(response), ELM_OK_PROMPT);
-				sp->writeData(response);
-				sp->writeData(ss->e_linefeed?newline_crlf:newline_cr);
-				responsecount++;
-			} else { // Can't do anything with one value, in modes other three or four
-				snprintf(response, sizeof(response), "%s", ELM_QUERY_PROMPT);
-				sp->writeData(response);
-				sp->writeData(ss->e_linefeed?newline_crlf:newline_cr);
-				responsecount++;
 			}
-		} else { // Two or more vals  mode0x01 => mode,pid[,possible optimisation]
-								// mode0x02 => mode,pid,frame
-
-			struct obdservicecmd *cmd = obdGetCmdForPID(vals[1]);
-			if(NULL == cmd) {
-				snprintf(response, sizeof(response), "%s", ELM_QUERY_PROMPT);
-				sp->writeData(response);
-				sp->writeData(ss->e_linefeed?newline_crlf:newline_cr);
-				responsecount++;
-			} else if(0x02 == vals[0]) {
-				// Freeze frame
-				for(i=0;i<ss->ecu_count;i++) {
-					int frame = 0;
-					if(num_vals_read > 2) {
-						// Third value is the frame
-						frame = vals[2];
-					}
-					if(frame < OBDSIM_MAXFREEZEFRAMES && frame <= ss->ecus[i].ffcount) {
-						// Don't understand frames higher than this
-						char ffmessage[256] = "\0";
-						struct freezeframe *ff = &(ss->ecus[i].ff[frame]);
-						int count = ff->valuecount[vals[1]];
-						int messagelen = count + 3; // Mode, PID, Frame
-
-						// Or could probably just strncat some or something
-						switch(count) {
-							case 1:
-								snprintf(ffmessage, sizeof(ffmessage),"%02X%s%02X%s%02X%s%02X",
-									vals[0], ss->e_spaces?" ":"",
-									vals[1], ss->e_spaces?" ":"",
-									frame, ss->e_spaces?" ":"",
-									ss->ecus[i].ff[frame].values[vals[1]][0]);
-								break;
-							case 2:
-								snprintf(ffmessage, sizeof(ffmessage),"%02X%s%02X%s%02X%s%02X%s%02X",
-									vals[0], ss->e_spaces?" ":"",
-									vals[1], ss->e_spaces?" ":"",
-									frame, ss->e_spaces?" ":"",
-									ff->values[vals[1]][0], ss->e_spaces?" ":"",
-									ff->values[vals[1]][1]);
-								break;
-							case 3:
-								snprintf(ffmessage, sizeof(ffmessage),"%02X%s%02X%s%02X%s%02X%s%02X%s%02X",
-									vals[0], ss->e_spaces?" ":"",
-									vals[1], ss->e_spaces?" ":"",
-									frame, ss->e_spaces?" ":"",
-									ff->values[vals[1]][0], ss->e_spaces?" ":"",
-									ff->values[vals[1]][1], ss->e_spaces?" ":"",
-									ff->values[vals[1]][2]);
-								break;
-							case 4:
-								snprintf(ffmessage, sizeof(ffmessage),"%02X%s%02X%s%02X%s%02X%s%02X%s%02X%s%02X",
-									vals[0], ss->e_spaces?" ":"",
-									vals[1], ss->e_spaces?" ":"",
-									frame, ss->e_spaces?" ":"",
-									ff->values[vals[1]][0], ss->e_spaces?" ":"",
-									ff->values[vals[1]][1], ss->e_spaces?" ":"",
-									ff->values[vals[1]][2], ss->e_spaces?" ":"",
-									ff->values[vals[1]][3]);
-								break;
-							case 0:
-							default:
-								// NO DATA
-								break;
+			simresponse_append(out, ELM_OK_PROMPT);
+			simresponse_newline(out, elm->e_linefeed);
+			responsecount++;
+		} else { // Can't do anything with one value, in modes other three or four
+			simresponse_append(out, ELM_QUERY_PROMPT);
+			simresponse_newline(out, elm->e_linefeed);
+			responsecount++;
+		}
+	} else { // Two or more vals  mode0x01 => mode,pid[,possible optimisation]
+							// mode0x02 => mode,pid,frame
+
+		struct obdservicecmd *cmd = obdGetCmdForPID(vals[1]);
+		if(NULL == cmd || (0x01 == vals[0] && pidcount <= 0)) {
+			simresponse_append(out, ELM_QUERY_PROMPT);
+			simresponse_newline(out, elm->e_linefeed);
+			responsecount++;
+		} else if(0x02 == vals[0]) {
+			// Freeze frame. Make sure any new errors have theirs before we answer
+			obdsim_freezeframes(ss->ecus, ss->ecu_count);
+			for(i=0;i<ss->ecu_count;i++) {
+				int frame = 0;
+				if(num_vals_read > 2) {
+					// Third value is the frame
+					frame = vals[2];
+				}
+				if(frame < OBDSIM_MAXFREEZEFRAMES && frame <= ss->ecus[i].ffcount &&
+						vals[1] >= 0 && vals[1] < OBDSIM_FRAMEPIDS) {
+					// Don't understand frames higher than this
+					struct freezeframe *ff = &(ss->ecus[i].ff[frame]);
+					int count = ff->valuecount[vals[1]];
+
+					if(count > 0 && count <= 4) {
+						if(elm->e_headers) {
+							render_obdheader(out, elm->e_protocol, &ss->ecus[i], 7, elm->e_spaces, elm->e_dlc);
 						}
-						if(count > 0) {
-							char header[16] = "\0";
-							if(ss->e_headers) {
-								render_obdheader(header, sizeof(header), ss->e_protocol, &ss->ecus[i], 7, ss->e_spaces, ss->e_dlc);
-							}
-							snprintf(response, sizeof(response), "%s%s", header, ffmessage);
-							sp->writeData(response);
-							sp->writeData(ss->e_linefeed?newline_crlf:newline_cr);
-							responsecount++;
+						simresponse_appendbyte(out, vals[0], 0);
+						simresponse_appendbyte(out, vals[1], elm->e_spaces);
+						simresponse_appendbyte(out, frame, elm->e_spaces);
+						int j;
+						for(j=0;j<count;j++) {
+							simresponse_appendbyte(out, ff->values[vals[1]][j], elm->e_spaces);
 						}
+						simresponse_newline(out, elm->e_linefeed);
+						responsecount++;
 					}
-
 				}
-			} else if(0x01 != vals[0]) {
-				// Eventually, modes other than 1 should move to the generators
-				//  but for now, respond NO DATA
-			} else {
 
-				// Here's the meat & potatoes of the whole application
+			}
+		} else if(0x01 != vals[0]) {
+			// Eventually, modes other than 1 should move to the generators
+			//  but for now, respond NO DATA
+		} else {
 
-				for(i=0;i<ss->ecu_count;i++) {
-					unsigned int abcd[8];
-					struct obdgen_ecu *e = ss->ecudelays[i].ecu;
+			// Here's the meat & potatoes of the whole application
 
-					if(accumulated_time+ss->ecudelays[i].delay > ss->e_timeout) {
-						printf("Timeout waiting for ecu %i. [%i > %i]\n",
-							e->ecu_num, e->customdelay, ss->e_timeout);
-						continue;
-					}
-					
-					accumulated_time += ss->ecudelays[i].delay;
-					ecu_replycount++;
+			// Work out which ECUs answer before the timeout, and when
+			struct ecupool_job jobs[OBDSIM_MAXECUS];
+			int jobcount = 0;
+			for(i=0;i<ss->ecu_count;i++) {
+				struct obdgen_ecu *e = ss->ecudelays[i].ecu;
 
-					timeouttime.tv_sec=0;
-					timeouttime.tv_usec=1000l*ss->ecudelays[i].delay;
-					select(0,NULL,NULL,NULL,&timeouttime);
+				if(accumulated_time+ss->ecudelays[i].delay > elm->e_timeout) {
+					printf("Timeout waiting for ecu %i. [%i > %i]\n",
+						e->ecu_num, e->customdelay, elm->e_timeout);
+					continue;
+				}
+				
+				accumulated_time += ss->ecudelays[i].delay;
+				ecu_replycount++;
 
-					int count = e->simgen->getvalue(e->dg,
-									vals[0], vals[1],
-									abcd+0, abcd+1, abcd+2, abcd+3);
-					// fprintf(stderr, "ecu %i count %i\n", i, count);
+				jobs[jobcount].ecu = e;
+				jobs[jobcount].due = accumulated_time;
+				jobcount++;
+			}
 
-					// printf("Returning %i values for %02X %02X\n", count, vals[0], vals[1]);
+			// Ask them all at once; returns when the last one is due
+			ecupool_getvalues(ss->pool, jobs, jobcount, vals[0], pids, pidcount, &requeststart);
 
-					if(-1 == count) {
-						mustexit = 1;
-						break;
-					}
+			for(i=0;i<jobcount;i++) {
+				unsigned int *abcd = jobs[i].values[0].abcd;
+				struct obdgen_ecu *e = jobs[i].ecu;
+				int count = jobs[i].values[0].count;
+				// fprintf(stderr, "ecu %i count %i\n", i, count);
 
-					if(0 < count) {
-						char header[16] = "\0";
-						if(ss->e_headers) {
-							render_obdheader(header, sizeof(header), ss->e_protocol, e, count+2, ss->e_spaces, ss->e_dlc);
-						}
+				// printf("Returning %i values for %02X %02X\n", count, vals[0], vals[1]);
+
+				if(-1 == jobs[i].ret || -1 == count) {
+					mustexit = 1;
+					break;
+				}
+
+				if(pidcount > 1) {
+					// One message with every PID this ECU knows, in the order asked
+					unsigned int payload[1 + OBDSIM_MAXREQUESTPIDS * 5];
+					int len = 0;
+					payload[len++] = vals[0]+0x40;
+					int p;
+					for(p=0;p<pidcount;p++) {
+						struct obdsim_value *v = &jobs[i].values[p];
+						if(v->count <= 0) continue;
+						payload[len++] = v->pid;
 						int j;
-						char shortbuf[64];
-						snprintf(response, sizeof(response), "%s%02X%s%02X",
-									header,
-									vals[0]+0x40, ss->e_spaces?" ":"", vals[1]);
-						int checksum = 0;
-						for(j=0;j<count && j<sizeof(abcd)/sizeof(abcd[0]);j++) {
-							checksum+=abcd[j];
-							snprintf(shortbuf, sizeof(shortbuf), "%s%02X",
-									ss->e_spaces?" ":"", abcd[j]);
-							// printf("shortbuf: '%s'   j: %i\n", shortbuf, abcd[j]);
-							strcat(response, shortbuf);
-						}
-						if(ss->e_headers) {
-										/* &&
-								(ss->e_protocol->headertype == OBDHEADER_CAN29 ||
-								ss->e_protocol->headertype == OBDHEADER_CAN11)) { */
-							snprintf(shortbuf, sizeof(shortbuf), "%s%02X",
-									ss->e_spaces?" ":"", checksum&0xFF);
-							strcat(response, shortbuf);
+						for(j=0;j<v->count && j<4;j++) {
+							payload[len++] = v->abcd[j];
 						}
-
-						sp->writeData(response);
-						sp->writeData(ss->e_linefeed?newline_crlf:newline_cr);
+					}
+					if(len > 1) {
+						render_isotp(out, elm, e, payload, len);
 						responsecount++;
 					}
+				} else if(0 < count) {
+					if(elm->e_headers) {
+						render_obdheader(out, elm->e_protocol, e, count+2, elm->e_spaces, elm->e_dlc);
+					}
+					simresponse_appendbyte(out, vals[0]+0x40, 0);
+					simresponse_appendbyte(out, vals[1], elm->e_spaces);
+
+					int j;
+					int checksum = 0;
+					for(j=0;j<count && j<(int)(sizeof(jobs[i].values[0].abcd)/sizeof(jobs[i].values[0].abcd[0]));j++) {
+						checksum+=abcd[j];
+						simresponse_appendbyte(out, abcd[j], elm->e_spaces);
+					}
+					if(elm->e_headers) {
+									/* &&
+							(elm->e_protocol->headertype == OBDHEADER_CAN29 ||
+							elm->e_protocol->headertype == OBDHEADER_CAN11)) { */
+						simresponse_appendbyte(out, checksum, elm->e_spaces);
+					}
+
+					simresponse_newline(out, elm->e_linefeed);
+					responsecount++;
 				}
 			}
 		}
+	}
+
+	// Only need a timeout if we didn't get replies from all the ECUs
+	if(ecu_replycount<ss->ecu_count || (0x01 == vals[0] && !responsehint)) {
+		obdsim_sleepuntil(&requeststart, elm->e_timeout);
+	}
+	if(0 >= responsecount) {
+		simresponse_append(out, ELM_NODATA_PROMPT);
+		simresponse_newline(out, elm->e_linefeed);
+	}
+	simresponse_append(out, ELM_PROMPT);
+	sp->writeData(out->buf);
 
-		// Only need a timeout if we didn't get replies from all the ECUs
-		if(ecu_replycount<ss->ecu_count || (0x01 == vals[0] && num_vals_read <= 2)) {
-			timeouttime.tv_sec=0;
-			timeouttime.tv_usec=1000l*(ss->e_timeout - accumulated_time);
-			select(0,NULL,NULL,NULL,&timeouttime);
+	if(mustexit) return OBDSIM_LINE_EXIT;
+	return 0<responsecount?OBDSIM_LINE_SAMPLE:OBDSIM_LINE_QUERY;
+}
+
+/// Store a new freeze frame for this ECU if it has new errors. Caller holds the ECU's lock
+static void obdsim_freezeframe(struct obdgen_ecu *e, int ecuidx) {
+	int errorcount;
+	int mil;
+	errorcount = e->simgen->geterrorcodes(e->dg,
+		NULL, 0, &mil);
+
+	if(0 == errorcount) {
+		if(e->lasterrorcount > 0) {
+			printf("Clearing errors\n");
 		}
-		if(0 >= responsecount) {
-			sp->writeData(ELM_NODATA_PROMPT);
-			sp->writeData(ss->e_linefeed?newline_crlf:newline_cr);
-		} else {
-			benchmarkcountgood++;
+		e->lasterrorcount = 0;
+		e->ffcount = 0;
+		return;
+	}
+
+	if(e->lasterrorcount == errorcount) return;
+
+	// Getting here means there's some new errors
+	if(e->ffcount >= OBDSIM_MAXFREEZEFRAMES) {
+		/* fprintf(stderr, "Warning: Ran out of Frames for ecu %i (%s)\nOBDSIM_MAXFREEZEFRAMES=%i\n",
+						ecuidx, e->simgen->name(),
+						OBDSIM_MAXFREEZEFRAMES); */
+		return;
+	}
+
+	printf("Storing new freezeframe(%i) on ecu %i (%s)\n", e->ffcount, ecuidx, e->simgen->name());
+	// Anything already fetched this tick is reused. Ask for the rest
+	//  in one go, so it's all from one moment
+	struct obdsim_value values[OBDSIM_FRAMEPIDS];
+	int missing = 0;
+	long long tick = obdsim_tick();
+	unsigned int j;
+	for(j=0;j<sizeof(values)/sizeof(values[0]);j++) {
+		if(e->recenttick[j] != tick) {
+			values[missing].pid = j;
+			values[missing].count = 0;
+			missing++;
 		}
-		sp->writeData(ELM_PROMPT);
+	}
+	if(missing > 0) {
+		// Also refreshes e->recent
+		obdsim_getvalues(e, 0x01, values, missing);
 	}
 
-	free(ss->device_identifier);
+	struct freezeframe *ff = &e->ff[e->ffcount];
+	int total_vals = 0;
+	for(j=0;j<sizeof(values)/sizeof(values[0]);j++) {
+		ff->valuecount[j] = e->recent[j].count;
+		memcpy(ff->values[j], e->recent[j].abcd, sizeof(ff->values[j]));
 
+		if(ff->valuecount[j] > 0) {
+			total_vals++;
+		}
+	}
+	printf("Stored %i vals [%i reused]\n", total_vals, (int)(sizeof(values)/sizeof(values[0])) - missing);
+
+	e->ffcount++;
+	e->lasterrorcount = errorcount;
 }
 
 void obdsim_freezeframes(struct obdgen_ecu *ecus, int ecu_count) {
@@ -425,122 +508,174 @@ void obdsim_freezeframes(struct obdgen_ecu *ecus, int ecu_count) {
 	for(i=0;i<ecu_count;i++) {
 		struct obdgen_ecu *e = &ecus[i];
 
-		if(NULL != e->simgen->geterrorcodes) {
-			int errorcount;
-			int mil;
-			errorcount = e->simgen->geterrorcodes(e->dg,
-				NULL, 0, &mil);
+		if(NULL == e->simgen->geterrorcodes) continue;
 
-			if(0 == errorcount) {
-				if(e->lasterrorcount > 0) {
-					printf("Clearing errors\n");
-				}
-				e->lasterrorcount = 0;
-				e->ffcount = 0;
-				continue;
-			}
+		// Generators that notify us only need looking at when they have
+		if(e->errornotify && !e->errorschanged) continue;
+		e->errorschanged = 0;
 
-			if(e->lasterrorcount == errorcount) continue;
-
-			// Getting here means there's some new errors
-			if(e->ffcount >= OBDSIM_MAXFREEZEFRAMES) {
-				/* fprintf(stderr, "Warning: Ran out of Frames for ecu %i (%s)\nOBDSIM_MAXFREEZEFRAMES=%i\n",
-								i, e->simgen->name(),
-								OBDSIM_MAXFREEZEFRAMES); */
-				continue;
-			}
-
-			printf("Storing new freezeframe(%i) on ecu %i (%s)\n", e->ffcount, i, e->simgen->name());
-			unsigned int j;
-			int total_vals = 0;
-			for(j=0;j<sizeof(obdcmds_mode1)/sizeof(obdcmds_mode1[0]);j++) {
-					e->ff[e->ffcount].valuecount[j] = e->simgen->getvalue(ecus[i].dg,
-						0x01, j,
-						e->ff[e->ffcount].values[j]+0, e->ff[e->ffcount].values[j]+1,
-						e->ff[e->ffcount].values[j]+2, e->ff[e->ffcount].values[j]+3);
-
-					if(e->ff[e->ffcount].valuecount[j] > 0) {
-						total_vals++;
-					}
-			}
-			printf("Stored %i vals\n", total_vals);
-
-			e->ffcount++;
-			e->lasterrorcount = errorcount;
-		}
+		obdsim_lockecu(e);
+		obdsim_freezeframe(e, i);
+		obdsim_unlockecu(e);
 	}
 }
 
-int render_obdheader(char *buf, size_t buflen, struct obdiiprotocol *proto,
+int render_obdheader(struct simresponse *out, struct obdiiprotocol *proto,
 	struct obdgen_ecu *ecu, unsigned int messagelen, int spaces, int dlc) {
 
+	size_t startlen = out->len;
 	unsigned int ecuaddress; //< The calculated address of this ecu
-	unsigned int segments[4]; //< If the address needs to be split up
-
-	char dlc_str[8] = "\0";
-	if(dlc) {
-		snprintf(dlc_str,sizeof(dlc_str),"%01X%s", messagelen+2, spaces?" ":"");
-		// printf("dlc_str: '%s'\n", dlc_str);
-	}
 
 	switch(proto->headertype) {
 		case OBDHEADER_J1850PWM:
 			ecuaddress = ecu->ecu_num + 0x10;
-			return snprintf(buf, buflen, "41%s6B%s%02X%s",
-				spaces?" ":"",
-				spaces?" ":"",
-				ecuaddress,
-				spaces?" ":"");
+			simresponse_appendbyte(out, 0x41, 0);
+			simresponse_appendbyte(out, 0x6B, spaces);
+			simresponse_appendbyte(out, ecuaddress, spaces);
 			break;
 		case OBDHEADER_J1850VPW: // also ISO 9141-2
 			ecuaddress = ecu->ecu_num + 0x10;
-			return snprintf(buf, buflen, "48%s6B%s%02X%s",
-				spaces?" ":"",
-				spaces?" ":"",
-				ecuaddress,
-				spaces?" ":"");
+			simresponse_appendbyte(out, 0x48, 0);
+			simresponse_appendbyte(out, 0x6B, spaces);
+			simresponse_appendbyte(out, ecuaddress, spaces);
 			break;
 		case OBDHEADER_14230:
 			ecuaddress = ecu->ecu_num + 0x10;
-			return snprintf(buf, buflen, "%02X%sF1%s%02X%s",
-				(unsigned)0x80 | messagelen, spaces?" ":"",
-				spaces?" ":"",
-				ecuaddress,
-				spaces?" ":"");
+			simresponse_appendbyte(out, 0x80 | messagelen, 0);
+			simresponse_appendbyte(out, 0xF1, spaces);
+			simresponse_appendbyte(out, ecuaddress, spaces);
 			break;
 		case OBDHEADER_CAN29:
 			ecuaddress = ecu->ecu_num + 0x18DAF110;
-			segments[0] = (ecuaddress >> 24) & 0xFF;
-			segments[1] = (ecuaddress >> 16) & 0xFF;
-			segments[2] = (ecuaddress >> 8) & 0xFF;
-			segments[3] = (ecuaddress >> 0) & 0xFF;
-			return snprintf(buf, buflen, "%02X%s%02X%s%02X%s%02X%s%02X%s%s",
-				segments[0], spaces?" ":"",
-				segments[1], spaces?" ":"",
-				segments[2], spaces?" ":"",
-				segments[3], spaces?" ":"",
-				messagelen, spaces?" ":"",
-				dlc_str);
+			simresponse_appendbyte(out, ecuaddress >> 24, 0);
+			simresponse_appendbyte(out, ecuaddress >> 16, spaces);
+			simresponse_appendbyte(out, ecuaddress >> 8, spaces);
+			simresponse_appendbyte(out, ecuaddress, spaces);
+			simresponse_appendbyte(out, messagelen, spaces);
 			break;
 		case OBDHEADER_CAN11:
+			// Eleven bit address is three hex digits
 			ecuaddress = ecu->ecu_num + 0x7E8;
-			return snprintf(buf, buflen, "%03X%s%02X%s%s",
-				ecuaddress, spaces?" ":"",
-				messagelen, spaces?" ":"",
-				dlc_str);
+			simresponse_appendn(out, "0123456789ABCDEF" + ((ecuaddress >> 8) & 0xF), 1);
+			simresponse_appendbyte(out, ecuaddress, 0);
+			simresponse_appendbyte(out, messagelen, spaces);
 			break;
 		case OBDHEADER_NULL:
 		default:
 			return 0;
-			break;
 	}
-	return snprintf(buf, buflen, "UNKNOWN%s%s", spaces?" ":"", dlc_str);
+
+	if(spaces) simresponse_appendn(out, " ", 1);
+
+	if(dlc && (OBDHEADER_CAN29 == proto->headertype ||
+			OBDHEADER_CAN11 == proto->headertype)) {
+		char dlc_str[8];
+		int dlclen = snprintf(dlc_str,sizeof(dlc_str),"%01X%s", messagelen+2, spaces?" ":"");
+		simresponse_appendn(out, dlc_str, dlclen);
+	}
+
+	return out->len - startlen;
 }
 
-int parse_ATcmd(struct simsettings *ss, OBDSimPort *sp, char *line, char *response, size_t n) {
-	// This is an AT command
+int obdsim_parsepids(const char *line, unsigned int *pids, int maxpids, int *responsehint) {
+	unsigned int bytes[1 + OBDSIM_MAXREQUESTPIDS + 1];
+	int nibbles = 0;
+	const char *c;
+	for(c=line;'\0' != *c;c++) {
+		int nibble;
+		if(' ' == *c) continue;
+		else if(*c >= '0' && *c <= '9') nibble = *c - '0';
+		else if(*c >= 'A' && *c <= 'F') nibble = *c - 'A' + 10;
+		else return -1;
+
+		if(nibbles/2 >= (int)(sizeof(bytes)/sizeof(bytes[0]))) return -1;
+		if(0 == nibbles%2) bytes[nibbles/2] = nibble << 4;
+		else bytes[nibbles/2] |= nibble;
+		nibbles++;
+	}
+
+	// A trailing single digit is the number of responses to expect
+	*responsehint = (1 == nibbles%2);
+	if(*responsehint) {
+		nibbles--;
+	}
+
+	int count = nibbles/2 - 1; // First byte is the mode
+	if(count < 1 || count > maxpids) return -1;
+
+	int i;
+	for(i=0;i<count;i++) {
+		pids[i] = bytes[i+1];
+	}
+	return count;
+}
 
-	struct timeval timeouttime; // Used anytime we need a simulated timeout
+void render_isotp(struct simresponse *out, struct elmsession *elm,
+		struct obdgen_ecu *ecu, const unsigned int *payload, int len) {
+
+	// The most a first frame can say it's carrying
+	if(len > 0xFFF) len = 0xFFF;
+
+	int multiframe = (len > 7);
+
+	if(multiframe && !elm->e_headers) {
+		// Without headers, an elm says how long the message is first
+		char lenstr[8];
+		snprintf(lenstr, sizeof(lenstr), "%03X", len);
+		simresponse_append(out, lenstr);
+		simresponse_newline(out, elm->e_linefeed);
+	}
+
+	int sent = 0; // Bytes of payload already sent
+	int seq = 0; // Frame number
+	while(sent < len) {
+		unsigned int frame[8]; // PCI followed by data, as on the wire
+		int pcilen; // Number of PCI bytes at the start of frame
+		if(!multiframe) { // Single frame
+			frame[0] = len;
+			pcilen = 1;
+		} else if(0 == seq) { // First frame
+			frame[0] = 0x10 | ((len >> 8) & 0x0F);
+			frame[1] = len & 0xFF;
+			pcilen = 2;
+		} else { // Consecutive frame
+			frame[0] = 0x20 | (seq & 0x0F);
+			pcilen = 1;
+		}
+
+		int framelen = pcilen;
+		while(framelen < 8 && sent < len) {
+			frame[framelen++] = payload[sent++];
+		}
+
+		int j;
+		if(elm->e_headers) {
+			render_obdheader(out, elm->e_protocol, ecu, frame[0], elm->e_spaces, 0);
+			if(elm->e_dlc) {
+				char dlc_str[8];
+				int dlclen = snprintf(dlc_str, sizeof(dlc_str), "%01X%s", framelen, elm->e_spaces?" ":"");
+				simresponse_appendn(out, dlc_str, dlclen);
+			}
+			for(j=1;j<framelen;j++) {
+				simresponse_appendbyte(out, frame[j], 1<j && elm->e_spaces);
+			}
+		} else {
+			if(multiframe) {
+				char seq_str[8];
+				int seqlen = snprintf(seq_str, sizeof(seq_str), "%01X:%s", seq & 0x0F, elm->e_spaces?" ":"");
+				simresponse_appendn(out, seq_str, seqlen);
+			}
+			for(j=pcilen;j<framelen;j++) {
+				simresponse_appendbyte(out, frame[j], j>pcilen && elm->e_spaces);
+			}
+		}
+		simresponse_newline(out, elm->e_linefeed);
+		seq++;
+	}
+}
+
+int parse_ATcmd(struct simsettings *ss, struct elmsession *elm, OBDSimPort *sp, char *line, char *response, size_t n) {
+	// This is an AT command
 
 	int atopt_i; // If they pass an integer option
 	char atopt_c; // If they pass a character option
@@ -556,7 +691,7 @@ int parse_ATcmd(struct simsettings *ss, OBDSimPort *sp, char *line, char *respon
 	if(1 == sscanf(at_cmd, "AT%i", &atopt_i)) {
 		if(atopt_i >=0 && atopt_i <= 2) {
 			printf("Adaptive Timing: %i\n", atopt_i);
-			ss->e_adaptive = atopt_i;
+			elm->e_adaptive = atopt_i;
 			command_recognised = 1;
 			snprintf(response, n, "%s", ELM_OK_PROMPT);
 		}
@@ -564,48 +699,48 @@ int parse_ATcmd(struct simsettings *ss, OBDSimPort *sp, char *line, char *respon
 
 	else if(1 == sscanf(at_cmd, "L%i", &atopt_i)) {
 		printf("Linefeed %s\n", atopt_i?"enabled":"disabled");
-		ss->e_linefeed = atopt_i;
+		elm->e_linefeed = atopt_i;
 		command_recognised = 1;
 		snprintf(response, n, "%s", ELM_OK_PROMPT);
 	}
 
 	else if(1 == sscanf(at_cmd, "H%i", &atopt_i)) {
 		printf("Headers %s\n", atopt_i?"enabled":"disabled");
-		ss->e_headers = atopt_i;
+		elm->e_headers = atopt_i;
 		command_recognised = 1;
 		snprintf(response, n, "%s", ELM_OK_PROMPT);
 	}
 
 	else if(('S' == at_cmd[0] || 'T' == at_cmd[0]) && 'P' == at_cmd[1]) {
-		if(0 == set_obdprotocol(at_cmd+2, ss)) {
+		if(0 == set_obdprotocol(at_cmd+2, elm)) {
 			command_recognised = 1;
-			printf("New Protocol: %s\n", ss->e_protocol->protocol_desc);
+			printf("New Protocol: %s\n", elm->e_protocol->protocol_desc);
 			snprintf(response, n, "%s", ELM_OK_PROMPT);
 		}
 	}
 
 	else if(1 == sscanf(at_cmd, "S%i", &atopt_i)) {
 		printf("Spaces %s\n", atopt_i?"enabled":"disabled");
-		ss->e_spaces = atopt_i;
+		elm->e_spaces = atopt_i;
 		command_recognised = 1;
 		snprintf(response, n, "%s", ELM_OK_PROMPT);
 	}
 
 	else if(1 == sscanf(at_cmd, "E%i", &atopt_i)) {
 		printf("Echo %s\n", atopt_i?"enabled":"disabled");
-		ss->e_echo = atopt_i;
-		sp->setEcho(ss->e_echo);
+		elm->e_echo = atopt_i;
+		sp->setEcho(elm->e_echo);
 		snprintf(response, n, "%s", ELM_OK_PROMPT);
 		command_recognised = 1;
 	}
 
 	else if(1 == sscanf(at_cmd, "ST%02X", &atopt_ui)) {
 		if(0 == atopt_ui) {
-			ss->e_timeout = ELM_TIMEOUT;
+			elm->e_timeout = ELM_TIMEOUT;
 		} else {
-			ss->e_timeout = 4 * atopt_ui;
+			elm->e_timeout = 4 * atopt_ui;
 		}
-		printf("Timeout %i\n", ss->e_timeout);
+		printf("Timeout %i\n", elm->e_timeout);
 		snprintf(response, n, "%s", ELM_OK_PROMPT);
 		command_recognised = 1;
 	}
@@ -615,42 +750,42 @@ int parse_ATcmd(struct simsettings *ss, OBDSimPort *sp, char *line, char *respon
 			snprintf(response, n, "%s", ss->elm_device);
 			command_recognised = 1;
 		} else if(2 == atopt_ui) {
-			snprintf(response, n, "%s", ss->device_identifier);
+			snprintf(response, n, "%s", elm->device_identifier);
 			command_recognised = 1;
 		} else if(3 == atopt_ui) {
 			snprintf(response, n, "%s", ELM_OK_PROMPT);
-			free(ss->device_identifier);
+			free(elm->device_identifier);
 			char *newid = at_cmd+2;
 			while(' ' == *newid) newid++;
-			ss->device_identifier = strdup(newid);
-			printf("Set device identifier to \"%s\"\n", ss->device_identifier);
+			elm->device_identifier = strdup(newid);
+			printf("Set device identifier to \"%s\"\n", elm->device_identifier);
 			command_recognised = 1;
 		}
 	}
 
 	else if(1 == sscanf(at_cmd, "CV%4i", &atopt_i)) {
-		ss->e_currentvoltage = (float)atopt_i/100;
+		elm->e_currentvoltage = (float)atopt_i/100;
 		snprintf(response, n, "%s", ELM_OK_PROMPT);
 		command_recognised = 1;
 	}
 
 	else if(0 == strncmp(at_cmd, "RV", 2)) {
 		float delta = (float)rand()/(float)RAND_MAX - 0.5f;
-		snprintf(response, n, "%.1f", ss->e_currentvoltage+delta);
+		snprintf(response, n, "%.1f", elm->e_currentvoltage+delta);
 		command_recognised = 1;
 	}
 
 	else if(0 == strncmp(at_cmd, "DPN", 3)) {
-		snprintf(response, n, "%s%c", ss->e_autoprotocol?"A":"", ss->e_protocol->protocol_num);
+		snprintf(response, n, "%s%c", elm->e_autoprotocol?"A":"", elm->e_protocol->protocol_num);
 		command_recognised = 1;
 	} else if(0 == strncmp(at_cmd, "DP", 2)) {
-		snprintf(response, n, "%s%s", ss->e_autoprotocol?"Auto, ":"", ss->e_protocol->protocol_desc);
+		snprintf(response, n, "%s%s", elm->e_autoprotocol?"Auto, ":"", elm->e_protocol->protocol_desc);
 		command_recognised = 1;
 	}
 
 	else if(1 == sscanf(at_cmd, "D%i", &atopt_i)) {
 		printf("DLC display %s\n", atopt_i?"enabled":"disabled");
-		ss->e_dlc = atopt_i;
+		elm->e_dlc = atopt_i;
 		command_recognised = 1;
 		snprintf(response, n, "%s", ELM_OK_PROMPT);
 	}
@@ -667,9 +802,7 @@ int parse_ATcmd(struct simsettings *ss, OBDSimPort *sp, char *line, char *respon
 			snprintf(response, n, "%s", ss->elm_version);
 			
 			// 10 times the regular timeout, just for want of a number
-			timeouttime.tv_sec=0;
-			timeouttime.tv_usec=1000l*ss->e_timeout * 10 / (ss->e_adaptive +1);
-			select(0,NULL,NULL,NULL,&timeouttime);
+			obdsim_sleep(elm->e_timeout * 10 / (elm->e_adaptive +1));
 		} else if('D' == at_cmd[0]) {
 			printf("Defaults\n");
 			snprintf(response, n, "%s", ELM_OK_PROMPT);
@@ -678,13 +811,11 @@ int parse_ATcmd(struct simsettings *ss, OBDSimPort *sp, char *line, char *respon
 			snprintf(response, n, "%s", ss->elm_version);
 
 			// Wait half as long as a reset
-			timeouttime.tv_sec=0;
-			timeouttime.tv_usec=1000l*ss->e_timeout * 5 / (ss->e_adaptive +1);
-			select(0,NULL,NULL,NULL,&timeouttime);
+			obdsim_sleep(elm->e_timeout * 5 / (elm->e_adaptive +1));
 		}
 
-		obdsim_elmreset(ss);
-		sp->setEcho(ss->e_echo);
+		obdsim_elmreset(elm);
+		sp->setEcho(elm->e_echo);
 
 		command_recognised = 1;
 	}
@@ -23,31 +23,88 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 #define __MAINLOOP_H
 
 
+#ifdef OBDPLATFORM_POSIX
+#include <sys/time.h>
+#endif //OBDPLATFORM_POSIX
+
 #include "obdsim.h"
 
+/// What obdsim_handleline did with a line
+enum obdsim_lineresult {
+	OBDSIM_LINE_QUERY, //< Answered, but not with a sample [AT command, NO DATA, ?]
+	OBDSIM_LINE_SAMPLE, //< At least one ECU returned a value
+	OBDSIM_LINE_EXIT //< The sim should exit
+};
+
 /// It's a main loop.
 /** \param sp the simport handle
     \param ss the overall sim state
 */
 void main_loop(OBDSimPort *sp, struct simsettings *ss);
 
+/// Answer a single line from a client
+/** \param ss the overall sim state
+    \param elm this connection's elm settings
+    \param sp the port to answer on
+    \param line the line; may be modified
+    \return one of enum obdsim_lineresult
+*/
+int obdsim_handleline(struct simsettings *ss, struct elmsession *elm,
+	OBDSimPort *sp, char *line);
+
+/// Run generator idle callbacks and freeze frames if they're due
+/** \param ss the overall sim state
+    \param now the current time
+    \param nextidle when they're next due; updated if they ran
+    \param mustexit set if a generator asked the sim to exit
+    \return time until they're next due [us]
+*/
+long obdsim_idle(struct simsettings *ss, struct timeval *now,
+	struct timeval *nextidle, int *mustexit);
+
 /// Parse this AT command [assumes that line is already known to be an AT command]
-int parse_ATcmd(struct simsettings *ss, OBDSimPort *sp, char *line, char *response, size_t n);
+int parse_ATcmd(struct simsettings *ss, struct elmsession *elm, OBDSimPort *sp, char *line, char *response, size_t n);
 
-/// Render a header into the passed string
-/** \param buf buffer to put rendered header into
-    \param buflen size of buf
+/// Render a header onto the end of a reply
+/** \param out reply to append the header to
     \param proto the obdii protocol we're rendering
     \param ecu the ecu this message is from
     \param messagelen the number of bytes being returned as the message itself
     \param spaces whether or not to put spaces between the characters [and at the end]
     \param dlc whether or not to put dlc byte in
-    \return length of string put in buf
+    \return number of characters appended
 */
-int render_obdheader(char *buf, size_t buflen, struct obdiiprotocol *proto,
+int render_obdheader(struct simresponse *out, struct obdiiprotocol *proto,
 	struct obdgen_ecu *ecu, unsigned int messagelen, int spaces, int dlc);
 
+/// Parse a mode 01 request as a list of PIDs, the way an elm does on CAN
+/** eg "01 0C 0D 05" or "010C0D05". A single trailing digit is the
+     number of responses to expect, as in "010C1"
+    \param line the request. Already uppercased
+    \param pids filled with the PIDs asked for
+    \param maxpids space in pids
+    \param responsehint set to whether the number of responses was given
+    \return number of PIDs, or -1 if it's not a request we understand
+*/
+int obdsim_parsepids(const char *line, unsigned int *pids, int maxpids, int *responsehint);
+
+/// Render one ECU's reply as ISO-TP frames [CAN only]
+/** Replies of up to seven bytes go in a single frame. Longer ones get
+     a first frame and as many consecutive frames as they need. With
+     headers off, they're shown as an elm would: a length, then one
+     numbered line per frame
+    \param out reply to append to
+    \param elm this connection's elm settings
+    \param ecu the ecu this message is from
+    \param payload the message, starting with the mode byte
+    \param len number of bytes in payload
+*/
+void render_isotp(struct simresponse *out, struct elmsession *elm,
+	struct obdgen_ecu *ecu, const unsigned int *payload, int len);
+
 /// Update the freeze frame info for all the ecus
+/** Takes each ECU's lock while it's checked. ECUs whose generators
+     notify us of new errors are skipped unless they have */
 void obdsim_freezeframes(struct obdgen_ecu *ecus, int ecucount);
 
 #endif // __MAINLOOP_H
@@ -0,0 +1,229 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** \file
+ \brief Serve many socket clients at once
+*/
+
+#ifdef HAVE_SOCKET
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include "obdsim.h"
+#include "simport.h"
+#include "socketsimport.h"
+#include "faultsimport.h"
+#include "mainloop.h"
+#include "multiclient.h"
+
+/// State shared between the accepting thread and all the clients
+struct multiclient_state {
+	struct simsettings *ss; //< The overall sim state
+
+	pthread_mutex_t lock; //< Protects everything below here
+	int clientcount; //< Number of clients currently connected
+	int mustexit; //< Set when everything should shut down
+	int countgood; //< Samples since the last benchmark print
+	int counttotal; //< Queries since the last benchmark print
+};
+
+/// A single connected client
+struct multiclient_client {
+	struct multiclient_state *state; //< Shared state
+	SocketClientSimPort *sp; //< The client's connection
+	OBDSimPort *io; //< What the client is talked to through; sp, or faults in front of it
+	struct elmsession elm; //< The client's elm settings
+};
+
+/// Find out if we should exit
+static int multiclient_mustexit(struct multiclient_state *state) {
+	pthread_mutex_lock(&state->lock);
+	int ret = state->mustexit;
+	pthread_mutex_unlock(&state->lock);
+	return ret;
+}
+
+/// Thread that answers a single client until it goes away
+static void *multiclient_thread(void *arg) {
+	struct multiclient_client *c = (struct multiclient_client *)arg;
+	struct multiclient_state *state = c->state;
+
+	c->io->setEcho(c->elm.e_echo);
+
+	while(!multiclient_mustexit(state)) {
+		// Wake up occasionally to notice if we should exit
+		if(0 >= c->io->waitReadable(OBDSIM_IDLEPERIOD)) continue;
+
+		char *line = c->io->readLine();
+		if(c->sp->isClosed()) break;
+		if(NULL == line) continue;
+
+		int result = obdsim_handleline(state->ss, &c->elm, c->io, line);
+
+		pthread_mutex_lock(&state->lock);
+		state->counttotal++;
+		if(OBDSIM_LINE_SAMPLE == result) {
+			state->countgood++;
+		} else if(OBDSIM_LINE_EXIT == result) {
+			state->mustexit = 1;
+		}
+		pthread_mutex_unlock(&state->lock);
+	}
+
+	printf("%s disconnected\n", c->sp->getPort());
+
+	if(c->io != c->sp) delete c->io;
+	delete c->sp;
+	obdsim_freeelmsession(&c->elm);
+	free(c);
+
+	pthread_mutex_lock(&state->lock);
+	state->clientcount--;
+	pthread_mutex_unlock(&state->lock);
+
+	return NULL;
+}
+
+void multiclient_loop(SocketSimPort *listener, struct simsettings *ss,
+		int maxclients, const char *logfile_name) {
+
+	struct multiclient_state state;
+	state.ss = ss;
+	state.clientcount = 0;
+	state.mustexit = 0;
+	state.countgood = 0;
+	state.counttotal = 0;
+	pthread_mutex_init(&state.lock, NULL);
+
+	// Total number of clients ever connected, for naming them
+	int clientnum = 0;
+
+	int mustexit = 0;
+
+	struct timeval benchmarkstart;
+	gettimeofday(&benchmarkstart, NULL);
+
+	struct timeval nextidle;
+	gettimeofday(&nextidle, NULL);
+
+	printf("Accepting up to %i simultaneous clients\n", maxclients);
+
+	while(!mustexit) {
+		struct timeval now;
+		gettimeofday(&now, NULL);
+
+		if(ss->benchmark > 0) {
+			float benchmarkdelta = (now.tv_sec - benchmarkstart.tv_sec) +
+					((float)(now.tv_usec - benchmarkstart.tv_usec))/1000000.0f;
+			if(ss->benchmark <= benchmarkdelta) {
+				pthread_mutex_lock(&state.lock);
+				printf("%f seconds. %i samples, %i queries. %.2f s/s, %.2f q/s. %i clients\n",
+					benchmarkdelta,
+					state.countgood,
+					state.counttotal,
+					(float)state.countgood/benchmarkdelta,
+					(float)state.counttotal/benchmarkdelta,
+					state.clientcount);
+				faultsim_printcounters(ss->faults);
+				state.countgood = 0;
+				state.counttotal = 0;
+				pthread_mutex_unlock(&state.lock);
+				benchmarkstart = now;
+			}
+		}
+
+		long untilidle = obdsim_idle(ss, &now, &nextidle, &mustexit);
+		if(mustexit || multiclient_mustexit(&state)) break;
+
+		if(0 >= listener->waitReadable(untilidle)) continue;
+
+		int clientfd = listener->acceptClient();
+		if(-1 == clientfd) continue;
+
+		pthread_mutex_lock(&state.lock);
+		int full = state.clientcount >= maxclients;
+		if(!full) state.clientcount++;
+		pthread_mutex_unlock(&state.lock);
+
+		if(full) {
+			fprintf(stderr, "Already have %i clients, refusing another\n", maxclients);
+			close(clientfd);
+			continue;
+		}
+
+		clientnum++;
+		struct multiclient_client *c = (struct multiclient_client *)malloc(sizeof(struct multiclient_client));
+		c->state = &state;
+		c->sp = new SocketClientSimPort(clientfd, clientnum);
+		c->io = c->sp;
+		if(NULL != ss->faults) {
+			c->io = new FaultSimPort(c->sp, ss->faults);
+		}
+		obdsim_copyelmsession(&c->elm, &ss->elm);
+
+		if(NULL != logfile_name) {
+			char clientlog[4096];
+			snprintf(clientlog, sizeof(clientlog), "%s.%i", logfile_name, clientnum);
+			c->sp->startLog(clientlog);
+		}
+
+		printf("%s connected\n", c->sp->getPort());
+
+		pthread_t thread;
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if(0 != pthread_create(&thread, &attr, multiclient_thread, c)) {
+			perror("Couldn't create client thread");
+			if(c->io != c->sp) delete c->io;
+			delete c->sp;
+			obdsim_freeelmsession(&c->elm);
+			free(c);
+			pthread_mutex_lock(&state.lock);
+			state.clientcount--;
+			pthread_mutex_unlock(&state.lock);
+		}
+		pthread_attr_destroy(&attr);
+	}
+
+	// Let all the clients notice and finish up
+	pthread_mutex_lock(&state.lock);
+	state.mustexit = 1;
+	pthread_mutex_unlock(&state.lock);
+
+	int remaining;
+	do {
+		pthread_mutex_lock(&state.lock);
+		remaining = state.clientcount;
+		pthread_mutex_unlock(&state.lock);
+		if(remaining > 0) {
+			usleep(OBDSIM_IDLEPERIOD);
+		}
+	} while(remaining > 0);
+
+	pthread_mutex_destroy(&state.lock);
+}
+
+#endif //HAVE_SOCKET
+
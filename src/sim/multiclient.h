@@ -0,0 +1,44 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** \file
+ \brief Serve many socket clients at once
+*/
+#ifndef __MULTICLIENT_H
+#define __MULTICLIENT_H
+
+#ifdef HAVE_SOCKET
+
+#include "obdsim.h"
+#include "socketsimport.h"
+
+/// Main loop for serving several socket clients at once
+/** Each client gets its own thread and its own elm settings. The
+     generators are shared, and only called with their ECU's lock held.
+    \param listener the socket port to accept clients on
+    \param ss the overall sim state
+    \param maxclients refuse clients beyond this many
+    \param logfile_name if not NULL, log each client to this with ".<client number>" appended
+*/
+void multiclient_loop(SocketSimPort *listener, struct simsettings *ss,
+	int maxclients, const char *logfile_name);
+
+#endif //HAVE_SOCKET
+
+#endif //__MULTICLIENT_H
+
@@ -32,6 +32,10 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 #include "simport.h"
 #include "datasource.h"
 #include "mainloop.h"
+#include "replay.h"
+#include "ecupool.h"
+#include "simclock.h"
+#include "faultsimport.h"
 
 #ifdef OBDPLATFORM_POSIX
 #include <unistd.h>
@@ -53,6 +57,7 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 
 #ifdef HAVE_SOCKET
 #include "socketsimport.h"
+#include "multiclient.h"
 #endif //HAVE_SOCKET
 
 
@@ -136,17 +141,27 @@ void obdsim_initialiseecu(struct obdgen_ecu *e) {
 	e->dg = 0;
 	e->customdelay = 0;
 	memset(e->ff, 0, sizeof(e->ff));
+	e->errornotify = 0;
+	e->errorschanged = 1; // Whatever errors it starts with need a frame
+	unsigned int i;
+	for(i=0;i<sizeof(e->recenttick)/sizeof(e->recenttick[0]);i++) {
+		e->recenttick[i] = -1;
+	}
+#ifdef OBDPLATFORM_POSIX
+	pthread_mutex_init(&e->lock, NULL);
+#endif //OBDPLATFORM_POSIX
 }
 
 /// Initialse all variables in a simsettings
 void obdsim_initialisesimsettings(struct simsettings *s) {
-	s->e_autoprotocol = 1;
-	set_obdprotocol(OBDSIM_DEFAULT_PROTOCOLNUM, s);
+	s->elm.e_autoprotocol = 1;
+	set_obdprotocol(OBDSIM_DEFAULT_PROTOCOLNUM, &s->elm);
 
 	s->benchmark = OBDSIM_BENCHMARKTIME;
-	s->e_currentvoltage = OBDSIM_BATTERYV;
+	s->elm.e_currentvoltage = OBDSIM_BATTERYV;
 
-	s->device_identifier = strdup("ChunkyKs");
+	s->elm.device_identifier = strdup("ChunkyKs");
+	snprintf(s->elm.previousline, sizeof(s->elm.previousline), "GARBAGE");
 	s->elm_device = strdup(OBDSIM_ELM_DEVICE_STRING);
 	s->elm_version = strdup(OBDSIM_ELM_VERSION_STRING);
 
@@ -158,11 +173,14 @@ void obdsim_initialisesimsettings(struct simsettings *s) {
 		s->ecudelays[i].delay = 0;
 	}
 
-	obdsim_elmreset(s);
+	s->pool = NULL;
+	s->faults = NULL;
+
+	obdsim_elmreset(&s->elm);
 }
 
 /// Do an elm reset [ATZ or similar]
-void obdsim_elmreset(struct simsettings *s) {
+void obdsim_elmreset(struct elmsession *s) {
 	s->e_headers = ELM_HEADERS;
 	s->e_spaces = ELM_SPACES;
 	s->e_echo = ELM_ECHO;
@@ -172,6 +190,68 @@ void obdsim_elmreset(struct simsettings *s) {
 	s->e_dlc = ELM_DISPLAYDLC;
 }
 
+void obdsim_copyelmsession(struct elmsession *dst, const struct elmsession *src) {
+	memcpy(dst, src, sizeof(*dst));
+	dst->device_identifier = strdup(src->device_identifier);
+}
+
+void obdsim_freeelmsession(struct elmsession *s) {
+	free(s->device_identifier);
+	s->device_identifier = NULL;
+}
+
+void obdsim_lockecu(struct obdgen_ecu *e) {
+#ifdef OBDPLATFORM_POSIX
+	pthread_mutex_lock(&e->lock);
+#endif //OBDPLATFORM_POSIX
+}
+
+void obdsim_unlockecu(struct obdgen_ecu *e) {
+#ifdef OBDPLATFORM_POSIX
+	pthread_mutex_unlock(&e->lock);
+#endif //OBDPLATFORM_POSIX
+}
+
+int obdsim_getvalues(struct obdgen_ecu *e, unsigned int mode,
+		struct obdsim_value *values, int count) {
+	int ret = 0;
+	int i;
+	if(NULL != e->simgen->getvalues) {
+		ret = e->simgen->getvalues(e->dg, mode, values, count);
+	} else {
+		for(i=0;i<count;i++) {
+			unsigned int *abcd = values[i].abcd;
+			values[i].count = e->simgen->getvalue(e->dg, mode, values[i].pid,
+				abcd+0, abcd+1, abcd+2, abcd+3);
+			if(-1 == values[i].count) return -1;
+		}
+	}
+
+	// Keep them around so a freeze frame this tick needn't ask again
+	if(0 == ret && 0x01 == mode) {
+		long long tick = obdsim_tick();
+		for(i=0;i<count;i++) {
+			unsigned int pid = values[i].pid;
+			if(pid < sizeof(e->recent)/sizeof(e->recent[0])) {
+				e->recent[pid] = values[i];
+				e->recenttick[pid] = tick;
+			}
+		}
+	}
+	return ret;
+}
+
+long long obdsim_tick() {
+	struct timeval now;
+	obdsim_gettimeofday(&now);
+	return ((long long)now.tv_sec * 1000000ll + now.tv_usec) / OBDSIM_IDLEPERIOD;
+}
+
+void obdsim_errornotify(void *cookie) {
+	struct obdgen_ecu *e = (struct obdgen_ecu *)cookie;
+	e->errorschanged = 1;
+}
+
 /// Create a sorted list for the ECUs to respond in, based on their delays
 void ecudelay_order(struct simsettings *ss) {
 	int i, j;
@@ -259,6 +339,9 @@ int main(int argc, char **argv) {
 #ifdef HAVE_SOCKET
 	// Set if they wanted a socket connection
 	int socket_port = 0;
+
+	// Number of socket clients to serve at once
+	int max_clients = 1;
 #endif //HAVE_SOCKET
 
 	// Store all settings in here
@@ -267,6 +350,12 @@ int main(int argc, char **argv) {
 
 	// Logfilen name
 	char *logfile_name = NULL;
+
+	// Serial log to replay instead of running generators
+	char *replay_name = NULL;
+
+	// Replay without honouring the recorded timing
+	int replay_fast = 0;
 	
 #ifdef OBDPLATFORM_WINDOWS
 	// Windows port to open
@@ -296,7 +385,7 @@ int main(int argc, char **argv) {
 				mustexit = 1;
 				break;
 			case 'p':
-				if(0 != set_obdprotocol(optarg, &ss)) {
+				if(0 != set_obdprotocol(optarg, &ss.elm)) {
 					printf("Couldn't find protocol \"%s\", exiting\n", optarg);
 					mustexit = 1;
 				}
@@ -308,6 +397,30 @@ int main(int argc, char **argv) {
 			case 'n':
 				ss.benchmark = atoi(optarg);
 				break;
+			case 'r':
+				if(NULL != replay_name) {
+					fprintf(stderr, "Warning! Multiple replay logs specified. Only last one will be used\n");
+					free(replay_name);
+				}
+				replay_name = strdup(optarg);
+				break;
+			case 'F':
+				replay_fast = 1;
+				break;
+			case 'T':
+				simclock_setvirtual(1);
+				break;
+			case 'f':
+				if(NULL != ss.faults) {
+					fprintf(stderr, "Warning! Multiple fault specs given. Only last one will be used\n");
+					faultsim_destroy(ss.faults);
+				}
+				ss.faults = faultsim_create(optarg);
+				if(NULL == ss.faults) {
+					fprintf(stderr, "Couldn't parse faults \"%s\"\n", optarg);
+					mustexit = 1;
+				}
+				break;
 			case 'V':
 				if(NULL != ss.elm_version) {
 					free(ss.elm_version);
@@ -377,6 +490,13 @@ int main(int argc, char **argv) {
 				simport_requested = SIMPORT_SOCKET;
 				socket_port = atoi(optarg);
 				break;
+			case 'm':
+				max_clients = atoi(optarg);
+				if(max_clients < 1) {
+					fprintf(stderr, "Must allow at least one client\n");
+					mustexit = 1;
+				}
+				break;
 #endif //HAVE_SOCKET
 #ifdef OBDPLATFORM_POSIX
 			case 'o':
@@ -409,7 +529,7 @@ int main(int argc, char **argv) {
 
 	ss.ecu_count = current_ecu;
 
-	if(NULL == ss.e_protocol) {
+	if(NULL == ss.elm.e_protocol) {
 		fprintf(stderr, "Couldn't find initial protocol %s\n", OBDSIM_DEFAULT_PROTOCOLNUM);
 		return 1;
 	}
@@ -433,6 +553,14 @@ int main(int argc, char **argv) {
 
 	if(mustexit) return 0;
 
+	struct replay_session replay;
+	if(NULL != replay_name) {
+		if(0 != replay_load(replay_name, &replay)) {
+			fprintf(stderr, "Couldn't load replay log \"%s\"\n", replay_name);
+			return 1;
+		}
+		replay.fast = replay_fast;
+	}
 	
 	int initialisation_errors = 0;
 	int i;
@@ -447,10 +575,22 @@ int main(int argc, char **argv) {
 		return 1;
 	}
 
+	// Generators that can tell us about new errors needn't be polled
+	for(i=0;i<ss.ecu_count;i++) {
+		if(NULL != ss.ecus[i].simgen->seterrornotify &&
+				0 == ss.ecus[i].simgen->seterrornotify(ss.ecus[i].dg,
+					obdsim_errornotify, &ss.ecus[i])) {
+			ss.ecus[i].errornotify = 1;
+		}
+	}
+
 	/* Getting here means all the ECUs are up and running. Now alter
 	    the order they're queried in based on customdelay */
 	ecudelay_order(&ss);
 
+	// With several ECUs, a slow generator shouldn't hold up the others
+	ss.pool = ecupool_create(&ss);
+
 	// The sim port
 	OBDSimPort *sp = NULL;
 
@@ -524,8 +664,37 @@ int main(int argc, char **argv) {
 	}
 #endif //OBDPLATFORM_POSIX
 
+	// Faults go between the loop and the port. Multiclient puts them in
+	//  front of each client instead of the listener
+	OBDSimPort *loopport = sp;
+	if(NULL != ss.faults) {
+		loopport = new FaultSimPort(sp, ss.faults);
+	}
+
 	printf("Successfully initialised obdsim, entering main loop\n");
-	main_loop(sp, &ss);
+	fflush(stdout); // Anything waiting on the port name may be reading a pipe
+	if(NULL != replay_name) {
+		replay_loop(loopport, &replay, ss.benchmark);
+		replay_free(&replay);
+		free(replay_name);
+#ifdef HAVE_SOCKET
+	} else if(SIMPORT_SOCKET == simport_requested && max_clients > 1) {
+		multiclient_loop((SocketSimPort *)sp, &ss, max_clients, logfile_name);
+#endif //HAVE_SOCKET
+	} else {
+		main_loop(loopport, &ss);
+	}
+
+	if(loopport != sp) {
+		delete loopport;
+	}
+
+	if(NULL != ss.faults) {
+		faultsim_printcounters(ss.faults);
+		faultsim_destroy(ss.faults);
+	}
+
+	ecupool_destroy(ss.pool);
 
 	for(i=0;i<ss.ecu_count;i++) {
 		ss.ecus[i].simgen->destroy(ss.ecus[i].dg);
@@ -549,6 +718,8 @@ int main(int argc, char **argv) {
 		free(ss.elm_device);
 	}
 
+	obdsim_freeelmsession(&ss.elm);
+
 #ifdef OBDPLATFORM_WINDOWS
 	if(NULL != winport) {
 		free(winport);
@@ -674,7 +845,7 @@ static struct obdsim_generator *find_generator(const char *gen_name) {
 	return NULL;
 }
 
-int set_obdprotocol(const char *prot, struct simsettings *ss) {
+int set_obdprotocol(const char *prot, struct elmsession *elm) {
 	if(NULL == prot) {
 		return -1;
 	}
@@ -704,8 +875,8 @@ int set_obdprotocol(const char *prot, struct simsettings *ss) {
 		e_autoprotocol = 1;
 	}
 
-	ss->e_protocol = e_protocol;
-	ss->e_autoprotocol = e_autoprotocol;
+	elm->e_protocol = e_protocol;
+	elm->e_autoprotocol = e_autoprotocol;
 
 	return 0;
 }
@@ -732,6 +903,9 @@ void printhelp(const char *argv0) {
 		"   [-D|--elm-device=<pretend to be this on AT@1>]\n"
 		"   [-L|--list-protocols]\n"
 		"   [-p|--protocol=<OBDII protocol>]\n"
+		"   [-r|--replay=<obdgpslogger serial log>] [-F|--replay-fast]\n"
+		"   [-T|--virtual-time]\n"
+		"   [-f|--faults=<name=value[,name=value...]>]\n"
 #ifdef OBDPLATFORM_POSIX
 		"   [-o|--launch-logger]\n"
 		"   [-c|--launch-screen] [\"EXIT\" or C-a,k to exit]\n"
@@ -744,7 +918,7 @@ void printhelp(const char *argv0) {
 		"   [-b|--bluetooth]\n"
 #endif //HAVE_BLUETOOTH
 #ifdef HAVE_SOCKET
-		"   [-k|--socket=<listen port>]\n"
+		"   [-k|--socket=<listen port>] [-m|--max-clients=<n>]\n"
 #endif //HAVE_SOCKET
 		"   [-e|--genhelp=<name of generator>]\n"
 		"   [-l|--list-generators]\n"
@@ -24,8 +24,15 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <getopt.h>
 #include <stdlib.h>
+#include <signal.h>
+
+#ifdef OBDPLATFORM_POSIX
+#include <pthread.h>
+#endif //OBDPLATFORM_POSIX
 
 #include "obdservicecommands.h"
+#include "simresponse.h"
+#include "datasource.h"
 
 /// This is the elm prompt
 #define ELM_PROMPT ">"
@@ -60,15 +67,24 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 /// ELM "NO DATA" prompt
 #define ELM_NODATA_PROMPT "NO DATA"
 
+/// ELM "BUS BUSY" prompt
+#define ELM_BUSBUSY_PROMPT "BUS BUSY"
+
+/// ELM "CAN ERROR" prompt
+#define ELM_CANERROR_PROMPT "CAN ERROR"
+
 /// Default sim generator
 #define DEFAULT_SIMGEN "Cycle"
 
 /// Default windows port
 #define DEFAULT_WINPORT "CNCA0"
 
-/// Length of time to sleep between nonblocking reads [us]
+/// Length of time to sleep between nonblocking reads, on ports that can't wait for input [us]
 #define OBDSIM_SLEEPTIME 1000
 
+/// Run generator idle() callbacks and check for freeze frames this often [us]
+#define OBDSIM_IDLEPERIOD 20000
+
 /// Print out benchmarks every this often [seconds]
 #define OBDSIM_BENCHMARKTIME 10
 
@@ -81,12 +97,18 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 /// Max number of frames for freeze frame
 #define OBDSIM_MAXFREEZEFRAMES 5
 
+/// Most PIDs that can be asked for in one mode 01 request [CAN only]
+#define OBDSIM_MAXREQUESTPIDS 6
+
+/// Freeze frames and recent values are indexed by PID, up to this
+#define OBDSIM_FRAMEPIDS (OBDCMDS_MODE1_MAXPID+1)
+
 
 
 /// This is a frozen frame
 struct freezeframe {
-	unsigned int values[sizeof(obdcmds_mode1)/sizeof(obdcmds_mode1[0])][4]; //< Up to four values for each pid
-	unsigned int valuecount[sizeof(obdcmds_mode1)/sizeof(obdcmds_mode1[0])]; //< Number of values stored for each pid
+	unsigned int values[OBDSIM_FRAMEPIDS][4]; //< Up to four values for each pid
+	unsigned int valuecount[OBDSIM_FRAMEPIDS]; //< Number of values stored for each pid
 };
 
 
@@ -100,6 +122,13 @@ struct obdgen_ecu {
 	struct freezeframe ff[OBDSIM_MAXFREEZEFRAMES]; //< Frozen frames
 	void *dg; //< The generator created by this ecu
 	int customdelay; //< This ECU takes this long to respond, ms
+	int errornotify; //< Set if the generator tells us when its errors change, so we needn't poll
+	volatile sig_atomic_t errorschanged; //< Set when the errors may have changed. Checked on the next idle
+	struct obdsim_value recent[OBDSIM_FRAMEPIDS]; //< Latest mode 01 values
+	long long recenttick[OBDSIM_FRAMEPIDS]; //< obdsim_tick() each of recent was fetched in. -1 for never
+#ifdef OBDPLATFORM_POSIX
+	pthread_mutex_t lock; //< Generators aren't threadsafe. Hold this while calling into this one
+#endif //OBDPLATFORM_POSIX
 };
 
 /// This is used for customdelays
@@ -110,8 +139,8 @@ struct obdgen_ecudelays {
 	long delay; //< How long to wait [after the last ecu in this list responded]
 };
 
-/// All of the settings relating to the sim go into this
-struct simsettings {
+/// ELM327 state. Every connection to the sim gets its own copy
+struct elmsession {
 	int e_headers; // Whether to show headers
 	int e_spaces; // Whether to show spaces
 	int e_echo; // Whether to echo commands
@@ -123,10 +152,21 @@ struct simsettings {
 	int e_autoprotocol; // Whether or not we put the "A" and "Auto, " prefix on DP/DPN
 	struct obdiiprotocol *e_protocol; // Starting protocol
 
-	int benchmark; // Benchmark frequency
 	float e_currentvoltage; // The current battery voltage
 
 	char *device_identifier;
+
+	char previousline[1024]; // Blank lines mean re-run previous command
+
+	struct simresponse out; // The reply currently being assembled
+};
+
+/// All of the settings relating to the sim go into this
+struct simsettings {
+	struct elmsession elm; // New connections start with these settings
+
+	int benchmark; // Benchmark frequency
+
 	char *elm_device;
 	char *elm_version;
 
@@ -134,6 +174,10 @@ struct simsettings {
 	int ecu_count;
 
 	struct obdgen_ecudelays ecudelays[OBDSIM_MAXECUS]; // ECUs are queried in this order
+
+	struct ecupool *pool; // Asks ECUs for values in parallel. NULL to ask them one at a time
+
+	struct faultsim *faults; // Faults to inject into replies. NULL for none
 };
 
 
@@ -155,7 +199,34 @@ enum protocol_headertype {
 };
 
 /// To a reset on the elm device [ATZ/D/WS]
-void obdsim_elmreset(struct simsettings *s);
+void obdsim_elmreset(struct elmsession *s);
+
+/// Start a new connection's elm settings as a copy of another
+void obdsim_copyelmsession(struct elmsession *dst, const struct elmsession *src);
+
+/// Free anything allocated in an elm session
+void obdsim_freeelmsession(struct elmsession *s);
+
+/// Take the lock on an ECU's generator [no-op where there are no threads]
+void obdsim_lockecu(struct obdgen_ecu *e);
+
+/// Release the lock on an ECU's generator
+void obdsim_unlockecu(struct obdgen_ecu *e);
+
+/// The current tick; OBDSIM_IDLEPERIOD long, by the sim's clock
+/** Values fetched in the same tick are considered to be from the same moment */
+long long obdsim_tick();
+
+/// Passed to generators' seterrornotify. cookie is the obdgen_ecu
+void obdsim_errornotify(void *cookie);
+
+/// Ask an ECU's generator for several values at once. Caller holds the ECU's lock
+/** Uses the generator's getvalues if it has one, else getvalue for each PID.
+     Mode 01 values are also kept in the ECU's recent values
+    \return 0 on success, -1 for "must exit"
+*/
+int obdsim_getvalues(struct obdgen_ecu *e, unsigned int mode,
+	struct obdsim_value *values, int count);
 
 /// Each OBDII Protocol has a number and description
 struct obdiiprotocol {
@@ -191,7 +262,7 @@ void printobdprotocols();
 /// Given a protocol [A]{0-9}, set the protocol in the struct
 /** \return 0 for success, <0 for failure
  */
-int set_obdprotocol(const char *prot, struct simsettings *ss);
+int set_obdprotocol(const char *prot, struct elmsession *elm);
 
 /// Given the single char, find the protocol for it
 struct obdiiprotocol *find_obdprotocol(const char *protocol_num);
@@ -212,6 +283,10 @@ static const struct option longopts[] = {
 	{ "elm-device", required_argument, NULL, 'D' }, ///< Pretend to be this on AT@1
 	{ "protocol", required_argument, NULL, 'p' }, ///< Set the default protocol to this
 	{ "list-protocols", no_argument, NULL, 'L' }, ///< List known protocols
+	{ "replay", required_argument, NULL, 'r' }, ///< Replay this obdgpslogger serial log
+	{ "replay-fast", no_argument, NULL, 'F' }, ///< Ignore timing in the replayed log
+	{ "virtual-time", no_argument, NULL, 'T' }, ///< Skip modelled delays instead of sleeping
+	{ "faults", required_argument, NULL, 'f' }, ///< Inject these faults into replies
 #ifdef OBDPLATFORM_POSIX
 	{ "launch-logger", no_argument, NULL, 'o' }, ///< Launch obdgpslogger
 	{ "launch-screen", no_argument, NULL, 'c' }, ///< Launch screen
@@ -225,12 +300,13 @@ static const struct option longopts[] = {
 #endif //HAVE_BLUETOOTH
 #ifdef HAVE_SOCKET
 	{ "socket", required_argument, NULL, 'k' }, ///< Listen with socket
+	{ "max-clients", required_argument, NULL, 'm' }, ///< Serve this many socket clients at once
 #endif //HAVE_SOCKET
 	{ NULL, 0, NULL, 0 } ///< End
 };
 
 /// getopt() short options
-static const char shortopts[] = "hln:e:vs:g:q:V:D:p:Ld:"
+static const char shortopts[] = "hln:e:vs:g:q:V:D:p:Ld:r:FTf:"
 #ifdef OBDPLATFORM_POSIX
 	"oct:"
 #endif //OBDPLATFORM_POSIX
@@ -241,7 +317,7 @@ static const char shortopts[] = "hln:e:vs:g:q:V:D:p:Ld:"
 	"b"
 #endif //HAVE_BLUETOOTH
 #ifdef HAVE_SOCKET
-	"k:"
+	"k:m:"
 #endif //HAVE_SOCKET
 ;
 
@@ -0,0 +1,350 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** \file
+ \brief Replay a serial log recorded by obdgpslogger
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifdef OBDPLATFORM_POSIX
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#endif //OBDPLATFORM_POSIX
+
+#ifdef OBDPLATFORM_WINDOWS
+#include <windows.h>
+#include "windowssimport.h" // Contains implementation of gettimeofday for windows
+#endif //OBDPLATFORM_WINDOWS
+
+#include "obdsim.h"
+#include "simport.h"
+#include "replay.h"
+#include "simclock.h"
+
+/// Direction of a single record in the log
+enum replay_direction {
+	REPLAY_NONE,
+	REPLAY_OUT, //< obdgpslogger sent this to the device
+	REPLAY_IN //< The device sent this to obdgpslogger
+};
+
+/// Parse the "HH:MM:SS[.uuuuuu](in|out): '" at the start of a record
+/** \param p start of the line
+    \param t filled with the time of day, us
+    \param hastiming set if there was a sub-second part
+    \param content filled with a pointer to the first char of the record content
+    \return direction of the record, or REPLAY_NONE if this isn't the start of a record
+*/
+static enum replay_direction replay_parseheader(const char *p, long long *t,
+	int *hastiming, const char **content) {
+
+	int h, m, s;
+	int consumed = 0;
+	if(3 != sscanf(p, "%2d:%2d:%2d%n", &h, &m, &s, &consumed) || 8 != consumed) {
+		return REPLAY_NONE;
+	}
+	p += consumed;
+
+	long usec = 0;
+	*hastiming = 0;
+	if('.' == *p) {
+		int digits = 0;
+		p++;
+		for(; isdigit(*p); p++, digits++) {
+			if(digits < 6) usec = usec * 10 + (*p - '0');
+		}
+		for(; digits < 6; digits++) usec *= 10;
+		*hastiming = 1;
+	}
+
+	enum replay_direction dir;
+	if(0 == strncmp(p, "(out): '", 8)) {
+		dir = REPLAY_OUT;
+		p += 8;
+	} else if(0 == strncmp(p, "(in): '", 7)) {
+		dir = REPLAY_IN;
+		p += 7;
+	} else {
+		return REPLAY_NONE;
+	}
+
+	*t = ((long long)h*3600 + m*60 + s) * 1000000ll + usec;
+	*content = p;
+	return dir;
+}
+
+/// Strip newlines and spaces and uppercase, so requests compare sanely
+/** Safe to call with dst == src */
+static void replay_normalise(char *dst, const char *src, size_t n) {
+	size_t i = 0;
+	for(; '\0' != *src && i+1 < n; src++) {
+		if(' ' == *src || '\r' == *src || '\n' == *src) continue;
+		dst[i++] = toupper(*src);
+	}
+	dst[i] = '\0';
+}
+
+int replay_load(const char *filename, struct replay_session *rs) {
+	memset(rs, 0, sizeof(*rs));
+
+	FILE *f = fopen(filename, "rb");
+	if(NULL == f) {
+		perror(filename);
+		return 1;
+	}
+
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	char *buf = (char *)malloc(len+1);
+	if(NULL == buf) {
+		fprintf(stderr, "Couldn't allocate memory for replay log\n");
+		fclose(f);
+		return 1;
+	}
+	if(len != (long)fread(buf, 1, len, f)) {
+		fprintf(stderr, "Couldn't read replay log %s\n", filename);
+		free(buf);
+		fclose(f);
+		return 1;
+	}
+	buf[len] = '\0';
+	fclose(f);
+
+	int allocated = 0;
+	struct replay_exchange *current = NULL;
+	long long requesttime = 0;
+	int alltiming = 1;
+
+	char *p = buf;
+	while('\0' != *p) {
+		long long t;
+		int hastiming;
+		const char *content;
+		enum replay_direction dir = replay_parseheader(p, &t, &hastiming, &content);
+		if(REPLAY_NONE == dir) {
+			// Records always start at the beginning of a line
+			p = strchr(p, '\n');
+			if(NULL == p) break;
+			p++;
+			continue;
+		}
+
+		// The record runs up to the next line that starts another record
+		const char *end = content;
+		const char *next = NULL;
+		while(NULL != (end = strchr(end, '\n'))) {
+			long long t2;
+			int h2;
+			const char *c2;
+			end++;
+			if(REPLAY_NONE != replay_parseheader(end, &t2, &h2, &c2)) {
+				next = end;
+				break;
+			}
+		}
+		if(NULL == next) {
+			next = buf + len;
+		}
+
+		// Drop the trailing "'\n" that closes each record
+		const char *contentend = next;
+		if(contentend > content && '\n' == contentend[-1]) contentend--;
+		if(contentend > content && '\'' == contentend[-1]) contentend--;
+		size_t contentlen = contentend - content;
+
+		if(!hastiming) alltiming = 0;
+
+		if(REPLAY_OUT == dir) {
+			if(rs->count >= allocated) {
+				allocated = 0==allocated?256:allocated*2;
+				struct replay_exchange *e = (struct replay_exchange *)realloc(rs->exchanges,
+					allocated * sizeof(struct replay_exchange));
+				if(NULL == e) {
+					fprintf(stderr, "Couldn't allocate memory for replay log\n");
+					free(buf);
+					replay_free(rs);
+					return 1;
+				}
+				rs->exchanges = e;
+			}
+			char *request = (char *)malloc(contentlen+1);
+			char *response = strdup("");
+			if(NULL == request || NULL == response) {
+				fprintf(stderr, "Couldn't allocate memory for replay log\n");
+				free(request);
+				free(response);
+				free(buf);
+				replay_free(rs);
+				return 1;
+			}
+			current = &rs->exchanges[rs->count++];
+			current->request = request;
+			memcpy(current->request, content, contentlen);
+			current->request[contentlen] = '\0';
+			replay_normalise(current->request, current->request, contentlen+1);
+			current->response = response;
+			current->delay = 0;
+			requesttime = t;
+		} else if(NULL != current) {
+			size_t oldlen = strlen(current->response);
+			char *r = (char *)realloc(current->response, oldlen + contentlen + 1);
+			if(NULL != r) {
+				memcpy(r + oldlen, content, contentlen);
+				r[oldlen + contentlen] = '\0';
+				current->response = r;
+			}
+			long long delay = t - requesttime;
+			if(delay < 0) delay += 86400ll * 1000000ll; // Midnight
+			current->delay = (long)delay;
+		}
+
+		p = (char *)next;
+	}
+
+	free(buf);
+
+	if(0 == rs->count) {
+		fprintf(stderr, "Didn't find any requests in replay log %s\n", filename);
+		replay_free(rs);
+		return 1;
+	}
+
+	rs->hastiming = alltiming;
+	if(!rs->hastiming) {
+		printf("Replay log has no sub-second timestamps, replaying as fast as possible\n");
+	}
+	printf("Loaded %i exchanges from replay log %s\n", rs->count, filename);
+	return 0;
+}
+
+void replay_free(struct replay_session *rs) {
+	int i;
+	for(i=0;i<rs->count;i++) {
+		free(rs->exchanges[i].request);
+		free(rs->exchanges[i].response);
+	}
+	free(rs->exchanges);
+	rs->exchanges = NULL;
+	rs->count = 0;
+}
+
+/// Find the next exchange matching this request
+/** Searches forward from the cursor, then wraps around to the start of the log
+    \return the exchange, or NULL if it's not in the log at all */
+static struct replay_exchange *replay_find(struct replay_session *rs, const char *request) {
+	int i;
+	for(i=0;i<rs->count;i++) {
+		int idx = (rs->cursor + i) % rs->count;
+		if(0 == strcmp(rs->exchanges[idx].request, request)) {
+			rs->cursor = (idx+1) % rs->count;
+			return &rs->exchanges[idx];
+		}
+	}
+	return NULL;
+}
+
+void replay_loop(OBDSimPort *sp, struct replay_session *rs, int benchmark) {
+	char *line; // Single line from the other end of the device
+	char request[1024]; // Normalised line
+
+	// Benchmarking
+	struct timeval benchmarkstart;
+	struct timeval benchmarkend;
+	long benchmarkcount = 0;
+
+	// Recorded responses already contain the echo, if there was one
+	sp->setEcho(0);
+
+	int mustexit = 0;
+
+	if(0 != gettimeofday(&benchmarkstart,NULL)) {
+		fprintf(stderr, "Couldn't gettimeofday for benchmarking\n");
+		mustexit = 1;
+	}
+
+	while(!mustexit) {
+		struct timeval selecttime;
+		struct timeval requesttime;
+
+		if(benchmark > 0) {
+			gettimeofday(&benchmarkend, NULL);
+			float benchmarkdelta = (benchmarkend.tv_sec - benchmarkstart.tv_sec) +
+					((float)(benchmarkend.tv_usec - benchmarkstart.tv_usec))/1000000.0f;
+			if(benchmark <= benchmarkdelta) {
+				printf("%f seconds. %li queries, %.2f q/s. %li served, %li missed total\n",
+					benchmarkdelta, benchmarkcount, (float)benchmarkcount/benchmarkdelta,
+					rs->served, rs->missed);
+				benchmarkstart = benchmarkend;
+				benchmarkcount = 0;
+			}
+		}
+
+		// Wake up occasionally anyway, for benchmark output
+		if(0 >= sp->waitReadable(OBDSIM_IDLEPERIOD)) continue;
+
+		line = sp->readLine();
+		if(NULL == line) continue;
+
+		gettimeofday(&requesttime, NULL);
+		benchmarkcount++;
+
+		replay_normalise(request, line, sizeof(request));
+
+		if(0 == strcmp(request, "EXIT")) {
+			printf("Received EXIT via serial port. Replay Exiting\n");
+			mustexit=1;
+			continue;
+		}
+
+		struct replay_exchange *e = replay_find(rs, request);
+		if(NULL == e) {
+			rs->missed++;
+			sp->writeData("\r" ELM_QUERY_PROMPT "\r" ELM_PROMPT);
+			continue;
+		}
+		rs->served++;
+
+		// Nothing else to keep in step with, so virtual time is just fast
+		if(!rs->fast && !simclock_isvirtual() && rs->hastiming && 0 < e->delay) {
+			// Account for however long it took us to get here
+			struct timeval now;
+			gettimeofday(&now, NULL);
+			long elapsed = (now.tv_sec - requesttime.tv_sec) * 1000000l +
+				(now.tv_usec - requesttime.tv_usec);
+			long remaining = e->delay - elapsed;
+			if(remaining > 0) {
+				selecttime.tv_sec = remaining / 1000000l;
+				selecttime.tv_usec = remaining % 1000000l;
+				select(0,NULL,NULL,NULL,&selecttime);
+			}
+		}
+
+		if('\0' != e->response[0]) {
+			sp->writeData(e->response);
+		}
+	}
+
+	printf("Replay finished. %li requests served, %li missed\n", rs->served, rs->missed);
+}
+
@@ -0,0 +1,64 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** \file
+ \brief Replay a serial log recorded by obdgpslogger
+*/
+#ifndef __REPLAY_H
+#define __REPLAY_H
+
+#include "simport.h"
+
+/// A single request and the response the device gave to it
+struct replay_exchange {
+	char *request; //< What the logger sent, newlines stripped
+	char *response; //< Everything the device sent back, up to and including the prompt
+	long delay; //< Time between request and the complete response, us
+};
+
+/// A whole recorded serial session
+struct replay_session {
+	struct replay_exchange *exchanges; //< All the exchanges, in the order they were recorded
+	int count; //< Number of exchanges
+	int cursor; //< Where we expect the next request to be
+	int hastiming; //< Set if the log had sub-second timestamps
+	int fast; //< Set to ignore recorded timing and respond immediately
+
+	long served; //< Number of requests answered from the log
+	long missed; //< Number of requests that weren't in the log
+};
+
+/// Load a serial log written by obdgpslogger --serial-log
+/** \param filename the serial log to read
+    \param rs the session to fill
+    \return 0 on success, nonzero on failure
+*/
+int replay_load(const char *filename, struct replay_session *rs);
+
+/// Free everything allocated by replay_load
+void replay_free(struct replay_session *rs);
+
+/// Replay main loop. Answer everything on sp from the loaded log
+/** \param sp the simport handle
+    \param rs the loaded session
+    \param benchmark print stats every this many seconds. Zero to disable
+*/
+void replay_loop(OBDSimPort *sp, struct replay_session *rs, int benchmark);
+
+#endif // __REPLAY_H
+
@@ -0,0 +1,111 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** \file
+ \brief The sim's clock, which may run ahead of real time
+*/
+#include <stdlib.h>
+#include <stdio.h>
+
+#ifdef OBDPLATFORM_POSIX
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#endif //OBDPLATFORM_POSIX
+
+#ifdef OBDPLATFORM_WINDOWS
+#include <windows.h>
+#include "windowssimport.h" // Contains implementation of gettimeofday for windows
+#endif //OBDPLATFORM_WINDOWS
+
+#include "simclock.h"
+
+/// Set when we're in virtual time
+static int simclock_virtual = 0;
+
+/// How far the virtual clock is ahead of real time, us
+static long long simclock_offset = 0;
+
+#ifdef OBDPLATFORM_POSIX
+/// Several clients and ECU workers may move the clock at once
+static pthread_mutex_t simclock_lock = PTHREAD_MUTEX_INITIALIZER;
+#define SIMCLOCK_LOCK() pthread_mutex_lock(&simclock_lock)
+#define SIMCLOCK_UNLOCK() pthread_mutex_unlock(&simclock_lock)
+#else
+#define SIMCLOCK_LOCK()
+#define SIMCLOCK_UNLOCK()
+#endif //OBDPLATFORM_POSIX
+
+void simclock_setvirtual(int yes) {
+	simclock_virtual = yes;
+}
+
+int simclock_isvirtual() {
+	return simclock_virtual;
+}
+
+/// Real time plus however far the virtual clock has been moved, us
+static long long simclock_now_us() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	SIMCLOCK_LOCK();
+	long long offset = simclock_offset;
+	SIMCLOCK_UNLOCK();
+	return (long long)tv.tv_sec * 1000000ll + tv.tv_usec + offset;
+}
+
+int obdsim_gettimeofday(struct timeval *tv) {
+	if(!simclock_virtual) {
+		return gettimeofday(tv, NULL);
+	}
+	long long now = simclock_now_us();
+	tv->tv_sec = now / 1000000ll;
+	tv->tv_usec = now % 1000000ll;
+	return 0;
+}
+
+void obdsim_sleepuntil(const struct timeval *start, long ms) {
+	long long target = (long long)start->tv_sec * 1000000ll + start->tv_usec + ms * 1000ll;
+	long long remaining = target - simclock_now_us();
+	if(remaining <= 0) return;
+
+	if(simclock_virtual) {
+		// Jump the clock to the target. If someone else already jumped
+		//  further, that's fine too
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		long long ahead = target - ((long long)tv.tv_sec * 1000000ll + tv.tv_usec);
+		SIMCLOCK_LOCK();
+		if(ahead > simclock_offset) simclock_offset = ahead;
+		SIMCLOCK_UNLOCK();
+		return;
+	}
+
+	struct timeval timeouttime;
+	timeouttime.tv_sec = remaining / 1000000ll;
+	timeouttime.tv_usec = remaining % 1000000ll;
+	select(0,NULL,NULL,NULL,&timeouttime);
+}
+
+void obdsim_sleep(long ms) {
+	struct timeval now;
+	obdsim_gettimeofday(&now);
+	obdsim_sleepuntil(&now, ms);
+}
+
@@ -0,0 +1,49 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** \file
+ \brief The sim's clock, which may run ahead of real time
+*/
+#ifndef __SIMCLOCK_H
+#define __SIMCLOCK_H
+
+#ifdef OBDPLATFORM_POSIX
+#include <sys/time.h>
+#endif //OBDPLATFORM_POSIX
+
+#include "datasource.h" // obdsim_gettimeofday is declared for generators in here
+
+/// Switch virtual time on or off
+/** In virtual time, every modelled delay [ECU delays, timeouts, resets]
+     returns immediately and moves the clock forward instead. The clock
+     never runs slower than real time. */
+void simclock_setvirtual(int yes);
+
+/// Find out if we're in virtual time
+int simclock_isvirtual();
+
+/// Sleep until ms milliseconds after start, by the sim's clock
+/** Returns immediately if that's already passed. In virtual time,
+     moves the clock forward instead of sleeping */
+void obdsim_sleepuntil(const struct timeval *start, long ms);
+
+/// Sleep for ms milliseconds, by the sim's clock
+void obdsim_sleep(long ms);
+
+#endif //__SIMCLOCK_H
+
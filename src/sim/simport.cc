@@ -25,8 +25,14 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 #ifdef OBDPLATFORM_POSIX
 #include <time.h>
 #include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
 #endif // OBDPLATFORM_POSIX
+#ifdef OBDPLATFORM_WINDOWS
+#include <windows.h>
+#endif //OBDPLATFORM_WINDOWS
 #include "simport.h"
+#include "obdsim.h"
 
 OBDSimPort::OBDSimPort() {
 	mUsable = false;
@@ -66,20 +72,21 @@ void OBDSimPort::writeLog(const char *data, int out) {
 	if(NULL != mLogFile) {
 #ifdef OBDPLATFORM_POSIX
 		char timestr[200];
+		struct timeval tv;
 		time_t t;
 		struct tm *tmp;
 
-		t = time(NULL);
+		// Sub-second resolution so logs can be replayed with their original timing
+		gettimeofday(&tv, NULL);
+		t = tv.tv_sec;
 		tmp = localtime(&t);
 		if (tmp == NULL) {
 			snprintf(timestr, sizeof(timestr), "Unknown time");
-		}
-
-		if (strftime(timestr, sizeof(timestr), "%H:%M:%S", tmp) == 0) {
+		} else if (strftime(timestr, sizeof(timestr), "%H:%M:%S", tmp) == 0) {
 			snprintf(timestr, sizeof(timestr), "Unknown time");
 		}
 
-		fprintf(mLogFile, "%s(%s): '%s'\n", timestr, out==SERIAL_OUT?"out":"in", data);
+		fprintf(mLogFile, "%s.%06li(%s): '%s'\n", timestr, (long)tv.tv_usec, out==SERIAL_OUT?"out":"in", data);
 		fflush(mLogFile);
 #else
 #warning "Better logging including timestamps not implemented here yet"
@@ -97,4 +104,16 @@ void OBDSimPort::setUsable(int yes) {
 	mUsable = yes;
 }
 
+int OBDSimPort::waitReadable(long timeout_us) {
+	// No way to wait on the port itself; fall back to polling
+	struct timeval selecttime;
+	if(timeout_us > OBDSIM_SLEEPTIME) timeout_us = OBDSIM_SLEEPTIME;
+	if(timeout_us > 0) {
+		selecttime.tv_sec = 0;
+		selecttime.tv_usec = timeout_us;
+		select(0,NULL,NULL,NULL,&selecttime);
+	}
+	return 1;
+}
+
 
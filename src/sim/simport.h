@@ -38,10 +38,10 @@ public:
 	virtual char *getPort() = 0;
 
 	/// Enable or disable echo
-	void setEcho(int yes);
+	virtual void setEcho(int yes);
 
 	/// Find out if echo is set
-	int getEcho();
+	virtual int getEcho();
 
 	/// Enable or disable logging
 	virtual int startLog(const char *filename);
@@ -63,6 +63,13 @@ public:
 	/** Take a copy if you care - the memory won't stay valid */
 	virtual char *readLine() = 0;
 
+	/// Block until readLine might have something, or timeout passes
+	/** Ports that can't wait on their input sleep for at most
+	     OBDSIM_SLEEPTIME and report that there may be data
+	    \param timeout_us longest time to wait [us]
+	    \return >0 if readLine should be called, 0 on timeout */
+	virtual int waitReadable(long timeout_us);
+
 protected:
 	/// Set usable
 	void setUsable(int yes);
@@ -0,0 +1,74 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** \file
+ \brief Assemble a complete reply before it's written to the port
+*/
+#include <string.h>
+
+#include "simresponse.h"
+
+#define HEXROW(hi) \
+	hi "0" hi "1" hi "2" hi "3" hi "4" hi "5" hi "6" hi "7" \
+	hi "8" hi "9" hi "A" hi "B" hi "C" hi "D" hi "E" hi "F"
+
+/// Two hex digits for every byte value. Byte b is at hextable[2*b]
+static const char hextable[] =
+	HEXROW("0") HEXROW("1") HEXROW("2") HEXROW("3")
+	HEXROW("4") HEXROW("5") HEXROW("6") HEXROW("7")
+	HEXROW("8") HEXROW("9") HEXROW("A") HEXROW("B")
+	HEXROW("C") HEXROW("D") HEXROW("E") HEXROW("F");
+
+void simresponse_reset(struct simresponse *r) {
+	r->len = 0;
+	r->buf[0] = '\0';
+}
+
+void simresponse_appendn(struct simresponse *r, const char *s, size_t len) {
+	if(r->len + len >= sizeof(r->buf)) {
+		len = sizeof(r->buf) - r->len - 1;
+	}
+	memcpy(r->buf + r->len, s, len);
+	r->len += len;
+	r->buf[r->len] = '\0';
+}
+
+void simresponse_append(struct simresponse *r, const char *s) {
+	simresponse_appendn(r, s, strlen(s));
+}
+
+void simresponse_appendbyte(struct simresponse *r, unsigned int byte, int space) {
+	if(r->len + 3 >= sizeof(r->buf)) return;
+
+	char *p = r->buf + r->len;
+	if(space) *p++ = ' ';
+	const char *hex = hextable + 2*(byte & 0xFF);
+	*p++ = hex[0];
+	*p++ = hex[1];
+	*p = '\0';
+	r->len = p - r->buf;
+}
+
+void simresponse_newline(struct simresponse *r, int linefeed) {
+	if(linefeed) {
+		simresponse_appendn(r, "\r\n", 2);
+	} else {
+		simresponse_appendn(r, "\r", 1);
+	}
+}
+
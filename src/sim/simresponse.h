@@ -0,0 +1,56 @@
+/* Copyright 2011 Gary Briggs
+
+This file is part of obdgpslogger.
+
+obdgpslogger is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+obdgpslogger is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** \file
+ \brief Assemble a complete reply before it's written to the port
+*/
+#ifndef __SIMRESPONSE_H
+#define __SIMRESPONSE_H
+
+#include <stddef.h>
+
+/// Longest complete reply, including every ECU's lines and the prompt
+#define OBDSIM_RESPONSE_SIZE 4096
+
+/// A reply being built up. Written to the port in one go once it's done
+struct simresponse {
+	char buf[OBDSIM_RESPONSE_SIZE]; //< The reply so far. Always nul-terminated
+	size_t len; //< strlen(buf)
+};
+
+/// Empty the reply
+void simresponse_reset(struct simresponse *r);
+
+/// Append a string. Anything that doesn't fit is dropped
+void simresponse_append(struct simresponse *r, const char *s);
+
+/// Append len bytes of s
+void simresponse_appendn(struct simresponse *r, const char *s, size_t len);
+
+/// Append a byte as two uppercase hex digits
+/** \param r the reply
+    \param byte value to append; only the bottom eight bits are used
+    \param space put a space before the digits
+*/
+void simresponse_appendbyte(struct simresponse *r, unsigned int byte, int space);
+
+/// Append \r or \r\n
+void simresponse_newline(struct simresponse *r, int linefeed);
+
+#endif // __SIMRESPONSE_H
+
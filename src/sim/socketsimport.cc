@@ -33,6 +33,7 @@ along with obdgpslogger.  If not, see <http://www.gnu.org/licenses/>.
 #include <string.h>
 #include <errno.h>
 #include <sys/socket.h>
+#include <netinet/tcp.h>
 
 #include "simport.h"
 #include "obdsim.h"
@@ -91,8 +92,13 @@ int SocketSimPort::tryConnection() {
 		}
 		connected = 1;
 		printf("Socket connected: %s\n", getPort());
+		hungup = 0;
 		fcntl(fd ,F_SETFL,O_NONBLOCK);
 
+		// Each reply is one small write; send it now rather than waiting to coalesce
+		int nodelay = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
 		return fd;
 	}
 
@@ -104,6 +110,39 @@ SocketSimPort::~SocketSimPort() {
 	close(s);
 }
 
+int SocketSimPort::acceptClient() {
+	struct sockaddr_in client_addr;
+	socklen_t opt = sizeof(client_addr);
+
+	fd_set select_set;
+	FD_ZERO(&select_set);
+	FD_SET(s, &select_set);
+
+	struct timeval tv;
+	tv.tv_sec = 0;
+	tv.tv_usec = 0;
+
+	if(0 >= select(s+1, &select_set, NULL, NULL, &tv)) {
+		return -1;
+	}
+
+	int clientfd = accept(s, (struct sockaddr *)&client_addr, &opt);
+	if(-1 == clientfd) {
+		perror("Couldn't accept socket connection");
+		return -1;
+	}
+	fcntl(clientfd, F_SETFL, O_NONBLOCK);
+
+	int nodelay = 1;
+	setsockopt(clientfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+	return clientfd;
+}
+
+int SocketSimPort::getListenFd() {
+	return s;
+}
+
 void SocketSimPort::closeCurrentConnection() {
 	if(isConnected()) {
 		close(fd);
@@ -112,5 +151,31 @@ void SocketSimPort::closeCurrentConnection() {
 }
 
 
+SocketClientSimPort::SocketClientSimPort(int clientfd, int clientnum) {
+	fd = clientfd;
+	connected = 1;
+	snprintf(portname, sizeof(portname), "Client %i", clientnum);
+	setUsable(1);
+}
+
+SocketClientSimPort::~SocketClientSimPort() {
+	closeCurrentConnection();
+}
+
+int SocketClientSimPort::isClosed() {
+	return -1 == fd;
+}
+
+int SocketClientSimPort::tryConnection() {
+	return -1;
+}
+
+void SocketClientSimPort::closeCurrentConnection() {
+	if(-1 != fd) {
+		close(fd);
+	}
+	fd = -1;
+}
+
 #endif // HAVE_SOCKET
 
@@ -43,6 +43,11 @@ public:
 	/// Destructor
 	virtual ~SocketSimPort();
 
+	/// Accept another client without disturbing the current connection
+	/** For serving more than one client at a time
+	    \return the new client's fd, or -1 if nobody was waiting */
+	int acceptClient();
+
 protected:
 	/// Wait for a connection
 	virtual int tryConnection();
@@ -50,6 +55,9 @@ protected:
 	/// Close the current actively connected socket
 	virtual void closeCurrentConnection();
 
+	/// Wait on the listening socket while not connected
+	virtual int getListenFd();
+
 	/// Two locations
 	struct sockaddr_in loc_addr, rem_addr;
 
@@ -60,6 +68,28 @@ protected:
 	int portno;
 };
 
+/// One of several simultaneous clients accepted by SocketSimPort
+class SocketClientSimPort : public FDSimPort {
+public:
+	/// Constructor
+	/** \param clientfd fd returned by SocketSimPort::acceptClient
+	    \param clientnum number used to identify this client */
+	SocketClientSimPort(int clientfd, int clientnum);
+
+	/// Destructor
+	virtual ~SocketClientSimPort();
+
+	/// Set once the client has gone away
+	int isClosed();
+
+protected:
+	/// Clients don't reconnect; once it's gone, it's gone
+	virtual int tryConnection();
+
+	/// Close the client
+	virtual void closeCurrentConnection();
+};
+
 #endif //  HAVE_SOCKET
 
 #endif //__SOCKETSIMPORT_H